@@ -0,0 +1,18 @@
+# Generated by Django 5.2.18 on 2026-10-17 00:30
+
+import django.db.models.functions.text
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('accounts', '0001_initial'),
+    ]
+
+    operations = [
+        migrations.AddIndex(
+            model_name='facility',
+            index=models.Index(django.db.models.functions.text.Upper('ae_title'), models.F('is_active'), name='facility_ae_title_upper_idx'),
+        ),
+    ]
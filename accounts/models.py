@@ -1,5 +1,7 @@
 from django.contrib.auth.models import AbstractUser
 from django.db import models
+from django.db.models import F
+from django.db.models.functions import Upper
 from django.utils import timezone
 
 class Facility(models.Model):
@@ -18,6 +20,10 @@ class Facility(models.Model):
 
     class Meta:
         verbose_name_plural = "Facilities"
+        indexes = [
+            # C-STORE attribution looks facilities up with ae_title__iexact
+            models.Index(Upper('ae_title'), F('is_active'), name='facility_ae_title_upper_idx'),
+        ]
 
     def __str__(self):
         return self.name
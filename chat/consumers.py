@@ -1,16 +1,24 @@
 import json
 import logging
+import time
 from datetime import datetime
 from channels.generic.websocket import AsyncWebsocketConsumer
 from channels.db import database_sync_to_async
 from django.contrib.auth.models import User
 from django.utils import timezone
 from .models import ChatRoom, ChatParticipant, ChatMessage, ChatMessageReaction
+from .persistence import get_writer
 
 logger = logging.getLogger(__name__)
 
+# While typing continues, re-broadcast at most this often (seconds)
+TYPING_REFRESH = 3.0
+
 
 class ChatConsumer(AsyncWebsocketConsumer):
+    is_typing = False
+    typing_sent_at = 0.0
+
     async def connect(self):
         self.user = self.scope["user"]
         if not self.user.is_authenticated:
@@ -33,7 +41,7 @@ class ChatConsumer(AsyncWebsocketConsumer):
         )
 
         # Update user online status
-        await self.update_online_status(True)
+        self.update_online_status(True)
 
         await self.accept()
 
@@ -48,8 +56,12 @@ class ChatConsumer(AsyncWebsocketConsumer):
         }))
 
     async def disconnect(self, close_code):
+        # Don't leave others with a stale typing indicator
+        if self.is_typing:
+            await self.handle_typing_indicator({'is_typing': False})
+
         # Update user online status
-        await self.update_online_status(False)
+        self.update_online_status(False)
         
         # Leave room group
         await self.channel_layer.group_discard(
@@ -89,9 +101,11 @@ class ChatConsumer(AsyncWebsocketConsumer):
         if not message_content:
             return
             
-        # Save message to database
-        message = await self.save_message(
-            content=message_content,
+        # Save message to database (batched with other messages on this loop)
+        message = await get_writer().save_message(
+            self.room_id,
+            self.user,
+            message_content,
             reply_to_id=reply_to_id
         )
         
@@ -113,8 +127,16 @@ class ChatConsumer(AsyncWebsocketConsumer):
             )
 
     async def handle_typing_indicator(self, data):
-        is_typing = data.get('is_typing', False)
-        
+        is_typing = bool(data.get('is_typing', False))
+
+        # Typing state lives only in memory; repeated keystroke events are
+        # broadcast on a change or as a periodic refresh, never persisted
+        now = time.monotonic()
+        if is_typing == self.is_typing and (not is_typing or now - self.typing_sent_at < TYPING_REFRESH):
+            return
+        self.is_typing = is_typing
+        self.typing_sent_at = now
+
         await self.channel_layer.group_send(
             self.room_group_name,
             {
@@ -186,7 +208,8 @@ class ChatConsumer(AsyncWebsocketConsumer):
             )
 
     async def handle_mark_read(self, data):
-        await self.mark_messages_as_read()
+        # Coalesced per user and room; written with the next chat batch
+        get_writer().mark_read(self.room_id, self.user.id)
 
     # Event handlers for group messages
     async def chat_message(self, event):
@@ -226,48 +249,8 @@ class ChatConsumer(AsyncWebsocketConsumer):
         except (ChatRoom.DoesNotExist, ChatParticipant.DoesNotExist):
             return False
 
-    @database_sync_to_async
     def update_online_status(self, is_online):
-        try:
-            participant = ChatParticipant.objects.get(
-                room_id=self.room_id, 
-                user=self.user, 
-                is_active=True
-            )
-            participant.is_online = is_online
-            participant.last_seen = timezone.now()
-            participant.save()
-        except ChatParticipant.DoesNotExist:
-            pass
-
-    @database_sync_to_async
-    def save_message(self, content, reply_to_id=None):
-        try:
-            room = ChatRoom.objects.get(id=self.room_id, is_active=True)
-            
-            reply_to = None
-            if reply_to_id:
-                try:
-                    reply_to = ChatMessage.objects.get(id=reply_to_id, room=room)
-                except ChatMessage.DoesNotExist:
-                    pass
-            
-            message = ChatMessage.objects.create(
-                room=room,
-                sender=self.user,
-                content=content,
-                reply_to=reply_to,
-                message_type='text'
-            )
-            
-            # Update room's last activity
-            room.last_activity = timezone.now()
-            room.save()
-            
-            return message
-        except Exception as e:
-            logger.error(f"Error saving message: {str(e)}")
-            return None
+        get_writer().set_online(self.room_id, self.user.id, is_online)
 
     @database_sync_to_async
     def toggle_reaction(self, message_id, emoji, action):
@@ -330,18 +313,6 @@ class ChatConsumer(AsyncWebsocketConsumer):
             logger.error(f"Error deleting message: {str(e)}")
             return False
 
-    @database_sync_to_async
-    def mark_messages_as_read(self):
-        try:
-            participant = ChatParticipant.objects.get(
-                room_id=self.room_id, 
-                user=self.user, 
-                is_active=True
-            )
-            participant.mark_as_read()
-        except ChatParticipant.DoesNotExist:
-            pass
-
 
 class UserChatConsumer(AsyncWebsocketConsumer):
     async def connect(self):
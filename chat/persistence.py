@@ -0,0 +1,214 @@
+"""
+Write-coalescing persistence for ChatConsumer.
+
+Every consumer on an event loop shares one ``ChatWriter``. Messages, read
+receipts and online-status changes are collected for ``CHAT_WRITE_WINDOW``
+seconds and written by a single ``database_sync_to_async`` call: active rooms
+and reply targets are checked with one query each, messages go in with one
+``bulk_create``, and each touched room gets one ``last_activity`` UPDATE
+instead of a full-row save per message. A consumer still awaits its message
+being stored before broadcasting it, so clients never see an id that is not
+in the database.
+
+Read receipts and online status are fire-and-forget and coalesced per
+(room, user), keeping only the latest value, so a client marking a busy room
+read on every message costs one UPDATE per window at most.
+"""
+import asyncio
+import logging
+import uuid
+import weakref
+
+from channels.db import database_sync_to_async
+from django.conf import settings
+from django.db import transaction
+from django.db.models import BooleanField, Case, DateTimeField, Q, Value, When
+from django.utils import timezone
+
+from noctis_pro import metrics
+from .models import ChatMessage, ChatParticipant, ChatRoom
+
+logger = logging.getLogger(__name__)
+
+# Messages that trigger a flush before the window ends
+MAX_BATCH = 200
+# (room, user) pairs per CASE update
+CASE_CHUNK = 200
+
+CHAT_WRITES = metrics.counter(
+    'noctis_chat_writes', 'Chat rows written by the coalescing writer', ('kind',))
+CHAT_FLUSH_SECONDS = metrics.histogram(
+    'noctis_chat_flush_duration_seconds', 'Time to write one coalesced chat batch')
+
+
+class ChatWriter:
+    def __init__(self, window=None):
+        self.window = window if window is not None else getattr(settings, 'CHAT_WRITE_WINDOW', 0.05)
+        self._messages = []     # (ChatMessage, reply_to_id, future)
+        self._receipts = {}     # (room_id, user_id) -> read at
+        self._presence = {}     # (room_id, user_id) -> (is_online, seen at)
+        self._handle = None
+
+    async def save_message(self, room_id, sender, content, reply_to_id=None):
+        """The stored ChatMessage, or None if the room is gone or the write failed"""
+        message = ChatMessage(id=uuid.uuid4(), room_id=room_id, sender=sender,
+                              content=content, message_type='text')
+        future = asyncio.get_running_loop().create_future()
+        self._messages.append((message, reply_to_id, future))
+        if len(self._messages) >= MAX_BATCH:
+            self._flush_now()
+        else:
+            self._schedule()
+        return await future
+
+    def mark_read(self, room_id, user_id):
+        self._receipts[(str(room_id), user_id)] = timezone.now()
+        self._schedule()
+
+    def set_online(self, room_id, user_id, is_online):
+        self._presence[(str(room_id), user_id)] = (is_online, timezone.now())
+        self._schedule()
+
+    def pending(self):
+        return len(self._messages) + len(self._receipts) + len(self._presence)
+
+    def _schedule(self):
+        if self._handle is None:
+            self._handle = asyncio.get_running_loop().call_later(self.window, self._flush_now)
+
+    def _flush_now(self):
+        if self._handle is not None:
+            self._handle.cancel()
+            self._handle = None
+        batch = (self._messages, self._receipts, self._presence)
+        self._messages, self._receipts, self._presence = [], {}, {}
+        asyncio.ensure_future(self._flush(*batch))
+
+    async def _flush(self, messages, receipts, presence):
+        saved = set()
+        try:
+            with CHAT_FLUSH_SECONDS.time():
+                # Runs on the shared database thread, so batches commit in order
+                saved = await database_sync_to_async(write_batch)(
+                    [(m, reply_to_id) for m, reply_to_id, _ in messages], receipts, presence)
+        except Exception as e:
+            logger.error(f"Chat write of {len(messages)} messages failed: {e}")
+        for message, _, future in messages:
+            if not future.done():
+                future.set_result(message if message.pk in saved else None)
+
+
+def write_batch(messages, receipts, presence):
+    """Persist one window of chat writes; returns the pks of stored messages.
+    Messages commit on their own, so a failed receipt or presence update is logged
+    rather than raised: the stored messages must still be broadcast.
+    """
+    saved = set()
+    if messages:
+        saved = _write_messages(messages)
+    if receipts:
+        try:
+            _update_participants(receipts, lambda at: {'last_read_at': at, 'last_seen': at},
+                                 {'last_read_at': DateTimeField(), 'last_seen': DateTimeField()})
+            CHAT_WRITES.inc(len(receipts), kind='read_receipt')
+        except Exception as e:
+            logger.error(f"Chat write of {len(receipts)} read receipts failed: {e}")
+    if presence:
+        try:
+            _update_participants(presence, lambda state: {'is_online': state[0], 'last_seen': state[1]},
+                                 {'is_online': BooleanField(), 'last_seen': DateTimeField()})
+            CHAT_WRITES.inc(len(presence), kind='presence')
+        except Exception as e:
+            logger.error(f"Chat write of {len(presence)} presence updates failed: {e}")
+    return saved
+
+
+def _write_messages(messages):
+    room_ids = {str(m.room_id) for m, _ in messages}
+    active = {str(pk) for pk in ChatRoom.objects.filter(
+        id__in=room_ids, is_active=True).values_list('id', flat=True)}
+
+    reply_ids = {str(r) for _, r in messages if r and _is_uuid(r)}
+    reply_rooms = {}
+    if reply_ids:
+        reply_rooms = {str(pk): str(room_id) for pk, room_id in ChatMessage.objects.filter(
+            id__in=reply_ids).values_list('id', 'room_id')}
+
+    rows = []
+    for message, reply_to_id in messages:
+        room_id = str(message.room_id)
+        if room_id not in active:
+            continue
+        if reply_to_id and reply_rooms.get(str(reply_to_id)) == room_id:
+            message.reply_to_id = reply_to_id
+        rows.append(message)
+    if not rows:
+        return set()
+
+    try:
+        with transaction.atomic():
+            ChatMessage.objects.bulk_create(rows)
+            _touch_rooms(rows)
+        stored = rows
+    except Exception as e:
+        # One bad row (e.g. a sender deleted meanwhile) must not drop the rest
+        logger.warning(f"Batched chat insert failed ({e}); retrying messages individually")
+        stored = []
+        for message in rows:
+            try:
+                with transaction.atomic():
+                    message.save(force_insert=True)
+                stored.append(message)
+            except Exception as row_error:
+                logger.error(f"Error saving message: {row_error}")
+        if stored:
+            _touch_rooms(stored)
+    CHAT_WRITES.inc(len(stored), kind='message')
+    return {m.pk for m in stored}
+
+
+def _touch_rooms(messages):
+    latest = {}
+    for message in messages:
+        room_id = str(message.room_id)
+        if room_id not in latest or message.created_at > latest[room_id]:
+            latest[room_id] = message.created_at
+    for room_id, at in latest.items():
+        ChatRoom.objects.filter(id=room_id).update(last_activity=at)
+
+
+def _update_participants(entries, values_for, fields):
+    """One CASE UPDATE per chunk of (room, user) pairs"""
+    items = list(entries.items())
+    for start in range(0, len(items), CASE_CHUNK):
+        chunk = items[start:start + CASE_CHUNK]
+        condition = Q()
+        whens = {name: [] for name in fields}
+        for (room_id, user_id), entry in chunk:
+            match = Q(room_id=room_id, user_id=user_id)
+            condition |= match
+            for name, value in values_for(entry).items():
+                whens[name].append(When(match, then=Value(value)))
+        ChatParticipant.objects.filter(condition, is_active=True).update(**{
+            name: Case(*whens[name], output_field=field) for name, field in fields.items()
+        })
+
+
+def _is_uuid(value):
+    try:
+        uuid.UUID(str(value))
+        return True
+    except ValueError:
+        return False
+
+
+_writers = weakref.WeakKeyDictionary()
+
+
+def get_writer():
+    """The ChatWriter for the running event loop"""
+    loop = asyncio.get_running_loop()
+    writer = _writers.get(loop)
+    if writer is None:
+        writer = _writers[loop] = ChatWriter()
+    return writer
@@ -16,6 +16,7 @@ Features:
 
 import os
 import sys
+import socket
 import logging
 import threading
 import time
@@ -46,13 +47,15 @@ from pydicom.errors import InvalidDicomError
 import numpy as np
 from PIL import Image
 
-from worklist.models import Patient, Study, Series, DicomImage, Modality, Facility
-from accounts.models import User
+from worklist.models import DicomImage
+from django.conf import settings
 from django.utils import timezone
-from django.db import transaction, connection
-from notifications.models import Notification, NotificationType
-from django.db import models
+from django.db import transaction, connection, connections, IntegrityError
 from django.core.files.base import ContentFile
+from noctis_pro import metrics
+from worklist import resolver
+from notifications.dispatcher import notify_new_study
+from dicom_viewer import headers, intensity, prefetch
 
 # Setup logging with rotation
 from logging.handlers import RotatingFileHandler
@@ -104,7 +107,7 @@ class DicomImageProcessor:
         """Generate thumbnail from DICOM image"""
         try:
             # Get pixel array
-            pixel_array = dicom_dataset.pixel_array
+            pixel_array = metrics.decode_pixels(dicom_dataset)
             
             # Apply basic windowing for display
             if hasattr(dicom_dataset, 'WindowCenter') and hasattr(dicom_dataset, 'WindowWidth'):
@@ -252,13 +255,33 @@ class DicomImageProcessor:
 class DicomReceiver:
     """Enhanced DICOM SCP (Service Class Provider) for receiving DICOM images"""
     
-    def __init__(self, port: int = 11112, aet: str = 'NOCTIS_SCP', max_pdu_size: int = 16384):
+    def __init__(self, port: int = 11112, aet: str = 'NOCTIS_SCP', max_pdu_size: int = 262144,
+                 bind_address: str = '', max_associations: int = 16, max_assoc_per_aet: int = 4,
+                 max_concurrent_stores: int = 8, backpressure_wait: float = 10.0,
+                 network_timeout: float = 60, acse_timeout: float = 30, dimse_timeout: float = 60,
+                 reuse_port: bool = False):
         self.port = port
         self.aet = aet
         self.max_pdu_size = max_pdu_size
+        self.bind_address = bind_address
         self.is_running = False
         self.ae = None
         
+        # Concurrency limits: total associations, associations per calling AE,
+        # and C-STOREs processed at once (the ingest queue)
+        self.max_associations = max_associations
+        self.max_assoc_per_aet = max_assoc_per_aet
+        self.max_concurrent_stores = max_concurrent_stores
+        self.backpressure_wait = backpressure_wait
+        self.network_timeout = network_timeout
+        self.acse_timeout = acse_timeout
+        self.dimse_timeout = dimse_timeout
+        self.reuse_port = reuse_port
+        self._store_slots = threading.BoundedSemaphore(max(1, max_concurrent_stores))
+        self._assoc_lock = threading.Lock()
+        self._assoc_per_aet = {}
+        self._assoc_counted = {}
+        
         # Statistics
         self.stats = {
             'total_received': 0,
@@ -282,7 +305,11 @@ class DicomReceiver:
         # Initialize processors
         self.image_processor = DicomImageProcessor()
         
-        self.logger.info(f"DICOM Receiver initialized - AET: {aet}, Port: {port}, Max PDU: {max_pdu_size}")
+        self.logger.info(
+            f"DICOM Receiver initialized - AET: {aet}, Port: {port}, Max PDU: {max_pdu_size}, "
+            f"Max associations: {max_associations} ({max_assoc_per_aet} per AE), "
+            f"Concurrent stores: {max_concurrent_stores}"
+        )
     
     def setup_ae(self):
         """Setup Application Entity with optimized settings"""
@@ -292,11 +319,12 @@ class DicomReceiver:
         self.ae.supported_contexts = AllStoragePresentationContexts
         self.ae.supported_contexts.extend(VerificationPresentationContexts)
         
-        # Optimize network settings
+        # Network settings; 0 disables the PDU size limit
         self.ae.maximum_pdu_size = self.max_pdu_size
-        self.ae.network_timeout = 30
-        self.ae.acse_timeout = 30
-        self.ae.dimse_timeout = 30
+        self.ae.maximum_associations = self.max_associations
+        self.ae.network_timeout = self.network_timeout
+        self.ae.acse_timeout = self.acse_timeout
+        self.ae.dimse_timeout = self.dimse_timeout
         
         # Allow any Called AE Title (facilities identify via Calling AE)
         if hasattr(self.ae, 'require_called_aet'):
@@ -306,23 +334,70 @@ class DicomReceiver:
                 pass
         
         # Event handlers
-        self.ae.on_c_store = self.handle_store
-        self.ae.on_c_echo = self.handle_echo
+        self.handlers = [
+            (evt.EVT_C_STORE, self.handle_store),
+            (evt.EVT_C_ECHO, self.handle_echo),
+            (evt.EVT_ACCEPTED, self.handle_accepted),
+            (evt.EVT_RELEASED, self.handle_closed),
+            (evt.EVT_ABORTED, self.handle_closed),
+            (evt.EVT_CONN_CLOSE, self.handle_closed),
+        ]
         
         self.logger.info("Application Entity configured successfully")
     
+    @staticmethod
+    def _calling_aet(assoc) -> str:
+        """Calling AE title as text (bytes in pynetdicom 1.x, str in 2.x)"""
+        aet = assoc.requestor.ae_title
+        if isinstance(aet, bytes):
+            aet = aet.decode(errors='ignore')
+        return (aet or '').strip()
+    
+    def handle_accepted(self, event):
+        """Enforce the per-AE association limit; excess associations are aborted so the modality retries"""
+        calling_aet = self._calling_aet(event.assoc).upper()
+        with self._assoc_lock:
+            active = self._assoc_per_aet.get(calling_aet, 0)
+            over_limit = self.max_assoc_per_aet and active >= self.max_assoc_per_aet
+            if not over_limit:
+                self._assoc_per_aet[calling_aet] = active + 1
+                self._assoc_counted[id(event.assoc)] = calling_aet
+        if over_limit:
+            self.logger.warning(
+                f"Association from '{calling_aet}' aborted: {active} already active "
+                f"(limit {self.max_assoc_per_aet} per AE)"
+            )
+            metrics.DICOM_ASSOCIATIONS_REFUSED.inc(reason='per_aet_limit')
+            event.assoc.abort()
+            return
+        metrics.DICOM_ASSOCIATIONS_ACTIVE.inc()
+    
+    def handle_closed(self, event):
+        """Release the association's per-AE slot (released, aborted or dropped)"""
+        with self._assoc_lock:
+            calling_aet = self._assoc_counted.pop(id(event.assoc), None)
+            if calling_aet is None:
+                return
+            remaining = self._assoc_per_aet.get(calling_aet, 1) - 1
+            if remaining > 0:
+                self._assoc_per_aet[calling_aet] = remaining
+            else:
+                self._assoc_per_aet.pop(calling_aet, None)
+        metrics.DICOM_ASSOCIATIONS_ACTIVE.dec()
+        # Merge the intensity counts of series this association delivered
+        intensity.flush()
+    
     def handle_echo(self, event):
         """Handle C-ECHO requests (DICOM ping) with enhanced logging"""
         try:
-            calling_aet = event.assoc.requestor.ae_title.decode(errors='ignore').strip()
+            calling_aet = self._calling_aet(event.assoc)
             peer_ip = getattr(event.assoc.requestor, 'address', 'unknown')
             
             # Log the echo request
             self.logger.info(f"C-ECHO received from '{calling_aet}' at {peer_ip}")
             
             # Check if facility exists (optional warning)
-            facility = Facility.objects.filter(ae_title__iexact=calling_aet, is_active=True).first()
-            if not facility:
+            if not resolver.facility_id_for_ae(calling_aet):
                 self.logger.warning(f"C-ECHO from unknown AE Title '{calling_aet}' - facility not registered")
             
             return 0x0000  # Success
@@ -332,6 +407,34 @@ class DicomReceiver:
             return 0x0000  # Still return success for basic connectivity
     
     def handle_store(self, event):
+        """Handle C-STORE requests, applying backpressure and recording latency and status metrics"""
+        start = time.perf_counter()
+        status = 0xA700
+        # Backpressure: when the ingest queue is full, hold this association
+        # (its reads stall) and only refuse with a temporary failure after
+        # backpressure_wait, so the modality retries instead of failing the study
+        acquired = self._store_slots.acquire(blocking=False)
+        if not acquired:
+            metrics.CSTORE_BACKPRESSURE.inc(outcome='delayed')
+            acquired = self._store_slots.acquire(timeout=self.backpressure_wait)
+        if not acquired:
+            metrics.CSTORE_BACKPRESSURE.inc(outcome='refused')
+            metrics.CSTORE_SECONDS.observe(time.perf_counter() - start, status=f'0x{status:04X}')
+            self.logger.warning(
+                f"C-STORE refused (Out of Resources): {self.max_concurrent_stores} stores in progress "
+                f"for more than {self.backpressure_wait}s"
+            )
+            return status
+        metrics.CSTORE_IN_FLIGHT.inc()
+        try:
+            status = self._handle_store(event)
+            return status
+        finally:
+            self._store_slots.release()
+            metrics.CSTORE_IN_FLIGHT.dec()
+            metrics.CSTORE_SECONDS.observe(time.perf_counter() - start, status=f'0x{status:04X}')
+    
+    def _handle_store(self, event):
         """Handle C-STORE requests with comprehensive error handling"""
         calling_aet = None
         peer_ip = None
@@ -342,12 +445,12 @@ class DicomReceiver:
             self.stats['last_received'] = timezone.now()
             
             # Extract connection information
-            calling_aet = event.assoc.requestor.ae_title.decode(errors='ignore').strip()
+            calling_aet = self._calling_aet(event.assoc)
             peer_ip = getattr(event.assoc.requestor, 'address', 'unknown')
             
             # Validate facility authorization
-            facility = Facility.objects.filter(ae_title__iexact=calling_aet, is_active=True).first()
-            if not facility:
+            facility_id = resolver.facility_id_for_ae(calling_aet)
+            if not facility_id:
                 self.logger.warning(f"C-STORE rejected: Unknown Calling AET '{calling_aet}' from {peer_ip}")
                 self.stats['total_errors'] += 1
                 return 0xC000  # Refused: Out of Resources - A400?
@@ -372,9 +475,17 @@ class DicomReceiver:
                 f"Study={study_uid}, Series={series_uid}, SOP={sop_instance_uid}"
             )
             
-            # Process the DICOM object in a transaction
-            with transaction.atomic():
-                success = self.process_dicom_object(ds, calling_aet, facility, peer_ip)
+            # Process the DICOM object in a transaction. Foreign keys are checked
+            # at commit, so a resolver entry for a row deleted by another process
+            # fails there; drop the cache and resolve again once.
+            try:
+                with transaction.atomic():
+                    success = self.process_dicom_object(ds, calling_aet, facility_id, peer_ip)
+            except IntegrityError as e:
+                self.logger.warning(f"Retrying {sop_instance_uid} with a fresh resolver cache: {e}")
+                resolver.get_resolver().clear()
+                with transaction.atomic():
+                    success = self.process_dicom_object(ds, calling_aet, facility_id, peer_ip)
                 
             if success:
                 self.stats['total_stored'] += 1
@@ -395,7 +506,7 @@ class DicomReceiver:
             self.logger.error(f"Traceback: {traceback.format_exc()}")
             return 0xA700  # Out of Resources
     
-    def process_dicom_object(self, ds, calling_aet: str, facility, peer_ip: str) -> bool:
+    def process_dicom_object(self, ds, calling_aet: str, facility_id: int, peer_ip: str) -> bool:
         """Process and store DICOM object with enhanced metadata extraction"""
         try:
             # Extract comprehensive metadata
@@ -406,24 +517,26 @@ class DicomReceiver:
                 self.logger.error("Missing required DICOM UIDs")
                 return False
             
-            # Process patient information
-            patient = self._get_or_create_patient(metadata)
-            if not patient:
+            # Patient, modality, study and series resolve to primary keys through
+            # the ingest resolver; after the first instance of a series these are
+            # cache hits and only the image row is written
+            patient_id = self._get_or_create_patient(metadata)
+            if not patient_id:
                 self.logger.error("Failed to create/retrieve patient")
                 return False
             
             # Process modality
-            modality = self._get_or_create_modality(metadata['modality'])
+            modality_id = self._get_or_create_modality(metadata['modality'])
             
             # Process study
-            study = self._get_or_create_study(metadata, patient, facility, modality)
-            if not study:
+            study_id, study_created = self._get_or_create_study(metadata, patient_id, facility_id, modality_id)
+            if not study_id:
                 self.logger.error("Failed to create/retrieve study")
                 return False
             
             # Process series
-            series = self._get_or_create_series(metadata, study, modality)
-            if not series:
+            series_id = self._get_or_create_series(metadata, study_id)
+            if not series_id:
                 self.logger.error("Failed to create/retrieve series")
                 return False
             
@@ -437,19 +550,27 @@ class DicomReceiver:
             thumbnail_data = self.image_processor.generate_thumbnail(ds)
             
             # Create DICOM image record
-            dicom_image = self._create_dicom_image(metadata, series, file_path, thumbnail_data)
+            dicom_image, image_created = self._create_dicom_image(metadata, series_id, file_path, thumbnail_data)
             if not dicom_image:
                 self.logger.error("Failed to create DICOM image record")
                 return False
             
+            # Fold the (already decoded) pixels into the series intensity stats,
+            # once per instance: a re-sent C-STORE must not count twice
+            if image_created:
+                intensity.accumulate(series_id, ds, metadata['modality'])
+            # Store the series' auto-window once its instances stop arriving; volumes and
+            # renders warmed here would fill this process's caches, which no viewer reads
+            prefetch.schedule(series_id, volume=False)
+            
             # Send notifications for new studies
-            if hasattr(study, '_created') and study._created:
-                self._send_new_study_notifications(study, facility, modality)
+            if study_created:
+                self._send_new_study_notifications(study_id)
             
             # Log success with details
             self.logger.info(
-                f"Successfully processed DICOM: Patient={patient.patient_id}, "
-                f"Study={study.accession_number}, Series={series.series_number}, "
+                f"Successfully processed DICOM: Patient={metadata['patient_id']}, "
+                f"Study={metadata['accession_number']}, Series={metadata['series_number']}, "
                 f"Instance={dicom_image.instance_number}"
             )
             
@@ -460,8 +581,8 @@ class DicomReceiver:
             self.logger.error(f"Traceback: {traceback.format_exc()}")
             return False
     
-    def _get_or_create_patient(self, metadata: Dict[str, Any]) -> Optional[Patient]:
-        """Get or create patient with enhanced name parsing"""
+    def _get_or_create_patient(self, metadata: Dict[str, Any]) -> Optional[int]:
+        """Get or create patient with enhanced name parsing; returns the primary key"""
         try:
             # Parse patient name
             patient_name = metadata['patient_name']
@@ -486,8 +607,8 @@ class DicomReceiver:
                     self.logger.warning(f"Invalid birth date format: {metadata['patient_birth_date']}")
             
             # Get or create patient
-            patient, created = Patient.objects.get_or_create(
-                patient_id=metadata['patient_id'],
+            patient_id, created = resolver.resolve_patient(
+                metadata['patient_id'],
                 defaults={
                     'first_name': first_name,
                     'last_name': last_name,
@@ -497,28 +618,28 @@ class DicomReceiver:
             )
             
             if created:
-                self.logger.info(f"Created new patient: {patient}")
+                self.logger.info(f"Created new patient: {metadata['patient_id']}")
             
-            return patient
+            return patient_id
             
         except Exception as e:
             self.logger.error(f"Error creating patient: {str(e)}")
             return None
     
-    def _get_or_create_modality(self, modality_code: str) -> Modality:
-        """Get or create modality"""
-        modality, created = Modality.objects.get_or_create(
-            code=modality_code,
+    def _get_or_create_modality(self, modality_code: str) -> int:
+        """Get or create modality; returns the primary key"""
+        modality_id, created = resolver.resolve_modality(
+            modality_code,
             defaults={
                 'name': modality_code,
                 'description': f'{modality_code} Modality'
             }
         )
-        return modality
+        return modality_id
     
-    def _get_or_create_study(self, metadata: Dict[str, Any], patient: Patient, 
-                           facility: Facility, modality: Modality) -> Optional[Study]:
-        """Get or create study with comprehensive metadata"""
+    def _get_or_create_study(self, metadata: Dict[str, Any], patient_id: int,
+                           facility_id: int, modality_id: int) -> Tuple[Optional[int], bool]:
+        """Get or create study with comprehensive metadata; returns (primary key, created)"""
         try:
             # Parse study datetime
             study_datetime = timezone.now()
@@ -531,13 +652,13 @@ class DicomReceiver:
                     self.logger.warning(f"Invalid study date/time: {metadata['study_date']}, {metadata['study_time']} - {e}")
             
             # Get or create study
-            study, created = Study.objects.get_or_create(
-                study_instance_uid=metadata['study_instance_uid'],
+            study_id, created = resolver.resolve_study(
+                metadata['study_instance_uid'],
                 defaults={
                     'accession_number': metadata['accession_number'],
-                    'patient': patient,
-                    'facility': facility,
-                    'modality': modality,
+                    'patient_id': patient_id,
+                    'facility_id': facility_id,
+                    'modality_id': modality_id,
                     'study_description': metadata['study_description'],
                     'study_date': study_datetime,
                     'referring_physician': metadata['referring_physician'],
@@ -547,25 +668,22 @@ class DicomReceiver:
                 }
             )
             
-            # Mark if newly created for notification purposes
-            study._created = created
-            
             if created:
-                self.logger.info(f"Created new study: {study}")
+                self.logger.info(f"Created new study: {metadata['study_instance_uid']}")
             
-            return study
+            return study_id, created
             
         except Exception as e:
             self.logger.error(f"Error creating study: {str(e)}")
-            return None
+            return None, False
     
-    def _get_or_create_series(self, metadata: Dict[str, Any], study: Study, modality: Modality) -> Optional[Series]:
-        """Get or create series with enhanced metadata"""
+    def _get_or_create_series(self, metadata: Dict[str, Any], study_id: int) -> Optional[int]:
+        """Get or create series with enhanced metadata; returns the primary key"""
         try:
-            series, created = Series.objects.get_or_create(
-                series_instance_uid=metadata['series_instance_uid'],
+            series_id, created = resolver.resolve_series(
+                metadata['series_instance_uid'],
                 defaults={
-                    'study': study,
+                    'study_id': study_id,
                     'series_number': metadata['series_number'],
                     'series_description': metadata['series_description'],
                     'modality': metadata['modality'],
@@ -577,9 +695,9 @@ class DicomReceiver:
             )
             
             if created:
-                self.logger.info(f"Created new series: {series}")
+                self.logger.info(f"Created new series: {metadata['series_instance_uid']}")
             
-            return series
+            return series_id
             
         except Exception as e:
             self.logger.error(f"Error creating series: {str(e)}")
@@ -602,8 +720,10 @@ class DicomReceiver:
             ds.save_as(file_path, write_like_original=False)
             
             # Verify file was saved correctly
-            if not file_path.exists() or file_path.stat().st_size == 0:
+            file_size = file_path.stat().st_size if file_path.exists() else 0
+            if file_size == 0:
                 raise ValueError("DICOM file was not saved correctly")
+            metrics.CSTORE_BYTES.inc(file_size)
             
             return file_path
             
@@ -611,9 +731,9 @@ class DicomReceiver:
             self.logger.error(f"Error saving DICOM file: {str(e)}")
             return None
     
-    def _create_dicom_image(self, metadata: Dict[str, Any], series: Series, 
-                          file_path: Path, thumbnail_data: Optional[bytes]) -> Optional[DicomImage]:
-        """Create DICOM image database record"""
+    def _create_dicom_image(self, metadata: Dict[str, Any], series_id: int, 
+                          file_path: Path, thumbnail_data: Optional[bytes]) -> Tuple[Optional[DicomImage], bool]:
+        """Create DICOM image database record; returns (image, created), created False for a re-sent instance"""
         try:
             # Create relative path for database storage
             relative_path = str(file_path.relative_to(BASE_DIR / 'media'))
@@ -623,12 +743,13 @@ class DicomReceiver:
             dicom_image, created = DicomImage.objects.get_or_create(
                 sop_instance_uid=metadata['sop_instance_uid'],
                 defaults={
-                    'series': series,
+                    'series_id': series_id,
                     'instance_number': metadata['instance_number'],
                     'image_position': metadata.get('image_position', ''),
                     'slice_location': metadata.get('slice_location'),
                     'file_path': relative_path,
                     'file_size': file_size,
+                    'header': headers.extract(file_path),
                     'processed': False
                 }
             )
@@ -645,57 +766,18 @@ class DicomReceiver:
             if created:
                 self.logger.info(f"Created new DICOM image: {dicom_image}")
             
-            return dicom_image
+            return dicom_image, created
             
         except Exception as e:
             self.logger.error(f"Error creating DICOM image record: {str(e)}")
-            return None
+            return None, False
     
-    def _send_new_study_notifications(self, study: Study, facility: Facility, modality: Modality):
-        """Send notifications for new studies"""
+    def _send_new_study_notifications(self, study_id: int):
+        """Queue new-study notifications; the dispatcher fans out after commit, off the association thread"""
         try:
-            notif_type, _ = NotificationType.objects.get_or_create(
-                code='new_study',
-                defaults={
-                    'name': 'New Study Uploaded',
-                    'description': 'A new study has been uploaded',
-                    'is_system': True
-                }
-            )
-            
-            # Get recipients (radiologists, admins, facility users)
-            recipients = User.objects.filter(
-                models.Q(role='radiologist') | 
-                models.Q(role='admin') | 
-                models.Q(facility=facility),
-                is_active=True
-            ).distinct()
-            
-            for recipient in recipients:
-                try:
-                    Notification.objects.create(
-                        type=notif_type,
-                        recipient=recipient,
-                        sender=None,
-                        title=f"New {modality.code} study for {study.patient.full_name}",
-                        message=f"Study {study.accession_number} uploaded from {facility.name}",
-                        priority='normal',
-                        study=study,
-                        facility=facility,
-                        data={
-                            'study_id': study.id,
-                            'accession_number': study.accession_number,
-                            'modality': modality.code,
-                            'patient_name': study.patient.full_name
-                        }
-                    )
-                except Exception as e:
-                    self.logger.warning(f"Failed to create notification for user {recipient.username}: {str(e)}")
-            
-            self.logger.info(f"Sent notifications for new study {study.accession_number} to {recipients.count()} users")
-            
+            notify_new_study(study_id)
         except Exception as e:
-            self.logger.warning(f"Failed to send notifications for new study: {str(e)}")
+            self.logger.warning(f"Failed to queue notifications for new study: {str(e)}")
     
     def get_statistics(self) -> Dict[str, Any]:
         """Get receiver statistics"""
@@ -730,14 +812,19 @@ class DicomReceiver:
             self.logger.info("NOCTIS PRO DICOM RECEIVER SERVICE")
             self.logger.info("=" * 60)
             self.logger.info(f"Application Entity Title: {self.aet}")
-            self.logger.info(f"Listening on port: {self.port}")
-            self.logger.info(f"Maximum PDU size: {self.max_pdu_size}")
+            self.logger.info(f"Listening on: {self.bind_address or '*'}:{self.port}"
+                             f"{' (SO_REUSEPORT)' if self.reuse_port else ''}")
+            self.logger.info(f"Maximum PDU size: {self.max_pdu_size or 'unlimited'}")
+            self.logger.info(f"Maximum associations: {self.max_associations} ({self.max_assoc_per_aet} per AE)")
             self.logger.info(f"Storage directory: {self.storage_dir}")
             self.logger.info("Waiting for DICOM connections...")
             self.logger.info("=" * 60)
             
+            if self.reuse_port:
+                _enable_reuse_port()
+            
             # Start the server (blocking)
-            self.ae.start_server(('', self.port), block=True)
+            self.ae.start_server((self.bind_address, self.port), block=True, evt_handlers=self.handlers)
             
         except KeyboardInterrupt:
             self.logger.info("DICOM receiver stopped by user (Ctrl+C)")
@@ -766,11 +853,104 @@ class DicomReceiver:
             self.ae.shutdown()
 
 
+def _enable_reuse_port():
+    """Bind the pynetdicom server socket with SO_REUSEPORT so several processes can share the port"""
+    from pynetdicom.transport import AssociationServer
+    
+    if getattr(AssociationServer.server_bind, '_reuse_port', False):
+        return
+    original_bind = AssociationServer.server_bind
+    
+    def server_bind(server):
+        server.socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+        original_bind(server)
+    
+    server_bind._reuse_port = True
+    AssociationServer.server_bind = server_bind
+
+
 def signal_handler(signum, frame):
     """Handle shutdown signals gracefully"""
     logger = logging.getLogger('dicom_receiver')
     logger.info(f"Received signal {signum}, shutting down gracefully...")
-    # The receiver will be stopped in the main function
+    # Unwind start_server(block=True); the receiver is stopped in run_receiver
+    raise KeyboardInterrupt
+
+
+def run_receiver(args, worker: Optional[int] = None):
+    """Run one receiver process until interrupted"""
+    receiver = DicomReceiver(
+        port=args.port,
+        aet=args.aet,
+        max_pdu_size=args.max_pdu,
+        bind_address=args.bind,
+        max_associations=args.max_associations,
+        max_assoc_per_aet=args.max_assoc_per_aet,
+        max_concurrent_stores=args.max_concurrent_stores,
+        backpressure_wait=args.backpressure_wait,
+        network_timeout=args.network_timeout,
+        acse_timeout=args.acse_timeout,
+        dimse_timeout=args.dimse_timeout,
+        reuse_port=args.reuse_port or args.workers > 1,
+    )
+    
+    # Set debug logging if requested
+    if args.debug:
+        logging.getLogger('dicom_receiver').setLevel(logging.DEBUG)
+        logging.getLogger('pynetdicom').setLevel(logging.DEBUG)
+    
+    # The receiver runs outside the web process, so it exposes its own metrics;
+    # each worker process serves them on its own port
+    if args.metrics_port:
+        metrics_port = args.metrics_port + (worker or 0)
+        metrics.start_http_server(metrics_port, args.metrics_addr, getattr(settings, 'METRICS_AUTH_TOKEN', ''))
+        receiver.logger.info(f"Metrics available on {args.metrics_addr}:{metrics_port}")
+    
+    try:
+        receiver.start()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        receiver.stop()
+
+
+def run_workers(args):
+    """Fork listener processes sharing one port through SO_REUSEPORT; the kernel balances associations"""
+    logger = DicomReceiverLogger.setup_logger()
+    if not hasattr(socket, 'SO_REUSEPORT'):
+        logger.error("SO_REUSEPORT is not supported on this platform; run with --workers 1")
+        sys.exit(1)
+    
+    # Children must not inherit the parent's database connections
+    connections.close_all()
+    children = []
+    for index in range(args.workers):
+        pid = os.fork()
+        if pid == 0:
+            code = 0
+            try:
+                run_receiver(args, worker=index)
+            except BaseException:
+                code = 1
+            finally:
+                os._exit(code)
+        children.append(pid)
+    logger.info(f"Started {len(children)} receiver workers on port {args.port}: {children}")
+    
+    def forward(signum, frame):
+        for pid in children:
+            try:
+                os.kill(pid, signum)
+            except ProcessLookupError:
+                pass
+    
+    signal.signal(signal.SIGINT, forward)
+    signal.signal(signal.SIGTERM, forward)
+    for pid in children:
+        try:
+            os.waitpid(pid, 0)
+        except ChildProcessError:
+            pass
 
 
 def main():
@@ -783,12 +963,36 @@ def main():
     )
     parser.add_argument('--port', type=int, default=11112, 
                        help='Port to listen on')
+    parser.add_argument('--bind', default='',
+                       help='Address to bind (empty for all interfaces)')
     parser.add_argument('--aet', default='NOCTIS_SCP', 
                        help='Application Entity Title')
-    parser.add_argument('--max-pdu', type=int, default=16384,
-                       help='Maximum PDU size in bytes')
+    parser.add_argument('--max-pdu', type=int, default=262144,
+                       help='Maximum PDU size in bytes (0 for unlimited)')
+    parser.add_argument('--max-associations', type=int, default=16,
+                       help='Maximum concurrent associations per process')
+    parser.add_argument('--max-assoc-per-aet', type=int, default=4,
+                       help='Maximum concurrent associations per calling AE (0 for no limit)')
+    parser.add_argument('--max-concurrent-stores', type=int, default=8,
+                       help='C-STOREs processed at once before backpressure applies')
+    parser.add_argument('--backpressure-wait', type=float, default=10.0,
+                       help='Seconds a C-STORE waits for a slot before Out of Resources (0xA700)')
+    parser.add_argument('--network-timeout', type=float, default=60,
+                       help='Network timeout in seconds')
+    parser.add_argument('--acse-timeout', type=float, default=30,
+                       help='Association negotiation timeout in seconds')
+    parser.add_argument('--dimse-timeout', type=float, default=60,
+                       help='DIMSE message timeout in seconds')
+    parser.add_argument('--workers', type=int, default=1,
+                       help='Listener processes sharing the port via SO_REUSEPORT')
+    parser.add_argument('--reuse-port', action='store_true',
+                       help='Bind with SO_REUSEPORT (for externally managed workers)')
     parser.add_argument('--debug', action='store_true',
                        help='Enable debug logging')
+    parser.add_argument('--metrics-port', type=int, default=0,
+                       help='Serve Prometheus metrics on this port (0 disables; workers use port + index)')
+    parser.add_argument('--metrics-addr', default='127.0.0.1',
+                       help='Address the metrics server binds (scrapers need METRICS_AUTH_TOKEN off loopback)')
     
     args = parser.parse_args()
     
@@ -799,21 +1003,11 @@ def main():
     # Ensure logs directory exists under project base directory
     (BASE_DIR / 'logs').mkdir(parents=True, exist_ok=True)
     
-    # Create receiver instance
-    receiver = DicomReceiver(port=args.port, aet=args.aet, max_pdu_size=args.max_pdu)
-    
-    # Set debug logging if requested
-    if args.debug:
-        logging.getLogger('dicom_receiver').setLevel(logging.DEBUG)
-        logging.getLogger('pynetdicom').setLevel(logging.DEBUG)
-    
-    try:
-        receiver.start()
-    except KeyboardInterrupt:
-        pass
-    finally:
-        receiver.stop()
+    if args.workers > 1:
+        run_workers(args)
+    else:
+        run_receiver(args)
 
 
 if __name__ == '__main__':
-    main()
\ No newline at end of file
+    main()
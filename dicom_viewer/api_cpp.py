@@ -4,10 +4,9 @@ from django.views.decorators.http import require_http_methods
 from django.shortcuts import get_object_or_404
 from django.conf import settings
 from worklist.models import Study, Series, DicomImage
-from .dicom_utils import safe_dicom_str
+from . import headers
 import os
 import json
-import pydicom
 
 @require_http_methods(["GET"])
 @csrf_exempt
@@ -108,31 +107,32 @@ def api_cpp_dicom_file(request, instance_uid:str):
 @csrf_exempt
 def api_cpp_dicom_info(request, instance_uid:str):
     img = get_object_or_404(DicomImage, sop_instance_uid=instance_uid)
-    if not img.file_path or not os.path.exists(img.file_path.path):
-        return JsonResponse({"error": "DICOM file not found"}, status=404)
-    try:
-        ds = pydicom.dcmread(img.file_path.path, stop_before_pixels=True)
-        info = {
-            "patient_name": str(getattr(ds, "PatientName", "")),
-            "patient_id": str(getattr(ds, "PatientID", "")),
-            "patient_birth_date": str(getattr(ds, "PatientBirthDate", "")),
-            "patient_sex": str(getattr(ds, "PatientSex", "")),
-            "study_date": str(getattr(ds, "StudyDate", "")),
-            "study_time": str(getattr(ds, "StudyTime", "")),
-            "study_description": str(getattr(ds, "StudyDescription", "")),
-            "series_description": str(getattr(ds, "SeriesDescription", "")),
-            "modality": str(getattr(ds, "Modality", "")),
-            "institution_name": str(getattr(ds, "InstitutionName", "")),
-            "rows": getattr(ds, "Rows", None),
-            "columns": getattr(ds, "Columns", None),
-            "pixel_spacing": safe_dicom_str(getattr(ds, "PixelSpacing", "")),
-            "slice_thickness": safe_dicom_str(getattr(ds, "SliceThickness", "")),
-            "window_center": safe_dicom_str(getattr(ds, "WindowCenter", "")),
-            "window_width": safe_dicom_str(getattr(ds, "WindowWidth", "")),
-        }
-        return JsonResponse({"instance_uid": instance_uid, "dicom_info": info})
-    except Exception:
+    # The header record stored at ingest; older instances get theirs extracted once here
+    record = headers.of(img) if img.file_path else None
+    if record is None:
+        if not img.file_path or not os.path.exists(img.file_path.path):
+            return JsonResponse({"error": "DICOM file not found"}, status=404)
         return JsonResponse({"error": "Cannot read DICOM metadata"}, status=500)
+    h = headers.Header(record)
+    info = {
+        "patient_name": headers.text(getattr(h, "PatientName", "")),
+        "patient_id": headers.text(getattr(h, "PatientID", "")),
+        "patient_birth_date": headers.text(getattr(h, "PatientBirthDate", "")),
+        "patient_sex": headers.text(getattr(h, "PatientSex", "")),
+        "study_date": headers.text(getattr(h, "StudyDate", "")),
+        "study_time": headers.text(getattr(h, "StudyTime", "")),
+        "study_description": headers.text(getattr(h, "StudyDescription", "")),
+        "series_description": headers.text(getattr(h, "SeriesDescription", "")),
+        "modality": headers.text(getattr(h, "Modality", "")),
+        "institution_name": headers.text(getattr(h, "InstitutionName", "")),
+        "rows": getattr(h, "Rows", None),
+        "columns": getattr(h, "Columns", None),
+        "pixel_spacing": headers.text(getattr(h, "PixelSpacing", "")),
+        "slice_thickness": headers.text(getattr(h, "SliceThickness", "")),
+        "window_center": headers.text(getattr(h, "WindowCenter", "")),
+        "window_width": headers.text(getattr(h, "WindowWidth", "")),
+    }
+    return JsonResponse({"instance_uid": instance_uid, "dicom_info": info})
 
 @require_http_methods(["GET"]) 
 @csrf_exempt
@@ -0,0 +1,376 @@
+"""
+Progressive MPR volume assembly.
+
+The first MPR request on a series used to wait until every slice had been
+read, decoded and stacked. ``prepare`` only sorts the slices and decodes one
+of them. It uses the positions recorded at ingest, or headers read without
+pixel data when those are missing. It then returns a volume whose native
+slices are allocated but not yet decoded. A background thread fills the
+volume (``Assembly.start``):
+
+* every ``STRIDE``th slice first, so sagittal, coronal and MIP views of the
+  whole extent are available early, at reduced Z resolution;
+* then the slices in between.
+
+An axial read of a slice that is not decoded yet decodes it in the request
+thread (``StoredVolume.plane`` calls ``Assembly.load``), so axial browsing does
+not wait for the background order. ``volume.completeness`` gives the decoded
+fraction. Once every slice is in, ``volume.loaded`` is cleared and reads are
+exactly those of a volume built in one pass.
+
+Slices that cannot join the 16-bit volume are not loaded into it. These are
+a different rescale, values outside the chosen dtype or unreadable files. At
+the end the series is read again in one pass through ``volumes.stack``, which
+falls back to float when needed, and the result replaces the partial volume.
+Pixel layouts that ``stack`` keeps as float, or that are not single-channel 2D,
+are read in one pass from the start.
+"""
+import logging
+import os
+import re
+import threading
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+import pydicom
+from django.conf import settings
+
+from noctis_pro import metrics
+from . import headers, volumes
+
+logger = logging.getLogger(__name__)
+
+# Every STRIDE-th slice is decoded before the ones in between
+STRIDE = 4
+# Display depth cap for the isotropic Z resample
+MAX_DEPTH = 2048
+
+_NUMBER = re.compile(r'[-+]?(?:\d+\.?\d*|\.\d+)(?:[eE][-+]?\d+)?')
+
+
+def _pixels(ds, path):
+    try:
+        return metrics.decode_pixels(ds)
+    except Exception:
+        import SimpleITK as sitk
+        px = sitk.GetArrayFromImage(sitk.ReadImage(path))
+        if px.ndim == 3 and px.shape[0] == 1:
+            px = px[0]
+        return px
+
+
+def _open(path, record=None):
+    """(header, pixels) of one slice: read at the pixel data offset when its header record allows,
+    with the record as the header, else parsed and decoded by pydicom
+    """
+    if record is not None and headers.native(record):
+        return headers.Header(record), headers.read_pixels(path, record)
+    ds = pydicom.dcmread(path)
+    return ds, _pixels(ds, path)
+
+
+def _rescale(ds):
+    return (float(getattr(ds, 'RescaleSlope', 1.0) or 1.0),
+            float(getattr(ds, 'RescaleIntercept', 0.0) or 0.0))
+
+
+def _normal(ds):
+    """Unit slice normal from ImageOrientationPatient, +Z without it"""
+    iop = getattr(ds, 'ImageOrientationPatient', None)
+    if iop is not None and len(iop) == 6:
+        normal = np.cross([float(v) for v in iop[:3]], [float(v) for v in iop[3:]])
+        return normal / (np.linalg.norm(normal) + 1e-8)
+    return np.array([0.0, 0.0, 1.0])
+
+
+def _position(ds, normal):
+    """Slice position along the normal; SliceLocation, then InstanceNumber, without ImagePositionPatient"""
+    pos = getattr(ds, 'ImagePositionPatient', None)
+    if pos is not None and len(pos) == 3:
+        return float(np.dot([float(v) for v in pos], normal))
+    return float(getattr(ds, 'SliceLocation', getattr(ds, 'InstanceNumber', 0)) or 0)
+
+
+def _recorded_positions(image_positions, normal):
+    """Positions along the normal from the ImagePositionPatient strings stored at ingest
+    ("[x, y, z]" or "x\\y\\z"), or None if any slice lacks one
+    """
+    positions = []
+    for text in image_positions:
+        values = _NUMBER.findall(text or '')
+        if len(values) != 3:
+            return None
+        positions.append(float(np.dot([float(v) for v in values], normal)))
+    return positions
+
+
+def _scanned_positions(paths, records, normal):
+    """(position, path) for every readable file, from its header record or reading headers only"""
+    found = []
+    for path in paths:
+        try:
+            record = records.get(path)
+            ds = headers.Header(record) if record else pydicom.dcmread(path, stop_before_pixels=True)
+            found.append((_position(ds, normal), path))
+        except Exception:
+            continue
+    return found
+
+
+def _geometry(ds):
+    """(slice spacing, (row, column) pixel spacing) from a slice header"""
+    st = getattr(ds, 'SpacingBetweenSlices', None)
+    if st is None:
+        st = getattr(ds, 'SliceThickness', 1.0)
+    try:
+        st = float(st)
+    except Exception:
+        st = 1.0
+    ps_attr = getattr(ds, 'PixelSpacing', [1.0, 1.0])
+    try:
+        ps = (float(ps_attr[0]), float(ps_attr[1]))
+    except Exception:
+        ps = (1.0, 1.0)
+    return st, ps
+
+
+def _stored_dtype(ds, px):
+    """16-bit dtype a progressively filled volume uses, from the first slice; None to read in one pass"""
+    if px.ndim != 2 or not np.issubdtype(px.dtype, np.integer):
+        return None
+    if px.dtype in (np.int8, np.uint8, np.int16):
+        return np.dtype(np.int16)
+    if px.dtype == np.uint16:
+        bits = int(getattr(ds, 'BitsStored', 16) or 16)
+        return np.dtype(np.int16 if bits <= 15 else np.uint16)
+    return None
+
+
+def read(paths, records=None):
+    """StoredVolume of the readable files, in the given order, decoded in one pass"""
+    slices = []
+    for path in paths:
+        try:
+            ds, px = _open(path, (records or {}).get(path))
+            slices.append((px,) + _rescale(ds))
+        except Exception:
+            continue
+    if len(slices) < 2:
+        raise ValueError('Could not read enough images for MPR')
+    return volumes.stack(slices)
+
+
+def display(volume, st, first_ps):
+    """(volume, spacing) for MPR display: thin stacks get cubic interpolation along Z, and depth is
+    resampled toward isotropic voxels from the in-plane pixel spacing. Both are lazy (zoom_depth).
+    """
+    # Enhanced interpolation for thin stacks - optimized for minimal images
+    original_depth = volume.shape[0]
+    if volume.shape[0] < 32:
+        if volume.shape[0] < 8:
+            # Very few images - use maximum interpolation
+            target_slices = max(64, volume.shape[0] * 8)
+        else:
+            target_slices = max(32, volume.shape[0] * 4)
+        factor = target_slices / volume.shape[0]
+        # Cubic spline interpolation, applied to each plane as it is read
+        volume = volume.zoom_depth(factor, order=3)
+        st = st / factor
+        logger.info(f"Enhanced interpolation: {original_depth} -> {volume.shape[0]} slices (factor: {factor:.2f})")
+
+    # Keep in-plane resolution; only resample depth for quality MPR
+    try:
+        py, px = float(first_ps[0]), float(first_ps[1])
+        target_xy = (py + px) / 2.0
+        if st and target_xy and st > 0 and target_xy > 0:
+            z_factor = max(1e-6, float(st) / float(target_xy))
+            target_depth = int(min(MAX_DEPTH, round(volume.shape[0] * z_factor)))
+            if target_depth > volume.shape[0] + 1 or z_factor > 1.05:
+                volume = volume.zoom_depth(float(target_depth) / volume.shape[0], order=1)
+                st = target_xy
+    except Exception:
+        pass
+
+    return volume, (float(st or 1.0), float(first_ps[0] or 1.0), float(first_ps[1] or 1.0))
+
+
+class Assembly:
+    """Background decode of a series' slices into a published, partially loaded volume"""
+
+    def __init__(self, paths, volume, st, first_ps, records=None):
+        self.paths = paths
+        self.records = records or {}
+        self.volume = volume
+        self.result = volume
+        self._geometry = (st, first_ps)
+        self._exact = True
+        self._failed = set()
+        self._done = threading.Event()
+        self._callbacks = []
+        self._failure_callbacks = []
+
+    def on_complete(self, callback):
+        """callback(assembly, volume) runs on the assembly thread with the final volume"""
+        self._callbacks.append(callback)
+
+    def on_failure(self, callback):
+        """callback(assembly) runs on the assembly thread if the volume cannot be completed;
+        the partial volume must then no longer be served
+        """
+        self._failure_callbacks.append(callback)
+
+    def start(self):
+        _get_pool().submit(self._run)
+
+    def load(self, indices):
+        """Decode native slices into the volume now (in the calling thread)"""
+        loaded = self.volume.loaded
+        if loaded is None:
+            return
+        for index in indices:
+            index = int(index)
+            if not loaded[index] and index not in self._failed:
+                self._load(index, loaded)
+
+    def wait(self, timeout=None):
+        """The complete volume, once the assembly has finished"""
+        if not self._done.wait(timeout):
+            raise TimeoutError('MPR volume assembly still running')
+        if self.result is None:
+            raise ValueError('Could not read enough images for MPR')
+        return self.result
+
+    def _load(self, index, loaded):
+        volume = self.volume
+        path = self.paths[index]
+        try:
+            ds, px = _open(path, self.records.get(path))
+        except Exception as e:
+            logger.warning(f"MPR assembly could not read {path}: {e}")
+            self._reject(index)
+            return
+        fits = (px.shape == volume.data.shape[1:] and np.issubdtype(px.dtype, np.integer)
+                and _rescale(ds) == (volume.slope, volume.intercept))
+        if fits and px.size:
+            info = np.iinfo(volume.data.dtype)
+            fits = info.min <= int(px.min()) and int(px.max()) <= info.max
+        if not fits:
+            self._reject(index)
+            return
+        volume.data[index] = px
+        loaded[index] = True
+
+    def _reject(self, index):
+        self._failed.add(index)
+        self._exact = False
+
+    def _run(self):
+        volume = self.volume
+        loaded = volume.loaded
+        count = len(self.paths)
+        try:
+            order = list(range(0, count, STRIDE)) + [i for i in range(count) if i % STRIDE]
+            for index in order:
+                if not loaded[index] and index not in self._failed:
+                    self._load(index, loaded)
+            if self._exact:
+                volume.loaded = None
+            else:
+                logger.info(f"MPR assembly: {len(self._failed)} slice(s) need a one-pass read")
+                self.result, _ = display(read(self.paths, self.records), *self._geometry)
+        except Exception as e:
+            logger.error(f"MPR volume assembly failed: {e}")
+            self.result = None
+        try:
+            if self.result is not None:
+                for callback in self._callbacks:
+                    try:
+                        callback(self, self.result)
+                    except Exception as e:
+                        logger.warning(f"MPR assembly callback failed: {e}")
+            else:
+                for callback in self._failure_callbacks:
+                    try:
+                        callback(self)
+                    except Exception as e:
+                        logger.warning(f"MPR assembly failure callback failed: {e}")
+        finally:
+            self._done.set()
+
+
+def prepare(series):
+    """(volume, spacing, assembly) for a series' MPR volume.
+    The volume is published with one decoded slice and assembly fills it once started;
+    assembly is None when the volume had to be read in one pass and is already complete.
+    """
+    images = headers.for_series(series, 'image_position')
+    if len(images) < 2:
+        raise ValueError('Not enough images for MPR')
+    paths = [headers.stored_path(file_path) for _, file_path, _ in images]
+    records = {path: record for path, (record, _, _) in zip(paths, images) if record}
+
+    # First readable slice: orientation, geometry, pixel layout and the volume's rescale
+    for first in paths:
+        try:
+            ds, px = _open(first, records.get(first))
+            break
+        except Exception:
+            continue
+    else:
+        raise ValueError('Could not read enough images for MPR')
+    normal = _normal(ds)
+    st, first_ps = _geometry(ds)
+
+    positions = _recorded_positions([position for _, _, position in images], normal)
+    if positions is not None:
+        ordered = list(zip(positions, paths))
+    else:
+        ordered = _scanned_positions(paths, records, normal)
+    # Stable: equal positions keep instance order
+    ordered.sort(key=lambda item: item[0])
+    paths = [path for _, path in ordered]
+
+    dtype = _stored_dtype(ds, px)
+    if dtype is None or len(paths) < 2:
+        volume, spacing = display(read(paths, records), st, first_ps)
+        return volume, spacing, None
+
+    slope, intercept = _rescale(ds)
+    data = np.zeros((len(paths),) + px.shape, dtype=dtype)
+    loaded = np.zeros(len(paths), dtype=bool)
+    native = volumes.StoredVolume(data, slope, intercept, loaded=loaded)
+    volume, spacing = display(native, st, first_ps)
+    assembly = Assembly(paths, volume, st, first_ps, records)
+    volume.source = assembly
+    assembly.load([paths.index(first)])
+    if not loaded.any():
+        # The first slice does not fit the 16-bit volume it chose (e.g. wider than BitsStored)
+        volume, spacing = display(read(paths, records), st, first_ps)
+        return volume, spacing, None
+    return volume, spacing, assembly
+
+
+def build(series):
+    """(volume, spacing) of a series, assembled completely in the calling thread and not
+    published anywhere; for one-off readers such as exports
+    """
+    volume, spacing, assembly = prepare(series)
+    if assembly is not None:
+        assembly._run()
+        volume = assembly.wait(0)
+    return volume, spacing
+
+
+_pool = None
+_pool_pid = None
+_pool_lock = threading.Lock()
+
+
+def _get_pool():
+    global _pool, _pool_pid
+    with _pool_lock:
+        if _pool is None or _pool_pid != os.getpid():
+            workers = getattr(settings, 'MPR_ASSEMBLY_THREADS', None) or 2
+            _pool = ThreadPoolExecutor(max_workers=workers, thread_name_prefix='mpr-assembly')
+            _pool_pid = os.getpid()
+        return _pool
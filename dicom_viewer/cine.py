@@ -0,0 +1,358 @@
+"""
+Server-pushed cine playback.
+
+``api_cine_mode`` used to return the file URLs of a series with a fixed 10 fps,
+and the client fetched and decoded every frame itself. A ``CineStream`` plays a
+series (single-frame instances in instance order, or the frames of multi-frame
+ultrasound/XA loops) on the server and hands out encoded, pre-windowed frames.
+The WebSocket consumer (``consumers.CineConsumer``) paces them:
+
+* frames are decoded ahead of the playback position by a read-ahead thread,
+  ``READ_AHEAD_SECONDS`` of playback deep, and kept (raw, so a window change
+  needs no re-decode) so loops replay without decoding. The kept frames of all
+  streams in a process share ``CINE_CACHE_MB``: each stream may hold an equal
+  share, beyond the frames it is about to play;
+* each sent frame carries a sequence number the client acknowledges. When more
+  than ``MAX_IN_FLIGHT_SECONDS`` of frames are unacknowledged, or the frame is
+  not decoded in time, the tick is dropped: the position still advances, so
+  playback keeps real time on a slow link instead of falling behind;
+* drops step the quality down ``QUALITY_LEVELS`` (JPEG quality and scale), and a
+  link that keeps up for ``UPGRADE_AFTER_SECONDS`` steps it back up.
+
+Frame rate defaults to the series' RecommendedDisplayFrameRate, CineRate or
+FrameTime, else ``DEFAULT_FPS``. Monochrome frames are windowed with the
+requested window, else the instance's window, else the series' auto-window.
+"""
+import logging
+import struct
+import threading
+import time
+from collections import OrderedDict
+
+import numpy as np
+import pydicom
+from django.conf import settings
+
+from noctis_pro import metrics
+from . import headers, rendering
+
+logger = logging.getLogger(__name__)
+
+DEFAULT_FPS = 10.0
+MAX_FPS = 60.0
+READ_AHEAD_SECONDS = 1.0
+MAX_IN_FLIGHT_SECONDS = 0.5
+UPGRADE_AFTER_SECONDS = 3.0
+# (JPEG quality, scale) from best to cheapest
+QUALITY_LEVELS = ((90, 1.0), (80, 1.0), (70, 0.75), (55, 0.5))
+
+# Binary frame message: sequence, frame index, JPEG quality, then the JPEG bytes
+FRAME_HEADER = struct.Struct('<IIB')
+
+CINE_FRAMES = metrics.counter(
+    'noctis_cine_frames', 'Cine frames per outcome (sent, or dropped and why)', ('outcome',))
+
+
+class _Budget:
+    """Raw-frame cache budget (CINE_CACHE_MB) divided between the open streams of this process"""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._streams = 0
+
+    def join(self):
+        with self._lock:
+            self._streams += 1
+
+    def leave(self):
+        with self._lock:
+            self._streams = max(0, self._streams - 1)
+
+    def share(self):
+        total = int(float(getattr(settings, 'CINE_CACHE_MB', 256) or 256) * (1 << 20))
+        with self._lock:
+            return total // max(1, self._streams)
+
+
+_budget = _Budget()
+
+
+def frame_rate(ds):
+    """Display frame rate from RecommendedDisplayFrameRate, CineRate or FrameTime (ms)"""
+    for keyword in ('RecommendedDisplayFrameRate', 'CineRate'):
+        try:
+            value = float(getattr(ds, keyword, 0) or 0)
+        except (TypeError, ValueError):
+            value = 0
+        if value > 0:
+            return min(MAX_FPS, value)
+    try:
+        frame_time = float(getattr(ds, 'FrameTime', 0) or 0)
+    except (TypeError, ValueError):
+        frame_time = 0
+    return min(MAX_FPS, 1000.0 / frame_time) if frame_time > 0 else DEFAULT_FPS
+
+
+def _first(value):
+    return value[0] if hasattr(value, '__iter__') and not isinstance(value, str) else value
+
+
+class _Instance:
+    """Header facts of one stored instance needed to decode and window its frames"""
+
+    __slots__ = ('path', 'record', 'frames', 'slope', 'intercept', 'rgb', 'window', 'inverted')
+
+    def __init__(self, path, ds, record=None):
+        self.path = path
+        self.record = record
+        self.frames = max(1, int(getattr(ds, 'NumberOfFrames', 1) or 1))
+        self.slope = float(getattr(ds, 'RescaleSlope', 1.0) or 1.0)
+        self.intercept = float(getattr(ds, 'RescaleIntercept', 0.0) or 0.0)
+        self.rgb = int(getattr(ds, 'SamplesPerPixel', 1) or 1) == 3
+        try:
+            self.window = (float(_first(ds.WindowWidth)), float(_first(ds.WindowCenter)))
+        except (AttributeError, TypeError, ValueError, IndexError):
+            self.window = None
+        self.inverted = str(getattr(ds, 'PhotometricInterpretation', '')).upper() == 'MONOCHROME1'
+
+
+def series_frames(series):
+    """(instances, frames, fps): frames are (instance number, frame index) in playback order.
+    With header records for every instance no file is opened. Otherwise headers are read for
+    every instance only when the first one is multi-frame; in a single-frame stack the other
+    instances are given by path and read as they are decoded.
+    """
+    images = headers.for_series(series)
+    paths = [headers.stored_path(file_path) for _, file_path in images]
+    if not paths:
+        return [], [], DEFAULT_FPS
+    records = [record for record, _ in images]
+    if all(records):
+        instances = [_Instance(path, headers.Header(record), record) for path, record in zip(paths, records)]
+        frames = [(i, f) for i, instance in enumerate(instances) for f in range(instance.frames)]
+        return instances, frames, frame_rate(headers.Header(records[0]))
+    first = pydicom.dcmread(paths[0], stop_before_pixels=True)
+    fps = frame_rate(first)
+    head = _Instance(paths[0], first)
+    if head.frames == 1:
+        return [head] + paths[1:], [(i, 0) for i in range(len(paths))], fps
+    instances = [head]
+    for path in paths[1:]:
+        try:
+            instances.append(_Instance(path, pydicom.dcmread(path, stop_before_pixels=True)))
+        except Exception as e:
+            logger.warning(f"Cine: skipping unreadable {path}: {e}")
+    frames = [(i, f) for i, instance in enumerate(instances) for f in range(instance.frames)]
+    return instances, frames, fps
+
+
+class CineStream:
+    """Playback state, read-ahead decoder and adaptive quality for one viewer connection.
+    next_frame() is called once per tick of the frame clock and may block briefly on decoding;
+    the other methods are cheap and may be called from any thread.
+    """
+
+    def __init__(self, series, window=None, inverted=None):
+        from . import intensity
+
+        self.series_id = series.id
+        self._instances, self._frames, self.fps = series_frames(series)
+        if not self._frames:
+            raise ValueError('Series has no images')
+        head = self._instances[0]
+        if window is None and head.window is None and not head.rgb:
+            stats = intensity.get_series_stats(series)
+            window = tuple(stats['auto_window']) if stats else None
+        self.window = window
+        self.inverted = head.inverted if inverted is None else bool(inverted)
+        self.modality = series.modality
+
+        self.position = 0
+        self.playing = False
+        self.finished = False
+        self.loop = True
+        self._lock = threading.Condition()
+        self._cache = OrderedDict()   # frame index -> (pixels, instance)
+        self._cache_bytes = 0
+        self._closed = False
+        self._seq = 0
+        self._acked = 0
+        self._level = 0
+        self._level_changed = 0.0
+        self._last_drop = 0.0
+        _budget.join()
+        self._reader = threading.Thread(target=self._read_ahead, name=f'cine-{series.id}', daemon=True)
+        self._reader.start()
+
+    # --- control ------------------------------------------------------------
+
+    def info(self):
+        return {'series_id': self.series_id, 'frame_count': len(self._frames), 'frame_rate': self.fps,
+                'position': self.position, 'playing': self.playing, 'loop': self.loop,
+                'window': list(self.window) if self.window else None, 'inverted': self.inverted,
+                'quality': QUALITY_LEVELS[self._level][0], 'modality': self.modality}
+
+    def play(self, fps=None, start=None, loop=None):
+        with self._lock:
+            if fps:
+                self.fps = min(MAX_FPS, max(0.5, float(fps)))
+            if start is not None:
+                self.position = min(max(0, int(start)), len(self._frames) - 1)
+            if loop is not None:
+                self.loop = bool(loop)
+            self.playing = True
+            self.finished = False
+            self._lock.notify_all()
+
+    def pause(self):
+        with self._lock:
+            self.playing = False
+
+    def seek(self, frame):
+        with self._lock:
+            self.position = min(max(0, int(frame)), len(self._frames) - 1)
+            self._lock.notify_all()
+
+    def set_window(self, window_width=None, window_level=None, inverted=None):
+        with self._lock:
+            if window_width is not None and window_level is not None:
+                self.window = (float(window_width), float(window_level))
+            if inverted is not None:
+                self.inverted = bool(inverted)
+
+    def ack(self, seq, now=None):
+        """Client received frame seq; a link that keeps up earns the quality back"""
+        now = time.monotonic() if now is None else now
+        with self._lock:
+            self._acked = max(self._acked, min(int(seq), self._seq))
+            if (self._level > 0 and self._seq - self._acked <= 1
+                    and now - max(self._last_drop, self._level_changed) >= UPGRADE_AFTER_SECONDS):
+                self._level -= 1
+                self._level_changed = now
+
+    def close(self):
+        with self._lock:
+            if self._closed:
+                return
+            self._closed = True
+            self._cache.clear()
+            self._cache_bytes = 0
+            self._lock.notify_all()
+        _budget.leave()
+
+    # --- frames ---------------------------------------------------------------
+
+    def next_frame(self, now=None):
+        """Binary message for this tick (FRAME_HEADER + JPEG), or None if the tick is dropped.
+        The position advances either way; playback stops at the end unless looping.
+        """
+        now = time.monotonic() if now is None else now
+        with self._lock:
+            if not self.playing:
+                return None
+            index = self.position
+            if index + 1 < len(self._frames):
+                self.position = index + 1
+            elif self.loop:
+                self.position = 0
+            else:
+                self.playing = False
+                self.finished = True
+            self._lock.notify_all()
+            if self._seq - self._acked >= max(2, round(self.fps * MAX_IN_FLIGHT_SECONDS)):
+                return self._drop('congested', now)
+            if index not in self._cache:
+                # Give the read-ahead one frame interval to catch up
+                self._lock.wait_for(lambda: index in self._cache or self._closed, timeout=1.0 / self.fps)
+            cached = self._cache.get(index)
+            if cached is None:
+                return self._drop('not_decoded', now)
+            self._cache.move_to_end(index)
+            pixels, instance = cached
+            window, inverted = self.window, self.inverted
+            quality, scale = QUALITY_LEVELS[self._level]
+            self._seq += 1
+            seq = self._seq
+
+        if instance.rgb:
+            display = pixels
+        else:
+            ww, wl = window or instance.window or (None, None)
+            display = rendering.window_to_uint8(pixels, ww, wl, inverted, instance.slope, instance.intercept)
+        size = None
+        if scale < 1.0:
+            size = (max(1, int(display.shape[1] * scale)), max(1, int(display.shape[0] * scale)))
+        body = rendering.encode(display, 'jpeg', quality=quality, size=size)
+        CINE_FRAMES.inc(outcome='sent')
+        return FRAME_HEADER.pack(seq, index, quality) + body
+
+    def _drop(self, reason, now):
+        """Caller holds the lock"""
+        CINE_FRAMES.inc(outcome=reason)
+        self._last_drop = now
+        if self._level + 1 < len(QUALITY_LEVELS) and now - self._level_changed >= MAX_IN_FLIGHT_SECONDS:
+            self._level += 1
+            self._level_changed = now
+        return None
+
+    def _wanted(self):
+        """Frame indices within the read-ahead window from the position; caller holds the lock"""
+        count = len(self._frames)
+        depth = min(count, max(2, int(round(self.fps * READ_AHEAD_SECONDS))))
+        if self.loop:
+            return [(self.position + k) % count for k in range(depth)]
+        return list(range(self.position, min(count, self.position + depth)))
+
+    def _read_ahead(self):
+        while True:
+            with self._lock:
+                self._lock.wait_for(lambda: self._closed or any(i not in self._cache for i in self._wanted()))
+                if self._closed:
+                    return
+                wanted = self._wanted()
+                index = next(i for i in wanted if i not in self._cache)
+            try:
+                pixels, instance = self._decode(index)
+            except Exception as e:
+                logger.warning(f"Cine: could not decode frame {index} of series {self.series_id}: {e}")
+                pixels, instance = None, None
+            with self._lock:
+                if self._closed:
+                    return
+                if pixels is None:
+                    # Leave a black frame rather than retrying a broken file every tick
+                    pixels = np.zeros((1, 1), dtype=np.uint8)
+                    instance = instance or self._instances[0]
+                self._cache[index] = (pixels, instance)
+                self._cache_bytes += pixels.nbytes
+                keep = set(self._wanted())
+                limit = _budget.share()
+                for old in list(self._cache):
+                    if self._cache_bytes <= limit:
+                        break
+                    if old not in keep:
+                        self._cache_bytes -= self._cache.pop(old)[0].nbytes
+                self._lock.notify_all()
+
+    def _decode(self, index):
+        """(raw pixels, instance) of one frame"""
+        number, frame = self._frames[index]
+        instance = self._instances[number]
+        if not isinstance(instance, str) and headers.native(instance.record):
+            pixels = headers.read_pixels(instance.path, instance.record,
+                                         frame=frame if instance.frames > 1 else None)
+            return pixels, instance
+        if isinstance(instance, str) or instance.frames == 1:
+            path = instance if isinstance(instance, str) else instance.path
+            ds = pydicom.dcmread(path)
+            if isinstance(instance, str):
+                instance = self._instances[number] = _Instance(path, ds)
+            pixels = metrics.decode_pixels(ds)
+            if pixels.ndim == 3 and not instance.rgb:
+                pixels = pixels[0]
+            return pixels, instance
+        try:
+            from pydicom.pixels import pixel_array
+            return pixel_array(instance.path, index=frame), instance
+        except ImportError:
+            return metrics.decode_pixels(pydicom.dcmread(instance.path))[frame], instance
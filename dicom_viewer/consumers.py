@@ -0,0 +1,115 @@
+import asyncio
+import json
+import logging
+import time
+
+from asgiref.sync import sync_to_async
+from channels.db import database_sync_to_async
+from channels.generic.websocket import AsyncWebsocketConsumer
+
+from .cine import CineStream
+
+logger = logging.getLogger(__name__)
+
+
+class CineConsumer(AsyncWebsocketConsumer):
+    """Server-pushed cine loop for one series (see cine.py).
+
+    Client -> server (JSON text):
+        {"type": "play", "fps": optional, "start": optional frame, "loop": optional}
+        {"type": "pause"} | {"type": "seek", "frame": n}
+        {"type": "window", "window_width", "window_level", "inverted"}
+        {"type": "ack", "seq": n}   after each binary frame is displayed
+    Server -> client: {"type": "info", ...} on connect and after each control message,
+    {"type": "stopped"} at the end of a non-looping play, {"type": "paused"} when a pause
+    ends the frame clock, and one binary message per
+    frame: cine.FRAME_HEADER (seq, frame index, JPEG quality) followed by the JPEG.
+    """
+
+    stream = None
+    player = None
+
+    async def connect(self):
+        self.user = self.scope["user"]
+        if not self.user.is_authenticated:
+            await self.close()
+            return
+        series_id = int(self.scope['url_route']['kwargs']['series_id'])
+        try:
+            self.stream = await self.open_stream(series_id)
+        except Exception as e:
+            logger.warning(f"Cine stream for series {series_id} refused: {e}")
+            self.stream = None
+        if self.stream is None:
+            await self.close()
+            return
+        await self.accept()
+        await self.send_info()
+
+    async def disconnect(self, close_code):
+        if self.player is not None:
+            self.player.cancel()
+        if self.stream is not None:
+            self.stream.close()
+
+    async def receive(self, text_data=None, bytes_data=None):
+        try:
+            message = json.loads(text_data or '{}')
+        except json.JSONDecodeError:
+            return
+        if not isinstance(message, dict):
+            return
+        kind = message.get('type')
+        try:
+            if kind == 'ack':
+                self.stream.ack(message.get('seq', 0))
+                return
+            if kind == 'play':
+                self.stream.play(message.get('fps'), message.get('start'), message.get('loop'))
+                if self.player is None or self.player.done():
+                    self.player = asyncio.ensure_future(self.play())
+            elif kind == 'pause':
+                self.stream.pause()
+            elif kind == 'seek':
+                self.stream.seek(message.get('frame', 0))
+            elif kind == 'window':
+                self.stream.set_window(message.get('window_width'), message.get('window_level'),
+                                       message.get('inverted'))
+            else:
+                return
+        except (TypeError, ValueError) as e:
+            await self.send(text_data=json.dumps({'type': 'error', 'message': str(e)}))
+            return
+        await self.send_info()
+
+    async def send_info(self):
+        await self.send(text_data=json.dumps({'type': 'info', **self.stream.info()}))
+
+    async def play(self):
+        """Frame clock: one tick per 1/fps; a late tick is not made up, the next one follows"""
+        next_frame = sync_to_async(self.stream.next_frame, thread_sensitive=False)
+        due = time.monotonic()
+        while self.stream.playing:
+            payload = await next_frame()
+            if payload is not None:
+                await self.send(bytes_data=payload)
+            due += 1.0 / self.stream.fps
+            now = time.monotonic()
+            if due < now - 1.0:
+                # More than a second behind (stalled worker): restart the clock
+                due = now
+            await asyncio.sleep(max(0.0, due - now))
+        kind = 'stopped' if self.stream.finished else 'paused'
+        await self.send(text_data=json.dumps({'type': kind, 'position': self.stream.position}))
+
+    @database_sync_to_async
+    def open_stream(self, series_id):
+        from worklist.models import Series
+
+        series = Series.objects.select_related('study').filter(id=series_id).first()
+        if series is None:
+            return None
+        user = self.user
+        if user.is_facility_user() and getattr(user, 'facility', None) and series.study.facility != user.facility:
+            return None
+        return CineStream(series)
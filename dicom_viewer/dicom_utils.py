@@ -7,6 +7,8 @@ import logging
 from django.conf import settings
 from django.utils import timezone
 
+from .volumes import StoredVolume, stack
+
 logger = logging.getLogger(__name__)
 
 
@@ -330,37 +332,46 @@ class DicomProcessor:
         else:
             return 'soft'  # Default for non-CT
     
+    # Digital radiography modalities, windowed from a wider percentile range
+    XRAY_MODALITIES = ('CR', 'DX', 'DR')
+
+    def auto_window_percentiles(self, percentile_range=(1, 99), modality='CT'):
+        """Percentile range auto_window_from_data uses for this modality"""
+        if modality.upper() in self.XRAY_MODALITIES:
+            # X-ray images often have inverted intensity values
+            # Use wider percentile range for better contrast
+            return (0.5, 99.5)
+        return tuple(percentile_range)
+
     def auto_window_from_data(self, pixel_array, percentile_range=(1, 99), modality='CT'):
         """Automatically calculate optimal window/level from image data with X-ray optimization"""
         try:
             # Remove extreme outliers
-            p_low, p_high = np.percentile(pixel_array.flatten(), percentile_range)
-            
-            # Special handling for X-ray images (typically have different characteristics)
-            if modality.upper() in ['CR', 'DX', 'DR']:  # Digital radiography modalities
-                # X-ray images often have inverted intensity values
-                # Use wider percentile range for better contrast
-                percentile_range = (0.5, 99.5)
-                p_low, p_high = np.percentile(pixel_array.flatten(), percentile_range)
-                
-                # Calculate optimal window for X-ray
-                window_width = (p_high - p_low) * 1.5  # Wider window for X-rays
-                window_level = (p_high + p_low) / 2
-                
-                # Ensure minimum window width for X-rays
-                if window_width < 1000:
-                    window_width = 1500
-                    
-                return float(window_width), float(window_level)
-            
-            # Calculate window width and level for CT and other modalities
-            window_width = max(50, p_high - p_low)  # Minimum width of 50 HU
-            window_level = (p_high + p_low) / 2
-            
-            return float(window_width), float(window_level)
+            p_low, p_high = np.percentile(pixel_array.flatten(), self.auto_window_percentiles(percentile_range, modality))
+            return self.auto_window_from_percentiles(p_low, p_high, modality)
         except:
             return 400.0, 40.0  # Safe defaults
 
+    def auto_window_from_percentiles(self, p_low, p_high, modality='CT'):
+        """Window/level from the percentiles given by auto_window_percentiles (e.g. precomputed per series)"""
+        # Special handling for X-ray images (typically have different characteristics)
+        if modality.upper() in self.XRAY_MODALITIES:
+            # Calculate optimal window for X-ray
+            window_width = (p_high - p_low) * 1.5  # Wider window for X-rays
+            window_level = (p_high + p_low) / 2
+
+            # Ensure minimum window width for X-rays
+            if window_width < 1000:
+                window_width = 1500
+
+            return float(window_width), float(window_level)
+
+        # Calculate window width and level for CT and other modalities
+        window_width = max(50, p_high - p_low)  # Minimum width of 50 HU
+        window_level = (p_high + p_low) / 2
+
+        return float(window_width), float(window_level)
+
     def get_pixel_spacing(self, dicom_data):
         try:
             if hasattr(dicom_data, 'PixelSpacing'):
@@ -710,20 +721,17 @@ class VolumeRenderer:
         self.origin = None
 
     def load_volume_from_series(self, dicom_files):
+        """Load a volumes.StoredVolume (stored values, rescale as metadata) from the datasets"""
         if not dicom_files:
             raise ValueError("No DICOM files provided")
         first_dicom = dicom_files[0]['dicom_data']
-        rows = first_dicom.Rows
-        cols = first_dicom.Columns
-        volume_shape = (len(dicom_files), rows, cols)
-        self.volume_data = np.zeros(volume_shape, dtype=np.float32)
-        for i, dicom_file in enumerate(dicom_files):
+        slices = []
+        for dicom_file in dicom_files:
             ds = dicom_file['dicom_data']
-            pixel_array = ds.pixel_array.astype(np.float32)
             slope = getattr(ds, 'RescaleSlope', 1.0)
             intercept = getattr(ds, 'RescaleIntercept', 0.0)
-            pixel_array = pixel_array * slope + intercept
-            self.volume_data[i] = pixel_array
+            slices.append((ds.pixel_array, slope, intercept))
+        self.volume_data = stack(slices)
         processor = DicomProcessor()
         pixel_spacing = processor.get_pixel_spacing(first_dicom)
         slice_thickness = processor.get_slice_thickness(first_dicom)
@@ -734,13 +742,16 @@ class VolumeRenderer:
     def get_orthogonal_slices(self, volume_data, slice_indices):
         if volume_data is None:
             raise ValueError("No volume data loaded")
+        if not isinstance(volume_data, StoredVolume):
+            volume_data = StoredVolume(volume_data)
         depth, height, width = volume_data.shape
+        # Slices in modality units; only these planes are converted to float
         axial_idx = min(slice_indices.get('axial', depth // 2), depth - 1)
-        axial_slice = volume_data[axial_idx, :, :]
+        axial_slice = volume_data.rescale(volume_data.plane('axial', axial_idx))
         sagittal_idx = min(slice_indices.get('sagittal', width // 2), width - 1)
-        sagittal_slice = volume_data[:, :, sagittal_idx]
+        sagittal_slice = volume_data.rescale(volume_data.plane('sagittal', sagittal_idx))
         coronal_idx = min(slice_indices.get('coronal', height // 2), height - 1)
-        coronal_slice = volume_data[:, coronal_idx, :]
+        coronal_slice = volume_data.rescale(volume_data.plane('coronal', coronal_idx))
         return {
             'axial': axial_slice,
             'sagittal': sagittal_slice,
@@ -0,0 +1,557 @@
+"""
+Streaming exports of images, series and studies.
+
+Exports used to be staged on disk: reconstruction results were written file
+by file into a temporary directory (never removed), zipped next to it, and the
+zip was then read whole into the response. Here archives are written as they
+are produced:
+
+* ``stream_zip`` writes ZIP entries into a buffer that is handed out whenever
+  it holds more than ``CHUNK`` bytes. It feeds a ``StreamingHttpResponse``
+  directly, or a file in the job result store (``write_zip``), and no temporary
+  files are involved. Entries are generators that write a slice at a time, so
+  memory stays at about one chunk plus one slice whatever the export size;
+* entries are PNG/JPEG renders, NPY, NIfTI-1 or raw volumes (stored values,
+  with the rescale in the header or a JSON sidecar) or copies of the stored
+  DICOM files;
+* ``gzip_chunks`` compresses like pigz: the stream is cut into ``GZIP_BLOCK``
+  blocks, each deflated on its own on ``EXPORT_GZIP_THREADS`` threads (zlib
+  releases the GIL). Each block is primed with the 32 KiB before it and
+  sync-flushed, so the deflate streams concatenate into one ordinary gzip
+  member, about as small as a single-threaded gzip. Volumes (``.nii.gz``,
+  ``.raw.gz``) are compressed this way as their slices are read from the
+  cached (or memory-mapped) array;
+* the work behind entries (rendering a slice, assembling a series volume)
+  runs on ``EXPORT_THREADS`` worker threads, at most ``EXPORT_AHEAD`` entries
+  ahead of the writer, and is consumed in archive order. A study export thus
+  prepares its next series while the current one is being sent.
+
+Rendering and volumes come from the caller (the viewer's renderer, and the
+MPR volume cache when it already holds the series), so exports look like the
+viewer and reuse what is loaded.
+"""
+import io
+import json
+import logging
+import os
+import re
+import struct
+import sys
+import threading
+import time
+import uuid
+import zipfile
+import zlib
+from collections import deque
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+from django.conf import settings
+
+from . import headers
+
+logger = logging.getLogger(__name__)
+
+# Bytes buffered before they are handed to the response (or file)
+CHUNK = 1 << 20
+# Bytes of a stored file read at a time
+FILE_BLOCK = 1 << 20
+# Entries of this size or more are written with ZIP64 extensions
+ZIP64_SIZE = 1 << 31
+# Deflate level for arrays and DICOM files: most of the gain at a fraction of the CPU
+DEFLATE_LEVEL = 1
+# Uncompressed bytes per independently deflated gzip block, and the window each is primed with
+GZIP_BLOCK = 1 << 20
+GZIP_WINDOW = 1 << 15
+
+IMAGE_FORMATS = {'png': 'png', 'jpg': 'jpeg', 'jpeg': 'jpeg'}
+SERIES_FORMATS = ('png', 'jpeg', 'dicom', 'npy', 'nifti', 'nifti_gz', 'raw')
+VOLUME_FORMATS = ('npy', 'nifti', 'nifti_gz', 'raw')
+
+# NIfTI-1 datatype codes
+_NIFTI_TYPES = {
+    np.dtype(np.uint8): 2, np.dtype(np.int16): 4, np.dtype(np.int32): 8, np.dtype(np.float32): 16,
+    np.dtype(np.float64): 64, np.dtype(np.int8): 256, np.dtype(np.uint16): 512, np.dtype(np.uint32): 768,
+    np.dtype(np.int64): 1024, np.dtype(np.uint64): 1280,
+}
+_NIFTI_HEADER_SIZE = 348
+# Header, then the 4-byte extension flag (no extensions)
+_NIFTI_VOX_OFFSET = 352
+
+
+def _setting(name, default):
+    value = getattr(settings, name, None)
+    return default if value is None else value
+
+
+class _Sink:
+    """Non-seekable write target collecting bytes until taken"""
+
+    def __init__(self):
+        self._parts = []
+        self.size = 0
+
+    def write(self, data):
+        self._parts.append(bytes(data))
+        self.size += len(data)
+        return len(data)
+
+    def flush(self):
+        pass
+
+    def take(self):
+        data = b''.join(self._parts)
+        self._parts, self.size = [], 0
+        return data
+
+
+class Entry:
+    """One archive member: name, a writer generator factory, and how to store it.
+    write(f) writes the member into f and yields whenever it has written a piece.
+    """
+
+    __slots__ = ('name', 'write', 'compress', 'size')
+
+    def __init__(self, name, write, compress=True, size=0):
+        self.name = name
+        self.write = write
+        self.compress = compress
+        self.size = size
+
+
+def stream_zip(entries):
+    """Bytes chunks of a ZIP archive of entries (an iterable of Entry), produced as they are written"""
+    sink = _Sink()
+    with zipfile.ZipFile(sink, 'w', compression=zipfile.ZIP_DEFLATED, compresslevel=DEFLATE_LEVEL,
+                         allowZip64=True) as archive:
+        for entry in entries:
+            # Deflated by default; already compressed members are stored
+            target = entry.name
+            if not entry.compress:
+                target = zipfile.ZipInfo(entry.name, date_time=time.localtime()[:6])
+            try:
+                with archive.open(target, 'w', force_zip64=entry.size >= ZIP64_SIZE) as member:
+                    for _ in entry.write(member):
+                        if sink.size >= CHUNK:
+                            yield sink.take()
+            except Exception as e:
+                # The member stays in the archive, truncated; note why next to it
+                logger.warning(f"Export of {entry.name} failed: {e}")
+                archive.writestr(f'{entry.name}.error.txt', str(e))
+            if sink.size >= CHUNK:
+                yield sink.take()
+    yield sink.take()
+
+
+def write_zip(path, entries):
+    """Write a ZIP archive of entries to path, through a partial file replaced when complete"""
+    return write_chunks(path, stream_zip(entries))
+
+
+def write_chunks(path, chunks):
+    """Write bytes chunks to path, through a partial file replaced when complete"""
+    os.makedirs(os.path.dirname(path) or '.', exist_ok=True)
+    # Own partial file, so concurrent writers of one path never interleave
+    partial = f'{path}.{uuid.uuid4().hex[:8]}.part'
+    try:
+        with open(partial, 'wb') as f:
+            for chunk in chunks:
+                f.write(chunk)
+        os.replace(partial, path)
+    except BaseException:
+        try:
+            os.remove(partial)
+        except OSError:
+            pass
+        raise
+    return path
+
+
+# ----------------------------------------------------------------------
+# Entry writers
+# ----------------------------------------------------------------------
+
+def bytes_entry(name, data, compress=False):
+    def write(f):
+        f.write(data)
+        yield
+    return Entry(name, write, compress, len(data))
+
+
+def json_entry(name, value):
+    return bytes_entry(name, json.dumps(value, indent=2, default=str).encode(), compress=True)
+
+
+def file_entry(name, path):
+    """Copy of a stored file, read a block at a time"""
+    def write(f):
+        with open(path, 'rb') as source:
+            while True:
+                block = source.read(FILE_BLOCK)
+                if not block:
+                    break
+                f.write(block)
+                yield
+    try:
+        size = os.path.getsize(path)
+    except OSError:
+        size = 0
+    return Entry(name, write, True, size)
+
+
+def _slices(array):
+    """C-ordered bytes of array, one outer index at a time"""
+    if array.ndim < 3:
+        yield np.ascontiguousarray(array).tobytes()
+        return
+    for k in range(array.shape[0]):
+        yield np.ascontiguousarray(array[k]).tobytes()
+
+
+def npy_entry(name, array):
+    """array in NPY format, written a slice at a time"""
+    def write(f):
+        header = np.lib.format.header_data_from_array_1_0(array)
+        header['fortran_order'] = False   # slices are written in C order whatever the array's layout
+        np.lib.format.write_array_header_1_0(f, header)
+        for data in _slices(array):
+            f.write(data)
+            yield
+    return Entry(name, write, True, array.nbytes)
+
+
+def nifti_header(shape, dtype, zooms, affine=None, slope=1.0, intercept=0.0, description=''):
+    """348-byte NIfTI-1 header (single file, .nii) for a (depth, height, width) array of stored values.
+    zooms: (x, y, z) voxel size in mm; affine: 4x4 voxel (i, j, k) -> RAS mm, diagonal from zooms if None.
+    """
+    datatype = _NIFTI_TYPES.get(np.dtype(dtype))
+    if datatype is None:
+        raise ValueError(f'No NIfTI datatype for {dtype}')
+    depth, height, width = shape
+    if affine is None:
+        affine = np.diag([float(zooms[0]), float(zooms[1]), float(zooms[2]), 1.0])
+    header = bytearray(_NIFTI_HEADER_SIZE)
+    struct.pack_into('<i', header, 0, _NIFTI_HEADER_SIZE)
+    header[38:39] = b'r'
+    struct.pack_into('<8h', header, 40, 3, width, height, depth, 1, 1, 1, 1)
+    struct.pack_into('<hhh', header, 70, datatype, np.dtype(dtype).itemsize * 8, 0)
+    struct.pack_into('<8f', header, 76, 1.0, float(zooms[0]), float(zooms[1]), float(zooms[2]), 0, 0, 0, 0)
+    struct.pack_into('<3f', header, 108, float(_NIFTI_VOX_OFFSET), float(slope), float(intercept))
+    header[123:124] = bytes([2])   # xyzt_units: millimetres
+    header[148:228] = description.encode('ascii', 'replace')[:79].ljust(80, b'\0')
+    struct.pack_into('<hh', header, 252, 0, 1)   # qform unset, sform scanner-anatomical
+    struct.pack_into('<12f', header, 280, *[float(v) for v in np.asarray(affine)[:3].ravel()])
+    header[344:348] = b'n+1\0'
+    return bytes(header)
+
+
+def nifti_chunks(array, zooms, affine=None, slope=1.0, intercept=0.0, description=''):
+    """Bytes of array (depth, height, width) as a single-file NIfTI-1 image, a slice at a time"""
+    yield nifti_header(array.shape, array.dtype, zooms, affine, slope, intercept, description) + b'\0\0\0\0'
+    yield from _slices(array)
+
+
+def chunks_entry(name, chunks, size=0, compress=True):
+    """Member written from an iterable of bytes chunks (e.g. nifti_chunks, gzip_chunks)"""
+    def write(f):
+        for data in chunks:
+            f.write(data)
+            yield
+    return Entry(name, write, compress, size)
+
+
+def nifti_entry(name, array, zooms, affine=None, slope=1.0, intercept=0.0, description=''):
+    """array (depth, height, width) as a single-file NIfTI-1 image, written a slice at a time"""
+    return chunks_entry(name, nifti_chunks(array, zooms, affine, slope, intercept, description),
+                        _NIFTI_VOX_OFFSET + array.nbytes)
+
+
+# ----------------------------------------------------------------------
+# Parallel gzip
+# ----------------------------------------------------------------------
+
+def _blocks(chunks, size):
+    """Bytes chunks regrouped into blocks of size bytes (the last one shorter)"""
+    pending = bytearray()
+    for data in chunks:
+        pending += data
+        while len(pending) >= size:
+            yield bytes(pending[:size])
+            del pending[:size]
+    if pending:
+        yield bytes(pending)
+
+
+def _deflate(block, primer, level, last):
+    """Raw deflate of one block, primed with the data before it; byte-aligned unless last"""
+    compressor = zlib.compressobj(level, zlib.DEFLATED, -zlib.MAX_WBITS, 9, zlib.Z_DEFAULT_STRATEGY,
+                                  *((primer,) if primer else ()))
+    return compressor.compress(block) + compressor.flush(zlib.Z_FINISH if last else zlib.Z_SYNC_FLUSH)
+
+
+def gzip_chunks(chunks, level=None):
+    """gzip of an iterable of bytes chunks, with GZIP_BLOCK blocks deflated in parallel.
+    At most twice EXPORT_GZIP_THREADS blocks are held at a time.
+    """
+    level = int(_setting('EXPORT_GZIP_LEVEL', 6) if level is None else level)
+    pool = _get_gzip_pool()
+    window = 2 * pool._max_workers
+    # Header: no name, no mtime, unknown OS
+    yield b'\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff'
+    crc, size = 0, 0
+    pending = deque()
+    held, primer = None, b''
+    for block in _blocks(chunks, GZIP_BLOCK):
+        crc = zlib.crc32(block, crc)
+        size += len(block)
+        if held is not None:
+            # Only once the next block exists is it known that this one is not the last
+            pending.append(pool.submit(_deflate, held, primer, level, False))
+            primer = held[-GZIP_WINDOW:]
+            while len(pending) >= window:
+                yield pending.popleft().result()
+        held = block
+    pending.append(pool.submit(_deflate, held or b'', primer, level, True))
+    while pending:
+        yield pending.popleft().result()
+    yield struct.pack('<II', crc & 0xFFFFFFFF, size & 0xFFFFFFFF)
+
+
+def array_entries(name, value):
+    """Entries for one named reconstruction result: 2D arrays as PNG, other arrays as NPY,
+    anything else as JSON or text
+    """
+    from PIL import Image
+
+    stem, ext = os.path.splitext(name)
+    if isinstance(value, np.ndarray):
+        if value.ndim == 2:
+            buffer = io.BytesIO()
+            Image.fromarray(value.astype(np.uint8)).save(buffer, format='PNG')
+            return [bytes_entry(f'{stem}.png' if ext.lower() != '.png' else name, buffer.getvalue())]
+        return [npy_entry(f'{stem}.npy' if ext.lower() != '.npy' else name, value)]
+    if isinstance(value, (dict, list)):
+        return [json_entry(name if ext else f'{name}.json', value)]
+    return [bytes_entry(name if ext else f'{name}.txt', str(value).encode(), compress=True)]
+
+
+# ----------------------------------------------------------------------
+# Parallel preparation
+# ----------------------------------------------------------------------
+
+_pool = None
+_pool_pid = None
+_pool_lock = threading.Lock()
+
+
+def _get_pool():
+    global _pool, _pool_pid
+    with _pool_lock:
+        if _pool is None or _pool_pid != os.getpid():
+            _pool = ThreadPoolExecutor(max_workers=max(1, int(_setting('EXPORT_THREADS', 2))),
+                                       thread_name_prefix='export')
+            _pool_pid = os.getpid()
+        return _pool
+
+
+_gzip_pool = None
+_gzip_pool_pid = None
+
+
+def _get_gzip_pool():
+    """Compression threads, separate from the export pool whose jobs may be compressing"""
+    global _gzip_pool, _gzip_pool_pid
+    with _pool_lock:
+        if _gzip_pool is None or _gzip_pool_pid != os.getpid():
+            workers = int(_setting('EXPORT_GZIP_THREADS', 0)) or min(4, os.cpu_count() or 1)
+            _gzip_pool = ThreadPoolExecutor(max_workers=workers, thread_name_prefix='export-gzip')
+            _gzip_pool_pid = os.getpid()
+        return _gzip_pool
+
+
+def prepared(jobs, ahead=None, pool=None):
+    """Results of zero-argument callables in order, computed on pool (default the export pool)
+    at most ahead (EXPORT_AHEAD) jobs in advance of the consumer
+    """
+    from django.db import close_old_connections
+
+    def run(job):
+        close_old_connections()
+        return job()
+
+    ahead = max(1, int(ahead or _setting('EXPORT_AHEAD', 4)))
+    pool = pool or _get_pool()
+    pending = deque()
+    jobs = iter(jobs)
+    try:
+        for job in jobs:
+            pending.append(pool.submit(run, job))
+            if len(pending) >= ahead:
+                yield pending.popleft().result()
+        while pending:
+            yield pending.popleft().result()
+    finally:
+        for future in pending:
+            future.cancel()
+
+
+# ----------------------------------------------------------------------
+# Series and studies
+# ----------------------------------------------------------------------
+
+def series_format(name):
+    """Normalized series export format, None if unsupported"""
+    name = (name or 'png').lower()
+    name = {'jpg': 'jpeg', 'dcm': 'dicom', 'nii': 'nifti', 'nii.gz': 'nifti_gz'}.get(name, name)
+    return name if name in SERIES_FORMATS else None
+
+
+def safe_name(text, fallback='export'):
+    name = re.sub(r'[^A-Za-z0-9._-]+', '_', str(text or '')).strip('._')
+    return name[:64] or fallback
+
+
+def series_folder(series):
+    return safe_name(f'{series.series_number or 0:03d}_{series.series_description or series.modality or "series"}',
+                     f'series_{series.id}')
+
+
+def _sorted_positions(records):
+    """ImagePositionPatient of records sorted along the slice normal, as assembly orders slices"""
+    first = next((r for r in records if r and len(r.get('orientation') or ()) == 6), None)
+    if first is None:
+        return None, None
+    iop = np.array(first['orientation'], dtype=float)
+    normal = np.cross(iop[:3], iop[3:])
+    positions = [np.array(r['position'], dtype=float) for r in records
+                 if r and len(r.get('position') or ()) == 3]
+    if len(positions) != len(records):
+        return iop, None
+    positions.sort(key=lambda p: float(np.dot(p, normal)))
+    return iop, positions
+
+
+def volume_geometry(records, volume, spacing):
+    """((x, y, z) voxel size, 4x4 RAS affine or None) of a series' native volume.
+    The affine comes from the header records' orientation and first and last positions;
+    without them the voxel size is derived from the display spacing.
+    """
+    depth = volume.data.shape[0]
+    zooms = (float(spacing[2]), float(spacing[1]), float(spacing[0]) * volume.depth / max(1, depth))
+    iop, positions = _sorted_positions(records)
+    first = next((r for r in records if r), None) or {}
+    pixel_spacing = first.get('pixel_spacing') or [zooms[1], zooms[0]]
+    if iop is None or not positions:
+        return zooms, None
+    if depth > 1 and len(positions) == depth:
+        step = (positions[-1] - positions[0]) / (depth - 1)
+    else:
+        step = np.cross(iop[:3], iop[3:]) * zooms[2]
+    lps = np.eye(4)
+    lps[:3, 0] = iop[:3] * float(pixel_spacing[1])
+    lps[:3, 1] = iop[3:] * float(pixel_spacing[0])
+    lps[:3, 2] = step
+    lps[:3, 3] = positions[0]
+    # DICOM patient space is LPS, NIfTI's RAS
+    affine = np.diag([-1.0, -1.0, 1.0, 1.0]) @ lps
+    zooms = (float(pixel_spacing[1]), float(pixel_spacing[0]), float(np.linalg.norm(step)) or zooms[2])
+    return zooms, affine
+
+
+def series_jobs(series, fmt, render, volume_of, prefix=''):
+    """Jobs (zero-argument callables) each returning the entries of a part of a series export.
+    render(image, fmt) -> encoded bytes; volume_of(series) -> (StoredVolume, spacing).
+    """
+    if fmt in ('png', 'jpeg'):
+        ext = 'png' if fmt == 'png' else 'jpg'
+        images = list(series.images.order_by('instance_number'))
+        width = max(4, len(str(len(images))))
+
+        def image_job(number, image):
+            name = f'{prefix}{number:0{width}d}.{ext}'
+            return _guarded(name, lambda: [bytes_entry(name, render(image, fmt))])
+        return [image_job(number, image) for number, image in enumerate(images, 1)]
+
+    if fmt == 'dicom':
+        def files():
+            return [file_entry(f'{prefix}{safe_name(image.sop_instance_uid, str(image.id))}.dcm',
+                               headers.stored_path(image.file_path))
+                    for image in series.images.order_by('instance_number')]
+        return [_guarded(f'{prefix}dicom', files)]
+
+    def volume_job():
+        volume = SeriesVolume(series, volume_of)
+        data = volume.data
+        if fmt == 'npy':
+            entry = npy_entry(f'{prefix}volume.npy', data)
+        elif fmt == 'nifti':
+            entry = nifti_entry(f'{prefix}volume.nii', data, *volume.nifti_args)
+        elif fmt == 'nifti_gz':
+            entry = chunks_entry(f'{prefix}volume.nii.gz', volume.nifti_gz(), data.nbytes, compress=False)
+        else:
+            entry = chunks_entry(f'{prefix}volume.raw.gz', volume.raw_gz(), data.nbytes, compress=False)
+        return [entry, json_entry(f'{prefix}volume.json', volume.meta)]
+    return [_guarded(f'{prefix}volume', volume_job)]
+
+
+class SeriesVolume:
+    """A series' native stored-value volume (from volume_of, e.g. the MPR cache) with its geometry"""
+
+    def __init__(self, series, volume_of):
+        volume, spacing = volume_of(series)
+        records = [record for record, _ in headers.for_series(series)]
+        self.data = volume.data
+        self.zooms, self.affine = volume_geometry(records, volume, spacing)
+        self.nifti_args = (self.zooms, self.affine, volume.slope, volume.intercept,
+                           safe_name(series.series_description or series.modality, ''))
+        self.meta = {
+            'series_instance_uid': series.series_instance_uid,
+            'shape': list(self.data.shape),
+            'dtype': str(self.data.dtype),
+            'byte_order': {'<': 'little', '>': 'big'}.get(self.data.dtype.byteorder, sys.byteorder),
+            'rescale_slope': volume.slope,
+            'rescale_intercept': volume.intercept,
+            'voxel_size_xyz_mm': list(self.zooms),
+            'affine_ras': self.affine.tolist() if self.affine is not None else None,
+            'axes': ['slice', 'row', 'column'],
+        }
+
+    def nifti_gz(self):
+        """Chunks of the volume as .nii.gz"""
+        return gzip_chunks(nifti_chunks(self.data, *self.nifti_args))
+
+    def raw_gz(self):
+        """Chunks of the gzipped C-ordered stored values (described by meta)"""
+        return gzip_chunks(_slices(self.data))
+
+
+def _guarded(name, job):
+    """job, returning a note in place of its entries if it fails, so that the rest of the export goes on"""
+    def run():
+        try:
+            return job()
+        except Exception as e:
+            logger.warning(f"Export of {name} failed: {e}")
+            return [bytes_entry(f'{name}.error.txt', str(e).encode(), compress=True)]
+    return run
+
+
+def _entries(jobs, ahead=None):
+    for entries in prepared(jobs, ahead):
+        yield from entries
+
+
+def series_zip(series, fmt, render, volume_of):
+    """Chunks of a ZIP export of one series"""
+    return stream_zip(_entries(series_jobs(series, fmt, render, volume_of)))
+
+
+def study_zip(study, fmt, render, volume_of):
+    """Chunks of a ZIP export of a study, one folder per series; series are prepared in parallel.
+    Volume formats keep at most EXPORT_THREADS volumes ahead of the writer.
+    """
+    jobs = []
+    for series in study.series_set.order_by('series_number'):
+        jobs.extend(series_jobs(series, fmt, render, volume_of, prefix=f'{series_folder(series)}/'))
+    ahead = _setting('EXPORT_THREADS', 2) if fmt in VOLUME_FORMATS else None
+    return stream_zip(_entries(jobs, ahead))
@@ -0,0 +1,247 @@
+"""
+Compact per-instance header records.
+
+Metadata endpoints, the display view and the MPR builder each used to open
+and parse the DICOM file again for a handful of attributes. The display view
+also read the pixel data just to fill ``image_info``. ``extract`` parses a
+stored file once at ingest and records in ``DicomImage.header`` (JSON):
+
+* pixel layout: rows, columns, frames and frame timing, samples, bits
+  allocated/stored, pixel representation, photometric interpretation,
+  transfer syntax;
+* geometry: pixel spacing, slice thickness and spacing, position,
+  orientation, slice location;
+* display: rescale, window, VOI LUT function and whether a VOI or modality
+  LUT sequence is present, modality;
+* identification: patient, study and series names, dates and institution,
+  as the metadata endpoints return them;
+* the byte offset and length of the Pixel Data value in the file.
+
+Only attributes present in the file are recorded. ``Header`` reads a record
+through DICOM keywords (``Header(rec).PixelSpacing``), so code written for
+datasets can take either. ``read_pixels`` seeks straight to the pixel data of
+native little-endian files and returns what ``pixel_array`` would. It
+returns None for encapsulated and other layouts, which still go through
+pydicom. Instances ingested before this have no record; ``of`` and
+``for_series`` extract and store it on first use.
+"""
+import logging
+import os
+import time
+
+import numpy as np
+import pydicom
+from django.conf import settings
+
+from noctis_pro import metrics
+
+logger = logging.getLogger(__name__)
+
+VERSION = 1
+PIXEL_DATA = 0x7FE00010
+UNDEFINED_LENGTH = 0xFFFFFFFF
+# Transfer syntaxes whose pixel data is read directly: Implicit and Explicit VR Little Endian
+NATIVE_SYNTAXES = ('1.2.840.10008.1.2', '1.2.840.10008.1.2.1')
+
+# record key -> DICOM keyword; numeric multi-valued attributes are stored as lists of floats
+KEYWORDS = {
+    'rows': 'Rows',
+    'columns': 'Columns',
+    'frames': 'NumberOfFrames',
+    'frame_time': 'FrameTime',
+    'cine_rate': 'CineRate',
+    'display_frame_rate': 'RecommendedDisplayFrameRate',
+    'samples': 'SamplesPerPixel',
+    'planar': 'PlanarConfiguration',
+    'bits_allocated': 'BitsAllocated',
+    'bits_stored': 'BitsStored',
+    'pixel_representation': 'PixelRepresentation',
+    'photometric': 'PhotometricInterpretation',
+    'modality': 'Modality',
+    'pixel_spacing': 'PixelSpacing',
+    'imager_spacing': 'ImagerPixelSpacing',
+    'thickness': 'SliceThickness',
+    'slice_spacing': 'SpacingBetweenSlices',
+    'position': 'ImagePositionPatient',
+    'orientation': 'ImageOrientationPatient',
+    'slice_location': 'SliceLocation',
+    'slope': 'RescaleSlope',
+    'intercept': 'RescaleIntercept',
+    'window_width': 'WindowWidth',
+    'window_center': 'WindowCenter',
+    'voi_lut_function': 'VOILUTFunction',
+    'institution': 'InstitutionName',
+    # Identification returned by the metadata endpoints as the file has it
+    'patient_name': 'PatientName',
+    'patient_id': 'PatientID',
+    'birth_date': 'PatientBirthDate',
+    'sex': 'PatientSex',
+    'study_date': 'StudyDate',
+    'study_time': 'StudyTime',
+    'study_description': 'StudyDescription',
+    'series_description': 'SeriesDescription',
+}
+_INTS = ('rows', 'columns', 'frames', 'samples', 'planar', 'bits_allocated', 'bits_stored', 'pixel_representation')
+_FLOATS = ('frame_time', 'cine_rate', 'display_frame_rate', 'thickness', 'slice_spacing', 'slice_location',
+           'slope', 'intercept')
+_LISTS = ('pixel_spacing', 'imager_spacing', 'position', 'orientation', 'window_width', 'window_center')
+_BY_KEYWORD = {keyword: key for key, keyword in KEYWORDS.items()}
+
+
+def _value(key, raw):
+    if key in _INTS:
+        return int(raw)
+    if key in _LISTS:
+        return [float(v) for v in (raw if hasattr(raw, '__iter__') and not isinstance(raw, str) else [raw])]
+    if key in _FLOATS:
+        return float(raw)
+    return str(raw).strip()
+
+
+def extract(path):
+    """Header record of a stored file, or None if it cannot be parsed.
+    Large values are skipped rather than read, so the pixel data costs nothing.
+    """
+    try:
+        ds = pydicom.dcmread(path, defer_size=1024)
+    except Exception as e:
+        logger.warning(f"Header extraction failed for {path}: {e}")
+        return None
+    record = {'version': VERSION}
+    for key, keyword in KEYWORDS.items():
+        try:
+            raw = getattr(ds, keyword, None)
+            if raw is None or raw == '':
+                continue
+            record[key] = _value(key, raw)
+        except (TypeError, ValueError, IndexError):
+            continue
+    record['transfer_syntax'] = metrics.transfer_syntax_of(ds)
+    record['voi_lut'] = 'VOILUTSequence' in ds
+    record['modality_lut'] = 'ModalityLUTSequence' in ds
+    if PIXEL_DATA in ds:
+        raw = ds.get_item(PIXEL_DATA, keep_deferred=True)
+        if getattr(raw, 'value_tell', None) is not None:
+            record['pixel_offset'] = int(raw.value_tell)
+            record['pixel_length'] = int(raw.length)
+    return record
+
+
+class Header:
+    """Read-only view of a record by DICOM keyword; a missing attribute raises AttributeError,
+    as a dataset does, so getattr(header, keyword, default) works unchanged
+    """
+
+    __slots__ = ('record',)
+
+    def __init__(self, record):
+        self.record = record
+
+    def __getattr__(self, keyword):
+        key = _BY_KEYWORD.get(keyword)
+        if key is None or key not in self.record:
+            raise AttributeError(keyword)
+        return self.record[key]
+
+    def __contains__(self, keyword):
+        key = _BY_KEYWORD.get(keyword)
+        return key is not None and key in self.record
+
+
+def text(value):
+    """A record value as the DICOM string it came from (multiple values joined by backslashes)"""
+    if value is None:
+        return ''
+    if isinstance(value, list):
+        return '\\'.join(text(v) for v in value)
+    if isinstance(value, float):
+        value = repr(value)
+        return value[:-2] if value.endswith('.0') else value
+    return str(value)
+
+
+def native(record):
+    """Whether read_pixels can read this instance's pixel data directly"""
+    if not record or 'pixel_offset' not in record:
+        return False
+    if record.get('transfer_syntax') not in NATIVE_SYNTAXES or record.get('samples', 1) != 1:
+        return False
+    bits = record.get('bits_allocated')
+    if bits not in (8, 16, 32):
+        return False
+    needed = record.get('rows', 0) * record.get('columns', 0) * record.get('frames', 1) * bits // 8
+    return needed > 0 and record['pixel_length'] != UNDEFINED_LENGTH and record['pixel_length'] >= needed
+
+
+def voi_identity(record):
+    """Whether apply_voi_lut leaves this instance's pixels unchanged (no VOI LUT and no window)"""
+    return not record.get('voi_lut') and 'window_width' not in record and 'window_center' not in record
+
+
+def read_pixels(path, record, frame=None):
+    """Stored pixel values as pixel_array gives them: (rows, columns), or (frames, rows, columns)
+    for multi-frame instances unless frame is given. None when the layout is not native.
+    Bits above BitsStored are masked (unsigned) or sign-extended (signed), as pydicom does.
+    """
+    if not native(record):
+        return None
+    start = time.perf_counter()
+    rows, columns, frames = record['rows'], record['columns'], record.get('frames', 1)
+    bits = record['bits_allocated']
+    signed = bool(record.get('pixel_representation', 0))
+    dtype = np.dtype(f"<{'i' if signed else 'u'}{bits // 8}")
+    per_frame = rows * columns
+    offset = record['pixel_offset']
+    if frame is not None:
+        if not 0 <= frame < frames:
+            raise ValueError(f'Frame {frame} out of range')
+        offset += frame * per_frame * dtype.itemsize
+        count, shape = per_frame, (rows, columns)
+    else:
+        count = per_frame * frames
+        shape = (frames, rows, columns) if frames > 1 else (rows, columns)
+    pixels = np.fromfile(path, dtype=dtype, count=count, offset=offset)
+    if pixels.size != count:
+        raise ValueError(f'Pixel data of {path} is truncated')
+    pixels = pixels.reshape(shape)
+    stored = record.get('bits_stored', bits)
+    if stored < bits:
+        if signed:
+            shift = bits - stored
+            pixels <<= shift
+            pixels >>= shift
+        else:
+            pixels &= (1 << stored) - 1
+    metrics.DICOM_DECODE_SECONDS.observe(time.perf_counter() - start, transfer_syntax=record['transfer_syntax'])
+    return pixels
+
+
+def stored_path(name):
+    """Filesystem path of a file stored under MEDIA_ROOT"""
+    return os.path.join(settings.MEDIA_ROOT, str(name))
+
+
+def of(image):
+    """The image's record, extracted from its file and stored if it has none yet (None if unreadable)"""
+    if image.header:
+        return image.header
+    record = extract(stored_path(image.file_path))
+    if record is not None:
+        type(image).objects.filter(pk=image.pk).update(header=record)
+        image.header = record
+    return record
+
+
+def for_series(series, *fields):
+    """[(record, file_path, *fields)] for a series' images in instance order, backfilling missing records"""
+    from worklist.models import DicomImage
+
+    rows = series.images.order_by('instance_number').values_list('pk', 'header', 'file_path', *fields)
+    result = []
+    for pk, record, file_path, *values in rows:
+        if not record:
+            record = extract(stored_path(file_path))
+            if record is not None:
+                DicomImage.objects.filter(pk=pk).update(header=record)
+        result.append((record, file_path, *values))
+    return result
@@ -0,0 +1,459 @@
+"""
+Per-series intensity statistics, computed once instead of per request.
+
+Auto-window and the MPR default window used to run ``np.percentile`` over an
+image or the whole (resampled) volume on every call, a full sort of tens of
+millions of voxels before the first MPR frame. Instead each series keeps a
+``SeriesIntensityStats`` row holding its value distribution in modality units
+(stored value * RescaleSlope + RescaleIntercept):
+
+* the DICOM receiver and ``import_dicom`` fold each instance in as it arrives
+  (a ``bincount`` of the already-decoded pixels, no sort) and merge the
+  pending counts into the row every ``FLUSH_EVERY`` instances, when the
+  association closes, and at exit;
+* web uploads, which do not decode pixels, queue a background build from the
+  stored files once the upload commits;
+* series without a row (ingested before this existed) are built on first
+  use: from the loaded volume by MPR, in the background by auto-window.
+
+The distribution is a sorted list of distinct values with their counts. CT and
+most MR/CR data have a few thousand distinct values, so percentiles, min/max,
+mean and histograms are exact; data with more than ``MAX_VALUES`` distinct
+values is folded into ``COMPACT_BINS`` equal-width bins.
+"""
+import atexit
+import logging
+import os
+import queue
+import struct
+import threading
+import zlib
+from collections import OrderedDict
+
+import numpy as np
+from django.db import IntegrityError, close_old_connections, transaction
+
+from noctis_pro import metrics
+
+logger = logging.getLogger(__name__)
+
+# Pending instances per series before their counts are merged into the row
+FLUSH_EVERY = 64
+# Distinct values kept exactly; beyond that the distribution is re-binned
+MAX_VALUES = 65536
+COMPACT_BINS = 16384
+# Widest stored-value range counted with bincount (wider ranges use unique)
+BINCOUNT_SPAN = 1 << 20
+BINCOUNT_BLOCK = 1 << 22
+# Percentiles served to the auto-window and MPR endpoints
+PERCENTILES = (0.5, 1, 2, 5, 25, 50, 75, 95, 98, 99, 99.5)
+HISTOGRAM_BINS = 256
+# Summaries kept per process
+MAX_SUMMARIES = 256
+
+_HEADER = struct.Struct('<I')
+
+INTENSITY_UPDATES = metrics.counter(
+    'noctis_intensity_stats_updates', 'Series intensity statistics written, by source', ('source',))
+
+
+# --- distributions ----------------------------------------------------------
+
+def _rescale(ds):
+    try:
+        slope = float(getattr(ds, 'RescaleSlope', 1.0) or 1.0)
+        intercept = float(getattr(ds, 'RescaleIntercept', 0.0) or 0.0)
+    except (TypeError, ValueError):
+        slope, intercept = 1.0, 0.0
+    return slope, intercept
+
+
+def _integer_distribution(arr):
+    """(stored values, counts) of an integer array in one bincount pass"""
+    lo, hi = int(arr.min()), int(arr.max())
+    if hi - lo > BINCOUNT_SPAN:
+        return np.unique(arr, return_counts=True)
+    flat = arr.ravel()
+    counts = np.zeros(hi - lo + 1, dtype=np.int64)
+    # In blocks, so a whole volume is never widened to int64 at once
+    for start in range(0, flat.size, BINCOUNT_BLOCK):
+        shifted = flat[start:start + BINCOUNT_BLOCK].astype(np.int64) - lo
+        counts += np.bincount(shifted, minlength=hi - lo + 1)
+    present = np.flatnonzero(counts)
+    return present + lo, counts[present]
+
+
+def _rescaled(stored, counts, slope, intercept):
+    values = stored.astype(np.float64) * slope + intercept
+    if slope < 0:
+        values, counts = values[::-1], counts[::-1]
+    return _compact(values, counts.astype(np.int64))
+
+
+def instance_distribution(ds):
+    """Value distribution of one dataset in modality units, or None (no pixels, colour)"""
+    if 'PixelData' not in ds or int(getattr(ds, 'SamplesPerPixel', 1) or 1) != 1:
+        return None
+    arr = metrics.decode_pixels(ds)
+    if arr.size == 0:
+        return None
+    if np.issubdtype(arr.dtype, np.integer):
+        stored, counts = _integer_distribution(arr)
+    else:
+        finite = arr[np.isfinite(arr)]
+        if finite.size == 0:
+            return None
+        stored, counts = np.unique(finite, return_counts=True)
+    return _rescaled(stored, counts, *_rescale(ds))
+
+
+def volume_distribution(volume):
+    """Value distribution of a volumes.StoredVolume in modality units"""
+    if np.issubdtype(volume.dtype, np.integer):
+        stored, counts = _integer_distribution(volume.data)
+        return _rescaled(stored, counts, volume.slope, volume.intercept)
+    # Float fallback volumes already hold modality values
+    flat = volume.data.ravel()
+    if not np.isfinite(flat).all():
+        flat = flat[np.isfinite(flat)]
+    if flat.size == 0:
+        return None
+    rounded = np.rint(flat)
+    if np.array_equal(rounded, flat):
+        values, counts = _integer_distribution(rounded.astype(np.int64))
+        return _compact(values.astype(np.float64), counts.astype(np.int64))
+    # Non-integer values (per-slice rescales): fixed bins, still no sort
+    counts, edges = np.histogram(flat, bins=COMPACT_BINS)
+    return _nonzero((edges[:-1] + edges[1:]) / 2.0, counts.astype(np.int64))
+
+
+def _nonzero(values, counts):
+    keep = counts > 0
+    return values[keep], counts[keep]
+
+
+def _compact(values, counts):
+    if len(values) <= MAX_VALUES:
+        return values, counts
+    lo, hi = float(values[0]), float(values[-1])
+    edges = np.linspace(lo, hi, COMPACT_BINS + 1)
+    binned = np.histogram(values, bins=edges, weights=counts)[0].astype(np.int64)
+    # Keep the true extremes as the outer bin values
+    centres = (edges[:-1] + edges[1:]) / 2.0
+    centres[0], centres[-1] = lo, hi
+    return _nonzero(centres, binned)
+
+
+def merge(distributions):
+    """Merge distributions (sorted values with counts) into one"""
+    parts = [d for d in distributions if d is not None and len(d[0])]
+    if not parts:
+        return None
+    if len(parts) == 1:
+        return parts[0]
+    values, inverse = np.unique(np.concatenate([v for v, _ in parts]), return_inverse=True)
+    counts = np.bincount(inverse, weights=np.concatenate([c for _, c in parts])).astype(np.int64)
+    return _compact(values, counts)
+
+
+def encode(distribution):
+    values, counts = distribution
+    return zlib.compress(_HEADER.pack(len(values)) + values.astype('<f8').tobytes()
+                         + counts.astype('<i8').tobytes(), 6)
+
+
+def decode(blob):
+    raw = zlib.decompress(bytes(blob))
+    n = _HEADER.unpack_from(raw)[0]
+    offset = _HEADER.size
+    values = np.frombuffer(raw, dtype='<f8', count=n, offset=offset)
+    counts = np.frombuffer(raw, dtype='<i8', count=n, offset=offset + 8 * n)
+    return values, counts
+
+
+def percentiles(distribution, qs):
+    """np.percentile (linear interpolation) over the voxels a distribution describes"""
+    values, counts = distribution
+    cumulative = np.cumsum(counts)
+    total = int(cumulative[-1])
+    ranks = np.asarray(qs, dtype=np.float64) / 100.0 * (total - 1)
+    below = np.floor(ranks)
+    lower = values[np.searchsorted(cumulative, below, side='right')]
+    upper = values[np.minimum(np.searchsorted(cumulative, below + 1, side='right'), len(values) - 1)]
+    return lower + (upper - lower) * (ranks - below)
+
+
+def summarize(distribution, modality='', instance_count=0):
+    """Percentiles, moments, a coarse histogram and window suggestions for a series"""
+    from .dicom_utils import DicomProcessor
+
+    values, counts = distribution
+    total = int(counts.sum())
+    mean = float(np.dot(values, counts) / total)
+    variance = float(np.dot((values - mean) ** 2, counts) / total)
+    vmin, vmax = float(values[0]), float(values[-1])
+    pct = dict(zip(PERCENTILES, (float(p) for p in percentiles(distribution, PERCENTILES))))
+    hist = np.histogram(values, bins=HISTOGRAM_BINS, range=(vmin, vmax if vmax > vmin else vmin + 1),
+                        weights=counts)[0]
+
+    modality = (modality or '').upper()
+    processor = DicomProcessor()
+    # Same rules and percentile ranges as api_auto_window (2-98, or 0.5-99.5 for X-ray)
+    low_q, high_q = processor.auto_window_percentiles((2, 98), modality)
+    auto_ww, auto_wl = processor.auto_window_from_percentiles(pct[low_q], pct[high_q], modality)
+    suggested = None
+    if modality == 'CT':
+        suggested = processor.get_optimal_preset_for_hu_range(vmin, vmax, modality)
+        preset = processor.window_presets.get(suggested)
+        if preset:
+            auto_ww, auto_wl = preset['ww'], preset['wl']
+
+    return {
+        'modality': modality,
+        'instances': instance_count,
+        'voxels': total,
+        'min': vmin,
+        'max': vmax,
+        'mean': mean,
+        'std': variance ** 0.5,
+        'percentiles': pct,
+        'histogram': {'min': vmin, 'max': vmax, 'counts': hist.astype(np.int64).tolist()},
+        'auto_window': (float(auto_ww), float(auto_wl)),
+        'suggested_preset': suggested,
+        # p1-p99 window used by MPR when the request has no window
+        'mpr_window': (max(1.0, pct[99] - pct[1]), (pct[99] + pct[1]) / 2.0),
+    }
+
+
+# --- persistence ------------------------------------------------------------
+
+def store(series_id, distribution, modality='', instances=0, replace=False, source='ingest'):
+    """Merge a distribution into the series row (or replace it); False if the series is gone"""
+    from .models import SeriesIntensityStats
+
+    if distribution is None:
+        return False
+    for attempt in range(2):
+        try:
+            with transaction.atomic():
+                row = SeriesIntensityStats.objects.select_for_update().filter(series_id=series_id).first()
+                merged, total = distribution, instances
+                if row is None:
+                    row = SeriesIntensityStats(series_id=series_id)
+                elif not replace:
+                    merged = merge([decode(row.distribution), distribution])
+                    total += row.instance_count
+                values, counts = merged
+                row.modality = modality or row.modality
+                row.instance_count = total
+                row.voxel_count = int(counts.sum())
+                row.min_value = float(values[0])
+                row.max_value = float(values[-1])
+                row.distribution = encode(merged)
+                row.save()
+            INTENSITY_UPDATES.inc(source=source)
+            return True
+        except IntegrityError as e:
+            # Another process created the row first (retry merges into it), or the series was deleted
+            if attempt:
+                logger.warning(f"Intensity stats for series {series_id} not stored: {e}")
+    return False
+
+
+class SeriesStatsAccumulator:
+    """Pending per-instance distributions, merged into the database in batches"""
+
+    def __init__(self, flush_every=FLUSH_EVERY):
+        self.flush_every = flush_every
+        self._lock = threading.Lock()
+        self._atexit_registered = False
+        self._reset()
+
+    def _reset(self):
+        self._pid = os.getpid()
+        self._pending = {}   # series_id -> [modality, [distributions], instances]
+
+    def add(self, series_id, ds, modality=''):
+        try:
+            distribution = instance_distribution(ds)
+        except Exception as e:
+            logger.debug(f"No intensity distribution for an instance of series {series_id}: {e}")
+            return
+        if distribution is None:
+            return
+        with self._lock:
+            if self._pid != os.getpid():
+                # Forked receiver worker: the parent's pending counts are not ours
+                self._reset()
+            if not self._atexit_registered:
+                atexit.register(self.flush)
+                self._atexit_registered = True
+            entry = self._pending.setdefault(series_id, [modality, [], 0])
+            entry[1].append(distribution)
+            entry[2] += 1
+            if len(entry[1]) >= 8:
+                # Keep memory flat for long series between flushes
+                entry[1] = [merge(entry[1])]
+            due = entry[2] >= self.flush_every
+            if due:
+                self._pending.pop(series_id)
+        if due:
+            store(series_id, merge(entry[1]), entry[0], entry[2])
+
+    def flush(self):
+        """Write every pending series (association close, end of an import, exit)"""
+        with self._lock:
+            if self._pid != os.getpid():
+                self._reset()
+            pending, self._pending = self._pending, {}
+        for series_id, (modality, distributions, instances) in pending.items():
+            try:
+                store(series_id, merge(distributions), modality, instances)
+            except Exception as e:
+                logger.warning(f"Failed to store intensity stats for series {series_id}: {e}")
+
+    def pending(self):
+        return sum(entry[2] for entry in self._pending.values())
+
+
+_accumulator = SeriesStatsAccumulator()
+
+
+def get_accumulator():
+    return _accumulator
+
+
+def accumulate(series_id, ds, modality=''):
+    """Count an ingested instance once the current transaction commits"""
+    transaction.on_commit(lambda: _accumulator.add(series_id, ds, modality))
+
+
+def flush():
+    _accumulator.flush()
+
+
+# --- background builds --------------------------------------------------------
+
+def build_series_stats(series_id):
+    """Compute a series' distribution from its stored files and replace the row"""
+    import pydicom
+    from django.conf import settings
+    from worklist.models import Series
+
+    series = Series.objects.filter(pk=series_id).only('modality').first()
+    if series is None:
+        return None
+    distributions = []
+    instances = 0
+    for file_path in series.images.values_list('file_path', flat=True):
+        try:
+            ds = pydicom.dcmread(os.path.join(settings.MEDIA_ROOT, str(file_path)))
+            distribution = instance_distribution(ds)
+        except Exception as e:
+            logger.debug(f"Skipping {file_path} for intensity stats: {e}")
+            continue
+        if distribution is not None:
+            distributions.append(distribution)
+            instances += 1
+            if len(distributions) >= 8:
+                distributions = [merge(distributions)]
+    distribution = merge(distributions)
+    if distribution is None:
+        return None
+    store(series_id, distribution, series.modality, instances, replace=True, source='files')
+    return summarize(distribution, series.modality, instances)
+
+
+class _Builder:
+    """One background thread per process building stats for queued series"""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._pid = None
+        self._queue = None
+        self._queued = set()
+        self._thread = None
+
+    def enqueue(self, series_id):
+        with self._lock:
+            if self._pid != os.getpid():
+                self._pid = os.getpid()
+                self._queue = queue.Queue()
+                self._queued = set()
+                self._thread = None
+            if series_id in self._queued:
+                return
+            self._queued.add(series_id)
+            if self._thread is None or not self._thread.is_alive():
+                self._thread = threading.Thread(target=self._run, name='intensity-stats', daemon=True)
+                self._thread.start()
+        self._queue.put(series_id)
+
+    def _run(self):
+        while True:
+            series_id = self._queue.get()
+            close_old_connections()
+            try:
+                build_series_stats(series_id)
+            except Exception as e:
+                logger.warning(f"Intensity stats build failed for series {series_id}: {e}")
+            finally:
+                with self._lock:
+                    self._queued.discard(series_id)
+
+
+_builder = _Builder()
+
+
+def schedule_build(series_id):
+    """Build a series' stats in the background once the current transaction commits"""
+    transaction.on_commit(lambda: _builder.enqueue(series_id))
+
+
+# --- lookups ------------------------------------------------------------------
+
+_summaries = OrderedDict()   # series_id -> (instance_count, updated_at, summary)
+_summaries_lock = threading.Lock()
+
+
+def _remember(series_id, key, summary):
+    with _summaries_lock:
+        _summaries[series_id] = key + (summary,)
+        _summaries.move_to_end(series_id)
+        while len(_summaries) > MAX_SUMMARIES:
+            _summaries.popitem(last=False)
+
+
+def get_series_stats(series, build_missing=False):
+    """Stored summary for a series, or None if none was recorded (optionally queueing a build).
+    A series still arriving is summarised from the instances counted so far.
+    """
+    from .models import SeriesIntensityStats
+
+    key = (SeriesIntensityStats.objects.filter(series_id=series.id)
+           .values_list('instance_count', 'updated_at').first())
+    if key is None:
+        metrics.cache_miss('intensity_stats')
+        if build_missing:
+            schedule_build(series.id)
+        return None
+    metrics.cache_hit('intensity_stats')
+    with _summaries_lock:
+        cached = _summaries.get(series.id)
+    if cached is not None and cached[:2] == key:
+        return cached[2]
+    stats = SeriesIntensityStats.objects.get(series_id=series.id)
+    summary = summarize(decode(stats.distribution), stats.modality or series.modality, stats.instance_count)
+    _remember(series.id, (stats.instance_count, stats.updated_at), summary)
+    return summary
+
+
+def stats_from_volume(series, volume, image_count=None):
+    """Summary computed from an already-loaded MPR volume, persisted for later requests"""
+    distribution = volume_distribution(volume)
+    if distribution is None:
+        return None
+    if image_count is None:
+        image_count = series.images.count()
+    store(series.id, distribution, series.modality, image_count, replace=True, source='volume')
+    return summarize(distribution, series.modality, image_count)
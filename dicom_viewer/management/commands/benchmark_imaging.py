@@ -0,0 +1,306 @@
+"""
+Imaging Performance Benchmark Management Command
+Generates synthetic CT/MR/CR/multi-frame series and times the imaging hot paths:
+upload ingest, volume build, slice render, windowing, MIP, bone mesh and HU probe.
+Per-slice window+encode latency is also timed on 512x512 and 2048x2048 int16 and
+float32 slices for each output format (PNG, lossless WebP, JPEG).
+
+Everything runs inside a rolled-back transaction against a temporary MEDIA_ROOT,
+so the database and media store are left untouched. Results are written as JSON
+and can be compared with a stored baseline to catch regressions before deploy:
+
+    python manage.py benchmark_imaging --output bench.json --save-baseline baseline.json
+    python manage.py benchmark_imaging --baseline baseline.json --fail-on-regression
+"""
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import tempfile
+import time
+
+import numpy as np
+from django.conf import settings
+from django.core.files.uploadedfile import SimpleUploadedFile
+from django.core.management.base import BaseCommand, CommandError
+from django.db import transaction
+from django.test import RequestFactory
+from django.test.utils import override_settings
+
+from accounts.models import Facility, User
+from worklist.models import DicomImage, Series
+from dicom_viewer import synthetic
+
+KINDS = ('CT', 'MR', 'CR', 'MF')
+
+
+class _Rollback(Exception):
+    pass
+
+
+class Command(BaseCommand):
+    help = 'Benchmark imaging hot paths on synthetic DICOM series'
+
+    def add_arguments(self, parser):
+        parser.add_argument('--kinds', type=str, default=','.join(KINDS),
+                          help='Comma separated series kinds (CT, MR, CR, DX, MF)')
+        parser.add_argument('--slices', type=int, default=None,
+                          help='Slices per series (default depends on kind)')
+        parser.add_argument('--rows', type=int, default=None, help='Image rows')
+        parser.add_argument('--cols', type=int, default=None, help='Image columns')
+        parser.add_argument('--repeat', type=int, default=5,
+                          help='Timed runs per benchmark')
+        parser.add_argument('--warmup', type=int, default=1,
+                          help='Untimed warm-up runs per benchmark')
+        parser.add_argument('--render-sizes', type=str, default='512,2048',
+                          help='Comma separated square slice sizes for the render benchmarks (empty to skip)')
+        parser.add_argument('--only', type=str, default='',
+                          help='Comma separated benchmark names to run (e.g. volume_build,mip)')
+        parser.add_argument('--output', type=str, default=None,
+                          help='Write results JSON to this path')
+        parser.add_argument('--baseline', type=str, default=None,
+                          help='Compare against a previous results JSON')
+        parser.add_argument('--save-baseline', type=str, default=None,
+                          help='Also write results to this baseline path')
+        parser.add_argument('--tolerance', type=float, default=0.20,
+                          help='Allowed p50 slowdown vs baseline before flagging (0.20 = 20%%)')
+        parser.add_argument('--fail-on-regression', action='store_true',
+                          help='Exit with an error when a regression is detected')
+
+    def handle(self, *args, **options):
+        kinds = [k.strip().upper() for k in options['kinds'].split(',') if k.strip()]
+        for kind in kinds:
+            if kind not in synthetic.SOP_CLASSES:
+                raise CommandError(f'Unknown kind "{kind}"')
+        self.only = {n.strip() for n in options['only'].split(',') if n.strip()}
+        self.repeat = max(1, options['repeat'])
+        self.warmup = max(0, options['warmup'])
+
+        workdir = tempfile.mkdtemp(prefix='noctis-bench-')
+        results = {}
+        try:
+            with override_settings(MEDIA_ROOT=os.path.join(workdir, 'media')):
+                try:
+                    with transaction.atomic():
+                        self.setup_user()
+                        for kind in kinds:
+                            self.stdout.write(self.style.SUCCESS(f'Benchmarking {kind}...'))
+                            results.update(self.run_kind(kind, workdir, options))
+                        sizes = [int(n) for n in options['render_sizes'].split(',') if n.strip()]
+                        if sizes:
+                            self.stdout.write(self.style.SUCCESS('Benchmarking slice rendering...'))
+                            results.update(self.run_render(sizes))
+                        raise _Rollback()
+                except _Rollback:
+                    pass
+        finally:
+            shutil.rmtree(workdir, ignore_errors=True)
+
+        report = {'meta': self.meta(kinds, options), 'results': results}
+        for path in (options['output'], options['save_baseline']):
+            if path:
+                with open(path, 'w') as fh:
+                    json.dump(report, fh, indent=2, sort_keys=True)
+                self.stdout.write(self.style.SUCCESS(f'Results written to {path}'))
+
+        regressions = self.compare(results, options)
+        if regressions and options['fail_on_regression']:
+            raise CommandError(f'{len(regressions)} benchmark(s) regressed: {", ".join(regressions)}')
+
+    # ------------------------------------------------------------------
+    # Setup
+    # ------------------------------------------------------------------
+
+    def setup_user(self):
+        self.facility = Facility.objects.create(
+            name='Benchmark Facility', address='', phone='', email='bench@example.invalid',
+            license_number=f'BENCH-IMG-{time.time_ns()}', ae_title='BENCH_IMG')
+        self.user = User.objects.create(username=f'bench_{time.time_ns()}', role='admin', is_active=True)
+        self.factory = RequestFactory()
+
+    def request(self, method, path, data=None):
+        req = getattr(self.factory, method)(path, data or {})
+        req.user = self.user
+        return req
+
+    def meta(self, kinds, options):
+        try:
+            rev = subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD'],
+                                          cwd=settings.BASE_DIR, stderr=subprocess.DEVNULL).decode().strip()
+        except Exception:
+            rev = ''
+        return {
+            'git_revision': rev,
+            'timestamp': time.strftime('%Y-%m-%dT%H:%M:%S'),
+            'python': platform.python_version(),
+            'numpy': np.__version__,
+            'machine': platform.machine(),
+            'cpu_count': os.cpu_count(),
+            'kinds': kinds,
+            'slices': options['slices'],
+            'rows': options['rows'],
+            'cols': options['cols'],
+            'repeat': self.repeat,
+        }
+
+    # ------------------------------------------------------------------
+    # Benchmarks
+    # ------------------------------------------------------------------
+
+    def timeit(self, results, name, fn, repeat=None):
+        if self.only and name.split('.', 1)[1] not in self.only:
+            return None
+        for _ in range(self.warmup):
+            fn()
+        timings = []
+        for _ in range(repeat or self.repeat):
+            t0 = time.perf_counter()
+            fn()
+            timings.append((time.perf_counter() - t0) * 1000.0)
+        timings.sort()
+        stats = {
+            'runs': len(timings),
+            'min_ms': round(timings[0], 3),
+            'p50_ms': round(statistics.median(timings), 3),
+            'p95_ms': round(timings[min(len(timings) - 1, int(round(len(timings) * 0.95)) - 1)], 3),
+            'mean_ms': round(statistics.fmean(timings), 3),
+        }
+        results[name] = stats
+        self.stdout.write(f'   {name}: p50={stats["p50_ms"]:.2f}ms p95={stats["p95_ms"]:.2f}ms')
+        return stats
+
+    def run_kind(self, kind, workdir, options):
+        from dicom_viewer import views
+        from dicom_viewer.dicom_utils import DicomProcessor
+        from worklist.views import upload_study
+
+        results = {}
+        geometry = dict(slices=options['slices'], rows=options['rows'], cols=options['cols'])
+
+        # Upload ingest: a fresh series (new UIDs) per run, generated outside the timer
+        batches = []
+        for i in range(self.warmup + self.repeat):
+            out = os.path.join(workdir, 'src', kind, str(i))
+            paths = synthetic.write_series(out, kind, series_number=i + 1, seed=i, **geometry)
+            batches.append([(os.path.basename(p), open(p, 'rb').read()) for p in paths])
+        pending = list(batches)
+
+        def ingest():
+            files = [SimpleUploadedFile(name, data, content_type='application/dicom') for name, data in pending.pop(0)]
+            response = upload_study(self.request('post', '/worklist/upload/', {'dicom_files': files}))
+            if response.status_code != 200 or not json.loads(response.content).get('success'):
+                raise CommandError(f'upload_study failed: {response.content[:200]!r}')
+
+        stats = self.timeit(results, f'{kind}.upload_ingest', ingest)
+        if stats is None:
+            # Ingest skipped by --only; still need one series on disk and in the DB
+            pending = pending[:1]
+            ingest()
+        if stats:
+            files = len(batches[0])
+            stats['files_per_run'] = files
+            stats['files_per_second'] = round(files / max(stats['p50_ms'] / 1000.0, 1e-9), 1)
+
+        series = Series.objects.filter(study__facility__isnull=False, modality=('CT' if kind == 'MF' else kind)).order_by('-id').first()
+        image = DicomImage.objects.filter(series=series).order_by('instance_number').first()
+        if series is None or image is None:
+            raise CommandError(f'No ingested {kind} series found')
+
+        # 2D paths on the first stored image
+        import pydicom
+        ds = pydicom.dcmread(os.path.join(settings.MEDIA_ROOT, str(image.file_path)))
+        pixels = ds.pixel_array.astype(np.float32) * float(getattr(ds, 'RescaleSlope', 1) or 1) \
+            + float(getattr(ds, 'RescaleIntercept', 0) or 0)
+        if pixels.ndim == 3:
+            pixels = pixels[pixels.shape[0] // 2]
+        ww, wl = float(ds.WindowWidth), float(ds.WindowCenter)
+        processor = DicomProcessor()
+
+        self.timeit(results, f'{kind}.decode', lambda: pydicom.dcmread(
+            os.path.join(settings.MEDIA_ROOT, str(image.file_path))).pixel_array)
+        self.timeit(results, f'{kind}.apply_windowing', lambda: processor.apply_windowing(pixels, ww, wl))
+        self.timeit(results, f'{kind}.slice_render', lambda: views._array_to_base64_image(pixels, ww, wl))
+        self.timeit(results, f'{kind}.image_display', lambda: views.api_dicom_image_display(
+            self.request('get', f'/dicom-viewer/api/image/{image.id}/display/'), image.id))
+        y, x = pixels.shape[0] // 2, pixels.shape[1] // 2
+        self.timeit(results, f'{kind}.hu_probe', lambda: views.api_hu_value(
+            self.request('get', '/dicom-viewer/api/hu/', {'mode': 'series', 'image_id': image.id, 'x': x, 'y': y})))
+
+        # 3D paths need a multi-instance series
+        if series.images.count() < 2:
+            return results
+
+        def build():
+            with views._MPR_CACHE_LOCK:
+                views._MPR_CACHE.pop(series.id, None)
+            views._get_mpr_volume_and_spacing(series, force_rebuild=True)
+
+        stats = self.timeit(results, f'{kind}.volume_build', build)
+        # Leave a warm volume in the cache for the view benchmarks
+        volume, _spacing = views._get_mpr_volume_and_spacing(series)
+        if stats:
+            stats['bytes'] = int(volume.nbytes)
+        self.timeit(results, f'{kind}.mpr_view', lambda: views.api_mpr_reconstruction(
+            self.request('get', f'/dicom-viewer/api/series/{series.id}/mpr/'), series.id))
+        self.timeit(results, f'{kind}.mip', lambda: views.api_mip_reconstruction(
+            self.request('get', f'/dicom-viewer/api/series/{series.id}/mip/'), series.id))
+        self.timeit(results, f'{kind}.bone_mesh', lambda: views.api_bone_reconstruction(
+            self.request('get', f'/dicom-viewer/api/series/{series.id}/bone/', {'mesh': 'true'}), series.id))
+        with views._MPR_CACHE_LOCK:
+            views._MPR_CACHE.pop(series.id, None)
+        return results
+
+    def run_render(self, sizes):
+        """Window/level + encode of one slice, per size, input dtype and format"""
+        from dicom_viewer import rendering, views
+
+        results = {}
+        for size in sizes:
+            yy, xx = np.mgrid[:size, :size]
+            noise = np.random.default_rng(size).normal(0, 40, (size, size))
+            stored = (np.sin(xx / 37.0) * 600 + np.cos(yy / 23.0) * 500 + noise).astype(np.int16)
+            for dtype, pixels in (('int16', stored), ('float32', stored.astype(np.float32))):
+                for fmt in rendering.FORMATS:
+                    stats = self.timeit(results, f'render.{size}_{dtype}_{fmt}',
+                                        lambda: views._array_to_base64_image(pixels, 400.0, 40.0, False, fmt))
+                    if stats:
+                        stats['bytes'] = len(views._array_to_base64_image(pixels, 400.0, 40.0, False, fmt))
+            # Three planes of one request on the render pool
+            self.timeit(results, f'render.{size}_float32_png_x3', lambda: rendering.parallel(
+                *[lambda: views._array_to_base64_image(pixels, 400.0, 40.0, False, 'png')] * 3))
+        return results
+
+    # ------------------------------------------------------------------
+    # Baseline comparison
+    # ------------------------------------------------------------------
+
+    def compare(self, results, options):
+        if not options['baseline']:
+            return []
+        try:
+            with open(options['baseline']) as fh:
+                baseline = json.load(fh).get('results', {})
+        except (OSError, ValueError) as e:
+            raise CommandError(f'Cannot read baseline {options["baseline"]}: {e}')
+
+        tolerance = options['tolerance']
+        regressions = []
+        self.stdout.write(self.style.SUCCESS(f'\nComparison with {options["baseline"]} (tolerance {tolerance:.0%}):'))
+        for name in sorted(results):
+            current = results[name]['p50_ms']
+            previous = baseline.get(name, {}).get('p50_ms')
+            if not previous:
+                self.stdout.write(f'   {name}: {current:.2f}ms (no baseline)')
+                continue
+            delta = (current - previous) / previous
+            line = f'   {name}: {current:.2f}ms vs {previous:.2f}ms ({delta:+.1%})'
+            if delta > tolerance:
+                regressions.append(name)
+                self.stdout.write(self.style.ERROR(line + '  REGRESSION'))
+            elif delta < -tolerance:
+                self.stdout.write(self.style.SUCCESS(line + '  faster'))
+            else:
+                self.stdout.write(line)
+        return regressions
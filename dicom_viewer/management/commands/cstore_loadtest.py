@@ -0,0 +1,440 @@
+"""
+C-STORE Load Test Management Command
+Opens several concurrent SCU associations against a running DICOM receiver and
+replays synthetic (or real) series, reporting per-association throughput,
+C-STORE response latency percentiles and end-to-end time until each instance
+is visible in the database.
+
+    python manage.py cstore_loadtest --ensure-facility --associations 3 --slices 200
+    python manage.py cstore_loadtest --source /data/ct_exam --transfer-syntax rle --json load.json
+    python manage.py cstore_loadtest --cleanup
+
+Every association sends its own copy of the series with fresh UIDs and a
+LOADTEST patient ID, so runs never collide and --cleanup can remove them.
+"""
+import json
+import os
+import statistics
+import threading
+import time
+from pathlib import Path
+
+from django.conf import settings
+from django.core.management.base import BaseCommand, CommandError
+from django.db import transaction
+from pydicom import dcmread
+from pydicom.errors import InvalidDicomError
+from pydicom.uid import (
+    DeflatedExplicitVRLittleEndian, ExplicitVRLittleEndian, ImplicitVRLittleEndian,
+    RLELossless, generate_uid,
+)
+
+from accounts.models import Facility
+from worklist.models import DicomImage, Patient, Study
+from dicom_viewer import synthetic
+
+LOADTEST_PATIENT_PREFIX = 'LOADTEST'
+
+TRANSFER_SYNTAXES = {
+    'implicit': ImplicitVRLittleEndian,
+    'explicit': ExplicitVRLittleEndian,
+    'deflated': DeflatedExplicitVRLittleEndian,
+    'rle': RLELossless,
+}
+
+# Bound on sop_instance_uid IN (...) parameters per visibility poll
+POLL_CHUNK = 900
+
+
+def _percentile(sorted_values, pct):
+    if not sorted_values:
+        return None
+    idx = min(len(sorted_values) - 1, max(0, int(round(len(sorted_values) * pct / 100.0)) - 1))
+    return sorted_values[idx]
+
+
+def _latency_summary(values_ms):
+    values = sorted(values_ms)
+    if not values:
+        return {'count': 0}
+    return {
+        'count': len(values),
+        'p50_ms': round(statistics.median(values), 2),
+        'p95_ms': round(_percentile(values, 95), 2),
+        'p99_ms': round(_percentile(values, 99), 2),
+        'max_ms': round(values[-1], 2),
+    }
+
+
+class Command(BaseCommand):
+    help = 'Load test a DICOM receiver with concurrent C-STORE associations'
+
+    def add_arguments(self, parser):
+        parser.add_argument('--host', type=str, default='127.0.0.1',
+                          help='Receiver host')
+        parser.add_argument('--port', type=int, default=11112,
+                          help='Receiver port')
+        parser.add_argument('--called-aet', type=str, default='NOCTIS_SCP',
+                          help='Called AE title (receiver)')
+        parser.add_argument('--calling-aet', type=str, default='LOADTEST_SCU',
+                          help='Calling AE title; must belong to an active facility')
+        parser.add_argument('--associations', type=int, default=3,
+                          help='Concurrent associations (simulated modalities)')
+        parser.add_argument('--series-per-association', type=int, default=1,
+                          help='Series sent sequentially on each association')
+        parser.add_argument('--source', type=str, default=None,
+                          help='Replay DICOM files from this directory instead of synthetic data')
+        parser.add_argument('--kind', type=str, default='CT',
+                          help='Synthetic series kind (CT, MR, CR, DX, MF)')
+        parser.add_argument('--slices', type=int, default=None,
+                          help='Synthetic slices per series')
+        parser.add_argument('--rows', type=int, default=None,
+                          help='Synthetic rows (instance size)')
+        parser.add_argument('--cols', type=int, default=None,
+                          help='Synthetic columns (instance size)')
+        parser.add_argument('--transfer-syntax', type=str, default='explicit',
+                          choices=sorted(TRANSFER_SYNTAXES),
+                          help='Transfer syntax to send with')
+        parser.add_argument('--max-pdu', type=int, default=0,
+                          help='Maximum PDU size advertised by the SCU (0 = unlimited)')
+        parser.add_argument('--timeout', type=float, default=60.0,
+                          help='Network/ACSE/DIMSE timeout in seconds')
+        parser.add_argument('--visibility-timeout', type=float, default=60.0,
+                          help='Seconds to wait for all instances to appear in the database')
+        parser.add_argument('--poll-interval', type=float, default=0.05,
+                          help='Database visibility poll interval in seconds')
+        parser.add_argument('--no-visibility', action='store_true',
+                          help='Do not poll the database (receiver uses another database)')
+        parser.add_argument('--ensure-facility', action='store_true',
+                          help='Create a facility for the calling AE title if missing')
+        parser.add_argument('--json', type=str, default=None,
+                          help='Write results to this JSON file')
+        parser.add_argument('--cleanup', action='store_true',
+                          help='Delete studies and files created by previous load tests and exit')
+
+    def handle(self, *args, **options):
+        if options['cleanup']:
+            self.cleanup()
+            return
+
+        try:
+            from pynetdicom import AE  # noqa: F401
+        except ImportError:
+            raise CommandError('pynetdicom is required for the C-STORE load test')
+
+        if options['ensure_facility']:
+            self.ensure_facility(options['calling_aet'])
+        elif not options['no_visibility'] and not Facility.objects.filter(
+                ae_title__iexact=options['calling_aet'], is_active=True).exists():
+            self.stdout.write(self.style.WARNING(
+                f'No active facility with AE title {options["calling_aet"]}; the receiver will refuse '
+                f'C-STOREs (use --ensure-facility)'))
+
+        n_assoc = max(1, options['associations'])
+        transfer_syntax = TRANSFER_SYNTAXES[options['transfer_syntax']]
+
+        self.stdout.write(self.style.SUCCESS('Preparing datasets...'))
+        template = self.load_template(options)
+        workloads = []
+        for a in range(n_assoc):
+            datasets = []
+            for s in range(max(1, options['series_per_association'])):
+                datasets.extend(self.clone_series(template, a, s, transfer_syntax))
+            workloads.append(datasets)
+        total = sum(len(w) for w in workloads)
+        self.stdout.write(self.style.SUCCESS(
+            f'Sending {total} instances over {n_assoc} associations to '
+            f'{options["called_aet"]}@{options["host"]}:{options["port"]} ({options["transfer_syntax"]})'))
+
+        self.sent_at = {}
+        self.sent_lock = threading.Lock()
+        results = [None] * n_assoc
+        start_barrier = threading.Barrier(n_assoc + 1)
+        threads = [
+            threading.Thread(target=self.run_association, name=f'loadtest-scu-{a}',
+                             args=(a, workloads[a], options, transfer_syntax, start_barrier, results),
+                             daemon=True)
+            for a in range(n_assoc)
+        ]
+        for t in threads:
+            t.start()
+        start_barrier.wait()
+        t0 = time.perf_counter()
+
+        visible_at = {}
+        if not options['no_visibility']:
+            visible_at = self.poll_visibility(threads, workloads, options)
+        for t in threads:
+            t.join()
+        wall = time.perf_counter() - t0
+
+        self.report(results, visible_at, wall, total, options)
+
+    # ------------------------------------------------------------------
+    # Workload
+    # ------------------------------------------------------------------
+
+    def ensure_facility(self, aet):
+        facility = Facility.objects.filter(ae_title__iexact=aet).first()
+        if facility is None:
+            Facility.objects.create(
+                name=f'Load Test ({aet})', address='', phone='', email='loadtest@example.invalid',
+                license_number=f'LOADTEST-{aet}', ae_title=aet, is_active=True)
+            self.stdout.write(self.style.SUCCESS(f'Created facility for AE title {aet}'))
+        elif not facility.is_active:
+            facility.is_active = True
+            facility.save(update_fields=['is_active'])
+
+    def load_template(self, options):
+        """One series' datasets, later cloned with fresh UIDs per association"""
+        if not options['source']:
+            return list(synthetic.iter_series(
+                options['kind'], slices=options['slices'], rows=options['rows'], cols=options['cols']))
+
+        source = Path(options['source'])
+        if not source.is_dir():
+            raise CommandError(f'Source directory {source} does not exist')
+        datasets = []
+        for path in sorted(p for p in source.rglob('*') if p.is_file()):
+            try:
+                datasets.append(dcmread(str(path)))
+            except (InvalidDicomError, OSError):
+                continue
+        if not datasets:
+            raise CommandError(f'No DICOM files found in {source}')
+        return datasets
+
+    def clone_series(self, template, assoc_index, series_index, transfer_syntax):
+        """Copy the template with new Study/Series/SOP UIDs and a load test patient"""
+        uid_map = {}
+        patient_id = f'{LOADTEST_PATIENT_PREFIX}{assoc_index:03d}'
+        clones = []
+        for src in template:
+            ds = src.copy()
+            ds.file_meta = src.file_meta.copy()
+            for attr in ('StudyInstanceUID', 'SeriesInstanceUID'):
+                old = str(getattr(src, attr, '') or attr)
+                setattr(ds, attr, uid_map.setdefault((attr, old), generate_uid()))
+            ds.SOPInstanceUID = generate_uid()
+            ds.file_meta.MediaStorageSOPInstanceUID = ds.SOPInstanceUID
+            ds.PatientID = patient_id
+            ds.PatientName = f'LOAD^TEST{assoc_index:03d}'
+            ds.AccessionNumber = f'LT{assoc_index:03d}{series_index:03d}'
+            self.set_transfer_syntax(ds, transfer_syntax)
+            clones.append(ds)
+        return clones
+
+    def set_transfer_syntax(self, ds, transfer_syntax):
+        current = ds.file_meta.TransferSyntaxUID
+        if current == transfer_syntax:
+            return
+        if current.is_compressed:
+            ds.decompress()
+        if transfer_syntax.is_compressed:
+            # Encode outside the timed section, as a modality would store it
+            ds.compress(transfer_syntax)
+        else:
+            ds.file_meta.TransferSyntaxUID = transfer_syntax
+
+    # ------------------------------------------------------------------
+    # Associations
+    # ------------------------------------------------------------------
+
+    def run_association(self, index, datasets, options, transfer_syntax, start_barrier, results):
+        from pynetdicom import AE
+
+        ae = AE(ae_title=options['calling_aet'])
+        ae.maximum_pdu_size = max(0, options['max_pdu'])
+        ae.network_timeout = options['timeout']
+        ae.acse_timeout = options['timeout']
+        ae.dimse_timeout = options['timeout']
+        # Explicit VR LE is always offered as well so the receiver can fall back
+        syntaxes = list(dict.fromkeys([transfer_syntax, ExplicitVRLittleEndian]))
+        for sop_class in dict.fromkeys(str(ds.SOPClassUID) for ds in datasets):
+            ae.add_requested_context(sop_class, syntaxes)
+
+        result = {
+            'association': index,
+            'instances': len(datasets),
+            'stored': 0,
+            'failed': 0,
+            'statuses': {},
+            'bytes': 0,
+            'latencies_ms': [],
+            'negotiated_pdu': None,
+            'error': None,
+        }
+        results[index] = result
+
+        try:
+            start_barrier.wait()
+        except threading.BrokenBarrierError:
+            return
+        t0 = time.perf_counter()
+        assoc = ae.associate(options['host'], options['port'], ae_title=options['called_aet'])
+        result['associate_ms'] = round((time.perf_counter() - t0) * 1000.0, 2)
+        if not assoc.is_established:
+            result['error'] = 'association rejected or aborted'
+            result['failed'] = len(datasets)
+            result['elapsed_s'] = time.perf_counter() - t0
+            return
+
+        result['negotiated_pdu'] = getattr(assoc.acceptor, 'maximum_length', None)
+        try:
+            for ds in datasets:
+                sop_uid = str(ds.SOPInstanceUID)
+                send_start = time.perf_counter()
+                with self.sent_lock:
+                    self.sent_at[sop_uid] = send_start
+                status = assoc.send_c_store(ds)
+                result['latencies_ms'].append((time.perf_counter() - send_start) * 1000.0)
+
+                code = getattr(status, 'Status', None)
+                key = 'no-response' if code is None else f'0x{int(code):04X}'
+                result['statuses'][key] = result['statuses'].get(key, 0) + 1
+                if code is not None and int(code) in (0x0000, 0xB000, 0xB007, 0xB006):
+                    result['stored'] += 1
+                    result['bytes'] += len(ds.PixelData) if 'PixelData' in ds else 0
+                else:
+                    result['failed'] += 1
+                    with self.sent_lock:
+                        self.sent_at.pop(sop_uid, None)
+                if not assoc.is_established:
+                    result['error'] = 'association aborted during transfer'
+                    break
+        finally:
+            if assoc.is_established:
+                assoc.release()
+            result['elapsed_s'] = time.perf_counter() - t0
+
+    def poll_visibility(self, threads, workloads, options):
+        """Record when each successfully sent instance appears in DicomImage"""
+        visible_at = {}
+        deadline = None
+        while True:
+            with self.sent_lock:
+                pending = [uid for uid in self.sent_at if uid not in visible_at]
+            for i in range(0, len(pending), POLL_CHUNK):
+                found = DicomImage.objects.filter(
+                    sop_instance_uid__in=pending[i:i + POLL_CHUNK]).values_list('sop_instance_uid', flat=True)
+                now = time.perf_counter()
+                for uid in found:
+                    visible_at[uid] = now
+
+            senders_done = not any(t.is_alive() for t in threads)
+            if senders_done:
+                with self.sent_lock:
+                    outstanding = len(self.sent_at) - len(visible_at)
+                if outstanding <= 0:
+                    break
+                if deadline is None:
+                    deadline = time.perf_counter() + options['visibility_timeout']
+                elif time.perf_counter() > deadline:
+                    self.stdout.write(self.style.WARNING(
+                        f'{outstanding} stored instances not visible after {options["visibility_timeout"]}s'))
+                    break
+            time.sleep(options['poll_interval'])
+        return visible_at
+
+    # ------------------------------------------------------------------
+    # Reporting
+    # ------------------------------------------------------------------
+
+    def report(self, results, visible_at, wall, total, options):
+        rows = []
+        all_latencies = []
+        stored = failed = total_bytes = 0
+        for r in results:
+            elapsed = max(r.get('elapsed_s') or 0.0, 1e-9)
+            lat = _latency_summary(r['latencies_ms'])
+            all_latencies.extend(r['latencies_ms'])
+            stored += r['stored']
+            failed += r['failed']
+            total_bytes += r['bytes']
+            row = {
+                'association': r['association'],
+                'instances': r['instances'],
+                'stored': r['stored'],
+                'failed': r['failed'],
+                'statuses': r['statuses'],
+                'negotiated_pdu': r['negotiated_pdu'],
+                'associate_ms': r.get('associate_ms'),
+                'elapsed_s': round(elapsed, 3),
+                'instances_per_s': round(r['stored'] / elapsed, 1),
+                'mb_per_s': round(r['bytes'] / elapsed / 1e6, 2),
+                'latency': lat,
+                'error': r['error'],
+            }
+            rows.append(row)
+            p50 = lat.get('p50_ms', 0.0)
+            p95 = lat.get('p95_ms', 0.0)
+            p99 = lat.get('p99_ms', 0.0)
+            line = (f'  assoc {row["association"]}: {row["stored"]}/{row["instances"]} stored, '
+                    f'{row["instances_per_s"]} inst/s, {row["mb_per_s"]} MB/s, '
+                    f'latency p50={p50}ms p95={p95}ms p99={p99}ms, pdu={row["negotiated_pdu"]}')
+            if row['error']:
+                self.stdout.write(self.style.ERROR(f'{line} ({row["error"]})'))
+            else:
+                self.stdout.write(line)
+
+        visibility = None
+        if visible_at:
+            delays = [(visible_at[uid] - self.sent_at[uid]) * 1000.0 for uid in visible_at if uid in self.sent_at]
+            visibility = _latency_summary(delays)
+            t_start = min(self.sent_at.values())
+            visibility['all_visible_s'] = round(max(visible_at.values()) - t_start, 3)
+            visibility['not_visible'] = len(self.sent_at) - len(visible_at)
+
+        summary = {
+            'instances': total,
+            'stored': stored,
+            'failed': failed,
+            'wall_s': round(wall, 3),
+            'instances_per_s': round(stored / max(wall, 1e-9), 1),
+            'mb_per_s': round(total_bytes / max(wall, 1e-9) / 1e6, 2),
+            'cstore_latency': _latency_summary(all_latencies),
+            'db_visibility': visibility,
+        }
+        self.stdout.write(self.style.SUCCESS(
+            f'Total: {stored}/{total} stored in {summary["wall_s"]}s '
+            f'({summary["instances_per_s"]} inst/s, {summary["mb_per_s"]} MB/s)'))
+        lat = summary['cstore_latency']
+        if lat['count']:
+            self.stdout.write(f'C-STORE latency: p50={lat["p50_ms"]}ms p95={lat["p95_ms"]}ms '
+                              f'p99={lat["p99_ms"]}ms max={lat["max_ms"]}ms')
+        if visibility and visibility['count']:
+            self.stdout.write(f'DB visibility: p50={visibility["p50_ms"]}ms p95={visibility["p95_ms"]}ms '
+                              f'p99={visibility["p99_ms"]}ms, all visible after {visibility["all_visible_s"]}s')
+
+        if options['json']:
+            config = {k: options[k] for k in (
+                'host', 'port', 'called_aet', 'calling_aet', 'associations', 'series_per_association',
+                'source', 'kind', 'slices', 'rows', 'cols', 'transfer_syntax', 'max_pdu')}
+            with open(options['json'], 'w') as fh:
+                json.dump({'config': config, 'summary': summary, 'associations': rows}, fh, indent=2)
+            self.stdout.write(self.style.SUCCESS(f'Results written to {options["json"]}'))
+
+    # ------------------------------------------------------------------
+    # Cleanup
+    # ------------------------------------------------------------------
+
+    def cleanup(self):
+        studies = Study.objects.filter(patient__patient_id__startswith=LOADTEST_PATIENT_PREFIX)
+        images = DicomImage.objects.filter(series__study__in=studies)
+        removed_files = 0
+        for file_path, thumbnail in images.values_list('file_path', 'thumbnail').iterator():
+            for rel in (file_path, thumbnail):
+                if not rel:
+                    continue
+                path = os.path.join(settings.MEDIA_ROOT, str(rel))
+                try:
+                    os.remove(path)
+                    removed_files += 1
+                except OSError:
+                    pass
+        with transaction.atomic():
+            # Cascades remove series and images
+            deleted, _ = studies.delete()
+            Patient.objects.filter(patient_id__startswith=LOADTEST_PATIENT_PREFIX).delete()
+        self.stdout.write(self.style.SUCCESS(
+            f'Removed load test data ({deleted} rows, {removed_files} files)'))
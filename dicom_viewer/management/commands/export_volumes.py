@@ -0,0 +1,110 @@
+"""
+Batch Volume Export Management Command
+Writes the stored-value volumes of many series for research use, one file per
+series under --out/<accession>/:
+
+* nifti: <series>.nii.gz, a NIfTI-1 image with the patient geometry and rescale;
+* raw:   <series>.raw.gz, the C-ordered (slice, row, column) values, with a
+  <series>.json sidecar giving shape, dtype, rescale, voxel size and affine.
+
+Each volume is assembled for the export alone (the command does not fill the
+viewer's MPR volume cache) and gzipped as it is read, in parallel blocks
+(EXPORT_GZIP_THREADS). --workers series (default EXPORT_THREADS) are exported
+at the same time on the command's own threads, so at most that many volumes
+are held in memory:
+
+    python manage.py export_volumes --study 12 --study 15 --out /data/export
+    python manage.py export_volumes --series 301,302 --format raw --out /data/export
+"""
+import json
+import os
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from django.conf import settings
+from django.core.management.base import BaseCommand, CommandError
+
+from worklist.models import Series
+from dicom_viewer import export
+
+FORMATS = ('nifti', 'raw')
+
+
+def _ids(values):
+    return [int(v) for value in values for v in str(value).split(',') if v.strip()]
+
+
+class Command(BaseCommand):
+    help = 'Export series volumes as gzipped NIfTI or raw files'
+
+    def add_arguments(self, parser):
+        parser.add_argument('--series', action='append', default=[],
+                          help='Series ids (comma separated, repeatable)')
+        parser.add_argument('--study', action='append', default=[],
+                          help='Study ids whose series are all exported (comma separated, repeatable)')
+        parser.add_argument('--format', choices=FORMATS, default='nifti', help='Output format')
+        parser.add_argument('--out', required=True, help='Output directory')
+        parser.add_argument('--workers', type=int, default=None,
+                          help='Series exported at the same time (default EXPORT_THREADS)')
+        parser.add_argument('--overwrite', action='store_true', help='Replace existing files')
+
+    def handle(self, *args, **options):
+        from dicom_viewer.views import _export_volume
+
+        try:
+            series_ids, study_ids = _ids(options['series']), _ids(options['study'])
+        except ValueError:
+            raise CommandError('Series and study ids must be integers')
+        if not series_ids and not study_ids:
+            raise CommandError('Give at least one --series or --study')
+        selected = Series.objects.filter(id__in=series_ids) | Series.objects.filter(study_id__in=study_ids)
+        selected = list(selected.select_related('study').distinct().order_by('study_id', 'series_number', 'id'))
+        if not selected:
+            raise CommandError('No matching series')
+        found_series = {s.id for s in selected}
+        found_studies = {s.study_id for s in selected}
+        missing = ([f'series {i}' for i in series_ids if i not in found_series]
+                   + [f'study {i}' for i in study_ids if i not in found_studies])
+        if missing:
+            raise CommandError(f"Not found (or without series): {', '.join(missing)}")
+
+        fmt, out = options['format'], options['out']
+        suffix = '.nii.gz' if fmt == 'nifti' else '.raw.gz'
+
+        def job(series):
+            def run():
+                folder = os.path.join(out, export.safe_name(series.study.accession_number, f'study_{series.study_id}'))
+                base = os.path.join(folder, export.series_folder(series))
+                if os.path.exists(base + suffix) and not options['overwrite']:
+                    return series, base + suffix, None, 'exists'
+                start = time.perf_counter()
+                try:
+                    volume = export.SeriesVolume(series, _export_volume)
+                    if fmt == 'nifti':
+                        export.write_chunks(base + suffix, volume.nifti_gz())
+                    else:
+                        export.write_chunks(base + suffix, volume.raw_gz())
+                        export.write_chunks(base + '.json', [json.dumps(volume.meta, indent=2).encode()])
+                except Exception as e:
+                    return series, base + suffix, None, str(e)
+                return series, base + suffix, time.perf_counter() - start, None
+            return run
+
+        workers = max(1, options['workers'] or getattr(settings, 'EXPORT_THREADS', 2))
+        exported = skipped = failed = 0
+        with ThreadPoolExecutor(max_workers=workers, thread_name_prefix='export-volumes') as pool:
+            for series, path, seconds, error in export.prepared((job(s) for s in selected), workers, pool):
+                if error == 'exists':
+                    skipped += 1
+                    self.stdout.write(f'   skipped {path} (exists)')
+                elif error:
+                    failed += 1
+                    self.stderr.write(self.style.ERROR(f'   series {series.id} failed: {error}'))
+                else:
+                    exported += 1
+                    size = os.path.getsize(path) / (1 << 20)
+                    self.stdout.write(f'   {path}: {size:.1f} MB in {seconds:.2f}s')
+        summary = f'Exported {exported} series to {out}, skipped {skipped} existing'
+        if failed:
+            raise CommandError(f'{summary}; {failed} of {len(selected)} series failed')
+        self.stdout.write(self.style.SUCCESS(summary))
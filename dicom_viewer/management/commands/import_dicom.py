@@ -9,6 +9,8 @@ from django.conf import settings
 from django.utils import timezone
 import pydicom
 from worklist.models import Study, Series, DicomImage, Patient, Modality
+from worklist import resolver
+from dicom_viewer import headers, intensity
 from accounts.models import User, Facility
 from datetime import datetime
 import shutil
@@ -49,9 +51,14 @@ class Command(BaseCommand):
         self.setup_logging()
         
         # Get facility and user if specified
-        facility = self.get_facility(options.get('facility'))
+        facility = self.get_facility(options.get('facility')) or Facility.objects.first()
         user = self.get_user(options.get('user'))
         
+        # Storage directory per series primary key, built on its first instance
+        self.storage_dirs = {}
+        # Series with replaced (--overwrite) instances, whose intensity stats are rebuilt at the end
+        self.restat_series = set()
+        
         # Find all DICOM files
         self.stdout.write(self.style.SUCCESS('🔍 Scanning for DICOM files...'))
         dicom_files = self.find_dicom_files(source_dir, options['recursive'])
@@ -250,6 +257,13 @@ class Command(BaseCommand):
             total_processed = imported_count + skipped_count + error_count
             self.stdout.write(f'   Progress: {total_processed}/{len(dicom_files)} files processed')
         
+        intensity.flush()
+        for series_id in sorted(self.restat_series):
+            try:
+                intensity.build_series_stats(series_id)
+            except Exception as e:
+                logger.warning(f'Intensity stats rebuild of series {series_id} failed: {e}')
+        
         # Final summary
         self.stdout.write(self.style.SUCCESS('\n🎉 Import complete!'))
         self.stdout.write(f'   ✅ Imported: {imported_count}')
@@ -263,27 +277,36 @@ class Command(BaseCommand):
             ds = pydicom.dcmread(file_path)
             
             # Check if already imported
+            replaced = False
             if DicomImage.objects.filter(sop_instance_uid=ds.SOPInstanceUID).exists():
                 if not options.get('overwrite'):
                     return 'skipped'
                 else:
-                    # Delete existing
-                    DicomImage.objects.filter(sop_instance_uid=ds.SOPInstanceUID).delete()
+                    # Delete existing; its series' stats already count it
+                    existing = DicomImage.objects.filter(sop_instance_uid=ds.SOPInstanceUID)
+                    self.restat_series.update(existing.values_list('series_id', flat=True))
+                    existing.delete()
+                    replaced = True
             
-            # Get or create patient
-            patient = self.get_or_create_patient(ds)
+            # Patient, modality, study and series resolve to primary keys through
+            # the ingest resolver, so only the first instance of a series queries them
+            patient_id = self.get_or_create_patient(ds)
             
             # Get or create modality
-            modality = self.get_or_create_modality(ds)
+            modality_id = self.get_or_create_modality(ds)
             
             # Get or create study
-            study = self.get_or_create_study(ds, patient, modality, facility, user)
+            study_id = self.get_or_create_study(ds, patient_id, modality_id, facility, user)
             
             # Get or create series
-            series = self.get_or_create_series(ds, study)
+            series_id = self.get_or_create_series(ds, study_id)
             
             # Create storage directory
-            storage_dir = self.create_storage_path(patient, study, series)
+            storage_dir = self.storage_dirs.get(series_id)
+            if storage_dir is None:
+                series = Series.objects.select_related('study__patient').get(pk=series_id)
+                storage_dir = self.create_storage_path(series.study.patient, series.study, series)
+                self.storage_dirs[series_id] = storage_dir
             
             # Copy/move file
             filename = f"{ds.SOPInstanceUID}.dcm"
@@ -300,15 +323,23 @@ class Command(BaseCommand):
             # Create DicomImage record
             image = DicomImage.objects.create(
                 sop_instance_uid=ds.SOPInstanceUID,
-                series=series,
+                series_id=series_id,
                 instance_number=getattr(ds, 'InstanceNumber', 0),
                 image_position=str(getattr(ds, 'ImagePositionPatient', '')),
                 slice_location=getattr(ds, 'SliceLocation', None),
                 file_path=relative_path,
                 file_size=os.path.getsize(dest_path),
+                header=headers.extract(dest_path),
                 processed=True
             )
             
+            # Series intensity stats for auto-window/MPR, counted while the file is in memory;
+            # a replaced instance is counted by the rebuild instead
+            if replaced:
+                self.restat_series.add(series_id)
+            else:
+                intensity.accumulate(series_id, ds, getattr(ds, 'Modality', ''))
+            
             return 'imported'
             
         except Exception as e:
@@ -340,8 +371,8 @@ class Command(BaseCommand):
         else:
             gender = 'M'  # Default
         
-        patient, created = Patient.objects.get_or_create(
-            patient_id=patient_id,
+        patient_pk, created = resolver.resolve_patient(
+            patient_id,
             defaults={
                 'first_name': first_name,
                 'last_name': last_name,
@@ -350,14 +381,14 @@ class Command(BaseCommand):
             }
         )
         
-        return patient
+        return patient_pk
 
     def get_or_create_modality(self, ds):
         """Get or create modality record"""
         modality_code = getattr(ds, 'Modality', 'OT')
         
-        modality, created = Modality.objects.get_or_create(
-            code=modality_code,
+        modality_id, created = resolver.resolve_modality(
+            modality_code,
             defaults={
                 'name': self.get_modality_name(modality_code),
                 'description': f'{modality_code} imaging modality',
@@ -365,7 +396,7 @@ class Command(BaseCommand):
             }
         )
         
-        return modality
+        return modality_id
 
     def get_modality_name(self, code):
         """Get full modality name from code"""
@@ -385,7 +416,7 @@ class Command(BaseCommand):
         }
         return modality_names.get(code, code)
 
-    def get_or_create_study(self, ds, patient, modality, facility, user):
+    def get_or_create_study(self, ds, patient_id, modality_id, facility, user):
         """Get or create study record with enhanced data extraction"""
         study_uid = ds.StudyInstanceUID
         
@@ -399,12 +430,12 @@ class Command(BaseCommand):
         else:
             study_date = timezone.now()
         
-        study, created = Study.objects.get_or_create(
-            study_instance_uid=study_uid,
+        study_id, created = resolver.resolve_study(
+            study_uid,
             defaults={
-                'patient': patient,
-                'facility': facility or Facility.objects.first(),
-                'modality': modality,
+                'patient_id': patient_id,
+                'facility': facility,
+                'modality_id': modality_id,
                 'accession_number': getattr(ds, 'AccessionNumber', f'ACC_{study_uid[:8]}'),
                 'study_description': getattr(ds, 'StudyDescription', ''),
                 'study_date': study_date,
@@ -416,9 +447,9 @@ class Command(BaseCommand):
             }
         )
         
-        return study
+        return study_id
 
-    def get_or_create_series(self, ds, study):
+    def get_or_create_series(self, ds, study_id):
         """Get or create series record with enhanced data extraction"""
         series_uid = ds.SeriesInstanceUID
         
@@ -427,10 +458,10 @@ class Command(BaseCommand):
         if hasattr(ds, 'PixelSpacing'):
             pixel_spacing = '\\'.join([str(x) for x in ds.PixelSpacing])
         
-        series, created = Series.objects.get_or_create(
-            series_instance_uid=series_uid,
+        series_id, created = resolver.resolve_series(
+            series_uid,
             defaults={
-                'study': study,
+                'study_id': study_id,
                 'series_number': getattr(ds, 'SeriesNumber', 0),
                 'series_description': getattr(ds, 'SeriesDescription', ''),
                 'modality': getattr(ds, 'Modality', ''),
@@ -441,7 +472,7 @@ class Command(BaseCommand):
             }
         )
         
-        return series
+        return series_id
 
     def create_storage_path(self, patient, study, series):
         """Create organized storage directory structure"""
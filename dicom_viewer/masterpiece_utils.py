@@ -567,27 +567,22 @@ class MasterpieceImageExporter:
     
     @staticmethod
     def export_volume_as_nifti(volume, filename, metadata=None):
-        """Export volume as NIfTI format"""
+        """Export a 3D volume (x, y, z) as NIfTI; gzip-compressed in parallel blocks if filename ends in .gz"""
+        from . import export
+
         try:
-            import nibabel as nib
-            
-            # Create NIfTI image
-            img = nib.Nifti1Image(volume, np.eye(4))
-            
-            # Add metadata if provided
-            if metadata:
-                img.header.set_data_dtype(volume.dtype)
-                if 'pixel_spacing' in metadata:
-                    spacing = metadata['pixel_spacing']
-                    img.header.set_zooms(spacing)
-            
-            # Save to file
-            nib.save(img, filename)
+            volume = np.asarray(volume)
+            if volume.ndim != 3:
+                raise ValueError(f'Expected a 3D volume, got shape {volume.shape}')
+            zooms = tuple(float(z) for z in (metadata or {}).get('pixel_spacing') or ())
+            zooms = (zooms + (1.0, 1.0, 1.0))[:3]
+            # Transposed view: written (z, y, x) a slice at a time, so x varies fastest as NIfTI stores it
+            chunks = export.nifti_chunks(volume.T, zooms)
+            if filename.endswith('.gz'):
+                chunks = export.gzip_chunks(chunks)
+            export.write_chunks(filename, chunks)
             return True
             
-        except ImportError:
-            logger.warning("nibabel not available for NIfTI export")
-            return False
         except Exception as e:
             logger.error(f"Error exporting NIfTI: {e}")
             return False
\ No newline at end of file
@@ -0,0 +1,29 @@
+# Generated by Django 5.2.18 on 2026-10-17 01:10
+
+import django.db.models.deletion
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('dicom_viewer', '0001_initial'),
+        ('worklist', '0003_study_search_index'),
+    ]
+
+    operations = [
+        migrations.CreateModel(
+            name='SeriesIntensityStats',
+            fields=[
+                ('id', models.BigAutoField(auto_created=True, primary_key=True, serialize=False, verbose_name='ID')),
+                ('modality', models.CharField(blank=True, max_length=16)),
+                ('instance_count', models.IntegerField(default=0)),
+                ('voxel_count', models.BigIntegerField(default=0)),
+                ('min_value', models.FloatField(blank=True, null=True)),
+                ('max_value', models.FloatField(blank=True, null=True)),
+                ('distribution', models.BinaryField()),
+                ('updated_at', models.DateTimeField(auto_now=True)),
+                ('series', models.OneToOneField(on_delete=django.db.models.deletion.CASCADE, related_name='intensity_stats', to='worklist.series')),
+            ],
+        ),
+    ]
@@ -102,6 +102,14 @@ class HangingProtocol(models.Model):
     def __str__(self):
         return f"{self.modality or '*'} {self.body_part or '*'} - {self.name} ({self.layout})"
 
+    @classmethod
+    def suggest(cls, modality='', body_part=''):
+        """Default protocol for a modality/body part, falling back to the modality, then any default"""
+        qs = cls.objects.filter(is_default=True)
+        return (qs.filter(modality=modality or '', body_part=body_part or '').first() or
+                qs.filter(modality=modality or '').first() or
+                qs.first())
+
 
 class WindowLevelPreset(models.Model):
     """Per-user window/level presets optionally scoped by modality/body part."""
@@ -225,3 +233,21 @@ class HounsfieldQAPhantom(models.Model):
     
     def __str__(self):
         return f"{self.name} ({self.manufacturer})"
+
+
+class SeriesIntensityStats(models.Model):
+    """Intensity distribution of a series in modality units (rescaled pixel values).
+    Built incrementally at ingest so auto-window and MPR defaults never scan the volume;
+    see dicom_viewer.intensity for the encoding of `distribution`.
+    """
+    series = models.OneToOneField(Series, on_delete=models.CASCADE, related_name='intensity_stats')
+    modality = models.CharField(max_length=16, blank=True)
+    instance_count = models.IntegerField(default=0)
+    voxel_count = models.BigIntegerField(default=0)
+    min_value = models.FloatField(null=True, blank=True)
+    max_value = models.FloatField(null=True, blank=True)
+    distribution = models.BinaryField()
+    updated_at = models.DateTimeField(auto_now=True)
+
+    def __str__(self):
+        return f"Intensity stats for series {self.series_id} ({self.instance_count} instances)"
@@ -0,0 +1,220 @@
+"""
+Warm-up of newly ingested series, driven by hanging protocols.
+
+A study arriving through the DICOM receiver or a web upload used to have
+nothing prepared until the first viewer click. The MPR volume, the default
+window, the mid-slice MPR renders and the MIP were all computed on that
+request. ``schedule`` queues a series for warm-up once its ingest commits:
+
+* the series is matched to ``HangingProtocol.suggest(modality, body_part)``.
+  An MPR layout warms the volume, the three mid-slice renders at the default
+  window (into the encoded slice cache) and the MIP projections. Any other
+  layout, or no protocol, warms only the intensity stats (auto-window);
+* C-STORE delivers a series one instance at a time, so a job runs
+  ``PREFETCH_SETTLE_SECONDS`` after the last instance of its series arrived;
+* ready jobs run by ``Study.priority`` (urgent first), then arrival;
+* one thread per process does the work, pausing after each job so that
+  warm-up uses at most ``PREFETCH_CPU_SHARE`` of its time;
+* a job still queued after ``PREFETCH_TTL_SECONDS`` is dropped, and so is a
+  warmed volume nobody opened within that time (``opened`` is called on
+  every MPR cache hit).
+
+Volumes and encoded slices are caches of the process that builds them. The
+DICOM receiver runs in its own process, so it schedules with
+``volume=False``: only the intensity stats, which are stored in the
+database, are warmed there.
+"""
+import logging
+import os
+import threading
+import time
+
+from django.conf import settings
+from django.db import close_old_connections, transaction
+
+from noctis_pro import metrics
+
+logger = logging.getLogger(__name__)
+
+# Study.priority -> scheduling rank (lower runs first)
+PRIORITY_RANKS = {'urgent': 0, 'high': 1, 'normal': 2, 'low': 3}
+# Longest wait between checks for expired jobs and unopened volumes
+SWEEP_SECONDS = 30.0
+
+PREFETCH_JOBS = metrics.counter(
+    'noctis_prefetch_jobs', 'Series warm-up jobs by outcome', ('outcome',))
+
+
+def _setting(name, default):
+    value = getattr(settings, name, None)
+    return default if value is None else value
+
+
+def _layout_warms_volume(layout):
+    return 'mpr' in (layout or '').lower()
+
+
+class _Scheduler:
+    """Debounced, prioritised warm-up queue with one worker thread per process"""
+
+    def __init__(self):
+        self._cond = threading.Condition()
+        self._pid = None
+        self._jobs = {}      # series_id -> {'rank', 'due', 'queued'}
+        self._warmed = {}    # series_id -> time its volume was warmed and not opened since
+        self._thread = None
+
+    def _reset_if_forked(self):
+        if self._pid != os.getpid():
+            self._pid = os.getpid()
+            self._jobs = {}
+            self._warmed = {}
+            self._thread = None
+
+    def enqueue(self, series_id, settle, volume=True):
+        now = time.monotonic()
+        with self._cond:
+            self._reset_if_forked()
+            job = self._jobs.get(series_id)
+            if job is not None:
+                # More instances of a queued series: run after they settle
+                job['due'] = now + settle
+                job['volume'] = job['volume'] or volume
+                self._cond.notify()
+                return
+        rank = _series_rank(series_id)
+        with self._cond:
+            job = self._jobs.setdefault(series_id, {'rank': rank, 'queued': now, 'volume': volume})
+            job['volume'] = job['volume'] or volume
+            job['due'] = now + settle
+            if self._thread is None or not self._thread.is_alive():
+                self._thread = threading.Thread(target=self._run, name='series-prefetch', daemon=True)
+                self._thread.start()
+            self._cond.notify()
+
+    def opened(self, series_id):
+        with self._cond:
+            self._warmed.pop(series_id, None)
+
+    def _next(self):
+        """(best ready job as (series id, volume) or None, warmed series ids to drop), waiting for either.
+        Jobs queued for longer than the TTL are dropped here.
+        """
+        with self._cond:
+            while True:
+                now = time.monotonic()
+                ttl = float(_setting('PREFETCH_TTL_SECONDS', 1800))
+                for series_id, job in list(self._jobs.items()):
+                    if now - job['queued'] > ttl:
+                        del self._jobs[series_id]
+                        PREFETCH_JOBS.inc(outcome='expired')
+                stale = [sid for sid, warmed in self._warmed.items() if now - warmed > ttl]
+                for series_id in stale:
+                    del self._warmed[series_id]
+                ready = [(job['rank'], job['due'], sid) for sid, job in self._jobs.items() if job['due'] <= now]
+                if ready:
+                    series_id = min(ready)[2]
+                    job = self._jobs.pop(series_id)
+                    return (series_id, job['volume']), stale
+                if stale:
+                    return None, stale
+                wake = min([job['due'] for job in self._jobs.values()] +
+                           [warmed + ttl for warmed in self._warmed.values()] + [now + SWEEP_SECONDS])
+                self._cond.wait(max(0.05, wake - now))
+
+    def _run(self):
+        while True:
+            job, stale = self._next()
+            for stale_id in stale:
+                _drop_volume(stale_id)
+            if job is None:
+                continue
+            series_id, volume = job
+            close_old_connections()
+            started = time.monotonic()
+            try:
+                if warm_series(series_id, with_volume=volume):
+                    with self._cond:
+                        self._warmed[series_id] = time.monotonic()
+                PREFETCH_JOBS.inc(outcome='warmed')
+            except Exception as e:
+                PREFETCH_JOBS.inc(outcome='failed')
+                logger.warning(f"Warm-up failed for series {series_id}: {e}")
+            # Stay within the CPU share: idle for the matching fraction of the job's time
+            share = min(1.0, max(0.01, float(_setting('PREFETCH_CPU_SHARE', 0.5))))
+            time.sleep((time.monotonic() - started) * (1.0 - share) / share)
+
+
+_scheduler = _Scheduler()
+
+
+def _series_rank(series_id):
+    from worklist.models import Series
+
+    priority = Series.objects.filter(pk=series_id).values_list('study__priority', flat=True).first()
+    return PRIORITY_RANKS.get(priority, PRIORITY_RANKS['normal'])
+
+
+def _drop_volume(series_id):
+    from . import views
+
+    if views._mpr_cache_drop(series_id):
+        PREFETCH_JOBS.inc(outcome='evicted')
+
+
+def schedule(series_id, settle=None, volume=True):
+    """Warm a series up in the background once the current transaction commits.
+    settle: seconds without new instances before the job may run (PREFETCH_SETTLE_SECONDS by default).
+    volume: False outside the web process, whose in-memory caches the volume warm-up would fill.
+    """
+    if not _setting('PREFETCH_ENABLED', True):
+        return
+    if settle is None:
+        settle = float(_setting('PREFETCH_SETTLE_SECONDS', 5))
+    transaction.on_commit(lambda: _scheduler.enqueue(series_id, settle, volume))
+
+
+def opened(series_id):
+    """A viewer used the series' volume: keep it past the warm-up TTL"""
+    _scheduler.opened(series_id)
+
+
+def warm_series(series_id, with_volume=True):
+    """Precompute what the series' hanging protocol will request; True if an MPR volume was warmed.
+    With with_volume False only the stored intensity stats are built.
+    """
+    from worklist.models import Series
+    from . import intensity, rendering, views
+    from .models import HangingProtocol
+
+    series = Series.objects.select_related('study').filter(pk=series_id).first()
+    if series is None:
+        return False
+    protocol = HangingProtocol.suggest(series.modality, series.body_part or series.study.body_part)
+    count = series.images.count()
+    if not with_volume or not protocol or not _layout_warms_volume(protocol.layout) or count < 2:
+        # Stack layouts need only the auto-window; receiver counts are merged first
+        intensity.flush()
+        intensity.get_series_stats(series, build_missing=True)
+        return False
+
+    # A volume cached before the last instances arrived is stale
+    with views._MPR_CACHE_LOCK:
+        entry = views._MPR_CACHE.get(series.id)
+        cached = entry.get('volume') if entry else None
+    if cached is not None and cached.complete and cached.native_depth != count:
+        views._mpr_cache_drop(series.id)
+        cached = None
+    volume, _spacing = views._get_mpr_volume_and_spacing(series)
+
+    intensity.flush()
+    stats = intensity.get_series_stats(series) or intensity.stats_from_volume(series, volume, count)
+    ww, wl = stats['mpr_window'] if stats else (400.0, 40.0)
+    fmt = rendering.image_format()
+    for plane, axis in (('axial', 0), ('coronal', 1), ('sagittal', 2)):
+        views._get_encoded_mpr_slice(series.id, volume, plane, volume.shape[axis] // 2,
+                                     float(ww), float(wl), False, fmt)
+        volume.projection(axis)
+    logger.info(f"Warmed series {series.id} for hanging protocol '{protocol.name}' ({protocol.layout})")
+    # A volume a viewer had already built is theirs, not subject to the warm-up TTL
+    return cached is None
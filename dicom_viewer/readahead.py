@@ -0,0 +1,233 @@
+"""
+Direction-aware read-ahead for scroll navigation.
+
+Scrolling a stack (``api_dicom_image_display``) or an MPR plane
+(``api_mpr_reconstruction?plane=``) requests one slice after another, and
+each one used to be decoded and rendered cold. ``observe`` is called by those
+endpoints with the index being served. For every viewer session, series and
+plane it keeps the scroll direction and speed, and renders the next slices
+into the slice caches before they are asked for:
+
+* the depth is ``READAHEAD_SECONDS`` of scrolling at the current speed,
+  between ``READAHEAD_MIN_SLICES`` and ``READAHEAD_MAX_SLICES``, stepping
+  by the size of the last scroll step (a fast wheel skips slices);
+* renders run on ``READAHEAD_THREADS`` background threads, lowered in OS
+  priority where the platform allows. A change of direction, window or
+  format cancels whatever is still queued, and a queued slice the user has
+  already scrolled past is skipped;
+* ``noctis_readahead_requests`` counts whether each scroll request (not the
+  first of a scroll) was served from cache. In steady scrolling every request
+  should be a hit. ``noctis_readahead_slices`` counts what the background
+  work did with each slice.
+"""
+import logging
+import os
+import threading
+import time
+from collections import OrderedDict
+from concurrent.futures import ThreadPoolExecutor
+
+from django.conf import settings
+from django.db import close_old_connections
+
+from noctis_pro import metrics
+
+logger = logging.getLogger(__name__)
+
+# A pause longer than this starts a new scroll: speed and direction are relearnt
+IDLE_SECONDS = 2.0
+# Largest scroll step followed as a stride
+MAX_STRIDE = 8
+# Sessions x series x planes tracked per process
+MAX_TRACKS = 512
+# How long a series' stack order is reused before being re-read
+ORDER_SECONDS = 30.0
+# Weight of the newest step in the scroll speed estimate
+SPEED_SMOOTHING = 0.5
+
+READAHEAD_REQUESTS = metrics.counter(
+    'noctis_readahead_requests', 'Scroll requests after the first of a scroll, by whether the slice was cached',
+    ('kind', 'result'))
+READAHEAD_SLICES = metrics.counter(
+    'noctis_readahead_slices', 'Read-ahead slices by outcome (rendered, cached, cancelled, failed)',
+    ('kind', 'outcome'))
+
+
+def _setting(name, default):
+    value = getattr(settings, name, None)
+    return default if value is None else value
+
+
+class _Track:
+    """Scroll state of one session in one series and plane"""
+
+    __slots__ = ('index', 'at', 'direction', 'stride', 'speed', 'params', 'generation', 'queued')
+
+    def __init__(self):
+        self.index = None
+        self.at = 0.0
+        self.direction = 0
+        self.stride = 1
+        self.speed = 0.0        # slices per second
+        self.params = None
+        self.generation = 0
+        self.queued = set()     # indices queued (or rendered) in this generation
+
+    def step(self, index, params, now):
+        """Record a request; True if it continues a scroll in the same direction"""
+        if params != self.params:
+            self.params = params
+            self._cancel()
+        last, elapsed = self.index, now - self.at
+        self.index, self.at = index, now
+        if last is None or index == last or elapsed > IDLE_SECONDS:
+            if last is None or elapsed > IDLE_SECONDS:
+                self.direction, self.speed = 0, 0.0
+                self._cancel()
+            return False
+        direction = 1 if index > last else -1
+        delta = abs(index - last)
+        speed = delta / max(elapsed, 1e-3)
+        if direction != self.direction:
+            self.direction, self.speed = direction, speed
+            self._cancel()
+            continuing = False
+        else:
+            self.speed += SPEED_SMOOTHING * (speed - self.speed)
+            continuing = True
+        self.stride = min(delta, MAX_STRIDE)
+        return continuing
+
+    def _cancel(self):
+        self.generation += 1
+        self.queued = set()
+
+    def targets(self, count):
+        """Indices to have rendered ahead of the current position"""
+        if not self.direction:
+            return []
+        lo = int(_setting('READAHEAD_MIN_SLICES', 2))
+        hi = int(_setting('READAHEAD_MAX_SLICES', 16))
+        depth = min(hi, max(lo, int(round(self.speed * float(_setting('READAHEAD_SECONDS', 0.5)) / self.stride))))
+        indices = (self.index + self.direction * self.stride * k for k in range(1, depth + 1))
+        return [i for i in indices if 0 <= i < count]
+
+    def wants(self, index, generation):
+        """A queued slice is still worth rendering: same scroll, and not yet passed"""
+        return generation == self.generation and (index - self.index) * self.direction > 0
+
+
+class _ReadAhead:
+    """Scroll tracks and the background render pool of one process"""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._pid = None
+        self._tracks = OrderedDict()   # (session, kind, series_id, plane) -> _Track
+        self._pool = None
+
+    def _reset_if_forked(self):
+        if self._pid != os.getpid():
+            self._pid = os.getpid()
+            self._tracks = OrderedDict()
+            self._pool = None
+
+    def _get_pool(self):
+        if self._pool is None:
+            self._pool = ThreadPoolExecutor(max_workers=max(1, int(_setting('READAHEAD_THREADS', 1))),
+                                            thread_name_prefix='readahead', initializer=_lower_priority)
+        return self._pool
+
+    def observe(self, key, kind, index, count, params, hit, render):
+        now = time.monotonic()
+        with self._lock:
+            self._reset_if_forked()
+            track = self._tracks.get(key)
+            if track is None:
+                track = self._tracks[key] = _Track()
+                while len(self._tracks) > MAX_TRACKS:
+                    self._tracks.popitem(last=False)
+            else:
+                self._tracks.move_to_end(key)
+            if track.step(index, params, now):
+                READAHEAD_REQUESTS.inc(kind=kind, result='hit' if hit else 'miss')
+            generation = track.generation
+            queue = [i for i in track.targets(count) if i not in track.queued]
+            track.queued.update(queue)
+            pool = self._get_pool() if queue else None
+        for target in queue:
+            pool.submit(self._run, track, kind, target, generation, render)
+
+    def _run(self, track, kind, index, generation, render):
+        with self._lock:
+            wanted = track.wants(index, generation)
+        if not wanted:
+            READAHEAD_SLICES.inc(kind=kind, outcome='cancelled')
+            return
+        close_old_connections()
+        try:
+            outcome = 'rendered' if render(index) else 'cached'
+        except Exception as e:
+            outcome = 'failed'
+            logger.debug(f"Read-ahead of {kind} slice {index} failed: {e}")
+        if outcome == 'failed':
+            with self._lock:
+                if generation == track.generation:
+                    # Let a later request try it again
+                    track.queued.discard(index)
+        READAHEAD_SLICES.inc(kind=kind, outcome=outcome)
+
+
+def _lower_priority():
+    """Make the calling pool thread yield the CPU to request threads (per-thread nice on Linux)"""
+    try:
+        os.setpriority(os.PRIO_PROCESS, threading.get_native_id(), 10)
+    except (AttributeError, OSError):
+        pass
+
+
+_readahead = _ReadAhead()
+
+
+def session_of(request):
+    """Identity of the viewer session scrolling: the session key, else the user"""
+    session = getattr(request, 'session', None)
+    return getattr(session, 'session_key', None) or f'user:{request.user.pk}'
+
+
+def observe(request, kind, series_id, plane, index, count, params, hit, render):
+    """Record that a scroll request for slice index (of count) was served, and queue the next ones.
+    params: whatever else shapes the rendered slice (window, format); a change cancels queued work.
+    hit: the request was served from cache. render(index): put that slice into the cache, returning
+    False if it was already there; it runs on a read-ahead thread.
+    """
+    if not _setting('READAHEAD_ENABLED', True) or count < 2:
+        return
+    _readahead.observe((session_of(request), kind, series_id, plane), kind, index, count, params, hit, render)
+
+
+_order_lock = threading.Lock()
+_orders = {}   # series_id -> (image ids in stack order, time read)
+
+
+def stack_position(series_id, image_id):
+    """(index of image_id in its series' stack order, ordered image ids); index None if not found.
+    The order is api_study_data's (instance number), the order the viewer scrolls in.
+    """
+    from worklist.models import DicomImage
+
+    now = time.monotonic()
+    with _order_lock:
+        cached = _orders.get(series_id)
+    ids = cached[0] if cached and now - cached[1] < ORDER_SECONDS else None
+    if ids is None or image_id not in ids:
+        ids = list(DicomImage.objects.filter(series_id=series_id)
+                   .order_by('instance_number').values_list('id', flat=True))
+        with _order_lock:
+            _orders[series_id] = (ids, now)
+            while len(_orders) > MAX_TRACKS:
+                _orders.pop(next(iter(_orders)))
+    try:
+        return ids.index(image_id), ids
+    except ValueError:
+        return None, ids
@@ -1,8 +1,7 @@
 import numpy as np
 import os
-import tempfile
-import zipfile
 import json
+import uuid
 from skimage import measure, morphology
 from scipy import ndimage
 import pydicom
@@ -10,6 +9,9 @@ import logging
 from PIL import Image
 from django.conf import settings
 
+from . import export
+from .volumes import stack
+
 logger = logging.getLogger(__name__)
 
 
@@ -17,63 +19,47 @@ class BaseProcessor:
     """Base class for all reconstruction processors"""
 
     def __init__(self):
-        self.temp_dir = tempfile.mkdtemp()
+        self.result_dir = getattr(settings, 'RECONSTRUCTION_RESULTS_DIR', None) or \
+            os.path.join(settings.MEDIA_ROOT, 'reconstructions')
 
     def load_series_volume(self, series):
+        """(volumes.StoredVolume, spacing): stored pixel values with the rescale as metadata"""
         images = series.images.all().order_by('instance_number')
         if not images:
             raise ValueError("No images found in series")
-        first_path = os.path.join(settings.MEDIA_ROOT, images[0].file_path.name)
-        first_dicom = pydicom.dcmread(first_path)
-        rows, cols = first_dicom.Rows, first_dicom.Columns
-        volume = np.zeros((len(images), rows, cols), dtype=np.float32)
+        slices = []
         spacing = []
         for i, image in enumerate(images):
             dicom_path = os.path.join(settings.MEDIA_ROOT, image.file_path.name)
             ds = pydicom.dcmread(dicom_path)
-            pixel_array = ds.pixel_array.astype(np.float32)
             slope = getattr(ds, 'RescaleSlope', 1.0)
             intercept = getattr(ds, 'RescaleIntercept', 0.0)
-            pixel_array = pixel_array * slope + intercept
-            volume[i] = pixel_array
+            slices.append((ds.pixel_array, slope, intercept))
             if i == 0:
                 pixel_spacing = getattr(ds, 'PixelSpacing', [1.0, 1.0])
                 slice_thickness = getattr(ds, 'SliceThickness', 1.0)
                 spacing = [float(slice_thickness), float(pixel_spacing[0]), float(pixel_spacing[1])]
-        return volume, spacing
+        return stack(slices), spacing
 
     def save_result(self, result_data, filename):
-        result_path = os.path.join(self.temp_dir, filename)
+        """Write a result into the job result store: a dict as a ZIP of its entries (2D arrays as PNG,
+        other arrays as NPY, the rest as JSON or text), streamed into place without temporary files.
+        filename gets a unique suffix, so jobs on the same series do not overwrite each other
+        """
+        result_path = os.path.join(self.result_dir, f'{filename}_{uuid.uuid4().hex[:12]}')
         if isinstance(result_data, dict):
-            zip_path = result_path + '.zip'
-            with zipfile.ZipFile(zip_path, 'w') as zipf:
-                for name, data in result_data.items():
-                    if isinstance(data, np.ndarray):
-                        temp_file = os.path.join(self.temp_dir, name)
-                        if data.ndim == 2:
-                            Image.fromarray(data.astype(np.uint8)).save(temp_file)
-                        else:
-                            np.save(temp_file, data)
-                        zipf.write(temp_file, name)
-                    else:
-                        temp_file = os.path.join(self.temp_dir, name)
-                        with open(temp_file, 'w') as f:
-                            if isinstance(data, (dict, list)):
-                                json.dump(data, f)
-                            else:
-                                f.write(str(data))
-                        zipf.write(temp_file, name)
-            return zip_path
-        else:
-            if isinstance(result_data, np.ndarray):
-                np.save(result_path, result_data)
+            entries = (entry for name, data in result_data.items() for entry in export.array_entries(name, data))
+            return export.write_zip(result_path + '.zip', entries)
+        os.makedirs(self.result_dir, exist_ok=True)
+        if isinstance(result_data, np.ndarray):
+            np.save(result_path, result_data)
+            return result_path + '.npy'
+        with open(result_path, 'w') as f:
+            if isinstance(result_data, (dict, list)):
+                json.dump(result_data, f)
             else:
-                with open(result_path, 'w') as f:
-                    if isinstance(result_data, (dict, list)):
-                        json.dump(result_data, f)
-                    else:
-                        f.write(str(result_data))
-            return result_path
+                f.write(str(result_data))
+        return result_path
 
 
 class MPRProcessor(BaseProcessor):
@@ -96,18 +82,18 @@ class MPRProcessor(BaseProcessor):
         axial_slices = []
         step = max(1, int(slice_thickness))
         for i in range(0, depth, step):
-            axial_slices.append(self.normalize_slice(volume[i]))
+            axial_slices.append(self.normalize_slice(volume.rescale(volume.plane('axial', i))))
         results['axial'] = np.array(axial_slices)
         sagittal_slices = []
         for i in range(0, width, step):
-            sagittal_slice = volume[:, :, i]
+            sagittal_slice = volume.rescale(volume.plane('sagittal', i))
             if interpolation == 'linear':
                 sagittal_slice = ndimage.zoom(sagittal_slice, [spacing[0] / max(spacing[1], 1e-6), 1.0], order=1)
             sagittal_slices.append(self.normalize_slice(sagittal_slice))
         results['sagittal'] = np.array(sagittal_slices)
         coronal_slices = []
         for i in range(0, height, step):
-            coronal_slice = volume[:, i, :]
+            coronal_slice = volume.rescale(volume.plane('coronal', i))
             if interpolation == 'linear':
                 coronal_slice = ndimage.zoom(coronal_slice, [spacing[0] / max(spacing[2], 1e-6), 1.0], order=1)
             coronal_slices.append(self.normalize_slice(coronal_slice))
@@ -154,16 +140,24 @@ class MIPProcessor(BaseProcessor):
             proj_func = np.min
         else:
             proj_func = np.mean
-        axial_mip = proj_func(volume, axis=0)
+        if volume.slope < 0 and proj_func is not np.mean:
+            # A negative rescale reverses the order of stored values
+            proj_func = np.min if proj_func is np.max else np.max
+
+        def project(data, axis):
+            """Projection of stored values, in modality units"""
+            return volume.rescale(proj_func(data, axis=axis))
+
+        axial_mip = project(volume.data, 0)
         results['axial_mip'] = self.normalize_slice(axial_mip)
-        sagittal_mip = proj_func(volume, axis=2)
+        sagittal_mip = project(volume.data, 2)
         results['sagittal_mip'] = self.normalize_slice(sagittal_mip)
-        coronal_mip = proj_func(volume, axis=1)
+        coronal_mip = project(volume.data, 1)
         results['coronal_mip'] = self.normalize_slice(coronal_mip)
         if angle_step and angle_step > 0:
-            results.update(self.generate_rotating_mip(volume, angle_step, proj_func))
+            results.update(self.generate_rotating_mip(volume.data, angle_step, project))
         if slab_thickness:
-            results.update(self.generate_slab_mip(volume, slab_thickness, proj_func))
+            results.update(self.generate_slab_mip(volume.data, slab_thickness, project))
         results['metadata.json'] = {
             'projection_type': projection_type,
             'slab_thickness': slab_thickness,
@@ -173,21 +167,21 @@ class MIPProcessor(BaseProcessor):
         }
         return results
 
-    def generate_rotating_mip(self, volume, angle_step, proj_func):
+    def generate_rotating_mip(self, volume, angle_step, project):
         results = {}
         for angle in range(0, 360, angle_step):
             rotated_volume = ndimage.rotate(volume, angle, axes=(1, 2), reshape=False)
-            mip = proj_func(rotated_volume, axis=2)
+            mip = project(rotated_volume, 2)
             results[f'rotating_mip_{angle:03d}'] = self.normalize_slice(mip)
         return results
 
-    def generate_slab_mip(self, volume, slab_thickness, proj_func):
+    def generate_slab_mip(self, volume, slab_thickness, project):
         results = {}
         depth = volume.shape[0]
         step = max(1, slab_thickness // 2)
         for i in range(0, depth - slab_thickness + 1, step):
             slab = volume[i:i + slab_thickness]
-            slab_mip = proj_func(slab, axis=0)
+            slab_mip = project(slab, 0)
             results[f'slab_mip_{i:03d}'] = self.normalize_slice(slab_mip)
         return results
 
@@ -216,7 +210,7 @@ class Bone3DProcessor(BaseProcessor):
 
     def generate_bone_reconstruction(self, volume, spacing, threshold, smoothing, decimation):
         results = {}
-        bone_mask = volume > threshold
+        bone_mask = volume.at_least(threshold, strict=True)
         if smoothing:
             bone_mask = morphology.binary_closing(bone_mask, morphology.ball(2))
             bone_mask = morphology.binary_opening(bone_mask, morphology.ball(1))
@@ -303,7 +297,9 @@ class MRI3DProcessor(BaseProcessor):
             segmentation_method = parameters.get('segmentation_method', 'threshold')
             tissue_type = parameters.get('tissue_type', 'brain')
             smoothing = parameters.get('smoothing', True)
-            mri_results = self.generate_mri_reconstruction(volume, spacing, segmentation_method, tissue_type, smoothing)
+            # Segmentation and contrast simulation work on modality values in float
+            mri_results = self.generate_mri_reconstruction(volume.rescale(volume.data), spacing, segmentation_method,
+                                                           tissue_type, smoothing)
             result_path = self.save_result(mri_results, f'mri_3d_reconstruction_{series.id}')
             return result_path
         except Exception as e:
@@ -0,0 +1,6 @@
+from django.urls import re_path
+from . import consumers
+
+websocket_urlpatterns = [
+    re_path(r'ws/cine/(?P<series_id>\d+)/$', consumers.CineConsumer.as_asgi()),
+]
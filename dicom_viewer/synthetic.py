@@ -0,0 +1,166 @@
+"""
+Synthetic DICOM generator for benchmarks and load tests.
+
+Produces deterministic CT, MR, CR/DX and multi-frame datasets with a simple
+anatomical phantom (body ellipse, soft tissue, bone ring) so windowing,
+thresholding and MIP work on realistic value ranges. No patient data is used.
+"""
+import os
+
+import numpy as np
+from pydicom.dataset import Dataset, FileMetaDataset
+from pydicom.uid import ExplicitVRLittleEndian, generate_uid
+
+SOP_CLASSES = {
+    'CT': '1.2.840.10008.5.1.4.1.1.2',          # CT Image Storage
+    'MR': '1.2.840.10008.5.1.4.1.1.4',          # MR Image Storage
+    'CR': '1.2.840.10008.5.1.4.1.1.1',          # CR Image Storage
+    'DX': '1.2.840.10008.5.1.4.1.1.1.1',        # Digital X-Ray Image Storage
+    'MF': '1.2.840.10008.5.1.4.1.1.2.1',        # Enhanced CT Image Storage
+}
+
+# Default geometry per kind: (slices, rows, cols)
+DEFAULT_SHAPES = {
+    'CT': (64, 512, 512),
+    'MR': (32, 256, 256),
+    'CR': (1, 2048, 2048),
+    'DX': (1, 2048, 2048),
+    'MF': (64, 256, 256),
+}
+
+
+def phantom_volume(kind, slices, rows, cols, seed=0):
+    """Stored-value (pre-rescale) int16/uint16 phantom of shape (slices, rows, cols)"""
+    rng = np.random.default_rng(seed)
+    zz = np.linspace(-1.0, 1.0, max(slices, 1), dtype=np.float32)[:, None, None]
+    yy = np.linspace(-1.0, 1.0, rows, dtype=np.float32)[None, :, None]
+    xx = np.linspace(-1.0, 1.0, cols, dtype=np.float32)[None, None, :]
+
+    body = (xx / 0.85) ** 2 + (yy / 0.65) ** 2 + (zz / 1.2) ** 2 <= 1.0
+    spine = ((xx / 0.12) ** 2 + ((yy - 0.35) / 0.12) ** 2) <= 1.0
+    ring = np.abs(np.sqrt((xx / 0.7) ** 2 + (yy / 0.5) ** 2) - 1.0) < 0.04
+
+    if kind in ('CT', 'MF'):
+        # HU values, stored with intercept -1024
+        hu = np.full((slices, rows, cols), -1000.0, dtype=np.float32)
+        hu = np.where(body, 40.0, hu)
+        hu = np.where(body & ring, 700.0, hu)
+        hu = np.where(body & spine, 1200.0, hu)
+        hu += rng.normal(0.0, 12.0, hu.shape).astype(np.float32)
+        return np.clip(hu + 1024.0, 0, 4095).astype(np.uint16)
+    if kind == 'MR':
+        sig = np.where(body, 600.0, 20.0).astype(np.float32)
+        sig = np.where(body & spine, 250.0, sig)
+        sig += rng.normal(0.0, 15.0, sig.shape).astype(np.float32)
+        return np.clip(sig, 0, 4095).astype(np.uint16)
+    # Projection radiograph: attenuation integrated through the body
+    atten = body.sum(axis=0).astype(np.float32) + 3.0 * (body & (ring | spine)).sum(axis=0)
+    atten = atten / max(float(atten.max()), 1.0)
+    img = 3500.0 - 3000.0 * atten[None] + rng.normal(0.0, 20.0, (1, rows, cols))
+    return np.clip(img, 0, 4095).astype(np.uint16)
+
+
+def _base_dataset(kind, study_uid, series_uid, patient_id, series_number, sop_class):
+    meta = FileMetaDataset()
+    meta.MediaStorageSOPClassUID = sop_class
+    meta.TransferSyntaxUID = ExplicitVRLittleEndian
+    meta.ImplementationClassUID = generate_uid()
+
+    ds = Dataset()
+    ds.file_meta = meta
+    ds.SOPClassUID = sop_class
+    ds.PatientName = f'SYNTHETIC^{kind}'
+    ds.PatientID = patient_id
+    ds.PatientBirthDate = '19700101'
+    ds.PatientSex = 'O'
+    ds.StudyInstanceUID = study_uid
+    ds.SeriesInstanceUID = series_uid
+    ds.StudyDate = '20240101'
+    ds.StudyTime = '120000'
+    ds.AccessionNumber = f'SYN{series_number:04d}'
+    ds.StudyDescription = f'Synthetic {kind} benchmark'
+    ds.SeriesDescription = f'Synthetic {kind} series'
+    ds.SeriesNumber = series_number
+    ds.Modality = 'CT' if kind == 'MF' else kind
+    ds.ReferringPhysicianName = ''
+    ds.BodyPartExamined = 'CHEST'
+    ds.SamplesPerPixel = 1
+    ds.PhotometricInterpretation = 'MONOCHROME2'
+    ds.BitsAllocated = 16
+    ds.BitsStored = 12
+    ds.HighBit = 11
+    ds.PixelRepresentation = 0
+    ds.PixelSpacing = [0.7, 0.7]
+    ds.SliceThickness = 1.25 if kind in ('CT', 'MF') else 4.0
+    ds.ImageOrientationPatient = [1, 0, 0, 0, 1, 0]
+    if kind in ('CT', 'MF'):
+        ds.RescaleIntercept = -1024
+        ds.RescaleSlope = 1
+        ds.WindowCenter = 40
+        ds.WindowWidth = 400
+    elif kind == 'MR':
+        ds.WindowCenter = 300
+        ds.WindowWidth = 800
+    else:
+        ds.WindowCenter = 2000
+        ds.WindowWidth = 4000
+    return ds
+
+
+def iter_series(kind='CT', slices=None, rows=None, cols=None, series_number=1,
+                study_uid=None, patient_id='SYN0001', seed=0):
+    """
+    Yield pydicom Datasets for one synthetic series. Multi-frame ('MF') yields
+    a single dataset holding every frame; CR/DX yield a single image.
+    """
+    kind = kind.upper()
+    if kind not in SOP_CLASSES:
+        raise ValueError(f'Unknown synthetic kind {kind!r}')
+    d_slices, d_rows, d_cols = DEFAULT_SHAPES[kind]
+    slices = 1 if kind in ('CR', 'DX') else (slices or d_slices)
+    rows = rows or d_rows
+    cols = cols or d_cols
+
+    study_uid = study_uid or generate_uid()
+    series_uid = generate_uid()
+    volume = phantom_volume(kind, slices, rows, cols, seed=seed)
+    thickness = 1.25 if kind in ('CT', 'MF') else 4.0
+
+    if kind == 'MF':
+        ds = _base_dataset(kind, study_uid, series_uid, patient_id, series_number, SOP_CLASSES[kind])
+        ds.SOPInstanceUID = generate_uid()
+        ds.file_meta.MediaStorageSOPInstanceUID = ds.SOPInstanceUID
+        ds.InstanceNumber = 1
+        ds.NumberOfFrames = slices
+        ds.Rows, ds.Columns = rows, cols
+        ds.ImagePositionPatient = [0.0, 0.0, 0.0]
+        ds.PixelData = volume.tobytes()
+        yield ds
+        return
+
+    for i in range(slices):
+        ds = _base_dataset(kind, study_uid, series_uid, patient_id, series_number, SOP_CLASSES[kind])
+        ds.SOPInstanceUID = generate_uid()
+        ds.file_meta.MediaStorageSOPInstanceUID = ds.SOPInstanceUID
+        ds.InstanceNumber = i + 1
+        ds.Rows, ds.Columns = rows, cols
+        z = i * thickness
+        ds.ImagePositionPatient = [0.0, 0.0, z]
+        ds.SliceLocation = z
+        ds.PixelData = volume[i].tobytes()
+        yield ds
+
+
+def write_series(out_dir, kind='CT', **kwargs):
+    """Write a synthetic series to out_dir; returns the list of file paths"""
+    os.makedirs(out_dir, exist_ok=True)
+    paths = []
+    for ds in iter_series(kind, **kwargs):
+        path = os.path.join(out_dir, f'{ds.SOPInstanceUID}.dcm')
+        try:
+            ds.save_as(path, enforce_file_format=True)
+        except TypeError:
+            # pydicom < 3
+            ds.save_as(path, write_like_original=False)
+        paths.append(path)
+    return paths
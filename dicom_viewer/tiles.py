@@ -0,0 +1,316 @@
+"""
+Tiled image pyramids for large projection images (CR/DX/MG and the like).
+
+``api_dicom_image_display`` renders an image as one full-resolution data URL.
+For a 4000x5000 mammogram that means a multi-megabyte response. Before the
+first paint, the whole image also goes through the X-ray enhancement
+(Gaussian smoothing and p1-p99 clipping). Here an image is cut into
+``TILE_SIZE`` square tiles at power-of-two scales:
+
+* level 0 is full resolution. Level k is 2**k times smaller, built by 2x2
+  averaging from level k-1, up to the level that fits in one tile. Levels
+  are built when first asked for, so an overview paints after one
+  decode and a few halvings;
+* the X-ray enhancement is applied per tile: the Gaussian (sigma 0.5, radius
+  2) on a level-0 tile read with a 2-pixel margin gives the same pixels as on
+  the full image. The clip bounds are p1/p99 of the smoothed full-resolution
+  image, as ``_enhance_xray`` computes them for the display render, shared by
+  every tile so that levels match;
+* encoded tiles are cached per window, inversion and format
+  (``TILE_CACHE_MB``), and pyramids per image (``TILE_PYRAMID_CACHE_MB``).
+
+``api_image_tiles`` describes the pyramid (size, levels, default window) and
+``api_image_tile`` returns one tile as an image. ``api_dicom_image_display``
+returns a ``preview`` level of a tiled image instead of full resolution; the
+viewer lays the visible tiles of the level matching its zoom over it.
+"""
+import logging
+import os
+import threading
+from collections import OrderedDict
+
+import numpy as np
+import pydicom
+from django.conf import settings
+from pydicom.pixel_data_handlers.util import apply_voi_lut
+
+from noctis_pro import metrics
+
+logger = logging.getLogger(__name__)
+
+TILE_SIZE = 256
+# Modalities whose display applies the VOI LUT, and those also given the X-ray enhancement
+VOI_MODALITIES = ('DX', 'CR', 'XA', 'RF', 'MG')
+ENHANCED_MODALITIES = ('DX', 'CR', 'XA', 'RF')
+# Gaussian of the X-ray enhancement and the margin that makes per-tile filtering exact
+_SIGMA = 0.5
+_MARGIN = 2
+# Longest side of the level returned by Pyramid.preview
+PREVIEW_SIZE = 1024
+
+
+def _setting(name, default):
+    value = getattr(settings, name, None)
+    return default if value is None else value
+
+
+def _first(value):
+    return value[0] if hasattr(value, '__iter__') and not isinstance(value, str) else value
+
+
+def _halve(level):
+    """2x2 mean (float32); an odd last row or column is averaged with itself"""
+    height, width = level.shape
+    if height % 2 or width % 2:
+        level = np.pad(level, ((0, height % 2), (0, width % 2)), mode='edge')
+    # Pairwise sums over strided views: several times faster than a reshaped mean
+    rows = np.add(level[0::2], level[1::2], dtype=np.float32)
+    halved = np.add(rows[:, 0::2], rows[:, 1::2])
+    halved *= np.float32(0.25)
+    return halved
+
+
+class Pyramid:
+    """Levels and display parameters of one image. Level 0 holds the stored values
+    (after the VOI LUT), the smaller levels float32 modality values.
+    """
+
+    def __init__(self, image_id, pixels, ds):
+        self.image_id = image_id
+        self.modality = str(getattr(ds, 'Modality', '')).upper()
+        self.slope = float(getattr(ds, 'RescaleSlope', 1.0) or 1.0)
+        self.intercept = float(getattr(ds, 'RescaleIntercept', 0.0) or 0.0)
+        self.enhanced = self.modality in ENHANCED_MODALITIES
+        self.height, self.width = pixels.shape
+        self.levels = [pixels]
+        size = max(self.height, self.width)
+        self.level_count = 1
+        while size > TILE_SIZE:
+            size = (size + 1) // 2
+            self.level_count += 1
+        self._lock = threading.Lock()
+
+        self.clip = None
+        if self.enhanced:
+            from scipy import ndimage
+
+            # Same values as the display render's enhancement, so full-resolution tiles match it
+            full = self._modality(pixels)
+            p1, p99 = np.percentile(ndimage.gaussian_filter(full, sigma=_SIGMA), [1, 99])
+            del full
+            if p99 > p1:
+                self.clip = (float(p1), float(p99))
+
+        try:
+            self.window = (float(_first(ds.WindowWidth)), float(_first(ds.WindowCenter)))
+        except (AttributeError, TypeError, ValueError, IndexError):
+            from .dicom_utils import DicomProcessor
+            overview = self.level(self.level_count - 1)
+            self.window = DicomProcessor().auto_window_from_data(overview, percentile_range=(2, 98),
+                                                                 modality=self.modality or 'CT')
+        photo = str(getattr(ds, 'PhotometricInterpretation', '')).upper()
+        self.inverted = self.modality in ENHANCED_MODALITIES and photo == 'MONOCHROME1'
+
+    @property
+    def nbytes(self):
+        return sum(level.nbytes for level in self.levels)
+
+    def _modality(self, stored):
+        values = stored.astype(np.float32)
+        if self.slope != 1.0 or self.intercept != 0.0:
+            values *= np.float32(self.slope)
+            values += np.float32(self.intercept)
+        return values
+
+    def preview(self):
+        """(level, modality values with the X-ray clip applied) of the largest level within
+        PREVIEW_SIZE, for a whole-image first paint
+        """
+        k = 0
+        while k + 1 < self.level_count and max(self.level_shape(k)) > PREVIEW_SIZE:
+            k += 1
+        values = self.level(k) if k else self._modality(self.levels[0])
+        if self.clip is not None:
+            values = np.clip(values, *self.clip, dtype=np.float32)
+        return k, values
+
+    def level(self, k):
+        """Level k as modality values (level 0: stored values), building missing levels"""
+        with self._lock:
+            while len(self.levels) <= k:
+                halved = _halve(self.levels[-1])
+                if len(self.levels) == 1:
+                    # Rescale is linear, so it commutes with the mean
+                    halved *= np.float32(self.slope)
+                    halved += np.float32(self.intercept)
+                self.levels.append(halved)
+            return self.levels[k]
+
+    def level_shape(self, k):
+        height, width = self.height, self.width
+        for _ in range(k):
+            height, width = (height + 1) // 2, (width + 1) // 2
+        return height, width
+
+    def grid(self, k):
+        """(columns, rows) of tiles at level k"""
+        height, width = self.level_shape(k)
+        return -(-width // TILE_SIZE), -(-height // TILE_SIZE)
+
+    def describe(self):
+        return {
+            'width': self.width,
+            'height': self.height,
+            'tile_size': TILE_SIZE,
+            'levels': [{'level': k, 'width': self.level_shape(k)[1], 'height': self.level_shape(k)[0],
+                        'columns': self.grid(k)[0], 'rows': self.grid(k)[1]}
+                       for k in range(self.level_count)],
+            'default_window_width': float(self.window[0]),
+            'default_window_level': float(self.window[1]),
+            'default_inverted': self.inverted,
+            'modality': self.modality,
+        }
+
+    def tile(self, k, col, row, window_width, window_level, inverted):
+        """Display uint8 pixels of one tile"""
+        from . import rendering
+
+        if not (0 <= k < self.level_count):
+            raise ValueError('Invalid level')
+        columns, rows = self.grid(k)
+        if not (0 <= col < columns and 0 <= row < rows):
+            raise ValueError('Invalid tile')
+        data = self.level(k)
+        height, width = data.shape
+        y0, x0 = row * TILE_SIZE, col * TILE_SIZE
+        y1, x1 = min(height, y0 + TILE_SIZE), min(width, x0 + TILE_SIZE)
+        slope, intercept = (self.slope, self.intercept) if k == 0 else (1.0, 0.0)
+
+        if k == 0 and self.enhanced:
+            from scipy import ndimage
+
+            # Filter with a margin, then keep the tile: identical to filtering the whole image
+            my0, mx0 = max(0, y0 - _MARGIN), max(0, x0 - _MARGIN)
+            my1, mx1 = min(height, y1 + _MARGIN), min(width, x1 + _MARGIN)
+            region = data[my0:my1, mx0:mx1].astype(np.float32)
+            if slope != 1.0 or intercept != 0.0:
+                region *= np.float32(slope)
+                region += np.float32(intercept)
+            region = ndimage.gaussian_filter(region, sigma=_SIGMA)[y0 - my0:y1 - my0, x0 - mx0:x1 - mx0]
+            slope, intercept = 1.0, 0.0
+        else:
+            region = data[y0:y1, x0:x1]
+        if self.clip is not None:
+            region = np.clip(region, *self.clip, dtype=np.float32) if k else np.clip(region, *self.clip, out=region)
+        return rendering.window_to_uint8(region, window_width, window_level, inverted, slope, intercept)
+
+
+class _ByteLRU:
+    """Thread-safe LRU bounded by the summed size of its values"""
+
+    def __init__(self, name, budget_setting, default_mb):
+        self.name = name
+        self._budget_setting = budget_setting
+        self._default_mb = default_mb
+        self._lock = threading.Lock()
+        self._items = OrderedDict()
+        self._bytes = 0
+        self._pid = None
+
+    def get(self, key):
+        with self._lock:
+            if self._pid != os.getpid():
+                self._pid = os.getpid()
+                self._items, self._bytes = OrderedDict(), 0
+            value = self._items.get(key)
+            if value is not None:
+                self._items.move_to_end(key)
+        if value is not None:
+            metrics.cache_hit(self.name)
+        else:
+            metrics.cache_miss(self.name)
+        return value
+
+    def put(self, key, value, size):
+        budget = int(float(_setting(self._budget_setting, self._default_mb)) * (1 << 20))
+        with self._lock:
+            old = self._items.pop(key, None)
+            if old is not None:
+                self._bytes -= old[1]
+            self._items[key] = (value, size)
+            self._bytes += size
+            while self._bytes > budget and len(self._items) > 1:
+                _, (_, evicted) = self._items.popitem(last=False)
+                self._bytes -= evicted
+                metrics.CACHE_EVICTIONS.inc(cache=self.name)
+        metrics.CACHE_STORED_BYTES.inc(size, cache=self.name)
+
+
+_pyramids = _ByteLRU('tile_pyramid', 'TILE_PYRAMID_CACHE_MB', 512)
+_tiles = _ByteLRU('tile', 'TILE_CACHE_MB', 128)
+_build_locks_lock = threading.Lock()
+_build_locks = {}
+
+
+def _load(image):
+    from . import headers
+
+    path = headers.stored_path(image.file_path)
+    record = headers.of(image)
+    if (record and headers.native(record)
+            and (record.get('modality', '').upper() not in VOI_MODALITIES or headers.voi_identity(record))):
+        # Read at the pixel data offset; the header record stands in for the dataset
+        return Pyramid(image.id, headers.read_pixels(path, record), headers.Header(record))
+    ds = pydicom.dcmread(path)
+    pixels = metrics.decode_pixels(ds)
+    if int(getattr(ds, 'SamplesPerPixel', 1) or 1) != 1:
+        raise ValueError('Tiled display supports monochrome images only')
+    if pixels.ndim == 3:
+        pixels = pixels[0]
+    if str(getattr(ds, 'Modality', '')).upper() in VOI_MODALITIES:
+        try:
+            pixels = apply_voi_lut(pixels, ds)
+        except Exception:
+            pass
+    return Pyramid(image.id, pixels, ds)
+
+
+def pyramid(image):
+    """The image's pyramid, decoding it once even when many tiles are requested at the same time"""
+    cached = _pyramids.get(image.id)
+    if cached is not None:
+        return cached[0]
+    with _build_locks_lock:
+        lock = _build_locks.setdefault(image.id, threading.Lock())
+    with lock:
+        cached = _pyramids.get(image.id)
+        if cached is None:
+            built = _load(image)
+            # Room for the smaller levels built later (a third of level 0 as float32)
+            _pyramids.put(image.id, built, built.nbytes + built.height * built.width * 4 // 3)
+            cached = (built,)
+    with _build_locks_lock:
+        _build_locks.pop(image.id, None)
+    return cached[0]
+
+
+def tile(image, level, col, row, window_width=None, window_level=None, inverted=None, fmt='png'):
+    """Encoded tile bytes; window and inversion default to the pyramid's"""
+    from . import rendering
+
+    source = pyramid(image)
+    ww = float(source.window[0] if window_width is None else window_width)
+    wl = float(source.window[1] if window_level is None else window_level)
+    inv = source.inverted if inverted is None else bool(inverted)
+    key = (image.id, level, col, row, round(ww, 2), round(wl, 2), inv, fmt)
+    cached = _tiles.get(key)
+    if cached is not None:
+        return cached[0]
+    body = rendering.encode(source.tile(level, col, row, ww, wl, inv), fmt)
+    _tiles.put(key, body, len(body))
+    return body
+
+
+def recommended(rows, columns):
+    """Whether an image of this size should be displayed tiled"""
+    return int(rows or 0) * int(columns or 0) >= int(_setting('TILE_MIN_PIXELS', 4_000_000))
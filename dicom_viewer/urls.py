@@ -20,12 +20,19 @@ urlpatterns = [
     path('api/study/<int:study_id>/data/', views.api_study_data, name='api_study_data'),
     path('api/image/<int:image_id>/data/', views.api_image_data, name='api_image_data'),
     path('api/image/<int:image_id>/display/', views.api_dicom_image_display, name='api_dicom_image_display'),
+    path('api/image/<int:image_id>/tiles/', views.api_image_tiles, name='api_image_tiles'),
+    path('api/image/<int:image_id>/tiles/<int:level>/<int:col>/<int:row>/', views.api_image_tile, name='api_image_tile'),
+    path('api/image/<int:image_id>/export/', views.api_export_image, name='api_export_image'),
+    path('api/series/<int:series_id>/export/', views.api_export_series, name='api_export_series'),
+    path('api/study/<int:study_id>/export/', views.api_export_study, name='api_export_study'),
+    path('api/study/<int:study_id>/measurements/export/', views.api_export_measurements, name='api_export_measurements'),
     
     # Advanced reconstruction endpoints
     path('api/series/<int:series_id>/mpr/', views.api_mpr_reconstruction, name='api_mpr_reconstruction'),
     path('api/series/<int:series_id>/mip/', views.api_mip_reconstruction, name='api_mip_reconstruction'),
     path('api/series/<int:series_id>/bone/', views.api_bone_reconstruction, name='api_bone_reconstruction'),
     path('api/series/<int:series_id>/sr-export/', views.api_series_sr_export, name='api_series_sr_export'),
+    path('api/series/<int:series_id>/cine/', views.api_cine_mode, name='api_cine_mode'),
     path('api/hu/', views.api_hu_value, name='api_hu_value'),
     path('api/hounsfield-units/', views.api_hounsfield_units, name='api_hounsfield_units'),
     path('api/auto-window/<int:image_id>/', views.api_auto_window, name='api_auto_window'),
@@ -48,6 +55,7 @@ urlpatterns = [
     # Presets and hanging protocols
     path('api/presets/', views.api_user_presets, name='api_user_presets'),
     path('api/hanging/', views.api_hanging_protocols, name='api_hanging_protocols'),
+    path('api/render/batch/', views.api_batch_render, name='api_batch_render'),
     # DICOM SR export
     path('api/study/<int:study_id>/export-sr/', views.api_export_dicom_sr, name='api_export_dicom_sr'),
     # Volume endpoint for GPU VR
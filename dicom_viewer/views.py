@@ -1,6 +1,6 @@
 from django.shortcuts import render, get_object_or_404, redirect
 from django.contrib.auth.decorators import login_required, user_passes_test
-from django.http import JsonResponse, HttpResponse
+from django.http import JsonResponse, HttpResponse, FileResponse, StreamingHttpResponse
 from django.views.decorators.csrf import csrf_exempt
 from django.contrib import messages
 from worklist.models import Study, Series, DicomImage, Patient, Modality
@@ -23,6 +23,7 @@ from django.views.decorators.http import require_http_methods
 from django.core.paginator import Paginator
 from django.db.models import Q, Count
 from django.conf import settings
+from django.urls import reverse
 from io import BytesIO
 from PIL import Image
 import base64
@@ -34,7 +35,9 @@ import subprocess
 from .models import ViewerSession, Measurement, Annotation, ReconstructionJob
 from .dicom_utils import DicomProcessor, safe_dicom_str
 from .reconstruction import MPRProcessor, Bone3DProcessor, MRI3DProcessor
+from . import assembly, cine, export, headers, intensity, prefetch, readahead, rendering, tiles, volumes
 from .models import WindowLevelPreset, HangingProtocol
+from noctis_pro import metrics
 
 # Initialize logger
 logger = logging.getLogger(__name__)
@@ -44,9 +47,9 @@ from threading import Lock
 import gc
 
 _MPR_CACHE_LOCK = Lock()
-_MPR_CACHE = {}  # series_id -> { 'volume': np.ndarray, 'spacing': tuple, 'timestamp': float }
+_MPR_CACHE = {}  # series_id -> { 'volume': volumes.StoredVolume, 'spacing': tuple, 'timestamp': float }
 _MPR_CACHE_ORDER = []
-_MAX_MPR_CACHE = 6  # Increased cache size for better performance
+_MAX_MPR_CACHE = 12  # Volumes are held as 16-bit stored values, half the size of float32
 
 # Encoded MPR slice cache (LRU) to avoid repeated windowing+encoding per slice/plane/WW/WL
 _MPR_IMG_CACHE_LOCK = Lock()
@@ -54,11 +57,35 @@ _MPR_IMG_CACHE = {}  # key -> base64 data URL
 _MPR_IMG_CACHE_ORDER = []  # list of keys in LRU order
 _MAX_MPR_IMG_CACHE = 800
 
-def _mpr_cache_key(series_id, plane, slice_index, ww, wl, inverted):
-    return f"{series_id}|{plane}|{int(slice_index)}|{int(round(float(ww)))}|{int(round(float(wl)))}|{1 if inverted else 0}"
+# api_dicom_image_display responses (LRU), filled by requests and by scroll read-ahead
+_STACK_IMG_CACHE_LOCK = Lock()
+_STACK_IMG_CACHE = {}  # key -> response payload dict
+_STACK_IMG_CACHE_ORDER = []  # list of keys in LRU order
+_MAX_STACK_IMG_CACHE = 400
 
-def _mpr_cache_get(series_id, plane, slice_index, ww, wl, inverted):
-    key = _mpr_cache_key(series_id, plane, slice_index, ww, wl, inverted)
+def _mpr_cache_sizes():
+    with _MPR_CACHE_LOCK:
+        volume_bytes = sum(int(getattr(e.get('volume'), 'nbytes', 0)) for e in _MPR_CACHE.values())
+        volume_entries = len(_MPR_CACHE)
+    with _MPR_IMG_CACHE_LOCK:
+        slice_bytes = sum(len(v) for v in _MPR_IMG_CACHE.values())
+        slice_entries = len(_MPR_IMG_CACHE)
+    with _STACK_IMG_CACHE_LOCK:
+        stack_bytes = sum(len(v.get('image_data') or '') for v in _STACK_IMG_CACHE.values())
+        stack_entries = len(_STACK_IMG_CACHE)
+    return volume_entries, volume_bytes, slice_entries, slice_bytes, stack_entries, stack_bytes
+
+_CACHE_GAUGE_LABELS = [('mpr_volume',), ('mpr_slice',), ('stack_image',)]
+metrics.gauge('noctis_cache_entries', 'Entries currently held per cache', ('cache',),
+              callback=lambda: dict(zip(_CACHE_GAUGE_LABELS, _mpr_cache_sizes()[0::2])))
+metrics.gauge('noctis_cache_bytes', 'Bytes currently held per cache', ('cache',),
+              callback=lambda: dict(zip(_CACHE_GAUGE_LABELS, _mpr_cache_sizes()[1::2])))
+
+def _mpr_cache_key(series_id, plane, slice_index, ww, wl, inverted, fmt='png'):
+    return f"{series_id}|{plane}|{int(slice_index)}|{int(round(float(ww)))}|{int(round(float(wl)))}|{1 if inverted else 0}|{fmt}"
+
+def _mpr_cache_get(series_id, plane, slice_index, ww, wl, inverted, fmt='png'):
+    key = _mpr_cache_key(series_id, plane, slice_index, ww, wl, inverted, fmt)
     with _MPR_IMG_CACHE_LOCK:
         val = _MPR_IMG_CACHE.get(key)
         if val is not None:
@@ -67,56 +94,118 @@ def _mpr_cache_get(series_id, plane, slice_index, ww, wl, inverted):
             except ValueError:
                 pass
             _MPR_IMG_CACHE_ORDER.append(key)
-        return val
+    if val is not None:
+        metrics.cache_hit('mpr_slice')
+    else:
+        metrics.cache_miss('mpr_slice')
+    return val
+
+def _mpr_cache_contains(series_id, plane, slice_index, ww, wl, inverted, fmt='png'):
+    """Whether the slice is cached, without touching LRU order or hit/miss counts"""
+    key = _mpr_cache_key(series_id, plane, slice_index, ww, wl, inverted, fmt)
+    with _MPR_IMG_CACHE_LOCK:
+        return key in _MPR_IMG_CACHE
 
-def _mpr_cache_set(series_id, plane, slice_index, ww, wl, inverted, img_b64):
-    key = _mpr_cache_key(series_id, plane, slice_index, ww, wl, inverted)
+def _mpr_cache_set(series_id, plane, slice_index, ww, wl, inverted, img_b64, fmt='png'):
+    key = _mpr_cache_key(series_id, plane, slice_index, ww, wl, inverted, fmt)
     with _MPR_IMG_CACHE_LOCK:
         if key not in _MPR_IMG_CACHE:
             while len(_MPR_IMG_CACHE_ORDER) >= _MAX_MPR_IMG_CACHE:
                 evict = _MPR_IMG_CACHE_ORDER.pop(0)
                 _MPR_IMG_CACHE.pop(evict, None)
+                metrics.CACHE_EVICTIONS.inc(cache='mpr_slice')
         _MPR_IMG_CACHE[key] = img_b64
+        metrics.CACHE_STORED_BYTES.inc(len(img_b64), cache='mpr_slice')
         try:
             _MPR_IMG_CACHE_ORDER.remove(key)
         except ValueError:
             pass
         _MPR_IMG_CACHE_ORDER.append(key)
 
-def _get_encoded_mpr_slice(series_id, volume, plane, slice_index, ww, wl, inverted):
-    """Get encoded base64 PNG for given MPR slice, using cache if possible.
-    volume is a numpy array (depth,height,width).
+def _stack_cache_key(image_id, ww_param, wl_param, inverted_param, fmt):
+    return f"{image_id}|{ww_param}|{wl_param}|{inverted_param}|{fmt}"
+
+def _stack_cache_contains(image_id, ww_param, wl_param, inverted_param, fmt):
+    key = _stack_cache_key(image_id, ww_param, wl_param, inverted_param, fmt)
+    with _STACK_IMG_CACHE_LOCK:
+        return key in _STACK_IMG_CACHE
+
+def _stack_cache_get(image_id, ww_param, wl_param, inverted_param, fmt):
+    key = _stack_cache_key(image_id, ww_param, wl_param, inverted_param, fmt)
+    with _STACK_IMG_CACHE_LOCK:
+        val = _STACK_IMG_CACHE.get(key)
+        if val is not None:
+            try:
+                _STACK_IMG_CACHE_ORDER.remove(key)
+            except ValueError:
+                pass
+            _STACK_IMG_CACHE_ORDER.append(key)
+    if val is not None:
+        metrics.cache_hit('stack_image')
+    else:
+        metrics.cache_miss('stack_image')
+    return val
+
+def _stack_cache_set(image_id, ww_param, wl_param, inverted_param, fmt, payload):
+    key = _stack_cache_key(image_id, ww_param, wl_param, inverted_param, fmt)
+    with _STACK_IMG_CACHE_LOCK:
+        if key not in _STACK_IMG_CACHE:
+            while len(_STACK_IMG_CACHE_ORDER) >= _MAX_STACK_IMG_CACHE:
+                evict = _STACK_IMG_CACHE_ORDER.pop(0)
+                _STACK_IMG_CACHE.pop(evict, None)
+                metrics.CACHE_EVICTIONS.inc(cache='stack_image')
+        else:
+            _STACK_IMG_CACHE_ORDER.remove(key)
+        _STACK_IMG_CACHE[key] = payload
+        metrics.CACHE_STORED_BYTES.inc(len(payload.get('image_data') or ''), cache='stack_image')
+        _STACK_IMG_CACHE_ORDER.append(key)
+
+def _get_encoded_mpr_slice(series_id, volume, plane, slice_index, ww, wl, inverted, fmt='png'):
+    """Get encoded base64 image (PNG/WebP/JPEG) for given MPR slice, using cache if possible.
+    volume is a volumes.StoredVolume (depth,height,width).
     """
-    cached = _mpr_cache_get(series_id, plane, slice_index, ww, wl, inverted)
+    cached = _mpr_cache_get(series_id, plane, slice_index, ww, wl, inverted, fmt)
     if cached is not None:
         return cached
-    
+    return _encode_mpr_slice(series_id, volume, plane, slice_index, ww, wl, inverted, fmt)
+
+def _readahead_mpr_slice(series_id, volume, plane, slice_index, ww, wl, inverted, fmt):
+    """Read-ahead render of one MPR slice into the slice cache; False if already cached"""
+    if _mpr_cache_contains(series_id, plane, slice_index, ww, wl, inverted, fmt):
+        return False
+    _encode_mpr_slice(series_id, volume, plane, slice_index, ww, wl, inverted, fmt)
+    return True
+
+def _encode_mpr_slice(series_id, volume, plane, slice_index, ww, wl, inverted, fmt='png'):
+    """Render and encode an MPR slice, caching it once the volume is complete"""
     # Validate slice index
     if plane == 'axial':
         if slice_index < 0 or slice_index >= volume.shape[0]:
             logger.warning(f"Invalid axial slice index {slice_index} for volume shape {volume.shape}")
             slice_index = min(max(0, slice_index), volume.shape[0] - 1)
-        slice_array = volume[slice_index, :, :]
+        slice_array = volume.plane('axial', slice_index)
     elif plane == 'sagittal':
         if slice_index < 0 or slice_index >= volume.shape[2]:
             logger.warning(f"Invalid sagittal slice index {slice_index} for volume shape {volume.shape}")
             slice_index = min(max(0, slice_index), volume.shape[2] - 1)
-        slice_array = volume[:, :, slice_index]
+        slice_array = volume.plane('sagittal', slice_index)
     else:  # coronal
         if slice_index < 0 or slice_index >= volume.shape[1]:
             logger.warning(f"Invalid coronal slice index {slice_index} for volume shape {volume.shape}")
             slice_index = min(max(0, slice_index), volume.shape[1] - 1)
-        slice_array = volume[:, slice_index, :]
+        slice_array = volume.plane('coronal', slice_index)
     
-    img_b64 = _array_to_base64_image(slice_array, ww, wl, inverted)
+    img_b64 = _array_to_base64_image(slice_array, ww, wl, inverted, fmt, volume.slope, volume.intercept)
     if img_b64:
-        _mpr_cache_set(series_id, plane, slice_index, ww, wl, inverted, img_b64)
+        # Slices of a partially decoded volume are refined on later requests, so not cached
+        if volume.complete:
+            _mpr_cache_set(series_id, plane, slice_index, ww, wl, inverted, img_b64, fmt)
     else:
         logger.error(f"Failed to generate base64 image for MPR slice: series={series_id}, plane={plane}, slice={slice_index}")
     return img_b64
 
 def _get_mpr_volume_for_series(series):
-    """Return a 3D numpy volume (depth, height, width) for the given series.
+    """Return a 3D volumes.StoredVolume (depth, height, width) for the given series.
     Uses a tiny LRU cache to avoid re-reading and decoding DICOMs on each request.
     """
     # Local import to avoid circular issues
@@ -126,14 +215,17 @@ def _get_mpr_volume_for_series(series):
 
     with _MPR_CACHE_LOCK:
         entry = _MPR_CACHE.get(series.id)
-        if entry is not None and isinstance(entry.get('volume'), _np.ndarray):
+        if entry is not None and entry.get('volume') is not None:
             # touch LRU order
             try:
                 _MPR_CACHE_ORDER.remove(series.id)
             except ValueError:
                 pass
             _MPR_CACHE_ORDER.append(series.id)
+            metrics.cache_hit('mpr_volume')
             return entry['volume']
+    metrics.cache_miss('mpr_volume')
+    build_start = time.perf_counter()
 
     # Build the volume (read from disk once)
     images_qs = series.images.all().order_by('slice_location', 'instance_number')
@@ -143,7 +235,7 @@ def _get_mpr_volume_for_series(series):
             dicom_path = _os.path.join(settings.MEDIA_ROOT, str(img.file_path))
             ds = _pydicom.dcmread(dicom_path)
             try:
-                pixel_array = ds.pixel_array.astype(_np.float32)
+                pixel_array = metrics.decode_pixels(ds)
             except Exception:
                 # Fallback to SimpleITK for compressed/transcoded pixel data
                 try:
@@ -152,26 +244,27 @@ def _get_mpr_volume_for_series(series):
                     px = _sitk.GetArrayFromImage(sitk_image)
                     if px.ndim == 3 and px.shape[0] == 1:
                         px = px[0]
-                    pixel_array = px.astype(_np.float32)
+                    pixel_array = px
                 except Exception:
                     continue
+            slope, intercept = 1.0, 0.0
             if hasattr(ds, 'RescaleSlope') and hasattr(ds, 'RescaleIntercept'):
                 try:
-                    pixel_array = pixel_array * float(ds.RescaleSlope) + float(ds.RescaleIntercept)
+                    slope, intercept = float(ds.RescaleSlope), float(ds.RescaleIntercept)
                 except Exception:
                     pass
-            volume_data.append(pixel_array)
+            volume_data.append((pixel_array, slope, intercept))
         except Exception:
             continue
 
     if len(volume_data) < 2:
         raise ValueError('Not enough images for MPR')
 
-    volume = _np.stack(volume_data, axis=0)
+    volume = volumes.stack(volume_data)
     # For very thin stacks, interpolate along depth to stabilize reformats
     if volume.shape[0] < 16:
         factor = max(2, int(_np.ceil(16 / max(volume.shape[0], 1))))
-        volume = ndimage.zoom(volume, (factor, 1, 1), order=1)
+        volume = volume.zoom_depth(factor, order=1)
 
     with _MPR_CACHE_LOCK:
         if series.id not in _MPR_CACHE:
@@ -179,6 +272,7 @@ def _get_mpr_volume_for_series(series):
             while len(_MPR_CACHE_ORDER) >= _MAX_MPR_CACHE:
                 evict_id = _MPR_CACHE_ORDER.pop(0)
                 _MPR_CACHE.pop(evict_id, None)
+                metrics.CACHE_EVICTIONS.inc(cache='mpr_volume')
             _MPR_CACHE[series.id] = { 'volume': volume }
             _MPR_CACHE_ORDER.append(series.id)
         else:
@@ -189,6 +283,8 @@ def _get_mpr_volume_for_series(series):
             except ValueError:
                 pass
             _MPR_CACHE_ORDER.append(series.id)
+    metrics.CACHE_STORED_BYTES.inc(int(volume.nbytes), cache='mpr_volume')
+    metrics.RECONSTRUCTION_SECONDS.observe(time.perf_counter() - build_start, kind='mpr_volume')
 
     return volume
 
@@ -329,6 +425,8 @@ def api_mpr_reconstruction(request, series_id):
     """API endpoint for Multiplanar Reconstruction (MPR)
     - If no plane is provided, returns mid-slice preview images for axial/sagittal/coronal plus counts
     - If plane is provided (?plane=axial|sagittal|coronal&slice=<idx>), returns that slice image and counts
+    - 'completeness' is the fraction of slices decoded so far: the first requests on a series are
+      answered while the volume is still being assembled, and re-requesting refines the image
     """
     series = get_object_or_404(Series, id=series_id)
     user = request.user
@@ -338,27 +436,28 @@ def api_mpr_reconstruction(request, series_id):
         return JsonResponse({'error': 'Permission denied'}, status=403)
 
     try:
-        # Load isotropically-resampled volume from cache or build once
-        volume, _spacing = _get_mpr_volume_and_spacing(series)
+        # Load isotropically-resampled volume from cache, or start assembling it
+        volume, _spacing = _get_mpr_volume_and_spacing(series, wait=False)
         
         # Validate volume data
         if volume is None or volume.size == 0:
             raise ValueError("Empty volume data")
         if volume.ndim != 3:
             raise ValueError(f"Volume must be 3D, got {volume.ndim}D")
-        if np.any(np.isnan(volume)) or np.any(np.isinf(volume)):
-            logger.warning(f"Volume contains NaN or inf values for series {series_id}")
-            volume = np.nan_to_num(volume, nan=0.0, posinf=0.0, neginf=0.0)
+        # NaN/inf can only occur in float fallback volumes, which volumes.stack cleans once
 
-        # Windowing params
+        # Windowing params: p1-p99 from the series intensity stats, built from
+        # this volume (and stored) only if ingest did not record them; a partial
+        # volume gives a window from its decoded slices without storing it
         def _derive_window(arr, fallback=(400.0, 40.0)):
             try:
-                flat = arr.astype(np.float32).flatten()
-                p1 = float(np.percentile(flat, 1))
-                p99 = float(np.percentile(flat, 99))
-                ww = max(1.0, p99 - p1)
-                wl = (p99 + p1) / 2.0
-                return ww, wl
+                stats = intensity.get_series_stats(series)
+                if not stats and arr.complete:
+                    stats = intensity.stats_from_volume(series, arr)
+                elif not stats:
+                    distribution = intensity.volume_distribution(arr.decoded())
+                    stats = distribution and intensity.summarize(distribution, series.modality)
+                return stats['mpr_window'] if stats else fallback
             except Exception:
                 return fallback
 
@@ -366,6 +465,7 @@ def api_mpr_reconstruction(request, series_id):
         ww_param = request.GET.get('window_width')
         wl_param = request.GET.get('window_level')
         inverted = request.GET.get('inverted', 'false').lower() == 'true'
+        fmt = rendering.image_format(request.GET.get('format'))
         if ww_param is None or wl_param is None:
             default_window_width, default_window_level = _derive_window(volume)
             window_width = float(ww_param) if ww_param is not None else float(default_window_width)
@@ -393,8 +493,14 @@ def api_mpr_reconstruction(request, series_id):
                 slice_index = counts[plane] // 2
             slice_index = max(0, min(counts[plane] - 1, slice_index))
 
-            # Get encoded slice via cache
-            img_b64 = _get_encoded_mpr_slice(series.id, volume, plane, slice_index, window_width, window_level, inverted)
+            # Get encoded slice via cache; scrolling a complete volume renders ahead (readahead.py)
+            hit = _mpr_cache_contains(series.id, plane, slice_index, window_width, window_level, inverted, fmt)
+            img_b64 = _get_encoded_mpr_slice(series.id, volume, plane, slice_index, window_width, window_level, inverted, fmt)
+            if volume.complete:
+                readahead.observe(request, 'mpr', series.id, plane, slice_index, counts[plane],
+                                  (window_width, window_level, inverted, fmt), hit,
+                                  lambda i: _readahead_mpr_slice(series.id, volume, plane, i, window_width,
+                                                                 window_level, inverted, fmt))
             return JsonResponse({
                 'plane': plane,
                 'index': slice_index,
@@ -402,6 +508,7 @@ def api_mpr_reconstruction(request, series_id):
                 'image': img_b64,
                 'counts': counts,
                 'volume_shape': tuple(int(x) for x in volume.shape),
+                'completeness': round(volume.completeness, 3),
                 'series_info': {
                     'id': series.id,
                     'description': series.series_description,
@@ -414,14 +521,17 @@ def api_mpr_reconstruction(request, series_id):
         axial_idx = volume.shape[0] // 2
         sagittal_idx = volume.shape[2] // 2
         coronal_idx = volume.shape[1] // 2
-        mpr_views['axial'] = _get_encoded_mpr_slice(series.id, volume, 'axial', axial_idx, window_width, window_level, inverted)
-        mpr_views['sagittal'] = _get_encoded_mpr_slice(series.id, volume, 'sagittal', sagittal_idx, window_width, window_level, inverted)
-        mpr_views['coronal'] = _get_encoded_mpr_slice(series.id, volume, 'coronal', coronal_idx, window_width, window_level, inverted)
+        mpr_views['axial'], mpr_views['sagittal'], mpr_views['coronal'] = rendering.parallel(
+            lambda: _get_encoded_mpr_slice(series.id, volume, 'axial', axial_idx, window_width, window_level, inverted, fmt),
+            lambda: _get_encoded_mpr_slice(series.id, volume, 'sagittal', sagittal_idx, window_width, window_level, inverted, fmt),
+            lambda: _get_encoded_mpr_slice(series.id, volume, 'coronal', coronal_idx, window_width, window_level, inverted, fmt),
+        )
 
         return JsonResponse({
             'mpr_views': mpr_views,
             'volume_shape': tuple(int(x) for x in volume.shape),
             'counts': counts,
+            'completeness': round(volume.completeness, 3),
             'series_info': {
                 'id': series.id,
                 'description': series.series_description,
@@ -446,7 +556,9 @@ def api_mpr_reconstruction(request, series_id):
 @csrf_exempt
 def api_mip_reconstruction(request, series_id):
     """API endpoint for Maximum Intensity Projection (MIP)
-    Optimized to reuse cached 3D volume when available for instant response."""
+    Optimized to reuse cached 3D volume when available for instant response.
+    While the volume is still being assembled the projections cover its decoded slices
+    and 'completeness' (fraction decoded) is below 1."""
     series = get_object_or_404(Series, id=series_id)
     user = request.user
     
@@ -457,7 +569,7 @@ def api_mip_reconstruction(request, series_id):
     try:
         # Prefer isotropic volume for higher-quality MIP
         try:
-            volume, _spacing = _get_mpr_volume_and_spacing(series)
+            volume, _spacing = _get_mpr_volume_and_spacing(series, wait=False)
             default_window_width, default_window_level = 400, 40
         except Exception:
             # Fallback: build volume from DICOMs (slower)
@@ -471,20 +583,21 @@ def api_mip_reconstruction(request, series_id):
                 try:
                     dicom_path = os.path.join(settings.MEDIA_ROOT, str(img.file_path))
                     ds = pydicom.dcmread(dicom_path)
-                    px = ds.pixel_array.astype(np.float32)
+                    px = metrics.decode_pixels(ds)
+                    slope, intercept = 1.0, 0.0
                     if hasattr(ds, 'RescaleSlope') and hasattr(ds, 'RescaleIntercept'):
-                        px = px * float(ds.RescaleSlope) + float(ds.RescaleIntercept)
+                        slope, intercept = float(ds.RescaleSlope), float(ds.RescaleIntercept)
                     if not volume_data:
                         ww = getattr(ds, 'WindowWidth', 400); wl = getattr(ds, 'WindowCenter', 40)
                         if hasattr(ww, '__iter__') and not isinstance(ww, str): ww = ww[0]
                         if hasattr(wl, '__iter__') and not isinstance(wl, str): wl = wl[0]
                         default_window_width, default_window_level = ww, wl
-                    volume_data.append(px)
+                    volume_data.append((px, slope, intercept))
                 except Exception:
                     continue
             if len(volume_data) < 2:
                 return JsonResponse({'error': 'Could not read enough images for MIP'}, status=400)
-            volume = np.stack(volume_data, axis=0)
+            volume = volumes.stack(volume_data)
         
         # Enhanced interpolation for thin stacks - always use high quality for better MIP
         quality = request.GET.get('quality', '').lower()
@@ -494,7 +607,7 @@ def api_mip_reconstruction(request, series_id):
             factor = target_slices / volume.shape[0]
             
             # Use high-quality interpolation for better MIP results
-            volume = ndimage.zoom(volume, (factor, 1, 1), order=3, prefilter=True)
+            volume = volume.zoom_depth(factor, order=3)
             logger.info(f"MIP enhanced interpolation: {volume.shape[0]} slices (factor: {factor:.2f})")
         
         # Get windowing parameters from request
@@ -502,15 +615,21 @@ def api_mip_reconstruction(request, series_id):
         window_level = float(request.GET.get('window_level', default_window_level))
         inverted = request.GET.get('inverted', 'false').lower() == 'true'
         
-        # Generate MIP projections (vectorized)
+        fmt = rendering.image_format(request.GET.get('format'))
+        
+        # Generate MIP projections over stored values (vectorized), one plane per render thread
+        def _mip(axis):
+            return _array_to_base64_image(volume.projection(axis), window_width, window_level, inverted, fmt,
+                                          volume.slope, volume.intercept)
+
         mip_views = {}
-        mip_views['axial'] = _array_to_base64_image(np.max(volume, axis=0), window_width, window_level, inverted)
-        mip_views['sagittal'] = _array_to_base64_image(np.max(volume, axis=1), window_width, window_level, inverted)
-        mip_views['coronal'] = _array_to_base64_image(np.max(volume, axis=2), window_width, window_level, inverted)
+        mip_views['axial'], mip_views['sagittal'], mip_views['coronal'] = rendering.parallel(
+            lambda: _mip(0), lambda: _mip(1), lambda: _mip(2))
         
         return JsonResponse({
             'mip_views': mip_views,
             'volume_shape': tuple(int(x) for x in volume.shape),
+            'completeness': round(volume.completeness, 3),
             'counts': {
                 'axial': int(volume.shape[0]),
                 'sagittal': int(volume.shape[2]),
@@ -557,15 +676,16 @@ def api_bone_reconstruction(request, series_id):
                 try:
                     dicom_path = os.path.join(settings.MEDIA_ROOT, str(img.file_path))
                     ds = pydicom.dcmread(dicom_path)
-                    px = ds.pixel_array.astype(np.float32)
+                    px = metrics.decode_pixels(ds)
+                    slope, intercept = 1.0, 0.0
                     if hasattr(ds, 'RescaleSlope') and hasattr(ds, 'RescaleIntercept'):
-                        px = px * ds.RescaleSlope + ds.RescaleIntercept
-                    volume_data.append(px)
+                        slope, intercept = float(ds.RescaleSlope), float(ds.RescaleIntercept)
+                    volume_data.append((px, slope, intercept))
                 except Exception:
                     continue
             if len(volume_data) < 2:
                 return JsonResponse({'error': 'Could not read enough images for bone reconstruction'}, status=400)
-            volume = np.stack(volume_data, axis=0)
+            volume = volumes.stack(volume_data)
         
         # Enhanced stabilization for thin stacks - optimized for bone reconstruction
         if volume.shape[0] < 32:  # More aggressive for better bone quality
@@ -574,37 +694,51 @@ def api_bone_reconstruction(request, series_id):
             factor = target_slices / volume.shape[0]
             
             # Use high-quality interpolation for better bone surface detection
-            volume = ndimage.zoom(volume, (factor, 1, 1), order=3, prefilter=True)
+            volume = volume.zoom_depth(factor, order=3)
             logger.info(f"Bone enhanced interpolation: {volume.shape[0]} slices (factor: {factor:.2f})")
         
-        # Threshold to bone
-        bone_mask = volume >= threshold
-        bone_volume = volume * bone_mask
+        # Threshold to bone in stored units; only the preview planes are rescaled
+        def bone_plane(plane, index):
+            """Preview plane in modality units, zero outside the bone mask"""
+            stored = volume.plane(plane, index)
+            return np.where(volume.at_least(threshold, pixels=stored), volume.rescale(stored), np.float32(0))
         
         # Windowing defaults for bone
         window_width = float(request.GET.get('window_width', 2000))
         window_level = float(request.GET.get('window_level', 300))
         inverted = request.GET.get('inverted', 'false').lower() == 'true'
+        fmt = rendering.image_format(request.GET.get('format'))
         
         # 3-plane orthogonal previews
         bone_views = {}
-        axial_idx = bone_volume.shape[0] // 2
-        sag_idx = bone_volume.shape[2] // 2
-        cor_idx = bone_volume.shape[1] // 2
-        bone_views['axial'] = _array_to_base64_image(bone_volume[axial_idx], window_width, window_level, inverted)
-        bone_views['sagittal'] = _array_to_base64_image(bone_volume[:, :, sag_idx], window_width, window_level, inverted)
-        bone_views['coronal'] = _array_to_base64_image(bone_volume[:, cor_idx, :], window_width, window_level, inverted)
+        axial_idx = volume.shape[0] // 2
+        sag_idx = volume.shape[2] // 2
+        cor_idx = volume.shape[1] // 2
+        bone_views['axial'], bone_views['sagittal'], bone_views['coronal'] = rendering.parallel(
+            lambda: _array_to_base64_image(bone_plane('axial', axial_idx), window_width, window_level, inverted, fmt),
+            lambda: _array_to_base64_image(bone_plane('sagittal', sag_idx), window_width, window_level, inverted, fmt),
+            lambda: _array_to_base64_image(bone_plane('coronal', cor_idx), window_width, window_level, inverted, fmt),
+        )
         
         mesh_payload = None
         if want_mesh:
             try:
                 from skimage import measure as _measure
+                # Voxels of the thresholded volume that are above 0, taken over the native
+                # slices; z spacing keeps vertices in (downsampled) display-depth units
+                solid = volume.at_least(threshold)
+                if threshold <= 0:
+                    solid &= volume.at_least(0, strict=True)
+                z_scale = (volume.shape[0] - 1) / max(1, volume.native_depth - 1)
                 if quality == 'high':
-                    vol_for_mesh = (bone_volume > 0).astype(np.float32)
+                    vol_for_mesh = solid.astype(np.float32)
+                    mesh_spacing = (z_scale, 1.0, 1.0)
                 else:
-                    ds_factor = max(1, int(np.ceil(max(1, bone_volume.shape[0]) / 128)))
-                    vol_for_mesh = (bone_volume[::ds_factor, ::2, ::2] > 0).astype(np.float32)
-                verts, faces, normals, values = _measure.marching_cubes(vol_for_mesh, level=0.5)
+                    ds_factor = max(1, int(np.ceil(max(1, volume.shape[0]) / 128)))
+                    native_step = max(1, int(np.ceil(max(1, volume.native_depth) / 128)))
+                    vol_for_mesh = solid[::native_step, ::2, ::2].astype(np.float32)
+                    mesh_spacing = (z_scale * native_step / ds_factor, 1.0, 1.0)
+                verts, faces, normals, values = _measure.marching_cubes(vol_for_mesh, level=0.5, spacing=mesh_spacing)
                 mesh_payload = {
                     'vertices': verts.tolist(),
                     'faces': faces.tolist(),
@@ -614,11 +748,11 @@ def api_bone_reconstruction(request, series_id):
         
         return JsonResponse({
             'bone_views': bone_views,
-            'volume_shape': tuple(int(x) for x in bone_volume.shape),
+            'volume_shape': tuple(int(x) for x in volume.shape),
             'counts': {
-                'axial': int(bone_volume.shape[0]),
-                'sagittal': int(bone_volume.shape[2]),
-                'coronal': int(bone_volume.shape[1]),
+                'axial': int(volume.shape[0]),
+                'sagittal': int(volume.shape[2]),
+                'coronal': int(volume.shape[1]),
             },
             'series_info': {
                 'id': series.id,
@@ -746,8 +880,11 @@ def api_study_progress(request, study_id):
         'last_updated': study.last_updated.isoformat()
     })
 
-def _array_to_base64_image(array, window_width=None, window_level=None, inverted=False):
-    """Convert numpy array to base64 encoded image with proper windowing"""
+def _array_to_base64_image(array, window_width=None, window_level=None, inverted=False, fmt='png',
+                           slope=1.0, intercept=0.0):
+    """Convert numpy array to a base64 data URL (PNG, lossless WebP or JPEG) with proper windowing.
+    slope/intercept rescale stored values to the units of the window.
+    """
     try:
         # Validate input
         if array is None or array.size == 0:
@@ -766,66 +903,46 @@ def _array_to_base64_image(array, window_width=None, window_level=None, inverted
         elif array.ndim > 2:
             logger.warning(f"_array_to_base64_image: array has {array.ndim} dimensions, using first 2D slice")
             array = array[0] if array.ndim == 3 else array.reshape(array.shape[-2:])
-            
-        # Convert to float for calculations
-        image_data = array.astype(np.float32)
-        
-        # Check for invalid data
-        if np.any(np.isnan(image_data)) or np.any(np.isinf(image_data)):
-            logger.warning("_array_to_base64_image: array contains NaN or inf values")
-            image_data = np.nan_to_num(image_data, nan=0.0, posinf=0.0, neginf=0.0)
-        
-        # Apply windowing if parameters provided
-        if window_width is not None and window_level is not None:
-            # Apply window/level
-            min_val = window_level - window_width / 2
-            max_val = window_level + window_width / 2
-            
-            # Clip and normalize
-            image_data = np.clip(image_data, min_val, max_val)
-            if max_val > min_val:
-                image_data = (image_data - min_val) / (max_val - min_val) * 255
-            else:
-                image_data = np.zeros_like(image_data)
-        else:
-            # Default normalization
-            data_min, data_max = image_data.min(), image_data.max()
-            if data_max > data_min:
-                image_data = ((image_data - data_min) / (data_max - data_min) * 255)
-            else:
-                image_data = np.zeros_like(image_data)
-        
-        # Apply inversion if requested
-        if inverted:
-            image_data = 255 - image_data
-        
-        # Convert to uint8
-        normalized = np.clip(image_data, 0, 255).astype(np.uint8)
-        
-        # Convert to PIL Image
-        img = Image.fromarray(normalized, mode='L')
-        
-        # Convert to base64
-        buffer = BytesIO()
-        try:
-            # Favor speed over size
-            img.save(buffer, format='PNG', optimize=False, compress_level=1)
-        except Exception as save_err:
-            logger.warning(f"PNG save with optimization failed: {save_err}, trying basic save")
-            img.save(buffer, format='PNG')
-        
-        img_str = base64.b64encode(buffer.getvalue()).decode()
         
-        return f"data:image/png;base64,{img_str}"
+        # Window/level straight into the encoder's uint8 buffer (NaN/inf render as 0)
+        return rendering.render_data_url(array, window_width, window_level, inverted, fmt,
+                                         slope=slope, intercept=intercept)
     except Exception as e:
         logger.error(f"_array_to_base64_image failed: {str(e)}, array shape: {getattr(array, 'shape', 'unknown')}, dtype: {getattr(array, 'dtype', 'unknown')}")
         return None
 
+def _enhance_xray(pixel_array):
+    """Display processing for DX/CR/XA/RF images: mild smoothing and p1-p99 clipping"""
+    try:
+        # Enhance X-ray contrast using histogram equalization
+        from scipy import ndimage
+        
+        # Apply mild Gaussian smoothing to reduce noise
+        pixel_array = ndimage.gaussian_filter(pixel_array.astype(np.float32), sigma=0.5)
+        
+        # Apply adaptive contrast enhancement
+        p1, p99 = np.percentile(pixel_array.flatten(), [1, 99])
+        if p99 > p1:
+            # Clip extreme values
+            pixel_array = np.clip(pixel_array, p1, p99)
+            
+            # Apply contrast stretching
+            pixel_array = (pixel_array - p1) / (p99 - p1) * (p99 - p1) + p1
+            
+    except ImportError:
+        # Fallback without scipy
+        pass
+    except Exception as e:
+        logger.warning(f"X-ray enhancement failed: {e}")
+    return pixel_array
+
 @login_required
 @csrf_exempt 
 def api_dicom_image_display(request, image_id):
     """API endpoint to get processed DICOM image with windowing
     - If pixel data cannot be decoded, still return metadata and sensible window defaults
+    - Responses are cached per image and parameters; scrolling through the stack renders
+      the next images ahead of the requests (readahead.py)
     """
     image = get_object_or_404(DicomImage, id=image_id)
     user = request.user
@@ -833,28 +950,76 @@ def api_dicom_image_display(request, image_id):
     # Check permissions
     if user.is_facility_user() and getattr(user, 'facility', None) and image.series.study.facility != user.facility:
         return JsonResponse({'error': 'Permission denied'}, status=403)
-    
+
+    params = (request.GET.get('window_width'), request.GET.get('window_level'),
+              request.GET.get('inverted'), rendering.image_format(request.GET.get('format')))
+    payload = _stack_cache_get(image.id, *params)
+    hit = payload is not None
+    if payload is None:
+        payload = _image_display_payload(image, *params)
+        if payload.get('image_data'):
+            _stack_cache_set(image.id, *params, payload)
+    index, ids = readahead.stack_position(image.series_id, image.id)
+    if index is not None:
+        readahead.observe(request, 'stack', image.series_id, None, index, len(ids), params, hit,
+                          lambda i: _render_stack_image(ids[i], *params))
+    return JsonResponse(payload)
+
+def _render_stack_image(image_id, window_width_param, window_level_param, inverted_param, fmt):
+    """Read-ahead render of one stack image into the display cache; False if already cached"""
+    if _stack_cache_contains(image_id, window_width_param, window_level_param, inverted_param, fmt):
+        return False
+    image = DicomImage.objects.select_related('series__study__patient').filter(id=image_id).first()
+    if image is None:
+        return False
+    payload = _image_display_payload(image, window_width_param, window_level_param, inverted_param, fmt)
+    if payload.get('image_data'):
+        _stack_cache_set(image_id, window_width_param, window_level_param, inverted_param, fmt, payload)
+    return True
+
+def _image_display_payload(image, window_width_param, window_level_param, inverted_param, fmt, tiled=True):
+    """Response body of api_dicom_image_display; parameters are the raw query values (None if absent).
+    With tiled=False large images are rendered at full resolution rather than as a tile preview
+    """
     # Always attempt to return a response (avoid 500 for robustness)
     warnings = {}
     try:
-        # Get windowing parameters from request
-        window_width_param = request.GET.get('window_width')
-        window_level_param = request.GET.get('window_level')
-        inverted = request.GET.get('inverted', 'false').lower() == 'true'
+        inverted = (inverted_param or 'false').lower() == 'true'
 
-        # Read DICOM file (best-effort)
+        # Native pixel data is read straight from its offset, with the header record standing in
+        # for the dataset; other files are read in full (best-effort)
         ds = None
-        try:
-            dicom_path = os.path.join(settings.MEDIA_ROOT, str(image.file_path))
-            ds = pydicom.dcmread(dicom_path, stop_before_pixels=False)
-        except Exception as e:
-            warnings['dicom_read_error'] = str(e)
-
         pixel_array = None
+        dicom_path = os.path.join(settings.MEDIA_ROOT, str(image.file_path))
+        record = headers.of(image)
+        if (record is not None and headers.native(record)
+                and (record.get('modality', '').upper() not in tiles.VOI_MODALITIES or headers.voi_identity(record))):
+            try:
+                pixel_array = headers.read_pixels(dicom_path, record).astype(np.float32)
+                ds = headers.Header(record)
+            except Exception as e:
+                logger.warning(f"Direct pixel read failed for image {image.id}: {e}")
+                pixel_array = None
+        if ds is None:
+            try:
+                ds = pydicom.dcmread(dicom_path, stop_before_pixels=False)
+            except Exception as e:
+                warnings['dicom_read_error'] = str(e)
+
+        # Large images are shown tiled (api_image_tiles): the response carries a preview level,
+        # which the viewer covers with the visible tiles, instead of the full-resolution image
+        pyramid = None
+        if tiled and ds is not None and tiles.recommended(getattr(ds, 'Rows', 0), getattr(ds, 'Columns', 0)):
+            try:
+                pyramid = tiles.pyramid(image)
+                pixel_array = None
+            except Exception as e:
+                warnings['tile_error'] = str(e)
+
         pixel_decode_error = None
-        if ds is not None:
+        if ds is not None and pixel_array is None and pyramid is None:
             try:
-                pixel_array = ds.pixel_array
+                pixel_array = metrics.decode_pixels(ds)
                 try:
                     modality = str(getattr(ds, 'Modality', '')).upper()
                     if modality in ['DX','CR','XA','RF','MG']:
@@ -882,6 +1047,9 @@ def api_dicom_image_display(request, image_id):
                 pixel_array = pixel_array * float(ds.RescaleSlope) + float(ds.RescaleIntercept)
             except Exception:
                 pass
+        if pyramid is not None:
+            # Modality values, with the X-ray clip of the full-resolution tiles already applied
+            pixel_array = pyramid.preview()[1]
         
         # Enhanced window derivation with medical imaging optimization
         def derive_window(arr, fallback=(400.0, 40.0)):
@@ -933,29 +1101,8 @@ def api_dicom_image_display(request, image_id):
             default_inverted = (photo == 'MONOCHROME1')
             
             # Apply additional X-ray specific processing if pixel array is available
-            if pixel_array is not None:
-                try:
-                    # Enhance X-ray contrast using histogram equalization
-                    from scipy import ndimage
-                    
-                    # Apply mild Gaussian smoothing to reduce noise
-                    pixel_array = ndimage.gaussian_filter(pixel_array.astype(np.float32), sigma=0.5)
-                    
-                    # Apply adaptive contrast enhancement
-                    p1, p99 = np.percentile(pixel_array.flatten(), [1, 99])
-                    if p99 > p1:
-                        # Clip extreme values
-                        pixel_array = np.clip(pixel_array, p1, p99)
-                        
-                        # Apply contrast stretching
-                        pixel_array = (pixel_array - p1) / (p99 - p1) * (p99 - p1) + p1
-                        
-                except ImportError:
-                    # Fallback without scipy
-                    pass
-                except Exception as e:
-                    logger.warning(f"X-ray enhancement failed: {e}")
-                    pass
+            if pixel_array is not None and pyramid is None:
+                pixel_array = _enhance_xray(pixel_array)
         
         # Overwrite request params only if not provided
         try:
@@ -967,7 +1114,7 @@ def api_dicom_image_display(request, image_id):
                 window_level = float(default_window_level)
             else:
                 window_level = float(window_level_param)
-            if request.GET.get('inverted') is None:
+            if inverted_param is None:
                 inverted = bool(default_inverted)
         except Exception:
             window_width = float(default_window_width)
@@ -977,7 +1124,7 @@ def api_dicom_image_display(request, image_id):
         image_data_url = None
         if pixel_array is not None:
             try:
-                image_data_url = _array_to_base64_image(pixel_array, window_width, window_level, inverted)
+                image_data_url = _array_to_base64_image(pixel_array, window_width, window_level, inverted, fmt)
             except Exception as e:
                 warnings['render_error'] = str(e)
                 image_data_url = None
@@ -994,8 +1141,10 @@ def api_dicom_image_display(request, image_id):
             'instance_number': getattr(image, 'instance_number', None),
             'slice_location': getattr(image, 'slice_location', None),
             'dimensions': [int(getattr(ds, 'Rows', 0) or 0), int(getattr(ds, 'Columns', 0) or 0)] if ds is not None else [0, 0],
-            'pixel_spacing': getattr(ds, 'PixelSpacing', [1.0, 1.0]) if ds is not None else (image.series.pixel_spacing or [1.0, 1.0]),
-            'slice_thickness': getattr(ds, 'SliceThickness', 1.0) if ds is not None else safe_float(getattr(image.series, 'slice_thickness', 1.0), 1.0),
+            # Set when image_data is only a preview of a tiled image
+            'tile_source': reverse('dicom_viewer:api_image_tiles', args=[image.id]) if pyramid is not None else None,
+            'pixel_spacing': [float(v) for v in getattr(ds, 'PixelSpacing', [1.0, 1.0])] if ds is not None else (image.series.pixel_spacing or [1.0, 1.0]),
+            'slice_thickness': safe_float(getattr(ds, 'SliceThickness', 1.0), 1.0) if ds is not None else safe_float(getattr(image.series, 'slice_thickness', 1.0), 1.0),
             'default_window_width': float(default_window_width) if default_window_width is not None else 400.0,
             'default_window_level': float(default_window_level) if default_window_level is not None else 40.0,
             'modality': getattr(ds, 'Modality', '') if ds is not None else (image.series.modality or ''),
@@ -1017,7 +1166,7 @@ def api_dicom_image_display(request, image_id):
             },
             'warnings': ({'pixel_decode_error': pixel_decode_error, **warnings} if (pixel_decode_error or warnings) else None)
         }
-        return JsonResponse(payload)
+        return payload
     except Exception as e:
         # Last-resort: never 500; return minimal defaults
         minimal = {
@@ -1046,7 +1195,53 @@ def api_dicom_image_display(request, image_id):
             },
             'warnings': {'fatal_error': str(e), **warnings}
         }
-        return JsonResponse(minimal)  # 200 OK to avoid frontend failure
+        return minimal  # served with 200 OK to avoid frontend failure
+
+@login_required
+def api_image_tiles(request, image_id):
+    """Tile pyramid of an image for deep-zoom display (see tiles.py).
+    Returns the size, the levels (0 = full resolution) with their tile grids, the default window
+    and tile_url, a template with {level}, {col} and {row}; the viewer fetches only the visible tiles.
+    """
+    image = get_object_or_404(DicomImage, id=image_id)
+    user = request.user
+    if user.is_facility_user() and getattr(user, 'facility', None) and image.series.study.facility != user.facility:
+        return JsonResponse({'error': 'Permission denied'}, status=403)
+    try:
+        source = tiles.pyramid(image)
+    except Exception as e:
+        logger.warning(f"Tile pyramid for image {image_id} failed: {e}")
+        return JsonResponse({'error': f'Tiled display unavailable: {e}'}, status=400)
+    return JsonResponse({
+        'image_id': image.id,
+        **source.describe(),
+        'tile_url': reverse('dicom_viewer:api_image_tiles', args=[image.id]) + '{level}/{col}/{row}/',
+    })
+
+@login_required
+def api_image_tile(request, image_id, level, col, row):
+    """One tile of an image's pyramid as an image (?window_width, window_level, inverted, format);
+    window and inversion default to the pyramid's"""
+    image = get_object_or_404(DicomImage, id=image_id)
+    user = request.user
+    if user.is_facility_user() and getattr(user, 'facility', None) and image.series.study.facility != user.facility:
+        return JsonResponse({'error': 'Permission denied'}, status=403)
+    fmt = rendering.image_format(request.GET.get('format'))
+    try:
+        ww, wl = request.GET.get('window_width'), request.GET.get('window_level')
+        inverted = request.GET.get('inverted')
+        body = tiles.tile(image, level, col, row,
+                          float(ww) if ww is not None else None,
+                          float(wl) if wl is not None else None,
+                          inverted.lower() == 'true' if inverted is not None else None, fmt)
+    except ValueError as e:
+        return JsonResponse({'error': str(e)}, status=400)
+    except Exception as e:
+        logger.error(f"Tile {level}/{col}/{row} of image {image_id} failed: {e}")
+        return JsonResponse({'error': 'Tile rendering failed'}, status=500)
+    response = HttpResponse(body, content_type=rendering.FORMATS[fmt])
+    response['Cache-Control'] = 'private, max-age=3600'
+    return response
 
 @login_required
 @csrf_exempt
@@ -1219,13 +1414,29 @@ def api_auto_window(request, image_id):
             if user.is_facility_user() and getattr(user, 'facility', None) and image.series.study.facility != user.facility:
                 return JsonResponse({'success': False, 'error': 'Permission denied'}, status=403)
             
+            # Serve from the series intensity stats when ingest recorded them. VOI LUT
+            # modalities are windowed per image from VOI-transformed values, so they
+            # keep the per-image path below.
+            series = image.series
+            if (series.modality or '').upper() not in ('DX', 'CR', 'XA', 'RF', 'MG'):
+                stats = intensity.get_series_stats(series, build_missing=True)
+                if stats is not None:
+                    return JsonResponse({
+                        'success': True,
+                        'window_width': stats['auto_window'][0],
+                        'window_level': stats['auto_window'][1],
+                        'suggested_preset': stats['suggested_preset'],
+                        'modality': stats['modality'],
+                        'hu_range': {'min': stats['min'], 'max': stats['max'], 'mean': stats['mean']},
+                    })
+            
             # Load DICOM file and analyze
             dicom_path = os.path.join(settings.MEDIA_ROOT, str(image.file_path))
             ds = pydicom.dcmread(dicom_path)
             
             # Get pixel data and convert to HU
             try:
-                pixel_array = ds.pixel_array
+                pixel_array = metrics.decode_pixels(ds)
                 try:
                     modality = str(getattr(ds, 'Modality', '')).upper()
                     if modality in ['DX','CR','XA','RF','MG']:
@@ -1373,9 +1584,51 @@ def api_calculate_distance(request):
     
     return JsonResponse({'error': 'Method not allowed'}, status=405)
 
+def _export_render(image, fmt, window_width_param=None, window_level_param=None, inverted_param=None):
+    """Encoded bytes of an image as the viewer displays it (png or jpeg), at full resolution; the
+    display cache is read but not filled, so an export does not push out what viewers are looking at
+    """
+    params = (window_width_param, window_level_param, inverted_param, fmt)
+    payload = _stack_cache_get(image.id, *params)
+    if payload is None or payload['image_info'].get('tile_source'):
+        # A tiled image's display payload only holds its preview
+        payload = _image_display_payload(image, *params, tiled=False)
+    data_url = payload.get('image_data') if isinstance(payload, dict) else None
+    if not data_url:
+        raise ValueError(f'Image {image.id} could not be rendered')
+    body = base64.b64decode(data_url.split(',', 1)[1])
+    rows, columns = payload['image_info']['dimensions']
+    size = Image.open(BytesIO(body)).size
+    if rows and columns and size != (columns, rows):
+        raise ValueError(f'Image {image.id} rendered at {size[0]}x{size[1]}, not {columns}x{rows}')
+    return body
+
+
+def _export_volume(series):
+    """(volume, spacing) of a series for volume exports: the MPR cache's volume when the viewer
+    has it, else one assembled for the export alone, so exports do not evict the viewer's volumes
+    """
+    with _MPR_CACHE_LOCK:
+        entry = _MPR_CACHE.get(series.id) or {}
+        volume, spacing = entry.get('volume'), entry.get('spacing')
+    if volume is not None and spacing is not None:
+        if not volume.complete:
+            volume = volume.source.wait()
+        return volume, tuple(spacing)
+    return assembly.build(series)
+
+
+def _export_response(chunks, filename, content_type='application/zip'):
+    response = StreamingHttpResponse(chunks, content_type=content_type)
+    response['Content-Disposition'] = f'attachment; filename="{filename}"'
+    return response
+
+
 @login_required
 def api_export_image(request, image_id):
-    """API endpoint to export image in various formats"""
+    """API endpoint to export image in various formats: png, jpg and tiff as displayed (window_width,
+    window_level and inverted as for display), dicom as stored
+    """
     image = get_object_or_404(DicomImage, id=image_id)
     user = request.user
     
@@ -1384,18 +1637,68 @@ def api_export_image(request, image_id):
     if user.is_facility_user() and study.facility != user.facility:
         return JsonResponse({'error': 'Permission denied'}, status=403)
     
-    export_format = request.GET.get('format', 'png')  # png, jpg, tiff, dicom
-    
-    # This would export the image in the requested format
-    # For now, we'll return a success message
-    result = {
-        'success': True,
-        'download_url': f'/media/exports/image_{image_id}.{export_format}',
-        'format': export_format,
-        'filename': f'image_{image_id}.{export_format}'
-    }
-    
-    return JsonResponse(result)
+    export_format = request.GET.get('format', 'png').lower()  # png, jpg, tiff, dicom
+    if export_format in ('dicom', 'dcm'):
+        path = headers.stored_path(image.file_path)
+        if not os.path.exists(path):
+            return JsonResponse({'error': 'DICOM file not found'}, status=404)
+        return FileResponse(open(path, 'rb'), as_attachment=True, filename=f'image_{image_id}.dcm',
+                            content_type='application/dicom')
+    if export_format not in ('png', 'jpg', 'jpeg', 'tif', 'tiff'):
+        return JsonResponse({'error': f'Unsupported format: {export_format}'}, status=400)
+
+    fmt = export.IMAGE_FORMATS.get(export_format, 'png')
+    try:
+        body = _export_render(image, fmt, request.GET.get('window_width'), request.GET.get('window_level'),
+                              request.GET.get('inverted'))
+    except Exception as e:
+        return JsonResponse({'error': str(e)}, status=500)
+    content_type, ext = rendering.FORMATS[fmt], 'png' if fmt == 'png' else 'jpg'
+    if export_format in ('tif', 'tiff'):
+        buffer = BytesIO()
+        Image.open(BytesIO(body)).save(buffer, format='TIFF', compression='tiff_deflate')
+        body, content_type, ext = buffer.getvalue(), 'image/tiff', 'tiff'
+    response = HttpResponse(body, content_type=content_type)
+    response['Content-Disposition'] = f'attachment; filename="image_{image_id}.{ext}"'
+    return response
+
+
+@login_required
+def api_export_series(request, series_id):
+    """Stream a ZIP export of a series: format=png|jpeg (rendered slices), dicom (stored files),
+    npy, nifti or raw (stored-value volume with its geometry). format=nifti_gz streams the
+    volume as a single .nii.gz, compressed in parallel blocks.
+    """
+    series = get_object_or_404(Series.objects.select_related('study'), id=series_id)
+    user = request.user
+    if user.is_facility_user() and series.study.facility != user.facility:
+        return JsonResponse({'error': 'Permission denied'}, status=403)
+    fmt = export.series_format(request.GET.get('format'))
+    if fmt is None:
+        return JsonResponse({'error': f"Unsupported format: {request.GET.get('format')}"}, status=400)
+    filename = f'{export.safe_name(series.study.accession_number, "study")}_{export.series_folder(series)}'
+    if fmt == 'nifti_gz':
+        try:
+            volume = export.SeriesVolume(series, _export_volume)
+        except Exception as e:
+            logger.error(f"Volume export of series {series_id} failed: {e}")
+            return JsonResponse({'error': 'Volume export failed'}, status=500)
+        return _export_response(volume.nifti_gz(), f'{filename}.nii.gz', 'application/gzip')
+    return _export_response(export.series_zip(series, fmt, _export_render, _export_volume), f'{filename}_{fmt}.zip')
+
+
+@login_required
+def api_export_study(request, study_id):
+    """Stream a ZIP export of a whole study, one folder per series (formats as api_export_series)"""
+    study = get_object_or_404(Study, id=study_id)
+    user = request.user
+    if user.is_facility_user() and study.facility != user.facility:
+        return JsonResponse({'error': 'Permission denied'}, status=403)
+    fmt = export.series_format(request.GET.get('format'))
+    if fmt is None:
+        return JsonResponse({'error': f"Unsupported format: {request.GET.get('format')}"}, status=400)
+    filename = f'{export.safe_name(study.accession_number, f"study_{study.id}")}_{fmt}.zip'
+    return _export_response(export.study_zip(study, fmt, _export_render, _export_volume), filename)
 
 @login_required
 @csrf_exempt
@@ -1432,7 +1735,10 @@ def api_annotations(request, study_id):
 
 @login_required
 def api_cine_mode(request, series_id):
-    """API endpoint for cine mode playback"""
+    """API endpoint for cine mode playback.
+    Returns the frames (instances, or the frames of a multi-frame loop) with the series' display
+    frame rate, and the WebSocket URL that streams them pre-windowed (see cine.py).
+    """
     series = get_object_or_404(Series, id=series_id)
     user = request.user
     
@@ -1442,11 +1748,18 @@ def api_cine_mode(request, series_id):
         return JsonResponse({'error': 'Permission denied'}, status=403)
     
     images = series.images.all().order_by('instance_number')
+    try:
+        _instances, frames, frame_rate = cine.series_frames(series)
+    except Exception as e:
+        logger.warning(f"Cine header read failed for series {series_id}: {e}")
+        frames, frame_rate = [], cine.DEFAULT_FPS
     
     cine_data = {
         'series_id': series_id,
         'image_count': images.count(),
-        'frame_rate': 10,  # Default FPS
+        'frame_count': len(frames) or images.count(),
+        'frame_rate': frame_rate,
+        'stream_url': f'/ws/cine/{series_id}/',
         'images': [
             {
                 'id': img.id,
@@ -1458,10 +1771,21 @@ def api_cine_mode(request, series_id):
     
     return JsonResponse(cine_data)
 
+class _Echo:
+    """csv writer target handing each written row back to the caller"""
+
+    def write(self, value):
+        return value
+
+
 @login_required
 @csrf_exempt
 def api_export_measurements(request, study_id):
-    """API endpoint to export measurements as PDF"""
+    """API endpoint to export measurements as CSV: the user's stored measurements on the study,
+    plus those posted as {"measurements": [...]} (e.g. not saved yet); streamed row by row
+    """
+    import csv
+
     study = get_object_or_404(Study, id=study_id)
     user = request.user
     
@@ -1469,29 +1793,36 @@ def api_export_measurements(request, study_id):
     if user.is_facility_user() and study.facility != user.facility:
         return JsonResponse({'error': 'Permission denied'}, status=403)
     
+    if request.method not in ('GET', 'POST'):
+        return JsonResponse({'error': 'Method not allowed'}, status=405)
+    posted = []
     if request.method == 'POST':
         try:
-            data = json.loads(request.body)
-            measurements = data.get('measurements', [])
-            
-            # This would generate a PDF report with measurements
-            # For now, we'll simulate the export
-            filename = f'measurements_{study.accession_number}_{int(time.time())}.pdf'
-            download_url = f'/media/exports/{filename}'
-            
-            result = {
-                'success': True,
-                'download_url': download_url,
-                'filename': filename,
-                'measurement_count': len(measurements)
-            }
-            
-            return JsonResponse(result)
-            
-        except json.JSONDecodeError:
+            posted = json.loads(request.body or b'{}').get('measurements', [])
+        except (json.JSONDecodeError, AttributeError):
             return JsonResponse({'error': 'Invalid JSON data'}, status=400)
-    
-    return JsonResponse({'error': 'Method not allowed'}, status=405)
+
+    stored = (Measurement.objects.filter(user=user, image__series__study=study)
+              .select_related('image__series').order_by('created_at'))
+
+    def rows():
+        writer = csv.writer(_Echo())
+        yield writer.writerow(['source', 'series_number', 'instance_number', 'image_id', 'type', 'value', 'unit',
+                               'points', 'notes', 'created_at'])
+        for m in stored.iterator():
+            yield writer.writerow(['stored', m.image.series.series_number, m.image.instance_number, m.image_id,
+                                   m.measurement_type, m.value, m.unit, m.points, m.notes, m.created_at.isoformat()])
+        for m in posted if isinstance(posted, list) else []:
+            if isinstance(m, dict):
+                yield writer.writerow(['posted', m.get('series_number', ''), m.get('instance_number', ''),
+                                       m.get('image_id', ''), m.get('type', m.get('measurement_type', '')),
+                                       m.get('value', ''), m.get('unit', ''), json.dumps(m.get('points', [])),
+                                       m.get('notes', ''), ''])
+
+    filename = f'measurements_{export.safe_name(study.accession_number, str(study.id))}_{int(time.time())}.csv'
+    response = StreamingHttpResponse(rows(), content_type='text/csv')
+    response['Content-Disposition'] = f'attachment; filename="{filename}"'
+    return response
 
 @login_required
 def load_from_directory(request):
@@ -2043,6 +2374,7 @@ def upload_dicom(request):
                                 'slice_location': getattr(ds, 'SliceLocation', None),
                                 'file_path': saved_path,
                                 'file_size': getattr(fobj, 'size', 0) or 0,
+                                'header': headers.extract(headers.stored_path(saved_path)),
                                 'processed': False,
                             }
                         )
@@ -2381,7 +2713,7 @@ def web_dicom_image(request, image_id):
         ds = pydicom.dcmread(file_path)
         # Robust pixel decode with SimpleITK fallback
         try:
-            pixel_array = ds.pixel_array
+            pixel_array = metrics.decode_pixels(ds)
         except Exception:
             try:
                 import SimpleITK as sitk
@@ -2620,10 +2952,10 @@ def web_reconstruction_result(request, job_id):
     if job.status != 'completed' or not job.result_path:
         return HttpResponse(status=404)
     try:
-        with open(job.result_path, 'rb') as f:
-            response = HttpResponse(f.read(), content_type='application/octet-stream')
-            response['Content-Disposition'] = f'attachment; filename="reconstruction_{job_id}.zip"'
-            return response
+        # Streamed from the job result store
+        ext = os.path.splitext(job.result_path)[1] or '.zip'
+        return FileResponse(open(job.result_path, 'rb'), as_attachment=True,
+                            filename=f'reconstruction_{job_id}{ext}', content_type='application/octet-stream')
     except FileNotFoundError:
         return HttpResponse(status=404)
 
@@ -2730,10 +3062,10 @@ def api_hu_value(request):
                 return JsonResponse({'error': 'Permission denied'}, status=403)
             dicom_path = os.path.join(settings.MEDIA_ROOT, str(image.file_path))
             ds = pydicom.dcmread(dicom_path)
-            arr = ds.pixel_array.astype(np.float32)
+            # Stored values; only the probed pixels are rescaled
+            arr = ds.pixel_array
             slope = float(getattr(ds, 'RescaleSlope', 1.0))
             intercept = float(getattr(ds, 'RescaleIntercept', 0.0))
-            arr = arr * slope + intercept
             h, w = arr.shape[:2]
             shape = (request.GET.get('shape') or '').lower()
             if shape == 'ellipse':
@@ -2743,7 +3075,7 @@ def api_hu_value(request):
                 ry = max(1, int(float(request.GET.get('ry', 1))))
                 yy, xx = np.ogrid[:h, :w]
                 mask = ((xx - cx) ** 2) / (rx ** 2) + ((yy - cy) ** 2) / (ry ** 2) <= 1.0
-                roi = arr[mask]
+                roi = arr[mask].astype(np.float32) * slope + intercept
                 if roi.size == 0:
                     return JsonResponse({'error': 'Empty ROI'}, status=400)
                 stats = {
@@ -2756,7 +3088,7 @@ def api_hu_value(request):
                 return JsonResponse({'mode': 'series', 'image_id': image_id, 'stats': stats})
             if x < 0 or y < 0 or x >= w or y >= h:
                 return JsonResponse({'error': 'Out of bounds'}, status=400)
-            hu = float(arr[y, x])
+            hu = float(arr[y, x]) * slope + intercept
             return JsonResponse({'mode': 'series', 'image_id': image_id, 'x': x, 'y': y, 'hu': round(hu, 2)})
 
         elif mode == 'mpr':
@@ -2768,27 +3100,11 @@ def api_hu_value(request):
             series = get_object_or_404(Series, id=series_id)
             if user.is_facility_user() and getattr(user, 'facility', None) and series.study.facility != user.facility:
                 return JsonResponse({'error': 'Permission denied'}, status=403)
-            images = series.images.all().order_by('slice_location', 'instance_number')
-            if images.count() < 2:
-                return JsonResponse({'error': 'Need at least 2 images for MPR'}, status=400)
-            volume_data = []
-            for img in images:
-                try:
-                    dicom_path = os.path.join(settings.MEDIA_ROOT, str(img.file_path))
-                    ds = pydicom.dcmread(dicom_path)
-                    a = ds.pixel_array.astype(np.float32)
-                    slope = float(getattr(ds, 'RescaleSlope', 1.0))
-                    intercept = float(getattr(ds, 'RescaleIntercept', 0.0))
-                    a = a * slope + intercept
-                    volume_data.append(a)
-                except Exception:
-                    continue
-            if len(volume_data) < 2:
-                return JsonResponse({'error': 'Could not read enough images for MPR'}, status=400)
-            volume = np.stack(volume_data, axis=0)
-            if volume.shape[0] < 16:
-                factor = max(2, int(np.ceil(16 / max(volume.shape[0], 1))))
-                volume = ndimage.zoom(volume, (factor, 1, 1), order=1)
+            # The cached MPR volume, so probes match the displayed reformats
+            try:
+                volume, _spacing = _get_mpr_volume_and_spacing(series)
+            except ValueError as e:
+                return JsonResponse({'error': str(e)}, status=400)
             counts = {
                 'axial': int(volume.shape[0]),
                 'sagittal': int(volume.shape[2]),
@@ -2808,7 +3124,7 @@ def api_hu_value(request):
                     ry = max(1, int(float(request.GET.get('ry', 1))))
                     yy, xx = np.ogrid[:h, :w]
                     mask = ((xx - cx) ** 2) / (rx ** 2) + ((yy - cy) ** 2) / (ry ** 2) <= 1.0
-                    roi = volume[slice_index][mask]
+                    roi = volume.rescale(volume.plane('axial', slice_index)[mask])
                     if roi.size == 0:
                         return JsonResponse({'error': 'Empty ROI'}, status=400)
                     stats = {
@@ -2821,9 +3137,9 @@ def api_hu_value(request):
                     return JsonResponse({'mode': 'mpr', 'series_id': series_id, 'plane': plane, 'slice': slice_index, 'stats': stats})
                 if x < 0 or y < 0 or x >= w or y >= h:
                     return JsonResponse({'error': 'Out of bounds'}, status=400)
-                hu = float(volume[slice_index, int(y), int(x)])
+                hu = volume.value(slice_index, int(y), int(x))
             elif plane == 'sagittal':
-                # slice = volume[:, :, slice_index] shape (depth, height)
+                # slice = volume.plane('sagittal', slice_index) shape (depth, height)
                 h, w = volume.shape[0], volume.shape[1]
                 shape = (request.GET.get('shape') or '').lower()
                 if shape == 'ellipse':
@@ -2833,18 +3149,16 @@ def api_hu_value(request):
                     ry = max(1, int(float(request.GET.get('ry', 1))))
                     yy, xx = np.ogrid[:h, :w]
                     mask = ((xx - cx) ** 2) / (rx ** 2) + ((yy - cy) ** 2) / (ry ** 2) <= 1.0
-                    z_idx = yy
-                    y_idx = xx
-                    roi = volume[z_idx, y_idx, slice_index][mask]
+                    roi = volume.rescale(volume.plane('sagittal', slice_index)[mask])
                     if roi.size == 0:
                         return JsonResponse({'error': 'Empty ROI'}, status=400)
                     stats = { 'mean': float(np.mean(roi)), 'std': float(np.std(roi)), 'min': float(np.min(roi)), 'max': float(np.max(roi)), 'n': int(roi.size) }
                     return JsonResponse({'mode': 'mpr', 'series_id': series_id, 'plane': plane, 'slice': slice_index, 'stats': stats})
                 if x < 0 or y < 0 or x >= w or y >= h:
                     return JsonResponse({'error': 'Out of bounds'}, status=400)
-                hu = float(volume[int(y), int(x), slice_index])
+                hu = volume.value(int(y), int(x), slice_index)
             else:  # coronal
-                # slice = volume[:, slice_index, :] shape (depth, width)
+                # slice = volume.plane('coronal', slice_index) shape (depth, width)
                 h, w = volume.shape[0], volume.shape[2]
                 shape = (request.GET.get('shape') or '').lower()
                 if shape == 'ellipse':
@@ -2854,16 +3168,14 @@ def api_hu_value(request):
                     ry = max(1, int(float(request.GET.get('ry', 1))))
                     yy, xx = np.ogrid[:h, :w]
                     mask = ((xx - cx) ** 2) / (rx ** 2) + ((yy - cy) ** 2) / (ry ** 2) <= 1.0
-                    z_idx = yy
-                    x_idx = xx
-                    roi = volume[z_idx, slice_index, x_idx][mask]
+                    roi = volume.rescale(volume.plane('coronal', slice_index)[mask])
                     if roi.size == 0:
                         return JsonResponse({'error': 'Empty ROI'}, status=400)
                     stats = { 'mean': float(np.mean(roi)), 'std': float(np.std(roi)), 'min': float(np.min(roi)), 'max': float(np.max(roi)), 'n': int(roi.size) }
                     return JsonResponse({'mode': 'mpr', 'series_id': series_id, 'plane': plane, 'slice': slice_index, 'stats': stats})
                 if x < 0 or y < 0 or x >= w or y >= h:
                     return JsonResponse({'error': 'Out of bounds'}, status=400)
-                hu = float(volume[int(y), slice_index, int(x)])
+                hu = volume.value(int(y), slice_index, int(x))
             return JsonResponse({'mode': 'mpr', 'series_id': series_id, 'plane': plane, 'slice': slice_index, 'x': x, 'y': y, 'hu': round(hu, 2)})
 
         else:
@@ -2871,167 +3183,106 @@ def api_hu_value(request):
     except Exception as e:
         return JsonResponse({'error': f'Failed to compute HU: {str(e)}'}, status=500)
 
-def _get_mpr_volume_and_spacing(series, force_rebuild=False):
-    """Return (volume, spacing) where spacing is (z,y,x) in mm.
+def _get_mpr_volume_and_spacing(series, force_rebuild=False, wait=True):
+    """Return (volume, spacing) where volume is a volumes.StoredVolume and spacing is (z,y,x) in mm.
     - Sorts slices using ImageOrientationPatient/ImagePositionPatient when available
-    - Applies rescale slope/intercept
+    - Keeps stored values (16-bit) with rescale slope/intercept as volume metadata
     - Optionally resamples along Z to approximate isotropic voxels based on in-plane pixel spacing
-      to improve MPR quality without degrading in-plane resolution
+      to improve MPR quality without degrading in-plane resolution; the resampling is lazy
+      (volume.shape has the resampled depth, only native slices are held)
+    - Slices are decoded in the background (assembly.py); with wait=False the volume may be
+      returned partially decoded (volume.completeness < 1), otherwise this waits for all of it
     - Uses tiny LRU cache; extends existing cache entry with spacing when available
     """
-    import numpy as _np
-    import pydicom as _pydicom
-    import os as _os
-
     # Try cache first
     with _MPR_CACHE_LOCK:
         entry = _MPR_CACHE.get(series.id)
-        if entry is not None and isinstance(entry.get('volume'), _np.ndarray) and not force_rebuild:
+        if entry is not None and entry.get('volume') is not None and not force_rebuild:
             vol = entry['volume']
             sp = entry.get('spacing')
-            if sp is not None:
-                return vol, tuple(sp)
-
-    images_qs = series.images.all().order_by('instance_number')
-    if images_qs.count() < 2:
-        raise ValueError('Not enough images for MPR')
-
-    # Gather slice data with positional sorting info
-    items = []  # (pos_along_normal, pixel_array)
-    first_ps = (1.0, 1.0)
-    st = None
-    normal = None
-    for img in images_qs:
-        try:
-            dicom_path = _os.path.join(settings.MEDIA_ROOT, str(img.file_path))
-            ds = _pydicom.dcmread(dicom_path)
-            try:
-                arr = ds.pixel_array.astype(_np.float32)
-            except Exception:
-                try:
-                    import SimpleITK as _sitk
-                    sitk_image = _sitk.ReadImage(dicom_path)
-                    px = _sitk.GetArrayFromImage(sitk_image)
-                    if px.ndim == 3 and px.shape[0] == 1:
-                        px = px[0]
-                    arr = px.astype(_np.float32)
-                except Exception:
-                    continue
-            slope = float(getattr(ds, 'RescaleSlope', 1.0) or 1.0)
-            intercept = float(getattr(ds, 'RescaleIntercept', 0.0) or 0.0)
-            arr = arr * slope + intercept
-
-            # Orientation-aware sorting
-            pos = getattr(ds, 'ImagePositionPatient', None)
-            iop = getattr(ds, 'ImageOrientationPatient', None)
-            if iop is not None and len(iop) == 6:
-                # row (x) and col (y) direction cosines
-                r = _np.array([float(iop[0]), float(iop[1]), float(iop[2])], dtype=_np.float64)
-                c = _np.array([float(iop[3]), float(iop[4]), float(iop[5])], dtype=_np.float64)
-                n = _np.cross(r, c)
-                if normal is None:
-                    normal = n / ( _np.linalg.norm(n) + 1e-8 )
-            else:
-                n = _np.array([0.0, 0.0, 1.0], dtype=_np.float64)
-                if normal is None:
-                    normal = n
-            if pos is not None and len(pos) == 3:
-                p = _np.array([float(pos[0]), float(pos[1]), float(pos[2])], dtype=_np.float64)
-                d = float(_np.dot(p, normal))
-            else:
-                # Fallback to slice_location, then instance number
-                d = float(getattr(ds, 'SliceLocation', getattr(ds, 'InstanceNumber', 0)) or 0)
-
-            # Pixel spacing & slice thickness (from first slice)
-            if st is None:
-                st = getattr(ds, 'SpacingBetweenSlices', None)
-                if st is None:
-                    st = getattr(ds, 'SliceThickness', 1.0)
-                try:
-                    st = float(st)
-                except Exception:
-                    st = 1.0
-                ps_attr = getattr(ds, 'PixelSpacing', [1.0, 1.0])
-                try:
-                    first_ps = (float(ps_attr[0]), float(ps_attr[1]))
-                except Exception:
-                    first_ps = (1.0, 1.0)
-
-            items.append((d, arr))
-        except Exception:
-            continue
-
-    if len(items) < 2:
-        raise ValueError('Could not read enough images for MPR')
-
-    # Sort by position along normal
-    items.sort(key=lambda x: x[0])
-    volume = _np.stack([a for _, a in items], axis=0)
-
-    # Enhanced interpolation for thin stacks - optimized for minimal images
-    # Use high-quality interpolation for better 3D reconstruction
-    original_depth = volume.shape[0]
-    if volume.shape[0] < 32:  # Increased threshold for better quality
-        # Calculate optimal interpolation factor for minimal images
-        if volume.shape[0] < 8:
-            # Very few images - use maximum interpolation
-            target_slices = max(64, volume.shape[0] * 8)
         else:
-            # Moderate number of images
-            target_slices = max(32, volume.shape[0] * 4)
-        
-        factor = target_slices / volume.shape[0]
-        
-        # Use high-quality spline interpolation for better results
-        try:
-            volume = ndimage.zoom(volume, (factor, 1, 1), order=3, prefilter=True)
-            st = st / factor
-            logger.info(f"Enhanced interpolation: {original_depth} -> {volume.shape[0]} slices (factor: {factor:.2f})")
-        except Exception as e:
-            logger.warning(f"High-quality interpolation failed, using linear: {e}")
-            # Fallback to linear interpolation
-            volume = ndimage.zoom(volume, (factor, 1, 1), order=1)
-            st = st / factor
-
-    # Resample along Z to approximate isotropic voxels using in-plane pixel spacing average
-    # Keep in-plane resolution; only resample depth for quality MPR
-    try:
-        py, px = float(first_ps[0]), float(first_ps[1])
-        target_xy = (py + px) / 2.0
-        if st and target_xy and st > 0 and target_xy > 0:
-            z_factor = max(1e-6, float(st) / float(target_xy))
-            # If z_factor > 1, we need to upsample Z to match XY spacing
-            # Cap the target depth to avoid memory blow-ups
-            max_depth = 2048
-            target_depth = int(min(max_depth, round(volume.shape[0] * z_factor)))
-            if target_depth > volume.shape[0] + 1 or z_factor > 1.05:
-                volume = ndimage.zoom(volume, (float(target_depth) / volume.shape[0], 1, 1), order=1)
-                st = target_xy
-    except Exception:
-        pass
-
-    spacing = (float(st or 1.0), float(first_ps[0] or 1.0), float(first_ps[1] or 1.0))
+            vol = sp = None
+    if sp is not None:
+        metrics.cache_hit('mpr_volume')
+        prefetch.opened(series.id)
+        if wait and not vol.complete:
+            vol = vol.source.wait()
+        return vol, tuple(sp)
+    metrics.cache_miss('mpr_volume')
+    build_start = time.perf_counter()
+
+    volume, spacing, builder = assembly.prepare(series)
 
     with _MPR_CACHE_LOCK:
-        # Store/refresh cache and attach spacing for future calls
         entry = _MPR_CACHE.get(series.id)
-        if entry is None:
-            while len(_MPR_CACHE_ORDER) >= _MAX_MPR_CACHE:
-                evict_id = _MPR_CACHE_ORDER.pop(0)
-                _MPR_CACHE.pop(evict_id, None)
-            _MPR_CACHE[series.id] = { 'volume': volume, 'spacing': spacing }
-            _MPR_CACHE_ORDER.append(series.id)
+        if entry is not None and entry.get('spacing') is not None and not force_rebuild:
+            # Another request published this series first; use its volume
+            volume, builder = entry['volume'], None
         else:
-            entry['volume'] = volume
-            entry['spacing'] = spacing
-            try:
-                _MPR_CACHE_ORDER.remove(series.id)
-            except ValueError:
-                pass
-            _MPR_CACHE_ORDER.append(series.id)
+            _mpr_cache_store(series.id, volume, spacing)
 
+    if builder is None:
+        metrics.RECONSTRUCTION_SECONDS.observe(time.perf_counter() - build_start, kind='mpr_volume')
+    else:
+        def _assembled(done, complete):
+            with _MPR_CACHE_LOCK:
+                entry = _MPR_CACHE.get(series.id)
+                if entry is not None and entry.get('volume') is done.volume:
+                    entry['volume'] = complete
+            if complete is not done.volume:
+                metrics.CACHE_STORED_BYTES.inc(int(complete.nbytes), cache='mpr_volume')
+            metrics.RECONSTRUCTION_SECONDS.observe(time.perf_counter() - build_start, kind='mpr_volume')
+
+        def _failed(done):
+            # Drop the partial volume so the next request rebuilds instead of serving it
+            with _MPR_CACHE_LOCK:
+                entry = _MPR_CACHE.get(series.id)
+                stale = entry is not None and entry.get('volume') is done.volume
+            if stale:
+                _mpr_cache_drop(series.id)
+
+        builder.on_complete(_assembled)
+        builder.on_failure(_failed)
+        builder.start()
+    if wait and not volume.complete:
+        volume = volume.source.wait()
     return volume, spacing
 
+def _mpr_cache_store(series_id, volume, spacing):
+    """Store/refresh a series' cache entry; caller holds _MPR_CACHE_LOCK"""
+    entry = _MPR_CACHE.get(series_id)
+    if entry is None:
+        while len(_MPR_CACHE_ORDER) >= _MAX_MPR_CACHE:
+            evict_id = _MPR_CACHE_ORDER.pop(0)
+            _MPR_CACHE.pop(evict_id, None)
+            metrics.CACHE_EVICTIONS.inc(cache='mpr_volume')
+        _MPR_CACHE[series_id] = { 'volume': volume, 'spacing': spacing }
+        _MPR_CACHE_ORDER.append(series_id)
+    else:
+        entry['volume'] = volume
+        entry['spacing'] = spacing
+        try:
+            _MPR_CACHE_ORDER.remove(series_id)
+        except ValueError:
+            pass
+        _MPR_CACHE_ORDER.append(series_id)
+    metrics.CACHE_STORED_BYTES.inc(int(volume.nbytes), cache='mpr_volume')
+
+def _mpr_cache_drop(series_id):
+    """Forget a series' volume and encoded slices (stale or unused); True if a volume was cached"""
+    with _MPR_CACHE_LOCK:
+        dropped = _MPR_CACHE.pop(series_id, None) is not None
+        try:
+            _MPR_CACHE_ORDER.remove(series_id)
+        except ValueError:
+            pass
+    prefix = f"{series_id}|"
+    with _MPR_IMG_CACHE_LOCK:
+        for key in [k for k in _MPR_IMG_CACHE if k.startswith(prefix)]:
+            del _MPR_IMG_CACHE[key]
+            _MPR_IMG_CACHE_ORDER.remove(key)
+    return dropped
+
 @login_required
 @csrf_exempt
 def api_user_presets(request):
@@ -3095,13 +3346,246 @@ def api_hanging_protocols(request):
     qs = HangingProtocol.objects.all()
     all_protocols = [{ 'id': hp.id, 'name': hp.name, 'layout': hp.layout, 'modality': hp.modality, 'body_part': hp.body_part, 'is_default': hp.is_default } for hp in qs]
     # suggested default
-    default = (qs.filter(modality=modality or '', body_part=body_part or '', is_default=True).first() or 
-               qs.filter(modality=modality or '', is_default=True).first() or 
-               qs.filter(is_default=True).first())
+    default = HangingProtocol.suggest(modality, body_part)
     suggested = {'id': default.id, 'name': default.name, 'layout': default.layout} if default else None
     return JsonResponse({'protocols': all_protocols, 'suggested': suggested})
 
 
+# Batch render: viewports per hanging-protocol layout, and the most one request may ask for
+_LAYOUT_VIEWPORTS = {'mpr-3plane': 3}
+_MAX_BATCH_VIEWPORTS = 16
+_MPR_PLANES = ('axial', 'sagittal', 'coronal')
+
+
+def _layout_capacity(layout):
+    if layout in _LAYOUT_VIEWPORTS:
+        return _LAYOUT_VIEWPORTS[layout]
+    try:
+        rows, cols = (int(n) for n in layout.lower().split('x'))
+        return rows * cols
+    except ValueError:
+        return None
+
+
+def _multipart_response(parts):
+    """multipart/mixed response from (headers dict, body bytes) parts"""
+    boundary = uuid.uuid4().hex
+    chunks = []
+    for headers, body in parts:
+        chunks.append(f'--{boundary}\r\n'.encode())
+        chunks.extend(f'{name}: {value}\r\n'.encode() for name, value in headers.items())
+        chunks.append(b'\r\n')
+        chunks.append(body)
+        chunks.append(b'\r\n')
+    chunks.append(f'--{boundary}--\r\n'.encode())
+    return HttpResponse(b''.join(chunks), content_type=f'multipart/mixed; boundary={boundary}')
+
+
+def _load_stack_image(path):
+    """(pixels with their rescale, default window or None, inverted default, modality) for one stored instance.
+    CT/MR-style images stay in stored integers and rendering folds the rescale into the window,
+    so it takes the lookup-table path; VOI LUT and X-ray images go through float display
+    processing as in api_dicom_image_display.
+    """
+    ds = pydicom.dcmread(os.path.join(settings.MEDIA_ROOT, path))
+    pixels = metrics.decode_pixels(ds)
+    if pixels.ndim == 3 and int(getattr(ds, 'SamplesPerPixel', 1) or 1) == 1:
+        pixels = pixels[pixels.shape[0] // 2]
+    modality = str(getattr(ds, 'Modality', '')).upper()
+    slope = float(getattr(ds, 'RescaleSlope', 1.0) or 1.0)
+    intercept = float(getattr(ds, 'RescaleIntercept', 0.0) or 0.0)
+    if modality in ('DX', 'CR', 'XA', 'RF', 'MG'):
+        try:
+            pixels = apply_voi_lut(pixels, ds)
+        except Exception:
+            pass
+        pixels = pixels.astype(np.float32) * slope + intercept
+        if modality != 'MG':
+            pixels = _enhance_xray(pixels)
+        slope, intercept = 1.0, 0.0
+
+    default_window = None
+    ww, wl = getattr(ds, 'WindowWidth', None), getattr(ds, 'WindowCenter', None)
+    if ww is not None and wl is not None:
+        try:
+            # First value of multi-valued windows
+            ww = ww[0] if hasattr(ww, '__iter__') and not isinstance(ww, str) else ww
+            wl = wl[0] if hasattr(wl, '__iter__') and not isinstance(wl, str) else wl
+            default_window = (float(ww), float(wl))
+        except (TypeError, ValueError, IndexError):
+            default_window = None
+    inverted = (modality in ('DX', 'CR', 'XA', 'RF')
+                and str(getattr(ds, 'PhotometricInterpretation', '')).upper() == 'MONOCHROME1')
+    return {'pixels': pixels, 'slope': slope, 'intercept': intercept,
+            'default_window': default_window, 'inverted': inverted, 'modality': modality}
+
+
+@login_required
+@csrf_exempt
+@require_http_methods(["POST"])
+def api_batch_render(request):
+    """Render every viewport of a hanging-protocol layout in one request.
+
+    POST JSON: {"layout": "2x2" | "mpr-3plane" | ..., "protocol_id": optional HangingProtocol,
+                "series_id": default series, "format": "png" | "webp" | "jpeg",
+                "viewports": [{"series_id", "plane": "image" | "axial" | "sagittal" | "coronal",
+                               "slice", "window_width", "window_level", "inverted",
+                               "size": 512 | [width, height], "format"}, ...]}
+    With "mpr-3plane" and no viewports, the three planes of series_id are rendered.
+
+    Returns multipart/mixed: an application/json manifest (per viewport: plane, slice,
+    count, window, part index or error, and for MPR planes the fraction of the volume
+    decoded so far) followed by one image part per rendered viewport.
+    Permissions are checked once per series, each MPR volume and stack image is decoded
+    once, and the tiles are windowed and encoded in parallel on the render pool.
+    """
+    try:
+        spec = json.loads(request.body or b'{}')
+    except (json.JSONDecodeError, UnicodeDecodeError):
+        return JsonResponse({'error': 'Invalid JSON'}, status=400)
+
+    layout = str(spec.get('layout') or '')
+    if spec.get('protocol_id'):
+        protocol = HangingProtocol.objects.filter(id=spec['protocol_id']).first()
+        if protocol is None:
+            return JsonResponse({'error': 'Unknown hanging protocol'}, status=404)
+        layout = protocol.layout
+    layout = layout or '1x1'
+    capacity = _layout_capacity(layout)
+    if capacity is None:
+        return JsonResponse({'error': f'Unsupported layout {layout!r}'}, status=400)
+
+    viewports = spec.get('viewports')
+    if not viewports and layout == 'mpr-3plane' and spec.get('series_id'):
+        viewports = [{'plane': plane} for plane in _MPR_PLANES]
+    if not isinstance(viewports, list) or not viewports:
+        return JsonResponse({'error': 'viewports required'}, status=400)
+    if len(viewports) > min(capacity, _MAX_BATCH_VIEWPORTS):
+        return JsonResponse({'error': f'Layout {layout} takes at most {min(capacity, _MAX_BATCH_VIEWPORTS)} viewports'}, status=400)
+
+    default_format = rendering.image_format(spec.get('format'))
+    tiles = []
+    try:
+        for vp in viewports:
+            size = vp.get('size')
+            if isinstance(size, (int, float)):
+                size = (int(size), int(size))
+            elif size:
+                size = (int(size[0]), int(size[1]))
+            tiles.append({
+                'series_id': int(vp.get('series_id') or spec.get('series_id')),
+                'plane': str(vp.get('plane') or 'image').lower(),
+                'slice': None if vp.get('slice') is None else int(vp['slice']),
+                'window_width': None if vp.get('window_width') is None else float(vp['window_width']),
+                'window_level': None if vp.get('window_level') is None else float(vp['window_level']),
+                'inverted': vp.get('inverted'),
+                'size': size,
+                'format': rendering.image_format(vp.get('format') or default_format),
+            })
+    except (TypeError, ValueError, IndexError) as e:
+        return JsonResponse({'error': f'Invalid viewport: {e}'}, status=400)
+    for tile in tiles:
+        if tile['plane'] != 'image' and tile['plane'] not in _MPR_PLANES:
+            return JsonResponse({'error': f"Invalid plane {tile['plane']!r}"}, status=400)
+
+    # One query and one permission check per series
+    series_by_id = Series.objects.select_related('study').in_bulk({t['series_id'] for t in tiles})
+    user = request.user
+    for series_id in {t['series_id'] for t in tiles}:
+        series = series_by_id.get(series_id)
+        if series is None:
+            return JsonResponse({'error': f'Series {series_id} not found'}, status=404)
+        if user.is_facility_user() and getattr(user, 'facility', None) and series.study.facility != user.facility:
+            return JsonResponse({'error': 'Permission denied'}, status=403)
+
+    # Shared inputs: one MPR volume per series, one decode per stack image
+    volumes, stacks, images, errors = {}, {}, {}, {}
+    for index, tile in enumerate(tiles):
+        series = series_by_id[tile['series_id']]
+        try:
+            if tile['plane'] == 'image':
+                if series.id not in stacks:
+                    stacks[series.id] = list(series.images.order_by('instance_number').values_list('file_path', flat=True))
+                stack = stacks[series.id]
+                if not stack:
+                    raise ValueError('Series has no images')
+                tile['count'] = len(stack)
+                tile['slice'] = max(0, min(len(stack) - 1, len(stack) // 2 if tile['slice'] is None else tile['slice']))
+                path = str(stack[tile['slice']])
+                if path not in images:
+                    images[path] = _load_stack_image(path)
+                tile['source'] = images[path]
+            else:
+                if series.id not in volumes:
+                    volumes[series.id] = _get_mpr_volume_and_spacing(series, wait=False)[0]
+                volume = volumes[series.id]
+                axis = {'axial': 0, 'coronal': 1, 'sagittal': 2}[tile['plane']]
+                tile['count'] = int(volume.shape[axis])
+                tile['slice'] = max(0, min(tile['count'] - 1, tile['count'] // 2 if tile['slice'] is None else tile['slice']))
+                tile['volume'] = volume
+                tile['completeness'] = round(volume.completeness, 3)
+        except Exception as e:
+            errors[index] = str(e)
+
+    def render(tile):
+        series = series_by_id[tile['series_id']]
+        ww, wl = tile['window_width'], tile['window_level']
+        inverted = bool(tile['inverted'])
+        if tile['plane'] == 'image':
+            source = tile['source']
+            if ww is None or wl is None:
+                stats = None if source['default_window'] else intensity.get_series_stats(series)
+                ww, wl = source['default_window'] or (stats['auto_window'] if stats else (400.0, 40.0))
+            if tile['inverted'] is None:
+                inverted = source['inverted']
+            pixels, slope, intercept = source['pixels'], source['slope'], source['intercept']
+        else:
+            if ww is None or wl is None:
+                stats = intensity.get_series_stats(series)
+                ww, wl = stats['mpr_window'] if stats else (400.0, 40.0)
+            volume = tile['volume']
+            pixels = volume.plane(tile['plane'], tile['slice'])
+            slope, intercept = volume.slope, volume.intercept
+        body = rendering.encode(rendering.window_to_uint8(pixels, ww, wl, inverted, slope, intercept),
+                                tile['format'], size=tile['size'])
+        return body, float(ww), float(wl), inverted
+
+    pending = [i for i in range(len(tiles)) if i not in errors]
+
+    def guarded(index):
+        try:
+            return render(tiles[index])
+        except Exception as e:
+            return e
+
+    outputs = dict(zip(pending, rendering.parallel(*[lambda i=i: guarded(i) for i in pending])))
+
+    manifest = {'layout': layout, 'viewports': []}
+    parts = []
+    for index, tile in enumerate(tiles):
+        entry = {'index': index, 'series_id': tile['series_id'], 'plane': tile['plane'],
+                 'slice': tile.get('slice'), 'count': tile.get('count')}
+        if 'completeness' in tile:
+            entry['completeness'] = tile['completeness']
+        output = outputs.get(index)
+        if isinstance(output, Exception):
+            errors[index] = str(output)
+        if index in errors:
+            entry['error'] = errors[index]
+            logger.warning(f"Batch render viewport {index} (series {tile['series_id']}) failed: {errors[index]}")
+        else:
+            body, ww, wl, inverted = output
+            entry.update({'window_width': ww, 'window_level': wl, 'inverted': inverted,
+                          'content_type': rendering.FORMATS[tile['format']], 'part': len(parts) + 1})
+            parts.append(({'Content-Type': rendering.FORMATS[tile['format']],
+                           'Content-ID': f'<viewport-{index}>',
+                           'Content-Length': str(len(body))}, body))
+        manifest['viewports'].append(entry)
+
+    manifest_part = ({'Content-Type': 'application/json'}, json.dumps(manifest).encode())
+    return _multipart_response([manifest_part] + parts)
+
+
 @login_required
 def api_export_dicom_sr(request, study_id):
     """Export measurements/annotations of a study to a DICOM SR (TID 1500-like simplification).
@@ -3177,17 +3661,18 @@ def api_series_volume_uint8(request, series_id):
         ww = float(request.GET.get('ww', 400))
         wl = float(request.GET.get('wl', 40))
         max_dim = int(request.GET.get('max_dim', 256))
-        # Normalize via window/level
-        min_val = wl - ww/2.0; max_val = wl + ww/2.0
-        vol = np.clip(volume, min_val, max_val)
-        if max_val > min_val:
-            vol = (vol - min_val) / (max_val - min_val) * 255.0
-        vol = vol.astype(np.uint8)
-        # Downsample to fit max_dim
-        z, y, x = vol.shape
+        # Normalize via window/level, a native slice at a time from the stored values
+        vol = np.empty(volume.data.shape, dtype=np.uint8)
+        for z in range(volume.native_depth):
+            vol[z] = rendering.window_to_uint8(volume.data[z], ww, wl, False, volume.slope, volume.intercept)
+        # Resample to the display depth and downsample to fit max_dim, in one pass
+        z, y, x = volume.shape
         scale = min(1.0, float(max_dim)/max(z, y, x))
-        if scale < 0.999:
-            vol = ndimage.zoom(vol, (scale, scale, scale), order=1)
+        if scale >= 0.999:
+            scale = 1.0
+        target = (int(round(z * scale)), int(round(y * scale)), int(round(x * scale)))
+        if target != vol.shape:
+            vol = ndimage.zoom(vol, [t / n for t, n in zip(target, vol.shape)], order=1)
         buf = vol.tobytes()
         import base64
         b64 = base64.b64encode(buf).decode('ascii')
@@ -0,0 +1,325 @@
+"""
+MPR, MIP and bone volumes kept in stored pixel units.
+
+Volumes used to be built as float32 modality values (stored * RescaleSlope +
+RescaleIntercept) and resampled in float. That is twice the size of the
+16-bit data the modality wrote, so a 1000x512x512 CT held 1 GB per process
+in the MPR cache. A ``StoredVolume`` keeps the stored integers (int16, or
+uint16 when the values need it) and carries the rescale alongside, which
+halves every cached volume:
+
+* rendering folds the rescale into the window (``rendering.window_to_uint8``
+  takes slope and intercept), so slices and projections go through the lookup
+  table with no float copy;
+* HU probes and ROI statistics convert only the pixels they read, and
+  thresholds are compared in stored units.
+
+Z resampling (thin-stack smoothing and the isotropic resample for MPR) is
+lazy. ``zoom_depth`` only records the display depth, and the volume keeps its
+native slices. A plane is interpolated when it is read: an axial slice blends
+its 2 (linear) or 4 (cubic) neighbouring slices, and a sagittal or coronal
+plane resamples just that native plane. Cubic interpolation uses B-spline
+coefficients along Z, cached for the volume on the first axial read.
+Position k of the display depth D maps to native position k*(n-1)/(D-1), as in
+``ndimage.zoom``. Interpolated values are rounded to the stored dtype.
+
+Slices with different rescales, non-integer pixel data or values outside the
+16-bit range fall back to a float32 volume in modality units (slope 1,
+intercept 0). Every consumer handles that case the same way.
+
+A volume can be published before all of its slices are decoded (see
+``assembly``). ``loaded`` then marks the decoded native slices and ``source``
+decodes missing ones on request. Axial reads decode the slices they need, so
+they are exact. Sagittal, coronal and projection reads interpolate linearly
+between the decoded slices. ``at_least`` and ``data`` see undecoded slices as
+zeros, so their callers wait for the complete volume.
+"""
+import math
+
+import numpy as np
+from scipy import ndimage
+
+_STORED_DTYPES = (np.int16, np.uint16)
+# Float working set per block when a projection interpolates the whole volume
+PROJECTION_BLOCK_BYTES = 16 << 20
+
+
+class StoredVolume:
+    """(depth, height, width) stored pixel values plus the rescale to modality units.
+    data holds the native slices; depth is the (possibly interpolated) display depth.
+    """
+
+    __slots__ = ('data', 'slope', 'intercept', 'depth', 'order', 'loaded', 'source', '_spline', '_projections')
+
+    def __init__(self, data, slope=1.0, intercept=0.0, depth=None, order=1, loaded=None, source=None):
+        self.data = data
+        self.slope = float(slope)
+        self.intercept = float(intercept)
+        self.depth = int(depth) if depth else data.shape[0]
+        self.order = order
+        # Boolean per native slice while the volume is being assembled, None once complete
+        self.loaded = loaded
+        self.source = source
+        self._spline = None
+        self._projections = {}
+
+    @property
+    def shape(self):
+        return (self.depth,) + self.data.shape[1:]
+
+    @property
+    def ndim(self):
+        return self.data.ndim
+
+    @property
+    def size(self):
+        return int(np.prod(self.shape))
+
+    @property
+    def nbytes(self):
+        spline = self._spline
+        projected = sum(p.nbytes for p in list(self._projections.values()))
+        return self.data.nbytes + (spline.nbytes if spline is not None else 0) + projected
+
+    @property
+    def dtype(self):
+        return self.data.dtype
+
+    @property
+    def native_depth(self):
+        return self.data.shape[0]
+
+    @property
+    def interpolated(self):
+        return self.depth != self.data.shape[0]
+
+    @property
+    def complete(self):
+        return self.loaded is None
+
+    @property
+    def completeness(self):
+        """Fraction of native slices decoded"""
+        loaded = self.loaded
+        return 1.0 if loaded is None else float(np.count_nonzero(loaded)) / len(loaded)
+
+    def decoded(self):
+        """StoredVolume of just the decoded native slices (self when complete)"""
+        available = self._available()
+        if available is None:
+            return self
+        return StoredVolume(self.data[available], self.slope, self.intercept)
+
+    def plane(self, plane, index):
+        """Stored 2D slice at display index: axial (z), coronal (y) or sagittal (x)"""
+        data = self.data
+        if plane == 'axial':
+            self._require([index])
+        available = self._available()
+        if plane == 'axial':
+            if not self.interpolated and (available is None or index in available):
+                return data[index]
+            spline = self._spline_volume() if self.order >= 3 and available is None else None
+            return self._along_z(data, [index], spline, available)[0]
+        native = data[:, index, :] if plane == 'coronal' else data[:, :, index]
+        if not self.interpolated and available is None:
+            return native
+        return self._along_z(native, np.arange(self.depth), available=available)
+
+    def rescale(self, stored):
+        """Stored values (any shape) in modality units as float32"""
+        values = np.multiply(stored, np.float32(self.slope), dtype=np.float32)
+        values += np.float32(self.intercept)
+        return values
+
+    def value(self, z, y, x):
+        """Modality value of one voxel (z at display depth)"""
+        self._require([z])
+        available = self._available()
+        if self.interpolated or available is not None:
+            stored = self._along_z(self.data[:, y, x], [z], available=available)[0]
+        else:
+            stored = self.data[z, y, x]
+        return float(stored) * self.slope + self.intercept
+
+    def to_stored(self, value):
+        return (float(value) - self.intercept) / self.slope
+
+    def at_least(self, value, strict=False, pixels=None):
+        """Mask of pixels (default: the native slices) whose modality value is >= value
+        (> with strict), compared in stored units
+        """
+        bound = self.to_stored(value)
+        # Modality order is stored order for a positive slope, reversed otherwise
+        upward = self.slope > 0
+        data = self.data if pixels is None else pixels
+        if not np.issubdtype(data.dtype, np.integer):
+            if upward:
+                return data > bound if strict else data >= bound
+            return data < bound if strict else data <= bound
+        info = np.iinfo(data.dtype)
+        if upward:
+            bound = math.floor(bound) + 1 if strict else math.ceil(bound)
+            if bound > info.max:
+                return np.zeros(data.shape, dtype=bool)
+            return data >= data.dtype.type(max(bound, info.min))
+        bound = math.ceil(bound) - 1 if strict else math.floor(bound)
+        if bound < info.min:
+            return np.zeros(data.shape, dtype=bool)
+        return data <= data.dtype.type(min(bound, info.max))
+
+    def projection(self, axis, kind='max'):
+        """Stored-value maximum (or minimum) intensity projection along an axis.
+        An interpolated volume is resampled and reduced a block of rows at a time,
+        so the result is exact without holding the resampled volume. Projections of a
+        complete volume are kept with it.
+        """
+        reduce = np.max if (kind == 'max') == (self.slope > 0) else np.min
+        available = self._available()
+        if available is None:
+            key = (axis, reduce is np.max)
+            projected = self._projections.get(key)
+            if projected is None:
+                projected = self._projections[key] = self._project(axis, reduce, None)
+            return projected
+        return self._project(axis, reduce, available)
+
+    def _project(self, axis, reduce, available):
+        if not self.interpolated and available is None:
+            return reduce(self.data, axis=axis)
+        depth = np.arange(self.depth)
+        spline = self._spline_volume() if self.order >= 3 and available is None else None
+        height, width = self.data.shape[1:]
+        rows = max(1, PROJECTION_BLOCK_BYTES // (self.depth * (self.order + 1) * width * 4))
+        parts = []
+        for start in range(0, height, rows):
+            block = self._along_z(self.data[:, start:start + rows], depth,
+                                  spline[:, start:start + rows] if spline is not None else None, available)
+            parts.append(reduce(block, axis=axis))
+        if axis == 1:
+            return reduce(np.stack(parts), axis=0)
+        return np.concatenate(parts, axis=0 if axis == 0 else 1)
+
+    def zoom_depth(self, factor, order=1):
+        """Same volume displayed with depth scaled by factor, as ndimage.zoom(volume, (factor, 1, 1)).
+        Nothing is resampled here; consecutive zooms collapse into one interpolation of the
+        native slices with the higher-order kernel.
+        """
+        zoomed = StoredVolume(self.data, self.slope, self.intercept,
+                              depth=max(1, int(round(self.depth * factor))), order=max(self.order, order),
+                              loaded=self.loaded, source=self.source)
+        zoomed._spline = self._spline
+        return zoomed
+
+    def _spline_volume(self):
+        """Cubic B-spline coefficients along Z, computed once per volume"""
+        spline = self._spline
+        if spline is None:
+            spline = self._spline = ndimage.spline_filter1d(
+                self.data, order=3, axis=0, output=np.float32, mode='mirror')
+        return spline
+
+    def _available(self):
+        """Native indices of the decoded slices, or None when all are"""
+        loaded = self.loaded
+        return None if loaded is None else np.flatnonzero(loaded)
+
+    def _require(self, indices):
+        """Decode the native slices that linear interpolation at display indices reads"""
+        loaded, source = self.loaded, self.source
+        if loaded is None or source is None:
+            return
+        taps = np.unique(self._taps(indices, np.arange(self.data.shape[0]))[0])
+        missing = taps[~loaded[taps]]
+        if missing.size:
+            source.load(missing)
+
+    def _taps(self, indices, available=None):
+        """(native slice indices, weights), each (len(indices), taps), for display depth indices.
+        With available (sorted native indices), interpolates linearly between those slices only.
+        """
+        n = self.data.shape[0]
+        indices = np.asarray(indices, dtype=np.float64)
+        if n == 1:
+            return np.zeros((len(indices), 1), dtype=np.intp), np.ones((len(indices), 1), dtype=np.float32)
+        positions = indices * ((n - 1) / (self.depth - 1)) if self.depth > 1 else np.zeros_like(indices)
+        if available is not None:
+            last = len(available) - 1
+            after = np.searchsorted(available, positions, side='right')
+            lo = available[np.clip(after - 1, 0, last)]
+            hi = available[np.clip(after, 0, last)]
+            t = np.clip((positions - lo) / np.maximum(hi - lo, 1), 0.0, 1.0)[:, None]
+            taps = np.stack([lo, hi], axis=1)
+            weights = np.hstack([1 - t, t])
+        elif self.order >= 3:
+            base = np.floor(positions)
+            t = (positions - base)[:, None]
+            taps = base.astype(np.intp)[:, None] + np.arange(-1, 3)
+            # Whole-sample mirror at both ends, as the prefilter assumes
+            period = 2 * (n - 1)
+            taps = np.abs(taps) % period
+            taps = np.where(taps > n - 1, period - taps, taps)
+            weights = np.hstack([(1 - t) ** 3, 3 * t ** 3 - 6 * t ** 2 + 4,
+                                 -3 * t ** 3 + 3 * t ** 2 + 3 * t + 1, t ** 3]) / 6.0
+        else:
+            base = np.minimum(np.floor(positions).astype(np.intp), n - 2)
+            t = (positions - base)[:, None]
+            taps = base[:, None] + np.arange(2)
+            weights = np.hstack([1 - t, t])
+        return taps, weights.astype(np.float32)
+
+    def _along_z(self, samples, indices, spline=None, available=None):
+        """samples (native depth first) interpolated at display depth indices, in the stored dtype.
+        A partial volume (available given) is interpolated linearly between its decoded slices.
+        """
+        taps, weights = self._taps(indices, available)
+        cubic = self.order >= 3 and available is None
+        if cubic and spline is None:
+            spline = ndimage.spline_filter1d(samples, order=3, axis=0, output=np.float32, mode='mirror')
+        gathered = (spline if cubic else samples)[taps]
+        weights = weights.reshape(weights.shape + (1,) * (gathered.ndim - 2))
+        values = np.multiply(gathered, weights, dtype=np.float32).sum(axis=1, dtype=np.float32)
+        if np.issubdtype(self.data.dtype, np.integer):
+            info = np.iinfo(self.data.dtype)
+            np.rint(values, out=values)
+            np.clip(values, info.min, info.max, out=values)
+            return values.astype(self.data.dtype)
+        return values
+
+
+def stack(slices):
+    """StoredVolume from (pixels, slope, intercept) per slice, in slice order"""
+    if not slices:
+        raise ValueError('No slices to stack')
+    shape = (len(slices),) + slices[0][0].shape
+    rescales = {(float(slope), float(intercept)) for _, slope, intercept in slices}
+    if len(rescales) == 1 and all(np.issubdtype(p.dtype, np.integer) for p, _, _ in slices):
+        dtype = _stored_dtype([p for p, _, _ in slices])
+        if dtype is not None:
+            data = np.empty(shape, dtype=dtype)
+            for i, (pixels, _, _) in enumerate(slices):
+                data[i] = pixels
+            slope, intercept = rescales.pop()
+            return StoredVolume(data, slope, intercept)
+
+    data = np.empty(shape, dtype=np.float32)
+    for i, (pixels, slope, intercept) in enumerate(slices):
+        data[i] = pixels
+        data[i] *= np.float32(slope)
+        data[i] += np.float32(intercept)
+    if not np.isfinite(data).all():
+        np.nan_to_num(data, copy=False, nan=0.0, posinf=0.0, neginf=0.0)
+    return StoredVolume(data)
+
+
+def _stored_dtype(arrays):
+    """Narrowest 16-bit dtype holding every value, or None"""
+    if all(a.dtype in (np.int8, np.uint8, np.int16) for a in arrays):
+        return np.int16
+    lo = min(int(a.min()) for a in arrays)
+    hi = max(int(a.max()) for a in arrays)
+    for dtype in _STORED_DTYPES:
+        info = np.iinfo(dtype)
+        if info.min <= lo and hi <= info.max:
+            return dtype
+    return None
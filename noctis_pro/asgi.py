@@ -20,6 +20,7 @@ try:
     from channels.auth import AuthMiddlewareStack
     from channels.security.websocket import AllowedHostsOriginValidator
     import chat.routing
+    import dicom_viewer.routing
     import notifications.routing
 
     application = ProtocolTypeRouter({
@@ -29,6 +30,7 @@ try:
                 URLRouter([
                     *chat.routing.websocket_urlpatterns,
                     *notifications.routing.websocket_urlpatterns,
+                    *dicom_viewer.routing.websocket_urlpatterns,
                 ])
             )
         ),
@@ -0,0 +1,566 @@
+"""
+Single-host channel layer for running several ASGI workers without Redis.
+
+``InMemoryChannelLayer`` only reaches consumers in the same process, so a chat
+message or notification sent from one Daphne worker (or from the DICOM
+receiver's notification dispatcher) never arrives at WebSockets held by
+another. ``UnixSocketChannelLayer`` connects every process to a small broker
+over a Unix domain socket:
+
+* Channel names embed the owning process (``specific.<client>!<token>``), so a
+  direct send goes to exactly one process and nothing is queued centrally.
+* The broker keeps group membership. ``group_send`` ships the message once;
+  the broker forwards the encoded body untouched as one frame per process
+  listing that process's member channels, which are then filled in a single
+  event-loop callback. Members in the sending process get it without a round
+  trip.
+* Each process holds one broker connection on an I/O thread; frames queued in
+  the same loop iteration are written with a single syscall.
+* The broker runs standalone (``manage.py channel_broker``) or embedded: the
+  first process to lock ``<socket>.lock`` serves it from its I/O thread, and
+  another process takes over if that one exits.
+* The socket and lock live in a directory only this user can enter (by
+  default the private runtime directory, see runtime.py); a socket owned by
+  anyone else is never connected to.
+
+``address`` may be ``tcp://host:port`` to share one standalone broker between
+hosts; CHANNEL_LAYER_BACKEND=redis switches to channels_redis instead (see
+settings.py). Only process-specific channels (from ``new_channel``) are routed
+between processes; plain channel names stay local to the process.
+"""
+import asyncio
+import base64
+import fcntl
+import hashlib
+import json
+import logging
+import os
+import struct
+import threading
+import time
+import uuid
+from collections import defaultdict, deque
+
+from channels.exceptions import ChannelFull
+from channels.layers import BaseChannelLayer
+from django.conf import settings
+
+from noctis_pro import metrics, runtime
+
+try:
+    import msgpack
+except ImportError:  # Installed with channels_redis; JSON works as well
+    msgpack = None
+
+logger = logging.getLogger('noctis_pro.channels')
+
+# Frame: head length, body length, head (op and routing), body (encoded message)
+_HEADER = struct.Struct('!II')
+MAX_FRAME = 16 * 1024 * 1024
+# Frames kept while the broker is unreachable
+MAX_PENDING = 10000
+# Per-connection write buffer above which the broker drops frames for a slow peer
+MAX_PEER_BUFFER = 32 * 1024 * 1024
+
+CHANNEL_MESSAGES = metrics.counter(
+    'noctis_channel_layer_messages', 'Messages sent through the channel layer', ('op',))
+CHANNEL_DROPPED = metrics.counter(
+    'noctis_channel_layer_dropped', 'Channel layer messages dropped before delivery', ('reason',))
+
+
+def default_address(base_dir=None):
+    """Per-deployment socket path in the private runtime directory (short enough for the
+    108-byte sun_path limit)
+    """
+    tag = hashlib.sha1(str(base_dir or os.getcwd()).encode()).hexdigest()[:10]
+    return runtime.runtime_path(f'channels-{tag}.sock')
+
+
+def parse_address(address):
+    if address.startswith('tcp://'):
+        host, _, port = address[len('tcp://'):].rpartition(':')
+        return 'tcp', (host or '127.0.0.1', int(port))
+    if address.startswith('unix://'):
+        address = address[len('unix://'):]
+    return 'unix', address
+
+
+def _json_default(value):
+    if isinstance(value, (bytes, bytearray)):
+        return {'__bytes__': base64.b64encode(bytes(value)).decode('ascii')}
+    raise TypeError(f'{type(value).__name__} is not serializable in a channel message')
+
+
+def _json_hook(obj):
+    if len(obj) == 1 and '__bytes__' in obj:
+        return base64.b64decode(obj['__bytes__'])
+    return obj
+
+
+def encode(obj):
+    if msgpack is not None:
+        return msgpack.packb(obj, use_bin_type=True)
+    return json.dumps(obj, default=_json_default, separators=(',', ':')).encode()
+
+
+def decode(data):
+    if msgpack is not None:
+        return msgpack.unpackb(data, raw=False)
+    if b'"__bytes__"' in data:
+        return json.loads(data, object_hook=_json_hook)
+    return json.loads(data)
+
+
+def frame(head, body=b''):
+    head = encode(head)
+    return _HEADER.pack(len(head), len(body)) + head + body
+
+
+async def read_frame(reader):
+    head_len, body_len = _HEADER.unpack(await reader.readexactly(_HEADER.size))
+    if head_len + body_len > MAX_FRAME:
+        raise ValueError(f'Channel layer frame of {head_len + body_len} bytes exceeds limit')
+    data = await reader.readexactly(head_len + body_len)
+    return decode(data[:head_len]), data[head_len:]
+
+
+def channel_owner(channel):
+    """Client id embedded in a process-specific channel name, or None"""
+    local, sep, _ = channel.partition('!')
+    if not sep:
+        return None
+    return local.rpartition('.')[2]
+
+
+class _FrameWriter:
+    """Coalesces frames written during one loop iteration into one write()"""
+
+    def __init__(self, writer):
+        self.writer = writer
+        self.pending = []
+
+    def send(self, data):
+        if not self.pending:
+            asyncio.get_running_loop().call_soon(self.flush)
+        self.pending.append(data)
+
+    def flush(self):
+        if not self.pending:
+            return
+        data = b''.join(self.pending)
+        self.pending = []
+        if self.writer.is_closing():
+            return
+        if self.writer.transport.get_write_buffer_size() > MAX_PEER_BUFFER:
+            CHANNEL_DROPPED.inc(reason='slow_peer')
+            return
+        self.writer.write(data)
+
+
+class ChannelBroker:
+    """Routes frames between layer clients; runs on one event loop"""
+
+    def __init__(self, address, group_expiry=86400):
+        self.address = address
+        self.group_expiry = group_expiry
+        self.groups = defaultdict(dict)     # group -> {channel: expires}
+        self.clients = {}                   # client id -> _FrameWriter
+        self.memberships = defaultdict(set)  # client id -> {(group, channel)}
+        self.server = None
+
+    async def start(self):
+        kind, target = parse_address(self.address)
+        if kind == 'unix':
+            # Callers hold <socket>.lock, so an existing socket file is stale
+            runtime.private_dir(os.path.dirname(os.path.abspath(target)))
+            if os.path.lexists(target):
+                os.unlink(target)
+            self.server = await asyncio.start_unix_server(self._serve, path=target)
+            os.chmod(target, 0o600)
+        else:
+            self.server = await asyncio.start_server(self._serve, *target)
+        logger.info(f'Channel broker listening on {self.address}')
+
+    async def serve_forever(self):
+        await self.start()
+        async with self.server:
+            await self.server.serve_forever()
+
+    async def _serve(self, reader, writer):
+        peer = _FrameWriter(writer)
+        client = None
+        try:
+            while True:
+                head, body = await read_frame(reader)
+                op = head[0]
+                if op == 'gsend':
+                    self._group_send(head[1], body, client)
+                elif op == 'send':
+                    self._send(head[1], body)
+                elif op == 'add':
+                    self.groups[head[1]][head[2]] = time.time() + self.group_expiry
+                    self.memberships[channel_owner(head[2])].add((head[1], head[2]))
+                elif op == 'discard':
+                    self._discard(head[1], head[2])
+                elif op == 'hello':
+                    client = head[1]
+                    self.clients[client] = peer
+                elif op == 'flush':
+                    self.groups.clear()
+                    self.memberships.clear()
+        except (asyncio.IncompleteReadError, ConnectionError, ValueError):
+            pass
+        finally:
+            if client is not None and self.clients.get(client) is peer:
+                # The client re-registers its groups when it reconnects
+                del self.clients[client]
+                for group, channel in list(self.memberships.pop(client, ())):
+                    self._discard(group, channel)
+            writer.close()
+
+    def _discard(self, group, channel):
+        members = self.groups.get(group)
+        if members is not None:
+            members.pop(channel, None)
+            if not members:
+                del self.groups[group]
+        owned = self.memberships.get(channel_owner(channel))
+        if owned is not None:
+            owned.discard((group, channel))
+
+    def _send(self, channel, body):
+        peer = self.clients.get(channel_owner(channel))
+        if peer is None:
+            CHANNEL_DROPPED.inc(reason='no_consumer')
+            return
+        peer.send(frame(['deliver', [channel]], body))
+
+    def _group_send(self, group, body, sender):
+        members = self.groups.get(group)
+        if not members:
+            return
+        now = time.time()
+        targets = defaultdict(list)
+        expired = []
+        for channel, expires in members.items():
+            if expires < now:
+                expired.append(channel)
+                continue
+            owner = channel_owner(channel)
+            if owner != sender:
+                targets[owner].append(channel)
+        for channel in expired:
+            self._discard(group, channel)
+        for owner, channels in targets.items():
+            peer = self.clients.get(owner)
+            if peer is None:
+                CHANNEL_DROPPED.inc(len(channels), reason='no_consumer')
+                continue
+            peer.send(frame(['deliver', channels], body))
+
+
+def acquire_broker_lock(address, blocking=False):
+    """File descriptor holding ``<socket>.lock``, or None if another process has it"""
+    path = parse_address(address)[1] + '.lock'
+    runtime.private_dir(os.path.dirname(os.path.abspath(path)))
+    fd = runtime.open_private(path, os.O_CREAT | os.O_RDWR)
+    try:
+        fcntl.flock(fd, fcntl.LOCK_EX | (0 if blocking else fcntl.LOCK_NB))
+    except BlockingIOError:
+        os.close(fd)
+        return None
+    return fd
+
+
+class _LocalChannel:
+    __slots__ = ('loop', 'queue', 'capacity', 'groups')
+
+    def __init__(self, loop, capacity):
+        self.loop = loop
+        self.queue = asyncio.Queue()
+        self.capacity = capacity
+        self.groups = set()
+
+
+_IMMUTABLE = (str, int, float, bool, bytes, type(None))
+
+
+def _put_all(channels, expires, body):
+    # Decode once for the whole batch; receive() hands each consumer its own
+    # shallow copy, which is as good as a deep copy for flat messages
+    message = decode(body)
+    item = message if all(isinstance(v, _IMMUTABLE) for v in message.values()) else body
+    for ch in channels:
+        if ch.queue.qsize() >= ch.capacity:
+            CHANNEL_DROPPED.inc(reason='full')
+            continue
+        ch.queue.put_nowait((expires, item))
+
+
+class _BrokerLink:
+    """This process's connection to the broker, on its own I/O thread"""
+
+    def __init__(self, layer):
+        self.layer = layer
+        self.client_id = uuid.uuid4().hex[:16]
+        self.pid = os.getpid()
+        self.loop = asyncio.new_event_loop()
+        self.pending = deque()
+        self.writer = None
+        self.lock_fd = None
+        self.broker = None
+        self.refused = False
+        self.connected = threading.Event()
+        self.thread = threading.Thread(target=self._run, name='channel-layer', daemon=True)
+        self.thread.start()
+
+    def submit(self, head, body=b''):
+        data = frame(head, body)
+        try:
+            self.loop.call_soon_threadsafe(self._enqueue, data)
+        except RuntimeError:
+            CHANNEL_DROPPED.inc(reason='closed')
+
+    def _enqueue(self, data):
+        if self.writer is not None:
+            self.writer.send(data)
+            return
+        if len(self.pending) >= MAX_PENDING:
+            self.pending.popleft()
+            CHANNEL_DROPPED.inc(reason='disconnected')
+        self.pending.append(data)
+
+    def _run(self):
+        asyncio.set_event_loop(self.loop)
+        self.loop.run_until_complete(self._maintain())
+
+    async def _connect(self):
+        kind, target = parse_address(self.layer.address)
+        if kind == 'unix':
+            runtime.check_socket(target)
+            return await asyncio.open_unix_connection(target)
+        return await asyncio.open_connection(*target)
+
+    async def _host_broker(self):
+        """Become the embedded broker if no other process holds the lock"""
+        if not self.layer.embedded_broker or self.broker is not None:
+            return False
+        if parse_address(self.layer.address)[0] != 'unix':
+            return False
+        try:
+            fd = acquire_broker_lock(self.layer.address)
+            if fd is None:
+                return False
+            self.lock_fd = fd
+            self.broker = ChannelBroker(self.layer.address, self.layer.group_expiry)
+            await self.broker.start()
+        except PermissionError as e:
+            if self.lock_fd is not None:
+                os.close(self.lock_fd)
+            self.lock_fd, self.broker = None, None
+            if not self.refused:
+                logger.error(f'Not hosting the channel broker: {e}')
+                self.refused = True
+            return False
+        logger.info(f'Process {os.getpid()} is hosting the channel broker')
+        return True
+
+    async def _maintain(self):
+        backoff = 0.05
+        while True:
+            try:
+                reader, writer = await self._connect()
+            except OSError:
+                if not await self._host_broker():
+                    await asyncio.sleep(backoff)
+                    backoff = min(backoff * 2, 2.0)
+                continue
+            backoff = 0.05
+
+            # Register before anything queued while disconnected
+            greeting = [frame(['hello', self.client_id])]
+            greeting += [frame(['add', group, channel]) for group, channel in self.layer._memberships()]
+            writer.write(b''.join(greeting) + b''.join(self.pending))
+            self.pending.clear()
+            self.writer = _FrameWriter(writer)
+            self.connected.set()
+            try:
+                while True:
+                    head, body = await read_frame(reader)
+                    if head[0] == 'deliver':
+                        self.layer._deliver(head[1], body)
+            except (asyncio.IncompleteReadError, ConnectionError, ValueError, OSError):
+                logger.warning('Lost connection to channel broker, reconnecting')
+            finally:
+                self.writer = None
+                self.connected.clear()
+                writer.close()
+
+    def release_fork(self):
+        # Child after fork: the I/O thread is gone, and an inherited broker lock
+        # would keep the lock held after the real broker exits
+        if self.lock_fd is not None:
+            os.close(self.lock_fd)
+
+
+class UnixSocketChannelLayer(BaseChannelLayer):
+    extensions = ['groups', 'flush']
+
+    def __init__(self, address=None, expiry=60, group_expiry=86400, capacity=100,
+                 channel_capacity=None, embedded_broker=True):
+        super().__init__(expiry=expiry, capacity=capacity, channel_capacity=channel_capacity)
+        self.address = address or default_address(settings.BASE_DIR)
+        self.group_expiry = group_expiry
+        self.embedded_broker = embedded_broker
+        self._channels = {}                 # local channel -> _LocalChannel
+        self._groups = defaultdict(set)     # group -> local channels
+        self._lock = threading.Lock()
+        self._link = None
+
+    def _get_link(self):
+        link = self._link
+        if link is not None and link.pid == os.getpid():
+            return link
+        with self._lock:
+            if self._link is not None and self._link.pid != os.getpid():
+                self._link.release_fork()
+                self._channels.clear()
+                self._groups.clear()
+                self._link = None
+            if self._link is None:
+                self._link = _BrokerLink(self)
+            return self._link
+
+    def _memberships(self):
+        with self._lock:
+            return [(group, channel) for group, channels in self._groups.items() for channel in channels]
+
+    def _is_local(self, channel):
+        return channel in self._channels or channel_owner(channel) == self._get_link().client_id
+
+    def _deliver(self, names, body):
+        """Queue body on local channels; callable from any thread"""
+        expires = time.time() + self.expiry
+        by_loop = defaultdict(list)
+        for name in names:
+            ch = self._channels.get(name)
+            if ch is None:
+                CHANNEL_DROPPED.inc(reason='no_consumer')
+                continue
+            by_loop[ch.loop].append(ch)
+        try:
+            running = asyncio.get_running_loop()
+        except RuntimeError:
+            running = None
+        for loop, channels in by_loop.items():
+            if loop is running:
+                _put_all(channels, expires, body)
+                continue
+            try:
+                loop.call_soon_threadsafe(_put_all, channels, expires, body)
+            except RuntimeError:
+                CHANNEL_DROPPED.inc(len(channels), reason='closed')
+
+    # ------------------------------------------------------------------
+    # Channel layer API
+    # ------------------------------------------------------------------
+
+    async def new_channel(self, prefix='specific'):
+        link = self._get_link()
+        name = f'{prefix}.{link.client_id}!{uuid.uuid4().hex[:12]}'
+        self._channels[name] = _LocalChannel(asyncio.get_running_loop(), self.get_capacity(name))
+        return name
+
+    async def send(self, channel, message):
+        assert isinstance(message, dict), 'message is not a dict'
+        self.require_valid_channel_name(channel)
+        body = encode(message)
+        CHANNEL_MESSAGES.inc(op='send')
+        if self._is_local(channel):
+            ch = self._channels.get(channel)
+            if ch is None:
+                ch = self._channels.setdefault(
+                    channel, _LocalChannel(asyncio.get_running_loop(), self.get_capacity(channel)))
+            if ch.queue.qsize() >= ch.capacity:
+                raise ChannelFull(channel)
+            self._deliver([channel], body)
+        else:
+            self._get_link().submit(['send', channel], body)
+
+    async def receive(self, channel):
+        self.require_valid_channel_name(channel)
+        ch = self._channels.get(channel)
+        if ch is None:
+            ch = self._channels.setdefault(
+                channel, _LocalChannel(asyncio.get_running_loop(), self.get_capacity(channel)))
+        try:
+            while True:
+                expires, item = await ch.queue.get()
+                if expires >= time.time():
+                    return dict(item) if isinstance(item, dict) else decode(item)
+                CHANNEL_DROPPED.inc(reason='expired')
+        except asyncio.CancelledError:
+            # Consumer went away: forget the channel and its memberships
+            if ch.queue.empty():
+                self._close_channel(channel, ch)
+            raise
+
+    def _close_channel(self, channel, ch):
+        with self._lock:
+            self._channels.pop(channel, None)
+            groups = list(ch.groups)
+            for group in groups:
+                members = self._groups.get(group)
+                if members is not None:
+                    members.discard(channel)
+                    if not members:
+                        del self._groups[group]
+        link = self._get_link()
+        for group in groups:
+            link.submit(['discard', group, channel])
+
+    async def group_add(self, group, channel):
+        self.require_valid_group_name(group)
+        self.require_valid_channel_name(channel)
+        if self._is_local(channel):
+            with self._lock:
+                self._groups[group].add(channel)
+                ch = self._channels.get(channel)
+                if ch is not None:
+                    ch.groups.add(group)
+        self._get_link().submit(['add', group, channel])
+
+    async def group_discard(self, group, channel):
+        self.require_valid_group_name(group)
+        self.require_valid_channel_name(channel)
+        with self._lock:
+            members = self._groups.get(group)
+            if members is not None:
+                members.discard(channel)
+                if not members:
+                    del self._groups[group]
+            ch = self._channels.get(channel)
+            if ch is not None:
+                ch.groups.discard(group)
+        self._get_link().submit(['discard', group, channel])
+
+    async def group_send(self, group, message):
+        assert isinstance(message, dict), 'message is not a dict'
+        self.require_valid_group_name(group)
+        body = encode(message)
+        CHANNEL_MESSAGES.inc(op='group_send')
+        with self._lock:
+            local = list(self._groups.get(group, ()))
+        if local:
+            self._deliver(local, body)
+        # Broker skips this process's members, delivered above
+        self._get_link().submit(['gsend', group], body)
+
+    async def flush(self):
+        with self._lock:
+            self._channels.clear()
+            self._groups.clear()
+        self._get_link().submit(['flush'])
+
+    async def close(self):
+        pass
@@ -138,4 +138,32 @@ def live_check(request):
     """
     Liveness check - verifies the application is running
     """
-    return HttpResponse("ALIVE", content_type="text/plain")
\ No newline at end of file
+    return HttpResponse("ALIVE", content_type="text/plain")
+
+
+def _queue_depths():
+    """Pending work per queue, evaluated at scrape time"""
+    from dicom_viewer.models import ReconstructionJob
+    from notifications.dispatcher import get_dispatcher
+    from notifications.models import NotificationQueue
+
+    return {
+        ('reconstruction',): ReconstructionJob.objects.filter(status__in=['pending', 'processing']).count(),
+        ('notification_delivery',): NotificationQueue.objects.filter(is_processed=False).count(),
+        ('notification_dispatch',): get_dispatcher().pending(),
+    }
+
+
+@csrf_exempt
+@require_http_methods(["GET"])
+def metrics_view(request):
+    """
+    Prometheus scrape endpoint for this process's metrics
+    """
+    from . import metrics
+
+    if not metrics.authorized(request.META.get('HTTP_AUTHORIZATION'), request.META.get('REMOTE_ADDR'),
+                              getattr(settings, 'METRICS_AUTH_TOKEN', '')):
+        return HttpResponse("Unauthorized", content_type="text/plain", status=401)
+    metrics.gauge('noctis_queue_depth', 'Pending items per work queue', ('queue',), callback=_queue_depths)
+    return HttpResponse(metrics.render(), content_type=metrics.CONTENT_TYPE)
@@ -4,148 +4,332 @@ Middleware for NoctisPro - Image optimization for slow connections
 
 import os
 import io
+import hashlib
+import threading
+from collections import OrderedDict
+from concurrent.futures import ThreadPoolExecutor, TimeoutError as FutureTimeout
 from PIL import Image
-from django.http import HttpResponse, FileResponse
+from django.http import HttpResponse, HttpResponseNotModified
 from django.conf import settings
-from django.core.files.storage import default_storage
-import mimetypes
+from django.utils.cache import patch_vary_headers
+
+from . import metrics
+
+_TRANSCODES = metrics.counter(
+    'noctis_image_transcodes', 'Image optimization transcodes by outcome '
+    '(transcoded, original, too_large, busy, timeout, failed)', ('outcome',))
 
 
 class ImageOptimizationMiddleware:
     """
-    Middleware to optimize images for slow internet connections
+    Transcode image responses for slow connections, caching the results.
+
+    Only clients that ask are served smaller images: ``Save-Data: on``, a slow
+    ``ECT`` hint, ``connection=slow|mobile`` or an explicit ``optimize=true``
+    (``optimize=false`` always opts out; ``IMAGE_OPTIMIZE_DEFAULT`` turns it on
+    for everyone). The output format follows ``format=`` or ``Accept`` (WebP
+    when accepted, else JPEG), and responses vary on ``Accept``, ``Save-Data``
+    and ``ECT``.
+
+    Transcodes are cached by source version and output parameters
+    (``IMAGE_OPTIMIZE_CACHE_MB``). The source version is the response's ETag,
+    else the stat of a served file, else a hash of the body. A repeat request
+    costs a lookup, and a streamed file is then never read. Misses run on
+    ``IMAGE_OPTIMIZE_THREADS`` worker threads, with identical requests sharing
+    one transcode. When the pool is busy or the transcode takes longer than
+    ``IMAGE_OPTIMIZE_WAIT_SECONDS``, the original image is served. Streamed
+    responses without a length or larger than ``IMAGE_OPTIMIZE_MAX_BYTES`` are
+    passed through untouched.
     """
-    
+
+    # (quality, max width, max height) per connection profile
+    PROFILES = {
+        'slow': (50, 800, 600),
+        'mobile': (60, 1200, 800),
+        'auto': (70, 1920, 1080),
+    }
+    FORMATS = {'JPEG': 'image/jpeg', 'WEBP': 'image/webp', 'PNG': 'image/png'}
+    # Source types Pillow cannot (usefully) re-encode
+    SKIPPED_TYPES = ('image/svg+xml', 'image/gif', 'image/x-icon', 'image/vnd.microsoft.icon')
+
     def __init__(self, get_response):
         self.get_response = get_response
-    
+
     def __call__(self, request):
         response = self.get_response(request)
-        
+
         # Check if this is an image request
-        if self.should_optimize_image(request, response):
-            response = self.optimize_image_response(request, response)
-        
+        params = self.should_optimize_image(request, response)
+        if params:
+            response = self.optimize_image_response(request, response, params)
+
         return response
-    
+
     def should_optimize_image(self, request, response):
         """
-        Determine if we should optimize this image
+        Output parameters (format, quality, max width, max height) if this response
+        should be transcoded, else None
         """
-        # Check if response is a file response
-        if not isinstance(response, (HttpResponse, FileResponse)):
-            return False
-        
-        # Check if it's an image
-        content_type = response.get('Content-Type', '')
-        if not content_type.startswith('image/'):
-            return False
-        
-        # Check if client wants optimization (from query params)
-        optimize = request.GET.get('optimize', 'true').lower()
+        if response.status_code != 200 or response.has_header('Content-Encoding'):
+            return None
+        content_type = response.get('Content-Type', '').split(';')[0].strip().lower()
+        if not content_type.startswith('image/') or content_type in self.SKIPPED_TYPES:
+            return None
+
+        optimize = request.GET.get('optimize', '').lower()
         if optimize == 'false':
-            return False
-        
-        # Check connection speed hint from query params
-        connection = request.GET.get('connection', 'auto').lower()
-        
-        return True
-    
-    def optimize_image_response(self, request, response):
+            return None
+        connection = request.GET.get('connection') or getattr(request, 'connection_speed', None) or 'auto'
+        connection = connection.lower()
+        if request.META.get('HTTP_SAVE_DATA', '').lower() == 'on' or \
+                request.META.get('HTTP_ECT', '').lower() in ('slow-2g', '2g'):
+            connection = 'slow'
+        elif connection == 'medium':
+            connection = 'mobile'
+        if connection not in ('slow', 'mobile') and optimize != 'true' and \
+                not getattr(settings, 'IMAGE_OPTIMIZE_DEFAULT', False):
+            return None
+
+        if getattr(response, 'streaming', False):
+            # Only files of a known, bounded size are worth reading into memory
+            try:
+                length = int(response.get('Content-Length', ''))
+            except ValueError:
+                return None
+            if length > int(getattr(settings, 'IMAGE_OPTIMIZE_MAX_BYTES', 8 << 20)):
+                _TRANSCODES.inc(outcome='too_large')
+                return None
+
+        quality, max_width, max_height = self.PROFILES.get(connection, self.PROFILES['auto'])
+        try:
+            quality = min(quality, int(request.GET.get('quality', quality)))
+            max_width = min(max_width, int(request.GET.get('max_width', max_width)))
+            max_height = min(max_height, int(request.GET.get('max_height', max_height)))
+        except ValueError:
+            return None
+        quality = max(1, min(95, quality))
+
+        format_type = request.GET.get('format', 'auto').upper()
+        if format_type == 'JPG':
+            format_type = 'JPEG'
+        if format_type not in self.FORMATS:
+            format_type = 'WEBP' if 'image/webp' in request.META.get('HTTP_ACCEPT', '').lower() else 'JPEG'
+        return format_type, quality, max(16, max_width), max(16, max_height)
+
+    def optimize_image_response(self, request, response, params):
         """
-        Optimize image based on connection speed and requirements
+        Serve the cached transcode of this response, transcoding it on the worker pool if needed
         """
-        try:
-            # Get optimization parameters from request
-            quality = int(request.GET.get('quality', '70'))  # Default 70% quality
-            max_width = int(request.GET.get('max_width', '1920'))
-            max_height = int(request.GET.get('max_height', '1080'))
-            format_type = request.GET.get('format', 'auto').upper()
-            connection = request.GET.get('connection', 'auto').lower()
-            
-            # Adjust settings based on connection type
-            if connection == 'slow':
-                quality = min(quality, 50)
-                max_width = min(max_width, 800)
-                max_height = min(max_height, 600)
-            elif connection == 'mobile':
-                quality = min(quality, 60)
-                max_width = min(max_width, 1200)
-                max_height = min(max_height, 800)
-            
-            # Get image content
-            if hasattr(response, 'streaming_content'):
-                content = b''.join(response.streaming_content)
-            else:
-                content = response.content
-            
-            if not content:
-                return response
-            
-            # Open and process image
-            img = Image.open(io.BytesIO(content))
-            
-            # Convert RGBA to RGB if saving as JPEG
-            if img.mode in ('RGBA', 'LA') and format_type in ('JPEG', 'auto'):
-                background = Image.new('RGB', img.size, (255, 255, 255))
-                if img.mode == 'LA':
-                    img = img.convert('RGBA')
-                background.paste(img, mask=img.split()[-1] if img.mode == 'RGBA' else None)
-                img = background
-            
-            # Resize if needed
-            if img.width > max_width or img.height > max_height:
-                img.thumbnail((max_width, max_height), Image.Resampling.LANCZOS)
-            
-            # Determine output format
-            if format_type == 'auto':
-                # Use WebP for better compression if supported
-                if 'webp' in request.META.get('HTTP_ACCEPT', '').lower():
-                    output_format = 'WEBP'
-                    content_type = 'image/webp'
-                else:
-                    output_format = 'JPEG'
-                    content_type = 'image/jpeg'
-            else:
-                output_format = format_type
-                content_type = f'image/{format_type.lower()}'
-            
-            # Save optimized image
-            output = io.BytesIO()
-            
-            if output_format == 'WEBP':
-                img.save(output, format='WEBP', quality=quality, optimize=True)
-            elif output_format == 'JPEG':
-                img.save(output, format='JPEG', quality=quality, optimize=True)
-            elif output_format == 'PNG':
-                img.save(output, format='PNG', optimize=True)
-            else:
-                img.save(output, format=output_format, quality=quality if output_format != 'PNG' else None)
-            
-            # Create optimized response
-            optimized_content = output.getvalue()
-            optimized_response = HttpResponse(optimized_content, content_type=content_type)
-            
-            # Copy headers from original response
-            for header, value in response.items():
-                if header.lower() not in ['content-length', 'content-type']:
-                    optimized_response[header] = value
-            
-            # Add optimization headers
-            optimized_response['X-Image-Optimized'] = 'true'
-            optimized_response['X-Original-Size'] = str(len(content))
-            optimized_response['X-Optimized-Size'] = str(len(optimized_content))
-            optimized_response['X-Compression-Ratio'] = f"{(1 - len(optimized_content)/len(content))*100:.1f}%"
-            
-            # Add cache headers for optimized images
-            optimized_response['Cache-Control'] = 'public, max-age=86400'  # 24 hours
-            
+        source = _source_version(response)
+        content = None
+        if source is None:
+            content = _read_content(response)
+            source = hashlib.blake2b(content, digest_size=16).hexdigest()
+        key = (source,) + tuple(params)
+        etag = 'W/"%s"' % hashlib.blake2b(repr(key).encode(), digest_size=12).hexdigest()
+
+        cached = _transcodes.get(key)
+        if cached is None:
+            if content is None:
+                content = _read_content(response)
+            cached = _transcoder.transcode(key, content, params)
+            if cached is None:
+                # Busy, slow or failed: the original image, whose body may have been consumed
+                return self._respond(response, content, response.get('Content-Type'), None, request)
+        body, content_type = cached
+        return self._respond(response, body, content_type, etag, request, len(content) if content else None)
+
+    def _respond(self, response, body, content_type, etag, request, original_size=None):
+        if etag and etag in request.META.get('HTTP_IF_NONE_MATCH', ''):
+            optimized_response = HttpResponseNotModified()
+        else:
+            optimized_response = HttpResponse(body, content_type=content_type)
+
+        # Copy headers from original response; a transcode is a different entity
+        skipped = ('content-length', 'content-type')
+        if etag is not None:
+            skipped += ('content-disposition', 'etag', 'last-modified')
+        for header, value in response.items():
+            if header.lower() not in skipped:
+                optimized_response[header] = value
+        _close(response)
+        patch_vary_headers(optimized_response, ('Accept', 'Save-Data', 'ECT'))
+        if etag is None:
             return optimized_response
-            
+
+        # Add optimization headers
+        optimized_response['ETag'] = etag
+        optimized_response['X-Image-Optimized'] = 'true'
+        if original_size:
+            optimized_response['X-Original-Size'] = str(original_size)
+        optimized_response['X-Optimized-Size'] = str(len(body))
+        if not optimized_response.has_header('Cache-Control'):
+            optimized_response['Cache-Control'] = 'private, max-age=86400'  # 24 hours
+        return optimized_response
+
+
+def _source_version(response):
+    """Version of the source image without reading it: its ETag, else the stat of the served file"""
+    etag = response.get('ETag')
+    if etag:
+        return 'etag:' + etag
+    stream = getattr(response, 'file_to_stream', None)
+    name = getattr(stream, 'name', None)
+    if isinstance(name, str):
+        try:
+            st = os.stat(name)
+        except OSError:
+            return None
+        return f'file:{name}:{st.st_size}:{st.st_mtime_ns}'
+    return None
+
+
+def _read_content(response):
+    if getattr(response, 'streaming', False):
+        content = b''.join(response.streaming_content)
+        # The body is consumed; what is served from here on is this copy
+        response.streaming_content = [content]
+        return content
+    return response.content
+
+
+def _close(response):
+    try:
+        response.close()
+    except Exception:
+        pass
+
+
+def _encode(content, params):
+    """(bytes, content type) of the image re-encoded with params, or of the source if that is smaller"""
+    output_format, quality, max_width, max_height = params
+    img = Image.open(io.BytesIO(content))
+    source_type = Image.MIME.get(img.format)
+    resized = img.width > max_width or img.height > max_height
+    if resized:
+        # JPEG sources decode straight at a reduced scale (no-op for other formats)
+        img.draft(img.mode, (max_width, max_height))
+
+    # Convert RGBA to RGB if saving as JPEG
+    if output_format == 'JPEG' and img.mode in ('RGBA', 'LA', 'P'):
+        img = img.convert('RGBA')
+        background = Image.new('RGB', img.size, (255, 255, 255))
+        background.paste(img, mask=img.split()[-1])
+        img = background
+    elif output_format == 'JPEG' and img.mode not in ('RGB', 'L'):
+        img = img.convert('RGB')
+    elif img.mode not in ('RGB', 'RGBA', 'L', 'LA'):
+        img = img.convert('RGBA' if 'A' in img.getbands() else 'RGB')
+
+    # Resize if needed
+    if resized:
+        img.thumbnail((max_width, max_height), Image.Resampling.LANCZOS)
+
+    output = io.BytesIO()
+    if output_format == 'PNG':
+        img.save(output, format='PNG', optimize=True)
+    else:
+        img.save(output, format=output_format, quality=quality, optimize=True)
+    body = output.getvalue()
+    if not resized and len(body) >= len(content) and source_type:
+        # Nothing gained: serve (and cache) the source as it is
+        return content, source_type
+    return body, ImageOptimizationMiddleware.FORMATS[output_format]
+
+
+class _TranscodeCache:
+    """Thread-safe LRU of encoded images bounded by IMAGE_OPTIMIZE_CACHE_MB"""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._items = OrderedDict()
+        self._bytes = 0
+        self._pid = None
+
+    def get(self, key):
+        with self._lock:
+            if self._pid != os.getpid():
+                self._pid = os.getpid()
+                self._items, self._bytes = OrderedDict(), 0
+            value = self._items.get(key)
+            if value is not None:
+                self._items.move_to_end(key)
+        if value is not None:
+            metrics.cache_hit('image_transcode')
+        else:
+            metrics.cache_miss('image_transcode')
+        return value
+
+    def put(self, key, value):
+        size = len(value[0])
+        budget = int(getattr(settings, 'IMAGE_OPTIMIZE_CACHE_MB', 128)) << 20
+        with self._lock:
+            old = self._items.pop(key, None)
+            if old is not None:
+                self._bytes -= len(old[0])
+            self._items[key] = value
+            self._bytes += size
+            while self._bytes > budget and len(self._items) > 1:
+                _, (evicted, _) = self._items.popitem(last=False)
+                self._bytes -= len(evicted)
+                metrics.CACHE_EVICTIONS.inc(cache='image_transcode')
+        metrics.CACHE_STORED_BYTES.inc(size, cache='image_transcode')
+
+    def sizes(self):
+        with self._lock:
+            return len(self._items), self._bytes
+
+
+class _Transcoder:
+    """Worker pool running transcodes, one per key at a time"""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._pool = None
+        self._pid = None
+        self._pending = {}   # key -> Future
+
+    def transcode(self, key, content, params):
+        """(body, content type), or None if the pool is saturated, the transcode is slow, or it failed"""
+        threads = max(1, int(getattr(settings, 'IMAGE_OPTIMIZE_THREADS', 2)))
+        with self._lock:
+            if self._pid != os.getpid():
+                self._pid, self._pool, self._pending = os.getpid(), None, {}
+            future = self._pending.get(key)
+            if future is None:
+                if len(self._pending) >= threads * 4:
+                    _TRANSCODES.inc(outcome='busy')
+                    return None
+                if self._pool is None:
+                    self._pool = ThreadPoolExecutor(max_workers=threads, thread_name_prefix='image-transcode')
+                future = self._pending[key] = self._pool.submit(self._run, key, content, params)
+        try:
+            return future.result(timeout=float(getattr(settings, 'IMAGE_OPTIMIZE_WAIT_SECONDS', 5.0)))
+        except FutureTimeout:
+            # Left to finish into the cache for the next request
+            _TRANSCODES.inc(outcome='timeout')
+            return None
+        except Exception:
+            return None
+
+    def _run(self, key, content, params):
+        try:
+            result = _encode(content, params)
+            # Cached before the key stops being pending, so a concurrent request finds one or the other
+            _transcodes.put(key, result)
         except Exception as e:
-            # If optimization fails, return original response
-            print(f"Image optimization failed: {e}")
-            return response
+            logger.warning(f"Image optimization failed: {e}")
+            _TRANSCODES.inc(outcome='failed')
+            raise
+        finally:
+            with self._lock:
+                self._pending.pop(key, None)
+        _TRANSCODES.inc(outcome='transcoded' if result[0] is not content else 'original')
+        return result
+
+
+_transcodes = _TranscodeCache()
+_transcoder = _Transcoder()
 
 
 class SlowConnectionOptimizationMiddleware:
@@ -538,4 +722,28 @@ class SessionTimeoutWarningMiddleware(MiddlewareMixin):
                 # Skip if user attribute is not properly initialized
                 pass
         
-        return response
\ No newline at end of file
+        return response
+
+class MetricsMiddleware:
+    """
+    Record per-view latency, status and bytes served for the /metrics endpoint.
+    Views are labelled by URL name so cardinality stays bounded.
+    """
+
+    def __init__(self, get_response):
+        self.get_response = get_response
+
+    def __call__(self, request):
+        from . import metrics
+
+        start = time.perf_counter()
+        response = self.get_response(request)
+        elapsed = time.perf_counter() - start
+
+        match = getattr(request, 'resolver_match', None)
+        view = (match.view_name or match._func_path) if match else 'unmatched'
+        metrics.HTTP_REQUEST_SECONDS.observe(elapsed, view=view, method=request.method)
+        metrics.HTTP_RESPONSES.inc(view=view, status=f'{response.status_code // 100}xx')
+        if not getattr(response, 'streaming', False):
+            metrics.HTTP_RESPONSE_BYTES.inc(len(response.content), view=view)
+        return response
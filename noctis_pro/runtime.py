@@ -0,0 +1,73 @@
+"""
+Private directory for per-host runtime files (channel layer socket and lock,
+shared session table).
+
+A fixed name in the shared temp directory can be pre-created, symlinked or
+raced by another local user. Runtime files therefore live in ``RUNTIME_DIR``
+(default ``$XDG_RUNTIME_DIR/noctis``, else ``<tmp>/noctis-<uid>``), which is
+created 0700 and refused unless it is a real directory owned by this user with
+no group or other access. Files in it are opened without following symlinks
+and checked the same way.
+"""
+import os
+import stat
+import tempfile
+
+from django.conf import settings
+
+
+def _check(st, path, is_kind, kind):
+    if not is_kind(st.st_mode):
+        raise PermissionError(f'{path} is not a {kind}')
+    if st.st_uid != os.getuid():
+        raise PermissionError(f'{path} is owned by uid {st.st_uid}, not {os.getuid()}')
+    if st.st_mode & 0o077:
+        raise PermissionError(f'{path} is accessible to other users (mode {stat.S_IMODE(st.st_mode):o})')
+
+
+def private_dir(path):
+    """Create path 0700 if missing; raise PermissionError unless it is a private directory of ours"""
+    parent = os.path.dirname(path)
+    if parent:
+        os.makedirs(parent, exist_ok=True)
+    try:
+        os.mkdir(path, 0o700)
+    except FileExistsError:
+        pass
+    _check(os.lstat(path), path, stat.S_ISDIR, 'directory')
+    return path
+
+
+def runtime_dir():
+    path = getattr(settings, 'RUNTIME_DIR', None)
+    if not path:
+        xdg = os.environ.get('XDG_RUNTIME_DIR')
+        path = os.path.join(xdg, 'noctis') if xdg else os.path.join(tempfile.gettempdir(), f'noctis-{os.getuid()}')
+    return private_dir(path)
+
+
+def runtime_path(name):
+    """Path of a runtime file in the private directory"""
+    return os.path.join(runtime_dir(), name)
+
+
+def open_private(path, flags):
+    """os.open with O_NOFOLLOW (mode 0600 when created); the file must be a regular file
+    owned by this user with no group or other access
+    """
+    fd = os.open(path, flags | os.O_NOFOLLOW | os.O_CLOEXEC, 0o600)
+    try:
+        _check(os.fstat(fd), path, stat.S_ISREG, 'regular file')
+    except OSError:
+        os.close(fd)
+        raise
+    return fd
+
+
+def check_socket(path):
+    """Raise PermissionError unless path is a Unix socket owned by this user"""
+    st = os.lstat(path)
+    if not stat.S_ISSOCK(st.st_mode):
+        raise PermissionError(f'{path} is not a socket')
+    if st.st_uid != os.getuid():
+        raise PermissionError(f'{path} is owned by uid {st.st_uid}, not {os.getuid()}')
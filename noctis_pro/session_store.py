@@ -0,0 +1,277 @@
+"""
+Database session engine with a front cache and throttled activity writes.
+
+With ``SESSION_SAVE_EVERY_REQUEST`` (and SessionTimeoutMiddleware stamping
+``last_activity``), the stock db backend loads and rewrites the session row
+on every request, including each AJAX slice fetch while scrolling a series.
+This engine keeps the database as the store of record but:
+
+* serves loads from a per-process LRU of encoded session rows, validated
+  against a generation number in a small shared-memory table, so a change or
+  logout in one worker is seen by every other worker on the next request;
+* skips the row UPDATE when nothing but activity changed and the row was
+  written less than ``SESSION_ACTIVITY_WRITE_INTERVAL`` seconds ago; the
+  activity time goes to the shared table instead.
+
+Inactivity expiry stays exact: rows are stored with ``expire_date`` extended
+by the write interval, and a load treats the session as expired once the
+latest activity (database or shared table) is older than the session age.
+``last_activity`` in the session data is set from the shared table on load,
+so SessionTimeoutMiddleware sees the same time in every worker.
+
+The shared table is a file in the private runtime directory (runtime.py),
+opened only if it is owned by this user and closed to others; otherwise the
+front cache is disabled. It covers one host; on several hosts behind one database set
+``SESSION_FRONT_CACHE = False`` to get plain db-backend behaviour.
+"""
+import hashlib
+import json
+import logging
+import mmap
+import os
+import struct
+import threading
+import time
+from collections import OrderedDict
+from datetime import timedelta
+
+from asgiref.sync import sync_to_async
+from django.conf import settings
+from django.contrib.sessions.backends.db import SessionStore as DBStore
+
+from noctis_pro import metrics, runtime
+
+logger = logging.getLogger('noctis_pro.sessions')
+
+# Session key written by SessionTimeoutMiddleware
+ACTIVITY_KEY = 'last_activity'
+
+# Slot: key fingerprint, generation, last activity (unix time)
+_SLOT = struct.Struct('=QQd')
+
+SESSION_WRITES = metrics.counter(
+    'noctis_session_writes', 'Session saves by outcome', ('outcome',))
+
+
+class SharedSessionTable:
+    """Fixed-size table of session slots in a memory-mapped file"""
+
+    def __init__(self, path, slots):
+        self.slots = slots
+        size = slots * _SLOT.size
+        # Anyone who can write the table can revive or forge session activity
+        runtime.private_dir(os.path.dirname(os.path.abspath(path)))
+        fd = runtime.open_private(path, os.O_RDWR | os.O_CREAT)
+        try:
+            if os.fstat(fd).st_size < size:
+                os.ftruncate(fd, size)
+            self.map = mmap.mmap(fd, size)
+        finally:
+            os.close(fd)
+
+    def _locate(self, session_key):
+        digest = hashlib.blake2b(session_key.encode(), digest_size=16).digest()
+        fingerprint, index = struct.unpack('=QQ', digest)
+        return fingerprint or 1, (index % self.slots) * _SLOT.size
+
+    def read(self, session_key):
+        """(generation, activity) for the key, or (None, None) if the slot is not ours"""
+        fingerprint, offset = self._locate(session_key)
+        owner, generation, activity = _SLOT.unpack_from(self.map, offset)
+        if owner != fingerprint:
+            return None, None
+        return generation, activity
+
+    def write(self, session_key, activity, generation=None):
+        """Claim the slot; a new generation invalidates every front cache"""
+        fingerprint, offset = self._locate(session_key)
+        if generation is None:
+            generation = int.from_bytes(os.urandom(8), 'little')
+        _SLOT.pack_into(self.map, offset, fingerprint, generation, activity)
+        return generation
+
+    def touch(self, session_key, activity):
+        """Record activity without invalidating; False if another key took the slot"""
+        generation, current = self.read(session_key)
+        if generation is None:
+            return False
+        if activity > current:
+            self.write(session_key, activity, generation)
+        return True
+
+
+class _FrontCache:
+    def __init__(self, max_entries):
+        self.max_entries = max_entries
+        self._lock = threading.Lock()
+        self._entries = OrderedDict()   # key -> (session_data, expires, generation, written_at)
+
+    def get(self, key):
+        with self._lock:
+            entry = self._entries.get(key)
+            if entry is not None:
+                self._entries.move_to_end(key)
+            return entry
+
+    def set(self, key, entry):
+        evicted = 0
+        with self._lock:
+            self._entries[key] = entry
+            self._entries.move_to_end(key)
+            while len(self._entries) > self.max_entries:
+                self._entries.popitem(last=False)
+                evicted += 1
+        if evicted:
+            metrics.CACHE_EVICTIONS.inc(evicted, cache='sessions')
+
+    def pop(self, key):
+        with self._lock:
+            self._entries.pop(key, None)
+
+
+_table = None
+_table_failed = False
+_front = None
+_setup_lock = threading.Lock()
+
+
+def _shared():
+    """(table, front cache), or (None, None) when disabled or unavailable"""
+    global _table, _table_failed, _front
+    if _table is not None or _table_failed:
+        return _table, _front
+    with _setup_lock:
+        if _table is None and not _table_failed:
+            if not getattr(settings, 'SESSION_FRONT_CACHE', True):
+                _table_failed = True
+                return None, None
+            path = getattr(settings, 'SESSION_SHARED_TABLE_PATH', None)
+            try:
+                if not path:
+                    tag = hashlib.sha1(str(settings.BASE_DIR).encode()).hexdigest()[:10]
+                    path = runtime.runtime_path(f'sessions-{tag}.bin')
+                _table = SharedSessionTable(path, getattr(settings, 'SESSION_SHARED_TABLE_SLOTS', 262144))
+                _front = _FrontCache(getattr(settings, 'SESSION_FRONT_CACHE_ENTRIES', 10000))
+            except (OSError, ValueError) as e:
+                logger.warning(f"Session front cache disabled, shared table unavailable: {e}")
+                _table_failed = True
+    return _table, _front
+
+
+def _without_activity(data):
+    return json.dumps({k: v for k, v in data.items() if k != ACTIVITY_KEY}, sort_keys=True, default=str)
+
+
+class SessionStore(DBStore):
+    def __init__(self, session_key=None):
+        super().__init__(session_key)
+        self._snapshot = None      # data as last persisted, minus activity
+        self._written_at = None    # when the row was last written
+        self._last_row = None
+
+    @property
+    def write_interval(self):
+        return getattr(settings, 'SESSION_ACTIVITY_WRITE_INTERVAL', 60)
+
+    def _age(self, data):
+        """Inactivity age in seconds, or None for absolute (datetime) expiry"""
+        expiry = data.get('_session_expiry')
+        if not expiry:
+            # None, or 0 for "at browser close": the cookie age applies (as in get_expiry_age)
+            return self.get_session_cookie_age()
+        return expiry if isinstance(expiry, int) else None
+
+    def create_model_instance(self, data):
+        obj = super().create_model_instance(data)
+        age = self._age(data)
+        if age is not None and _shared()[0] is not None:
+            # Slack so the row outlives throttled activity; load() enforces the exact age
+            obj.expire_date += timedelta(seconds=self.write_interval)
+        self._last_row = obj
+        return obj
+
+    def load(self):
+        table, front = _shared()
+        key = self.session_key
+        if table is None or not key:
+            return super().load()
+
+        generation, activity = table.read(key)
+        entry = front.get(key)
+        now = time.time()
+        if entry is not None and generation is not None and entry[2] == generation and entry[1] > now:
+            metrics.cache_hit('sessions')
+            session_data, _, _, written_at = entry
+            data = self.decode(session_data)
+        else:
+            metrics.cache_miss('sessions')
+            row = self._get_session_from_db()
+            if row is None:
+                front.pop(key)
+                return {}
+            data = self.decode(row.session_data)
+            age = self._age(data)
+            expires = row.expire_date.timestamp()
+            written_at = expires - age - self.write_interval if age is not None else now
+            if generation is None:
+                generation = table.write(key, written_at)
+                activity = written_at
+            front.set(key, (row.session_data, expires, generation, written_at))
+
+        age = self._age(data)
+        last_seen = max(written_at, activity or 0.0)
+        if age is not None and now - last_seen > age:
+            # Inactive for the full session age (the row itself carries slack)
+            front.pop(key)
+            self._session_key = None
+            return {}
+
+        self._snapshot = _without_activity(data)
+        self._written_at = written_at
+        if activity:
+            current = data.get(ACTIVITY_KEY)
+            data[ACTIVITY_KEY] = max(current, activity) if isinstance(current, (int, float)) else activity
+        return data
+
+    def save(self, must_create=False):
+        table, front = _shared()
+        if self.session_key is None:
+            return self.create()
+        if table is not None and not must_create and self._snapshot is not None:
+            data = self._get_session()
+            now = time.time()
+            if (now - self._written_at < self.write_interval and self._age(data) is not None
+                    and _without_activity(data) == self._snapshot
+                    and table.touch(self.session_key, now)):
+                SESSION_WRITES.inc(outcome='throttled')
+                return
+
+        super().save(must_create=must_create)
+        SESSION_WRITES.inc(outcome='written')
+        if table is not None and self._last_row is not None:
+            now = time.time()
+            row = self._last_row
+            generation = table.write(self.session_key, now)
+            front.set(self.session_key, (row.session_data, row.expire_date.timestamp(), generation, now))
+            self._snapshot = _without_activity(self.decode(row.session_data))
+            self._written_at = now
+
+    def delete(self, session_key=None):
+        key = session_key or self.session_key
+        super().delete(session_key)
+        table, front = _shared()
+        if table is not None and key:
+            front.pop(key)
+            table.write(key, 0.0)
+        if key == self.session_key:
+            self._snapshot = None
+
+    # The async variants share the cache logic above
+    async def aload(self):
+        return await sync_to_async(self.load)()
+
+    async def asave(self, must_create=False):
+        return await sync_to_async(self.save)(must_create)
+
+    async def adelete(self, session_key=None):
+        return await sync_to_async(self.delete)(session_key)
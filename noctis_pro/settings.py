@@ -85,12 +85,15 @@ INSTALLED_APPS = [
 ]
 
 MIDDLEWARE = [
+    'noctis_pro.middleware.MetricsMiddleware',  # Outermost so latency covers the full stack
+    'noctis_pro.middleware.ImageOptimizationMiddleware',  # Only for clients asking (Save-Data, connection=)
     'corsheaders.middleware.CorsMiddleware',  # Re-enabled
     'django.middleware.security.SecurityMiddleware',
     'django.contrib.sessions.middleware.SessionMiddleware',
     'django.middleware.common.CommonMiddleware',
     'django.middleware.csrf.CsrfViewMiddleware',
     'django.contrib.auth.middleware.AuthenticationMiddleware',
+    'noctis_pro.middleware.SessionTimeoutMiddleware',  # Cheap with the throttled session engine below
     'django.contrib.messages.middleware.MessageMiddleware',
     'django.middleware.clickjacking.XFrameOptionsMiddleware',
 ]
@@ -119,22 +122,43 @@ ASGI_APPLICATION = 'noctis_pro.asgi.application'  # Re-enabled for Daphne
 # Database
 # https://docs.djangoproject.com/en/5.2/ref/settings/#databases
 
-# Redis configuration for channels - Disabled for now to fix login
-# CHANNEL_LAYERS = {
-#     'default': {
-#         'BACKEND': 'channels_redis.core.RedisChannelLayer',
-#         'CONFIG': {
-#             "hosts": [('127.0.0.1', 6379)],
-#         },
-#     },
-# }
-
-# Use in-memory channel layer for now
-CHANNEL_LAYERS = {
-    'default': {
-        'BACKEND': 'channels.layers.InMemoryChannelLayer',
-    },
-}
+# Private directory (0700, owned by this user) for host-local runtime files such as
+# the channel layer socket; defaults to $XDG_RUNTIME_DIR/noctis or <tmp>/noctis-<uid>
+RUNTIME_DIR = os.environ.get('NOCTIS_RUNTIME_DIR') or None
+
+# Channel layer: 'local' routes between worker processes on this host through a
+# Unix socket broker (noctis_pro/channel_layer.py), 'redis' uses channels_redis,
+# 'memory' keeps everything in one process
+CHANNEL_LAYER_BACKEND = os.environ.get('CHANNEL_LAYER_BACKEND', 'local')
+
+if CHANNEL_LAYER_BACKEND == 'redis':
+    CHANNEL_LAYERS = {
+        'default': {
+            'BACKEND': 'channels_redis.core.RedisChannelLayer',
+            'CONFIG': {
+                "hosts": [os.environ.get('CHANNEL_LAYER_REDIS_URL', 'redis://127.0.0.1:6379/0')],
+            },
+        },
+    }
+elif CHANNEL_LAYER_BACKEND == 'memory':
+    CHANNEL_LAYERS = {
+        'default': {
+            'BACKEND': 'channels.layers.InMemoryChannelLayer',
+        },
+    }
+else:
+    CHANNEL_LAYERS = {
+        'default': {
+            'BACKEND': 'noctis_pro.channel_layer.UnixSocketChannelLayer',
+            'CONFIG': {
+                # Unix socket path or tcp://host:port of a standalone channel_broker;
+                # defaults to a per-deployment socket in RUNTIME_DIR
+                'address': os.environ.get('CHANNEL_LAYER_ADDRESS') or None,
+                # Set to 0 when a channel_broker service runs the broker instead
+                'embedded_broker': os.environ.get('CHANNEL_LAYER_EMBEDDED_BROKER', '1') == '1',
+            },
+        },
+    }
 
 # Celery Configuration - Disabled for now to fix login
 # CELERY_BROKER_URL = 'redis://localhost:6379'
@@ -198,6 +222,69 @@ MEDIA_ROOT = os.path.join(BASE_DIR, 'media')
 # DICOM files storage
 DICOM_ROOT = os.path.join(MEDIA_ROOT, 'dicom')
 
+# Viewer image encoding (dicom_viewer/rendering.py): default format of rendered
+# slices when a request has no ?format= (png, webp = lossless WebP, jpeg), and the
+# threads that render the planes of one MPR/MIP/bone request concurrently
+VIEWER_IMAGE_FORMAT = os.environ.get('VIEWER_IMAGE_FORMAT', 'png')
+VIEWER_JPEG_QUALITY = int(os.environ.get('VIEWER_JPEG_QUALITY', '90'))
+IMAGE_RENDER_THREADS = int(os.environ.get('IMAGE_RENDER_THREADS', '0')) or None
+# Background threads decoding MPR volumes after their first request (dicom_viewer/assembly.py)
+MPR_ASSEMBLY_THREADS = int(os.environ.get('MPR_ASSEMBLY_THREADS', '2'))
+
+# Warm-up of ingested series for their hanging protocol (dicom_viewer/prefetch.py):
+# quiet period after the last received instance, share of the warm-up thread's
+# time spent working, and how long queued jobs and unopened volumes are kept
+PREFETCH_ENABLED = os.environ.get('PREFETCH_ENABLED', 'True').lower() == 'true'
+PREFETCH_SETTLE_SECONDS = float(os.environ.get('PREFETCH_SETTLE_SECONDS', '5'))
+PREFETCH_CPU_SHARE = float(os.environ.get('PREFETCH_CPU_SHARE', '0.5'))
+PREFETCH_TTL_SECONDS = int(os.environ.get('PREFETCH_TTL_SECONDS', '1800'))
+
+# Raw decoded cine frames kept by all cine streams of a process together
+# (dicom_viewer/cine.py), shared equally between the open streams
+CINE_CACHE_MB = int(os.environ.get('CINE_CACHE_MB', '256'))
+
+# Scroll read-ahead (dicom_viewer/readahead.py): slices rendered ahead of a
+# scrolling viewer cover READAHEAD_SECONDS at its current speed, within the
+# slice bounds, on low-priority background threads
+READAHEAD_ENABLED = os.environ.get('READAHEAD_ENABLED', 'True').lower() == 'true'
+READAHEAD_THREADS = int(os.environ.get('READAHEAD_THREADS', '1'))
+READAHEAD_SECONDS = float(os.environ.get('READAHEAD_SECONDS', '0.5'))
+READAHEAD_MIN_SLICES = int(os.environ.get('READAHEAD_MIN_SLICES', '2'))
+READAHEAD_MAX_SLICES = int(os.environ.get('READAHEAD_MAX_SLICES', '16'))
+
+# Deep-zoom tiles (dicom_viewer/tiles.py): images of at least TILE_MIN_PIXELS
+# are advertised for tiled display; decoded pyramids and encoded tiles are
+# cached within these budgets
+TILE_MIN_PIXELS = int(os.environ.get('TILE_MIN_PIXELS', '4000000'))
+TILE_PYRAMID_CACHE_MB = int(os.environ.get('TILE_PYRAMID_CACHE_MB', '512'))
+TILE_CACHE_MB = int(os.environ.get('TILE_CACHE_MB', '128'))
+
+# Image optimization (noctis_pro/middleware.py): image responses are
+# transcoded for clients on slow links (Save-Data, connection=slow|mobile) or
+# for everyone with IMAGE_OPTIMIZE_DEFAULT. Results are cached by source
+# version and output parameters; misses run on IMAGE_OPTIMIZE_THREADS workers
+# and requests wait at most IMAGE_OPTIMIZE_WAIT_SECONDS before getting the
+# original. Streamed files above IMAGE_OPTIMIZE_MAX_BYTES pass through.
+IMAGE_OPTIMIZE_DEFAULT = os.environ.get('IMAGE_OPTIMIZE_DEFAULT', 'False').lower() == 'true'
+IMAGE_OPTIMIZE_THREADS = int(os.environ.get('IMAGE_OPTIMIZE_THREADS', '2'))
+IMAGE_OPTIMIZE_WAIT_SECONDS = float(os.environ.get('IMAGE_OPTIMIZE_WAIT_SECONDS', '5'))
+IMAGE_OPTIMIZE_MAX_BYTES = int(os.environ.get('IMAGE_OPTIMIZE_MAX_BYTES', str(8 << 20)))
+IMAGE_OPTIMIZE_CACHE_MB = int(os.environ.get('IMAGE_OPTIMIZE_CACHE_MB', '128'))
+
+# Exports (dicom_viewer/export.py): archives are streamed as they are written;
+# EXPORT_THREADS workers render slices and assemble series volumes at most
+# EXPORT_AHEAD entries ahead of the writer. Reconstruction job results are
+# written to RECONSTRUCTION_RESULTS_DIR.
+EXPORT_THREADS = int(os.environ.get('EXPORT_THREADS', '2'))
+EXPORT_AHEAD = int(os.environ.get('EXPORT_AHEAD', '4'))
+RECONSTRUCTION_RESULTS_DIR = os.environ.get('RECONSTRUCTION_RESULTS_DIR', os.path.join(MEDIA_ROOT, 'reconstructions'))
+
+# Gzip of volume exports (.nii.gz, .raw.gz and export_volumes): 1 MiB blocks deflated
+# in parallel on EXPORT_GZIP_THREADS threads (0: up to 4, one per CPU) at
+# EXPORT_GZIP_LEVEL. The output is a single ordinary gzip stream.
+EXPORT_GZIP_THREADS = int(os.environ.get('EXPORT_GZIP_THREADS', '0'))
+EXPORT_GZIP_LEVEL = int(os.environ.get('EXPORT_GZIP_LEVEL', '6'))
+
 # Default primary key field type
 # https://docs.djangoproject.com/en/5.2/ref/settings/#default-auto-field
 
@@ -272,8 +359,13 @@ LOGIN_URL = '/login/'
 LOGIN_REDIRECT_URL = '/worklist/'
 LOGOUT_REDIRECT_URL = '/login/'
 
-# Session configuration - Use database sessions instead of Redis
-SESSION_ENGINE = 'django.contrib.sessions.backends.db'
+# Session configuration - database sessions behind a per-process front cache
+# (noctis_pro/session_store.py); activity-only saves reach the database at most
+# once per SESSION_ACTIVITY_WRITE_INTERVAL seconds, inactivity expiry stays exact
+SESSION_ENGINE = 'noctis_pro.session_store'
+SESSION_ACTIVITY_WRITE_INTERVAL = int(os.environ.get('SESSION_ACTIVITY_WRITE_INTERVAL', '60'))
+# Disable when several hosts share the database (the cache is coherent per host)
+SESSION_FRONT_CACHE = os.environ.get('SESSION_FRONT_CACHE', 'True').lower() == 'true'
 # 30 minutes inactivity timeout
 SESSION_COOKIE_AGE = 1800
 # Refresh expiry on each request to implement inactivity-based expiry
@@ -422,6 +514,16 @@ print(f"   • Security: {'Development' if DEBUG else 'Production'} profile")
 # Masterpiece overrides removed to allow dynamic configuration via environment and NGROK_URL
 SECURE_PROXY_SSL_HEADER = ('HTTP_X_FORWARDED_PROTO', 'https')
 
+# Metrics endpoints (/metrics and the receiver's --metrics-port); when set, scrapers
+# must send "Authorization: Bearer <token>", when empty only loopback clients are answered
+METRICS_AUTH_TOKEN = os.environ.get('METRICS_AUTH_TOKEN', '')
+
+# New-study notifications are coalesced over this many seconds before fan-out
+NOTIFICATION_DISPATCH_WINDOW = float(os.environ.get('NOTIFICATION_DISPATCH_WINDOW', '2.0'))
+
+# Chat message inserts, read receipts and presence are batched over this many seconds
+CHAT_WRITE_WINDOW = float(os.environ.get('CHAT_WRITE_WINDOW', '0.05'))
+
 # DICOM viewer masterpiece settings
 DICOM_VIEWER_SETTINGS = {
     'MAX_UPLOAD_SIZE': 100 * 1024 * 1024,  # 100MB
@@ -79,4 +79,5 @@ urlpatterns += [
     path('health/simple/', health_views.simple_health_check, name='health_simple'),
     path('health/ready/', health_views.ready_check, name='health_ready'),
     path('health/live/', health_views.live_check, name='health_live'),
+    path('metrics', health_views.metrics_view, name='metrics'),
 ]
@@ -45,11 +45,17 @@ class NotificationConsumer(AsyncWebsocketConsumer):
         notification_type = event['notification_type']
         message = event['message']
 
-        # Send notification to WebSocket
-        await self.send(text_data=json.dumps({
+        payload = {
             'type': notification_type,
             'message': message,
-        }))
+        }
+        # Dispatcher notifications carry their title and ids
+        for key in ('title', 'notification_id', 'study_id'):
+            if event.get(key) is not None:
+                payload[key] = event[key]
+
+        # Send notification to WebSocket
+        await self.send(text_data=json.dumps(payload))
 
 
 class SystemStatusConsumer(AsyncWebsocketConsumer):
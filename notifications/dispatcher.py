@@ -0,0 +1,250 @@
+"""
+Batched, asynchronous fan-out of new-study notifications.
+
+Ingest (the DICOM receiver and web upload) only enqueues a small event after
+its transaction commits; a background thread per process collects events for
+``NOTIFICATION_DISPATCH_WINDOW`` seconds, resolves recipients once per batch,
+writes all notifications with one ``bulk_create`` and pushes them to the
+``notifications_<user_id>`` groups served by ``NotificationConsumer``. Ingest
+latency is therefore independent of the number of recipients.
+
+A burst of several new studies within one window becomes a single summary
+notification per recipient instead of one per study.
+"""
+import atexit
+import logging
+import os
+import queue
+import threading
+import time
+
+from django.conf import settings
+from django.db import close_old_connections, transaction
+from django.db.models import Q
+
+from noctis_pro import metrics
+
+logger = logging.getLogger('noctis_pro.notifications')
+
+# Upper bound on events folded into one flush
+MAX_BATCH = 500
+# Studies listed by name in a summary notification
+SUMMARY_LISTED = 5
+
+NOTIFICATIONS_CREATED = metrics.counter(
+    'noctis_notifications_created', 'Notifications written by the dispatcher', ('kind',))
+NOTIFICATION_FLUSH_SECONDS = metrics.histogram(
+    'noctis_notification_flush_duration_seconds', 'Time to resolve, write and push one notification batch')
+
+_STOP = object()
+
+
+class NotificationDispatcher:
+    def __init__(self, window=None):
+        self.window = window if window is not None else getattr(settings, 'NOTIFICATION_DISPATCH_WINDOW', 2.0)
+        self._lock = threading.Lock()
+        self._atexit_registered = False
+        self._reset()
+
+    def _reset(self):
+        self._pid = os.getpid()
+        self._queue = queue.Queue()
+        self._thread = None
+
+    def _ensure_thread(self):
+        with self._lock:
+            if self._pid != os.getpid():
+                # Forked receiver worker: the parent's thread does not exist here
+                self._reset()
+            if self._thread is None or not self._thread.is_alive():
+                self._thread = threading.Thread(target=self._run, name='notification-dispatcher', daemon=True)
+                self._thread.start()
+                if not self._atexit_registered:
+                    atexit.register(self.stop)
+                    self._atexit_registered = True
+
+    def enqueue(self, study_id, sender_id=None, series_count=None):
+        self._ensure_thread()
+        self._queue.put({'study_id': study_id, 'sender_id': sender_id, 'series_count': series_count})
+
+    def pending(self):
+        return self._queue.qsize()
+
+    def stop(self, timeout=10.0):
+        """Flush what is queued and stop the thread (registered with atexit)"""
+        thread = self._thread
+        if thread is None or not thread.is_alive():
+            return
+        self._queue.put(_STOP)
+        thread.join(timeout)
+
+    def _run(self):
+        while True:
+            item = self._queue.get()
+            if item is _STOP:
+                return
+            batch = [item]
+            stopping = False
+            deadline = time.monotonic() + self.window
+            while len(batch) < MAX_BATCH:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    break
+                try:
+                    item = self._queue.get(timeout=remaining)
+                except queue.Empty:
+                    break
+                if item is _STOP:
+                    stopping = True
+                    break
+                batch.append(item)
+
+            close_old_connections()
+            try:
+                with NOTIFICATION_FLUSH_SECONDS.time():
+                    dispatch(batch)
+            except Exception as e:
+                logger.error(f"Notification dispatch failed for {len(batch)} events: {e}")
+            if stopping:
+                return
+
+
+def dispatch(events):
+    """Write and push notifications for a batch of new-study events"""
+    from accounts.models import User
+    from worklist.models import Study
+    from .models import Notification, NotificationPreference, NotificationType
+
+    # Later events for the same study win (e.g. a second upload adding series)
+    by_study = {}
+    for event in events:
+        by_study[event['study_id']] = event
+    studies = Study.objects.select_related('patient', 'facility', 'modality').in_bulk(list(by_study))
+    if not studies:
+        return 0
+
+    notif_type, _ = NotificationType.objects.get_or_create(
+        code='new_study',
+        defaults={'name': 'New Study Uploaded', 'description': 'A new study has been uploaded', 'is_system': True}
+    )
+
+    facility_ids = {s.facility_id for s in studies.values()}
+    recipients = list(User.objects.filter(
+        Q(role__in=('radiologist', 'admin')) | Q(facility_id__in=facility_ids),
+        is_active=True,
+    ).values_list('id', 'role', 'facility_id'))
+    opted_out = set(NotificationPreference.objects.filter(
+        user_id__in=[r[0] for r in recipients], new_study_notifications=False,
+    ).values_list('user_id', flat=True))
+
+    ordered = sorted(studies.values(), key=lambda s: s.id)
+    notifications = []
+    for user_id, role, facility_id in recipients:
+        if user_id in opted_out:
+            continue
+        visible = ordered if role in ('radiologist', 'admin') else [s for s in ordered if s.facility_id == facility_id]
+        if not visible:
+            continue
+        if len(visible) == 1:
+            notifications.append(_study_notification(notif_type, user_id, visible[0], by_study[visible[0].id]))
+        else:
+            notifications.append(_summary_notification(notif_type, user_id, visible))
+
+    created = Notification.objects.bulk_create(notifications, batch_size=500)
+    for n in created:
+        NOTIFICATIONS_CREATED.inc(kind='summary' if n.study_id is None else 'study')
+    _push(created)
+    logger.info(f"Dispatched {len(created)} notifications for {len(studies)} new studies")
+    return len(created)
+
+
+def _study_notification(notif_type, user_id, study, event):
+    from .models import Notification
+
+    patient_name = study.patient.full_name
+    message = f"Study {study.accession_number} uploaded from {study.facility.name}"
+    data = {
+        'study_id': study.id,
+        'accession_number': study.accession_number,
+        'modality': study.modality.code,
+        'patient_name': patient_name,
+    }
+    if event.get('series_count'):
+        message += f" with {event['series_count']} series"
+        data['series_count'] = event['series_count']
+    return Notification(
+        notification_type=notif_type,
+        recipient_id=user_id,
+        sender_id=event.get('sender_id'),
+        title=f"New {study.modality.code} study for {patient_name}",
+        message=message,
+        priority='normal',
+        study=study,
+        facility=study.facility,
+        data=data,
+    )
+
+
+def _summary_notification(notif_type, user_id, studies):
+    from .models import Notification
+
+    listed = ', '.join(f"{s.accession_number} ({s.modality.code})" for s in studies[:SUMMARY_LISTED])
+    more = len(studies) - SUMMARY_LISTED
+    facilities = {s.facility_id for s in studies}
+    return Notification(
+        notification_type=notif_type,
+        recipient_id=user_id,
+        title=f"{len(studies)} new studies",
+        message=f"New studies: {listed}" + (f" and {more} more" if more > 0 else ''),
+        priority='normal',
+        facility=studies[0].facility if len(facilities) == 1 else None,
+        data={
+            'study_ids': [s.id for s in studies],
+            'accession_numbers': [s.accession_number for s in studies],
+        },
+    )
+
+
+def _push(notifications):
+    """Send to each recipient's NotificationConsumer group"""
+    if not notifications:
+        return
+    try:
+        import asyncio
+        from asgiref.sync import async_to_sync
+        from channels.layers import get_channel_layer
+    except ImportError:
+        return
+    layer = get_channel_layer()
+    if layer is None:
+        return
+
+    async def send_all():
+        await asyncio.gather(*[
+            layer.group_send(f'notifications_{n.recipient_id}', {
+                'type': 'send_notification',
+                'notification_type': 'new_study',
+                'message': n.message,
+                'title': n.title,
+                'notification_id': n.pk,
+                'study_id': n.study_id,
+            })
+            for n in notifications
+        ], return_exceptions=True)
+
+    try:
+        async_to_sync(send_all)()
+    except Exception as e:
+        logger.warning(f"Notification push failed: {e}")
+
+
+_dispatcher = NotificationDispatcher()
+
+
+def get_dispatcher():
+    return _dispatcher
+
+
+def notify_new_study(study_id, sender_id=None, series_count=None):
+    """Queue a new-study notification once the current transaction commits"""
+    transaction.on_commit(lambda: _dispatcher.enqueue(study_id, sender_id=sender_id, series_count=series_count))
@@ -0,0 +1,243 @@
+"""
+Channel Layer Benchmark Management Command
+Connects many simulated WebSocket clients (one channel each, all in one group)
+spread over several worker processes, then measures group fan-out latency
+(time until every client has a message) with paced sends and delivered
+messages per second with a burst of sends:
+
+    python manage.py benchmark_channels --clients 1000 --processes 4
+    python manage.py benchmark_channels --backend memory --clients 1000 --json memory.json
+
+The local backend runs its own broker on a temporary socket, so it does not
+disturb a running server. The memory backend (InMemoryChannelLayer) cannot
+cross processes and always runs the clients in this process.
+"""
+import asyncio
+import json
+import multiprocessing
+import os
+import statistics
+import tempfile
+import time
+
+from django.core.management.base import BaseCommand, CommandError
+
+GROUP = 'benchmark'
+
+
+def _percentile(sorted_values, pct):
+    if not sorted_values:
+        return None
+    idx = min(len(sorted_values) - 1, max(0, int(round(len(sorted_values) * pct / 100.0)) - 1))
+    return sorted_values[idx]
+
+
+def _latency_summary(values_ms):
+    values = sorted(values_ms)
+    if not values:
+        return {'count': 0}
+    return {
+        'count': len(values),
+        'p50_ms': round(statistics.median(values), 3),
+        'p95_ms': round(_percentile(values, 95), 3),
+        'p99_ms': round(_percentile(values, 99), 3),
+        'max_ms': round(values[-1], 3),
+    }
+
+
+async def _subscribe(layer, clients, control, total, timeout):
+    """Join `clients` channels to the group and receive `total` messages on each"""
+    names = [await layer.new_channel() for _ in range(clients)]
+    for name in names:
+        await layer.group_add(GROUP, name)
+    # Sent after the group_adds on the same connection, so the broker has them
+    await layer.send(control, {'type': 'ready', 'clients': clients})
+
+    arrivals = {}
+    latencies = []
+
+    async def consume(name):
+        for _ in range(total):
+            message = await layer.receive(name)
+            now = time.time()
+            seq = message['seq']
+            if now > arrivals.get(seq, 0.0):
+                arrivals[seq] = now
+            latencies.append((now - message['sent']) * 1000.0)
+
+    tasks = [asyncio.ensure_future(consume(name)) for name in names]
+    await asyncio.wait(tasks, timeout=timeout)
+    for task in tasks:
+        task.cancel()
+    return {'arrivals': arrivals, 'latencies': latencies}
+
+
+def _subscriber_process(address, clients, total, timeout, control_queue, result_queue):
+    from noctis_pro.channel_layer import UnixSocketChannelLayer
+
+    control = control_queue.get(timeout=60)
+    layer = UnixSocketChannelLayer(address=address, embedded_broker=False, capacity=total + 16)
+    result_queue.put(asyncio.run(_subscribe(layer, clients, control, total, timeout)))
+
+
+class Command(BaseCommand):
+    help = 'Benchmark channel layer fan-out latency and throughput with many clients'
+
+    def add_arguments(self, parser):
+        parser.add_argument('--backend', type=str, choices=('local', 'memory'), default='local',
+                          help='local = UnixSocketChannelLayer, memory = InMemoryChannelLayer')
+        parser.add_argument('--clients', type=int, default=1000,
+                          help='Connected clients (channels in the group)')
+        parser.add_argument('--processes', type=int, default=4,
+                          help='Worker processes the clients are spread over (local backend)')
+        parser.add_argument('--latency-messages', type=int, default=100,
+                          help='Paced group sends used for fan-out latency')
+        parser.add_argument('--interval', type=float, default=0.01,
+                          help='Seconds between paced group sends')
+        parser.add_argument('--burst-messages', type=int, default=200,
+                          help='Back-to-back group sends used for throughput')
+        parser.add_argument('--payload', type=int, default=256,
+                          help='Message payload size in bytes')
+        parser.add_argument('--timeout', type=float, default=120.0,
+                          help='Seconds to wait for all deliveries')
+        parser.add_argument('--json', type=str, default=None,
+                          help='Write results JSON to this path')
+
+    def handle(self, *args, **options):
+        if options['clients'] < 1:
+            raise CommandError('--clients must be at least 1')
+        self.options = options
+        self.total = options['latency_messages'] + options['burst_messages']
+        processes = 1 if options['backend'] == 'memory' else max(1, min(options['processes'], options['clients']))
+
+        workdir = tempfile.mkdtemp(prefix='noctis-channels-')
+        address = os.path.join(workdir, 'bench.sock')
+        ctx = multiprocessing.get_context('fork')
+        control_queue, result_queue = ctx.Queue(), ctx.Queue()
+        workers = []
+        if options['backend'] == 'local':
+            share, extra = divmod(options['clients'], processes)
+            for i in range(processes):
+                worker = ctx.Process(target=_subscriber_process, daemon=True, args=(
+                    address, share + (1 if i < extra else 0), self.total, options['timeout'],
+                    control_queue, result_queue))
+                worker.start()
+                workers.append(worker)
+
+        try:
+            results = asyncio.run(self.run(address, workers, control_queue, result_queue))
+        finally:
+            for worker in workers:
+                worker.join(5)
+                if worker.is_alive():
+                    worker.terminate()
+            for name in os.listdir(workdir):
+                os.unlink(os.path.join(workdir, name))
+            os.rmdir(workdir)
+        self.report(results, processes)
+
+    def make_layer(self, address, capacity):
+        if self.options['backend'] == 'memory':
+            from channels.layers import InMemoryChannelLayer
+            return InMemoryChannelLayer(capacity=capacity)
+        from noctis_pro.channel_layer import UnixSocketChannelLayer
+        return UnixSocketChannelLayer(address=address, embedded_broker=True, capacity=capacity)
+
+    async def run(self, address, workers, control_queue, result_queue):
+        options = self.options
+        layer = self.make_layer(address, max(self.total, len(workers)) + 16)
+        control = await layer.new_channel()
+        local_task = None
+        if workers:
+            for _ in workers:
+                control_queue.put(control)
+            expected = len(workers)
+        else:
+            local_task = asyncio.ensure_future(
+                _subscribe(layer, options['clients'], control, self.total, options['timeout']))
+            expected = 1
+
+        t_connect = time.time()
+        for _ in range(expected):
+            await asyncio.wait_for(layer.receive(control), 60)
+        connect_s = time.time() - t_connect
+        self.stdout.write(f'{options["clients"]} clients subscribed in {connect_s:.2f}s')
+
+        payload = 'x' * options['payload']
+        sent = {}
+        for seq in range(options['latency_messages']):
+            sent[seq] = time.time()
+            await layer.group_send(GROUP, {'type': 'bench.message', 'seq': seq, 'sent': sent[seq], 'payload': payload})
+            await asyncio.sleep(options['interval'])
+
+        burst_start = time.time()
+        for seq in range(options['latency_messages'], self.total):
+            sent[seq] = time.time()
+            await layer.group_send(GROUP, {'type': 'bench.message', 'seq': seq, 'sent': sent[seq], 'payload': payload})
+            if seq % 50 == 0:
+                await asyncio.sleep(0)
+        burst_sent_s = time.time() - burst_start
+
+        if local_task is not None:
+            parts = [await local_task]
+        else:
+            loop = asyncio.get_running_loop()
+            parts = [await loop.run_in_executor(None, result_queue.get, True, options['timeout'] + 30)
+                     for _ in workers]
+        return {'parts': parts, 'sent': sent, 'burst_start': burst_start,
+                'burst_sent_s': burst_sent_s, 'connect_s': connect_s}
+
+    def report(self, results, processes):
+        options = self.options
+        sent = results['sent']
+        arrivals = {}
+        latencies = []
+        for part in results['parts']:
+            latencies.extend(part['latencies'])
+            for seq, at in part['arrivals'].items():
+                seq = int(seq)
+                arrivals[seq] = max(arrivals.get(seq, 0.0), at)
+
+        paced = range(options['latency_messages'])
+        burst = range(options['latency_messages'], self.total)
+        fan_out = _latency_summary([(arrivals[s] - sent[s]) * 1000.0 for s in paced if s in arrivals])
+        delivered = len(latencies)
+        expected = options['clients'] * self.total
+        burst_done = max((arrivals[s] for s in burst if s in arrivals), default=results['burst_start'])
+        burst_s = max(burst_done - results['burst_start'], 1e-9)
+        burst_deliveries = options['clients'] * len(burst)
+
+        summary = {
+            'backend': options['backend'],
+            'clients': options['clients'],
+            'processes': processes,
+            'payload_bytes': options['payload'],
+            'subscribe_s': round(results['connect_s'], 3),
+            'delivered': delivered,
+            'expected': expected,
+            'fan_out_latency': fan_out,
+            'delivery_latency': _latency_summary(latencies),
+            'burst_group_sends_per_s': round(len(burst) / burst_s, 1),
+            'burst_deliveries_per_s': round(burst_deliveries / burst_s, 1),
+            'burst_send_only_s': round(results['burst_sent_s'], 3),
+        }
+
+        self.stdout.write(self.style.SUCCESS(
+            f'{options["backend"]}: {delivered}/{expected} delivered to {options["clients"]} clients '
+            f'over {processes} process(es)'))
+        if fan_out['count']:
+            self.stdout.write(f'Fan-out latency (all clients): p50={fan_out["p50_ms"]}ms '
+                              f'p95={fan_out["p95_ms"]}ms p99={fan_out["p99_ms"]}ms max={fan_out["max_ms"]}ms')
+        lat = summary['delivery_latency']
+        if lat['count']:
+            self.stdout.write(f'Per-client delivery latency: p50={lat["p50_ms"]}ms p95={lat["p95_ms"]}ms '
+                              f'p99={lat["p99_ms"]}ms')
+        self.stdout.write(f'Burst: {summary["burst_group_sends_per_s"]} group sends/s, '
+                          f'{summary["burst_deliveries_per_s"]} deliveries/s')
+        if delivered < expected:
+            self.stdout.write(self.style.ERROR(f'{expected - delivered} deliveries missing'))
+
+        if options['json']:
+            with open(options['json'], 'w') as fh:
+                json.dump(summary, fh, indent=2)
+            self.stdout.write(self.style.SUCCESS(f'Results written to {options["json"]}'))
@@ -0,0 +1,50 @@
+"""
+Channel Broker Management Command
+Runs the UnixSocketChannelLayer broker as its own service instead of inside
+whichever worker process starts first:
+
+    CHANNEL_LAYER_EMBEDDED_BROKER=0 python manage.py channel_broker
+    python manage.py channel_broker --address tcp://10.0.0.5:8765
+
+With a tcp:// address the broker has no authentication; bind it to a private
+interface only.
+"""
+import asyncio
+import os
+
+from django.conf import settings
+from django.core.management.base import BaseCommand
+
+from noctis_pro.channel_layer import ChannelBroker, acquire_broker_lock, default_address, parse_address
+
+
+class Command(BaseCommand):
+    help = 'Run the channel layer broker for worker processes on this host'
+
+    def add_arguments(self, parser):
+        config = settings.CHANNEL_LAYERS.get('default', {}).get('CONFIG', {})
+        parser.add_argument('--address', type=str,
+                          default=config.get('address') or default_address(settings.BASE_DIR),
+                          help='Unix socket path or tcp://host:port to listen on')
+        parser.add_argument('--group-expiry', type=int, default=config.get('group_expiry', 86400),
+                          help='Seconds before a group membership lapses')
+
+    def handle(self, *args, **options):
+        address = options['address']
+        lock_fd = None
+        if parse_address(address)[0] == 'unix':
+            lock_fd = acquire_broker_lock(address)
+            if lock_fd is None:
+                self.stdout.write(self.style.WARNING(
+                    f'Another process is serving {address}; waiting for it to exit'))
+                lock_fd = acquire_broker_lock(address, blocking=True)
+
+        broker = ChannelBroker(address, group_expiry=options['group_expiry'])
+        self.stdout.write(self.style.SUCCESS(f'Channel broker listening on {address}'))
+        try:
+            asyncio.run(broker.serve_forever())
+        except KeyboardInterrupt:
+            self.stdout.write(self.style.SUCCESS('Channel broker stopped'))
+        finally:
+            if lock_fd is not None:
+                os.close(lock_fd)
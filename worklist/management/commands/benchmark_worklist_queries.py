@@ -0,0 +1,274 @@
+"""
+Worklist Query Benchmark Management Command
+Loads synthetic studies/series/images and captures EXPLAIN plans and timings
+for the hot queries issued by the worklist, viewer and DICOM receiver.
+
+Run against SQLite (default) or PostgreSQL by pointing DB_ENGINE/DB_NAME at
+the target database, or by selecting a configured alias with --database.
+"""
+import json
+import random
+import time
+from datetime import timedelta
+
+from django.core.management.base import BaseCommand, CommandError
+from django.db import connections, transaction
+from django.utils import timezone
+
+from accounts.models import Facility
+from worklist.models import Patient, Modality, Study, Series, DicomImage
+
+# Synthetic rows are tagged so they can be found and purged again
+BENCH_PREFIX = 'BENCH'
+
+# Hot queries whose callers only need the row count
+COUNT_QUERIES = ('upload_stats_week', 'study_image_count')
+
+
+class Command(BaseCommand):
+    help = 'Benchmark worklist/viewer hot queries and print their EXPLAIN plans'
+
+    def add_arguments(self, parser):
+        parser.add_argument('--database', type=str, default='default',
+                          help='Database alias to run against')
+        parser.add_argument('--load', action='store_true',
+                          help='Load synthetic data before benchmarking')
+        parser.add_argument('--purge', action='store_true',
+                          help='Remove previously loaded synthetic data and exit')
+        parser.add_argument('--studies', type=int, default=50000,
+                          help='Number of synthetic studies to load')
+        parser.add_argument('--images', type=int, default=1000000,
+                          help='Total number of synthetic images to load')
+        parser.add_argument('--facilities', type=int, default=20,
+                          help='Number of synthetic facilities to spread studies over')
+        parser.add_argument('--series-per-study', type=int, default=4,
+                          help='Number of series per synthetic study')
+        parser.add_argument('--batch-size', type=int, default=5000,
+                          help='bulk_create batch size')
+        parser.add_argument('--repeat', type=int, default=20,
+                          help='Timed executions per query')
+        parser.add_argument('--json', type=str, default=None,
+                          help='Write results (timings and plans) to this JSON file')
+        parser.add_argument('--no-explain', action='store_true',
+                          help='Skip printing EXPLAIN output')
+
+    def handle(self, *args, **options):
+        alias = options['database']
+        if alias not in connections:
+            raise CommandError(f'Unknown database alias "{alias}"')
+
+        if options['purge']:
+            self.purge(alias)
+            return
+
+        if options['load']:
+            self.load(alias, options)
+
+        if not Study.objects.using(alias).filter(study_instance_uid__startswith=BENCH_PREFIX).exists():
+            raise CommandError('No synthetic data found. Run with --load first.')
+
+        results = self.run_benchmarks(alias, options)
+
+        if options['json']:
+            with open(options['json'], 'w') as fh:
+                json.dump({
+                    'vendor': connections[alias].vendor,
+                    'studies': Study.objects.using(alias).count(),
+                    'images': DicomImage.objects.using(alias).count(),
+                    'queries': results,
+                }, fh, indent=2)
+            self.stdout.write(self.style.SUCCESS(f'Results written to {options["json"]}'))
+
+    # ------------------------------------------------------------------
+    # Synthetic data
+    # ------------------------------------------------------------------
+
+    def load(self, alias, options):
+        n_studies = max(1, options['studies'])
+        n_series = max(1, options['series_per_study'])
+        images_per_series = max(1, options['images'] // (n_studies * n_series))
+        batch_size = options['batch_size']
+        rng = random.Random(1234)
+        now = timezone.now()
+
+        self.stdout.write(self.style.SUCCESS(
+            f'Loading {n_studies} studies x {n_series} series x {images_per_series} images '
+            f'into "{alias}" ({connections[alias].vendor})...'))
+        t0 = time.time()
+
+        with transaction.atomic(using=alias):
+            facilities = []
+            for i in range(max(1, options['facilities'])):
+                facilities.append(Facility(
+                    name=f'{BENCH_PREFIX} Facility {i}',
+                    address='', phone='', email=f'bench{i}@example.invalid',
+                    license_number=f'{BENCH_PREFIX}-LIC-{i}',
+                    ae_title=f'BENCH_AE_{i}',
+                ))
+            Facility.objects.using(alias).bulk_create(facilities, batch_size=batch_size)
+            facilities = list(Facility.objects.using(alias).filter(license_number__startswith=f'{BENCH_PREFIX}-LIC-'))
+
+            modalities = []
+            for code in ('CT', 'MR', 'CR', 'DX', 'US', 'MG'):
+                modality, _ = Modality.objects.using(alias).get_or_create(code=code, defaults={'name': code})
+                modalities.append(modality)
+
+            n_patients = max(1, n_studies // 3)
+            Patient.objects.using(alias).bulk_create([
+                Patient(patient_id=f'{BENCH_PREFIX}P{i:08d}', first_name=f'First{i}', last_name=f'Last{i}',
+                        date_of_birth=(now - timedelta(days=365 * 40)).date(), gender='O')
+                for i in range(n_patients)
+            ], batch_size=batch_size)
+            patient_ids = list(Patient.objects.using(alias).filter(
+                patient_id__startswith=f'{BENCH_PREFIX}P').values_list('id', flat=True))
+
+            for start in range(0, n_studies, batch_size):
+                chunk = []
+                for i in range(start, min(n_studies, start + batch_size)):
+                    chunk.append(Study(
+                        study_instance_uid=f'{BENCH_PREFIX}.1.{i}',
+                        accession_number=f'{BENCH_PREFIX}{i:08d}',
+                        patient_id=rng.choice(patient_ids),
+                        facility=rng.choice(facilities),
+                        modality=rng.choice(modalities),
+                        study_description=f'Synthetic study {i}',
+                        study_date=now - timedelta(minutes=rng.randint(0, 60 * 24 * 365 * 3)),
+                        referring_physician='',
+                        status='completed',
+                    ))
+                Study.objects.using(alias).bulk_create(chunk, batch_size=batch_size)
+            # upload_date is auto_now_add; spread it so upload_date__gte is selective
+            study_ids = list(Study.objects.using(alias).filter(
+                study_instance_uid__startswith=f'{BENCH_PREFIX}.1.').values_list('id', flat=True))
+            buckets = {}
+            for sid in study_ids:
+                buckets.setdefault(rng.randint(0, 24 * 365), []).append(sid)
+            for hours_ago, ids in buckets.items():
+                for start in range(0, len(ids), 500):
+                    Study.objects.using(alias).filter(id__in=ids[start:start + 500]).update(
+                        upload_date=now - timedelta(hours=hours_ago))
+
+            for start in range(0, len(study_ids), max(1, batch_size // n_series)):
+                chunk = []
+                for sid in study_ids[start:start + max(1, batch_size // n_series)]:
+                    for s in range(n_series):
+                        chunk.append(Series(
+                            series_instance_uid=f'{BENCH_PREFIX}.2.{sid}.{s}',
+                            study_id=sid,
+                            series_number=s + 1,
+                            modality='CT',
+                        ))
+                Series.objects.using(alias).bulk_create(chunk, batch_size=batch_size)
+
+            series_ids = Series.objects.using(alias).filter(
+                series_instance_uid__startswith=f'{BENCH_PREFIX}.2.').values_list('id', flat=True).iterator()
+            chunk = []
+            for series_id in series_ids:
+                for n in range(images_per_series):
+                    chunk.append(DicomImage(
+                        sop_instance_uid=f'{BENCH_PREFIX}.3.{series_id}.{n}',
+                        series_id=series_id,
+                        instance_number=n + 1,
+                        slice_location=float(n) * 1.25,
+                        file_path=f'dicom/bench/{series_id}/{n}.dcm',
+                        file_size=524288,
+                    ))
+                if len(chunk) >= batch_size:
+                    DicomImage.objects.using(alias).bulk_create(chunk, batch_size=batch_size)
+                    chunk = []
+            if chunk:
+                DicomImage.objects.using(alias).bulk_create(chunk, batch_size=batch_size)
+
+        self.analyze(alias)
+        self.stdout.write(self.style.SUCCESS(f'Loaded synthetic data in {time.time() - t0:.1f}s'))
+
+    def purge(self, alias):
+        with transaction.atomic(using=alias):
+            # Cascades remove series and images
+            deleted, _ = Study.objects.using(alias).filter(study_instance_uid__startswith=BENCH_PREFIX).delete()
+            Patient.objects.using(alias).filter(patient_id__startswith=f'{BENCH_PREFIX}P').delete()
+            Facility.objects.using(alias).filter(license_number__startswith=f'{BENCH_PREFIX}-LIC-').delete()
+        self.stdout.write(self.style.SUCCESS(f'Purged synthetic data ({deleted} rows)'))
+
+    def analyze(self, alias):
+        """Refresh planner statistics so EXPLAIN reflects the loaded data"""
+        with connections[alias].cursor() as cursor:
+            cursor.execute('ANALYZE')
+
+    # ------------------------------------------------------------------
+    # Hot queries
+    # ------------------------------------------------------------------
+
+    def hot_queries(self, alias):
+        """Querysets mirroring the ones issued by the views and receiver"""
+        facility = Facility.objects.using(alias).filter(license_number__startswith=f'{BENCH_PREFIX}-LIC-').first()
+        study = Study.objects.using(alias).filter(study_instance_uid__startswith=BENCH_PREFIX).first()
+        series = Series.objects.using(alias).filter(study=study).first()
+        recent_cutoff = timezone.now() - timedelta(hours=24)
+        week_ago = timezone.now() - timedelta(days=7)
+        studies = Study.objects.using(alias)
+        images = DicomImage.objects.using(alias)
+
+        return [
+            # worklist.views.study_list / dicom_viewer.views.web_study_list
+            ('study_list_facility', 'worklist study_list (facility user)',
+             studies.filter(facility=facility).select_related('patient', 'facility', 'modality').order_by('-study_date')[:50]),
+            ('study_list_all', 'worklist study_list (admin/radiologist)',
+             studies.select_related('patient', 'facility', 'modality').order_by('-study_date')[:50]),
+            # worklist.views.api_refresh_worklist / api_get_upload_stats
+            ('refresh_recent', 'api_refresh_worklist',
+             studies.filter(upload_date__gte=recent_cutoff).order_by('-upload_date')[:20]),
+            ('refresh_recent_facility', 'api_refresh_worklist (facility user)',
+             studies.filter(facility=facility, upload_date__gte=recent_cutoff).order_by('-upload_date')[:20]),
+            ('upload_stats_week', 'api_get_upload_stats',
+             studies.filter(upload_date__gte=week_ago).order_by()),
+            # dicom_viewer.views.api_study_data / web_study_detail
+            ('study_series', 'viewer series list',
+             Series.objects.using(alias).filter(study=study).order_by('series_number')),
+            ('study_image_count', 'Study.get_image_count',
+             images.filter(series__study=study).order_by()),
+            # dicom_viewer.views stack and MPR loading
+            ('series_images_instance', 'viewer stack ordering by instance_number',
+             images.filter(series=series).order_by('instance_number')),
+            ('series_images_location', 'MPR/MIP ordering by slice_location',
+             images.filter(series=series).order_by('slice_location', 'instance_number')),
+            # dicom_receiver.DicomReceiver.handle_store; SQLite compiles iexact to
+            # LIKE so only PostgreSQL/MySQL plans use the UPPER(ae_title) index
+            ('facility_by_ae', 'C-STORE facility attribution',
+             Facility.objects.using(alias).filter(ae_title__iexact=facility.ae_title if facility else '', is_active=True)[:1]),
+        ]
+
+    def run_benchmarks(self, alias, options):
+        repeat = max(1, options['repeat'])
+        results = []
+        for key, label, qs in self.hot_queries(alias):
+            try:
+                plan = qs.explain()
+            except Exception as e:
+                plan = f'EXPLAIN failed: {e}'
+
+            timings = []
+            for _ in range(repeat):
+                t0 = time.perf_counter()
+                # .all() clones the queryset so each run hits the database
+                if key in COUNT_QUERIES:
+                    qs.all().count()
+                else:
+                    list(qs.all())
+                timings.append((time.perf_counter() - t0) * 1000.0)
+            timings.sort()
+            p50 = timings[len(timings) // 2]
+            p95 = timings[min(len(timings) - 1, int(len(timings) * 0.95))]
+
+            self.stdout.write(self.style.SUCCESS(f'{key}: p50={p50:.2f}ms p95={p95:.2f}ms  ({label})'))
+            if not options['no_explain']:
+                for line in str(plan).splitlines():
+                    self.stdout.write(f'    {line}')
+            results.append({
+                'query': key,
+                'source': label,
+                'p50_ms': round(p50, 3),
+                'p95_ms': round(p95, 3),
+                'plan': str(plan),
+            })
+        return results
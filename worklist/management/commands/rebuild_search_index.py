@@ -0,0 +1,27 @@
+"""
+Rebuild the prefix study search index used by api_search_studies.
+Migrations index existing studies and ingest keeps the index current; run this
+to repair it, e.g. after bulk changes made outside the ORM.
+"""
+import time
+
+from django.core.management.base import BaseCommand
+
+from worklist import search
+
+
+class Command(BaseCommand):
+    help = 'Rebuild the study search index'
+
+    def add_arguments(self, parser):
+        parser.add_argument('--batch-size', type=int, default=1000,
+                          help='Number of studies to index per transaction')
+
+    def handle(self, *args, **options):
+        t0 = time.time()
+        self.stdout.write(self.style.SUCCESS('Rebuilding study search index...'))
+        total = search.rebuild_index(
+            batch_size=options['batch_size'],
+            progress=lambda n: self.stdout.write(f'   Indexed {n} studies'),
+        )
+        self.stdout.write(self.style.SUCCESS(f'Indexed {total} studies in {time.time() - t0:.1f}s'))
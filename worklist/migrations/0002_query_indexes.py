@@ -0,0 +1,48 @@
+# Generated by Django 5.2.18 on 2026-10-17 00:30
+
+from django.conf import settings
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('accounts', '0002_query_indexes'),
+        ('worklist', '0001_initial'),
+        migrations.swappable_dependency(settings.AUTH_USER_MODEL),
+    ]
+
+    operations = [
+        migrations.AddIndex(
+            model_name='dicomimage',
+            index=models.Index(fields=['series', 'instance_number'], name='image_series_instance_idx'),
+        ),
+        migrations.AddIndex(
+            model_name='dicomimage',
+            index=models.Index(fields=['series', 'slice_location', 'instance_number'], name='image_series_location_idx'),
+        ),
+        migrations.AddIndex(
+            model_name='series',
+            index=models.Index(fields=['study', 'series_number'], name='series_study_number_idx'),
+        ),
+        migrations.AddIndex(
+            model_name='study',
+            index=models.Index(fields=['facility', '-study_date'], name='study_facility_date_idx'),
+        ),
+        migrations.AddIndex(
+            model_name='study',
+            index=models.Index(fields=['-study_date'], name='study_date_idx'),
+        ),
+        migrations.AddIndex(
+            model_name='study',
+            index=models.Index(fields=['facility', '-upload_date'], name='study_facility_upload_idx'),
+        ),
+        migrations.AddIndex(
+            model_name='study',
+            index=models.Index(fields=['-upload_date'], name='study_upload_date_idx'),
+        ),
+        migrations.AddIndex(
+            model_name='study',
+            index=models.Index(fields=['-last_updated'], name='study_last_updated_idx'),
+        ),
+    ]
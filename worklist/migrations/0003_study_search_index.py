@@ -0,0 +1,29 @@
+# Generated by Django 5.2.18 on 2026-10-17 00:35
+
+import django.db.models.deletion
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('accounts', '0002_query_indexes'),
+        ('worklist', '0002_query_indexes'),
+    ]
+
+    operations = [
+        migrations.CreateModel(
+            name='StudySearchTerm',
+            fields=[
+                ('id', models.BigAutoField(auto_created=True, primary_key=True, serialize=False, verbose_name='ID')),
+                ('term', models.CharField(max_length=64)),
+                ('field', models.CharField(choices=[('accession', 'Accession Number'), ('patient_id', 'Patient ID'), ('name', 'Patient Name'), ('description', 'Study Description')], max_length=12)),
+                ('weight', models.PositiveSmallIntegerField(default=1)),
+                ('facility', models.ForeignKey(db_index=False, on_delete=django.db.models.deletion.CASCADE, related_name='+', to='accounts.facility')),
+                ('study', models.ForeignKey(on_delete=django.db.models.deletion.CASCADE, related_name='search_terms', to='worklist.study')),
+            ],
+            options={
+                'indexes': [models.Index(fields=['term', 'study', 'weight'], name='search_term_study_idx'), models.Index(fields=['facility', 'term', 'study', 'weight'], name='search_fac_term_study_idx')],
+            },
+        ),
+    ]
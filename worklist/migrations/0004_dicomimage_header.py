@@ -0,0 +1,18 @@
+# Generated by Django 5.2.18 on 2026-10-17 02:00
+
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('worklist', '0003_study_search_index'),
+    ]
+
+    operations = [
+        migrations.AddField(
+            model_name='dicomimage',
+            name='header',
+            field=models.JSONField(blank=True, null=True),
+        ),
+    ]
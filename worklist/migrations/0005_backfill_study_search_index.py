@@ -0,0 +1,85 @@
+import re
+import unicodedata
+
+from django.db import migrations
+
+BATCH = 1000
+
+# Frozen copy of the term extraction in worklist/search.py as of this migration, so later
+# changes to the tokenizer do not change what it writes; rebuild_search_index reindexes
+# with the current one
+FIELD_WEIGHTS = {
+    'accession': 4,
+    'patient_id': 4,
+    'name': 3,
+    'description': 1,
+}
+MAX_TERM_LENGTH = 64
+
+_TOKEN_SPLIT = re.compile(r'[^0-9a-z]+')
+_ALNUM_RUNS = re.compile(r'[a-z]+|[0-9]+')
+
+
+def _normalize(text):
+    if not text:
+        return []
+    text = unicodedata.normalize('NFKD', str(text))
+    text = ''.join(ch for ch in text if not unicodedata.combining(ch)).lower()
+    return [t[:MAX_TERM_LENGTH] for t in _TOKEN_SPLIT.split(text) if t]
+
+
+def _index_tokens(text):
+    tokens = set()
+    for token in _normalize(text):
+        tokens.add(token)
+        runs = _ALNUM_RUNS.findall(token)
+        if len(runs) > 1:
+            tokens.update(runs)
+        for run in runs:
+            if run.isdigit() and run.lstrip('0'):
+                tokens.add(run.lstrip('0'))
+    return tokens
+
+
+def _study_terms(study, StudySearchTerm):
+    patient = study.patient
+    sources = {
+        'accession': study.accession_number,
+        'patient_id': patient.patient_id if patient else '',
+        'name': f"{patient.first_name} {patient.last_name}" if patient else '',
+        'description': study.study_description,
+    }
+    best = {}
+    for field, value in sources.items():
+        weight = FIELD_WEIGHTS[field]
+        for term in _index_tokens(value):
+            if term not in best or best[term][1] < weight:
+                best[term] = (field, weight)
+    return [
+        StudySearchTerm(study_id=study.id, facility_id=study.facility_id, term=term, field=field, weight=weight)
+        for term, (field, weight) in best.items()
+    ]
+
+
+def backfill(apps, schema_editor):
+    """Index the studies that have no search terms yet (all of them when upgrading)"""
+    Study = apps.get_model('worklist', 'Study')
+    StudySearchTerm = apps.get_model('worklist', 'StudySearchTerm')
+
+    ids = list(Study.objects.filter(search_terms__isnull=True).order_by('id').values_list('id', flat=True))
+    for i in range(0, len(ids), BATCH):
+        terms = []
+        for study in Study.objects.filter(id__in=ids[i:i + BATCH]).select_related('patient'):
+            terms.extend(_study_terms(study, StudySearchTerm))
+        StudySearchTerm.objects.bulk_create(terms, batch_size=2000)
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('worklist', '0004_dicomimage_header'),
+    ]
+
+    operations = [
+        migrations.RunPython(backfill, migrations.RunPython.noop),
+    ]
@@ -77,6 +77,15 @@ class Study(models.Model):
 
     class Meta:
         ordering = ['-study_date']
+        indexes = [
+            # Worklist/viewer listings: facility scoped and global, newest first
+            models.Index(fields=['facility', '-study_date'], name='study_facility_date_idx'),
+            models.Index(fields=['-study_date'], name='study_date_idx'),
+            # Refresh/upload stats poll on upload_date__gte
+            models.Index(fields=['facility', '-upload_date'], name='study_facility_upload_idx'),
+            models.Index(fields=['-upload_date'], name='study_upload_date_idx'),
+            models.Index(fields=['-last_updated'], name='study_last_updated_idx'),
+        ]
 
     def __str__(self):
         return f"{self.accession_number} - {self.patient.full_name} ({self.modality.code})"
@@ -109,6 +118,9 @@ class Series(models.Model):
     class Meta:
         verbose_name_plural = "Series"
         ordering = ['series_number']
+        indexes = [
+            models.Index(fields=['study', 'series_number'], name='series_study_number_idx'),
+        ]
 
     def __str__(self):
         return f"Series {self.series_number} - {self.series_description}"
@@ -124,10 +136,18 @@ class DicomImage(models.Model):
     file_size = models.BigIntegerField()
     thumbnail = models.ImageField(upload_to='dicom/thumbnails/', null=True, blank=True)
     processed = models.BooleanField(default=False)
+    # Compact header record extracted at ingest (dicom_viewer/headers.py): geometry, rescale,
+    # window, pixel layout and pixel data offset, so readers need not parse the file
+    header = models.JSONField(null=True, blank=True)
     created_at = models.DateTimeField(auto_now_add=True)
 
     class Meta:
         ordering = ['instance_number']
+        indexes = [
+            # Slice ordering for stack/MPR loading without a sort step
+            models.Index(fields=['series', 'instance_number'], name='image_series_instance_idx'),
+            models.Index(fields=['series', 'slice_location', 'instance_number'], name='image_series_location_idx'),
+        ]
 
     def __str__(self):
         return f"Image {self.instance_number} - {self.sop_instance_uid}"
@@ -252,3 +272,29 @@ class StudyNote(models.Model):
 
     def __str__(self):
         return f"Note by {self.user.username} on {self.study.accession_number}"
+
+class StudySearchTerm(models.Model):
+    """Normalized search tokens for a study (see worklist.search)"""
+    FIELD_CHOICES = [
+        ('accession', 'Accession Number'),
+        ('patient_id', 'Patient ID'),
+        ('name', 'Patient Name'),
+        ('description', 'Study Description'),
+    ]
+
+    study = models.ForeignKey(Study, on_delete=models.CASCADE, related_name='search_terms')
+    # Denormalized so facility-scoped searches never join back to Study
+    facility = models.ForeignKey(Facility, on_delete=models.CASCADE, related_name='+', db_index=False)
+    term = models.CharField(max_length=64)
+    field = models.CharField(max_length=12, choices=FIELD_CHOICES)
+    weight = models.PositiveSmallIntegerField(default=1)
+
+    class Meta:
+        # Covering indexes: prefix range scans read only (term, study, weight)
+        indexes = [
+            models.Index(fields=['term', 'study', 'weight'], name='search_term_study_idx'),
+            models.Index(fields=['facility', 'term', 'study', 'weight'], name='search_fac_term_study_idx'),
+        ]
+
+    def __str__(self):
+        return f"{self.term!r} -> study {self.study_id} ({self.field})"
@@ -0,0 +1,194 @@
+"""
+UID-to-primary-key resolver cache for the ingest path.
+
+Every instance of a series carries the same calling AE title, patient ID,
+modality, Study UID and Series UID, so the DICOM receiver, ``upload_study`` and
+the ``import_dicom`` command resolve those to primary keys through this cache
+and only reach the database on the first instance (or after an eviction).
+
+Entries are bounded per kind (LRU) and expire after ``INGEST_RESOLVER_TTL``
+seconds. Deleting a Facility, Patient, Modality, Study or Series (and saving a
+Facility) clears the cache in this process immediately and in every other
+process sharing MEDIA_ROOT through a stamp file checked on each lookup (one
+``stat`` call), so a deleted study can be re-sent straight away.
+"""
+import os
+import threading
+import time
+from collections import OrderedDict
+
+from django.conf import settings
+from django.db import transaction
+
+from noctis_pro import metrics
+
+KINDS = ('facility', 'patient', 'modality', 'study', 'series')
+
+# Returned by get() when a key is not cached (None is a valid cached value)
+MISSING = object()
+
+STAMP_NAME = '.ingest_resolver_stamp'
+
+
+class ResolverCache:
+    def __init__(self, max_entries=None, ttl=None, stamp_path=None):
+        self.max_entries = max_entries or getattr(settings, 'INGEST_RESOLVER_MAX_ENTRIES', 20000)
+        self.ttl = ttl or getattr(settings, 'INGEST_RESOLVER_TTL', 600)
+        self.stamp_path = stamp_path or os.path.join(settings.MEDIA_ROOT, STAMP_NAME)
+        self._lock = threading.Lock()
+        self._entries = {kind: OrderedDict() for kind in KINDS}
+        self._stamp = self._read_stamp()
+
+    def _read_stamp(self):
+        try:
+            st = os.stat(self.stamp_path)
+            return (st.st_mtime_ns, st.st_size)
+        except OSError:
+            return None
+
+    def _sync_stamp(self):
+        # Called with the lock held: another process deleted something
+        stamp = self._read_stamp()
+        if stamp != self._stamp:
+            self._stamp = stamp
+            for entries in self._entries.values():
+                entries.clear()
+
+    def get(self, kind, key):
+        now = time.monotonic()
+        with self._lock:
+            self._sync_stamp()
+            entries = self._entries[kind]
+            item = entries.get(key)
+            if item is not None and item[1] < now:
+                del entries[key]
+                item = None
+            if item is not None:
+                entries.move_to_end(key)
+        if item is None:
+            metrics.cache_miss('ingest_resolver')
+            return MISSING
+        metrics.cache_hit('ingest_resolver')
+        return item[0]
+
+    def set(self, kind, key, value):
+        expires = time.monotonic() + self.ttl
+        evicted = 0
+        with self._lock:
+            entries = self._entries[kind]
+            entries[key] = (value, expires)
+            entries.move_to_end(key)
+            while len(entries) > self.max_entries:
+                entries.popitem(last=False)
+                evicted += 1
+        if evicted:
+            metrics.CACHE_EVICTIONS.inc(evicted, cache='ingest_resolver')
+
+    def resolve(self, kind, key, create):
+        """
+        (pk, created) for key. On a miss ``create()`` must return (pk, created),
+        typically from a get_or_create; the pk is cached once the surrounding
+        transaction commits, so a rolled-back row is never handed out.
+        """
+        value = self.get(kind, key)
+        if value is not MISSING:
+            return value, False
+        pk, created = create()
+        transaction.on_commit(lambda: self.set(kind, key, pk))
+        return pk, created
+
+    def forget(self, kind, key):
+        with self._lock:
+            self._entries[kind].pop(key, None)
+
+    def clear(self):
+        with self._lock:
+            for entries in self._entries.values():
+                entries.clear()
+
+    def size(self):
+        with self._lock:
+            return sum(len(entries) for entries in self._entries.values())
+
+
+_resolver = None
+_resolver_lock = threading.Lock()
+
+
+def get_resolver():
+    global _resolver
+    if _resolver is None:
+        with _resolver_lock:
+            if _resolver is None:
+                _resolver = ResolverCache()
+    return _resolver
+
+
+def _touch_stamp():
+    resolver = get_resolver()
+    try:
+        os.makedirs(os.path.dirname(resolver.stamp_path), exist_ok=True)
+        with open(resolver.stamp_path, 'w') as fh:
+            fh.write(str(time.time_ns()))
+    except OSError:
+        pass
+    resolver.clear()
+
+
+def invalidate():
+    """Drop cached keys here now, and in other processes once the delete commits"""
+    get_resolver().clear()
+    transaction.on_commit(_touch_stamp)
+
+
+# ----------------------------------------------------------------------
+# Lookups shared by the receiver, web upload and import_dicom
+# ----------------------------------------------------------------------
+
+def facility_id_for_ae(ae_title):
+    """Primary key of the active facility for a calling AE title, or None"""
+    from accounts.models import Facility
+
+    ae_title = (ae_title or '').strip()
+    key = ae_title.upper()
+    resolver = get_resolver()
+    value = resolver.get('facility', key)
+    if value is MISSING:
+        # Unknown AE titles are cached too; they are refused on every retry
+        value = Facility.objects.filter(ae_title__iexact=ae_title, is_active=True).values_list('id', flat=True).first()
+        resolver.set('facility', key, value)
+    return value
+
+
+def resolve_patient(patient_id, defaults):
+    """(pk, created) for a Patient ID; the helpers below work the same way"""
+    from .models import Patient
+
+    return get_resolver().resolve('patient', patient_id, lambda: _pk(
+        Patient.objects.get_or_create(patient_id=patient_id, defaults=defaults)))
+
+
+def resolve_modality(code, defaults):
+    from .models import Modality
+
+    return get_resolver().resolve('modality', code, lambda: _pk(
+        Modality.objects.get_or_create(code=code, defaults=defaults)))
+
+
+def resolve_study(study_instance_uid, defaults):
+    from .models import Study
+
+    return get_resolver().resolve('study', study_instance_uid, lambda: _pk(
+        Study.objects.get_or_create(study_instance_uid=study_instance_uid, defaults=defaults)))
+
+
+def resolve_series(series_instance_uid, defaults):
+    from .models import Series
+
+    return get_resolver().resolve('series', series_instance_uid, lambda: _pk(
+        Series.objects.get_or_create(series_instance_uid=series_instance_uid, defaults=defaults)))
+
+
+def _pk(result):
+    obj, created = result
+    return obj.pk, created
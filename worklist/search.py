@@ -0,0 +1,263 @@
+"""
+Prefix search index for studies.
+
+Accession numbers, patient IDs, patient names and study descriptions are split
+into normalized tokens and stored in ``StudySearchTerm``. A query token is then
+an index range scan (``term >= t AND term < t + U+FFFF``) rather than an
+``icontains`` table scan, which works the same on SQLite and PostgreSQL.
+Results are ranked by exact > prefix > typo-tolerant (shortened prefix) matches,
+weighted by field. The index is maintained on ingest by worklist/signals.py;
+studies that existed before it are indexed by migration 0005 (which keeps its
+own copy of the tokenizer).
+"""
+import re
+import unicodedata
+
+from django.db import transaction
+from django.db.models import Q
+
+# Relative importance of each indexed field when ranking matches
+FIELD_WEIGHTS = {
+    'accession': 4,
+    'patient_id': 4,
+    'name': 3,
+    'description': 1,
+}
+
+# Match tiers multiplied by the field weight
+EXACT, PREFIX, FUZZY = 3, 2, 1
+
+# Study fields whose change requires reindexing
+INDEXED_STUDY_FIELDS = {'accession_number', 'study_description', 'patient', 'patient_id', 'facility', 'facility_id'}
+INDEXED_PATIENT_FIELDS = {'patient_id', 'first_name', 'last_name'}
+
+# Rows read when probing a token's selectivity, and when reading candidates
+PROBE_CAP = 500
+POSTING_CAP = 5000
+# Newest matches ranked when every query token is common
+COMMON_CAP = 1000
+# Bound on study_id IN (...) parameters per query
+IN_CHUNK = 900
+# Shortest prefix tried when a token has no match (typo tolerance)
+MIN_FUZZY_PREFIX = 3
+MAX_QUERY_TOKENS = 6
+MAX_TERM_LENGTH = 64
+
+_TOKEN_SPLIT = re.compile(r'[^0-9a-z]+')
+_ALNUM_RUNS = re.compile(r'[a-z]+|[0-9]+')
+
+
+def normalize(text):
+    """Lowercase, strip accents and split into alphanumeric tokens"""
+    if not text:
+        return []
+    text = unicodedata.normalize('NFKD', str(text))
+    text = ''.join(ch for ch in text if not unicodedata.combining(ch)).lower()
+    return [t[:MAX_TERM_LENGTH] for t in _TOKEN_SPLIT.split(text) if t]
+
+
+def index_tokens(text):
+    """
+    Tokens stored for a value. Mixed tokens are also indexed by their letter and
+    digit runs, and digit runs without leading zeros, so "ACC00042" is found by
+    "acc00042", "00042" and "42".
+    """
+    tokens = set()
+    for token in normalize(text):
+        tokens.add(token)
+        runs = _ALNUM_RUNS.findall(token)
+        if len(runs) > 1:
+            tokens.update(runs)
+        for run in runs:
+            if run.isdigit() and run.lstrip('0'):
+                tokens.add(run.lstrip('0'))
+    return tokens
+
+
+def study_terms(study, model):
+    """Unsaved model rows (model: StudySearchTerm) for a study"""
+    patient = study.patient
+    sources = {
+        'accession': study.accession_number,
+        'patient_id': patient.patient_id if patient else '',
+        'name': f"{patient.first_name} {patient.last_name}" if patient else '',
+        'description': study.study_description,
+    }
+    # One row per term, keeping the strongest field it came from
+    best = {}
+    for field, value in sources.items():
+        weight = FIELD_WEIGHTS[field]
+        for term in index_tokens(value):
+            if term not in best or best[term][1] < weight:
+                best[term] = (field, weight)
+    return [
+        model(study_id=study.id, facility_id=study.facility_id, term=term, field=field, weight=weight)
+        for term, (field, weight) in best.items()
+    ]
+
+
+def build_terms(study):
+    """Build unsaved StudySearchTerm rows for a study"""
+    from .models import StudySearchTerm
+
+    return study_terms(study, StudySearchTerm)
+
+
+def index_study(study):
+    """(Re)index a single study"""
+    from .models import StudySearchTerm
+
+    terms = build_terms(study)
+    with transaction.atomic():
+        StudySearchTerm.objects.filter(study_id=study.id).delete()
+        StudySearchTerm.objects.bulk_create(terms, batch_size=1000)
+
+
+def rebuild_index(queryset=None, batch_size=1000, progress=None):
+    """Rebuild the index for a queryset of studies (all studies by default)"""
+    from .models import Study, StudySearchTerm
+
+    full = queryset is None
+    if full:
+        queryset = Study.objects.all()
+        StudySearchTerm.objects.all().delete()
+    queryset = queryset.select_related('patient').order_by('id')
+
+    done = 0
+    batch = []
+    for study in queryset.iterator(chunk_size=batch_size):
+        batch.append(study)
+        if len(batch) >= batch_size:
+            _index_batch(batch, replace=not full)
+            done += len(batch)
+            batch = []
+            if progress:
+                progress(done)
+    if batch:
+        _index_batch(batch, replace=not full)
+        done += len(batch)
+        if progress:
+            progress(done)
+    return done
+
+
+def _index_batch(studies, replace=True):
+    from .models import StudySearchTerm
+
+    terms = []
+    for study in studies:
+        terms.extend(build_terms(study))
+    with transaction.atomic():
+        if replace:
+            StudySearchTerm.objects.filter(study_id__in=[s.id for s in studies]).delete()
+        StudySearchTerm.objects.bulk_create(terms, batch_size=2000)
+
+
+def index_available():
+    from .models import StudySearchTerm
+
+    return StudySearchTerm.objects.exists()
+
+
+def _prefix_filter(qs, prefix):
+    # Range form so SQLite can use the index (its LIKE is case-insensitive)
+    return qs.filter(term__gte=prefix, term__lt=prefix + '￿')
+
+
+def _token_matches(terms, token, cap, study_ids=None, newest_first=False):
+    """
+    {study_id: score} for one query token, plus whether the list was capped.
+    Tries the full token first, then shorter prefixes down to MIN_FUZZY_PREFIX.
+    """
+    prefix = token
+    while True:
+        qs = _prefix_filter(terms, prefix)
+        if study_ids is not None:
+            qs = qs.filter(study_id__in=study_ids)
+        if newest_first:
+            qs = qs.order_by('-study_id')
+        rows = list(qs.values_list('study_id', 'term', 'weight')[:cap + 1])
+        if rows or len(prefix) <= MIN_FUZZY_PREFIX:
+            break
+        prefix = prefix[:-1]
+
+    scores = {}
+    for study_id, term, weight in rows[:cap]:
+        if prefix != token:
+            tier = FUZZY
+        elif term == token:
+            tier = EXACT
+        else:
+            tier = PREFIX
+        score = tier * weight
+        if score > scores.get(study_id, 0):
+            scores[study_id] = score
+    return scores, len(rows) > cap
+
+
+def search_studies(query, facility=None, patient_id=None, limit=20):
+    """
+    Ranked search. All query tokens must match (as exact, prefix or shortened
+    prefix); returns a list of Study objects, best match first. Falls back to
+    icontains filtering while the index has not been built.
+    """
+    from .models import Study, StudySearchTerm
+
+    tokens = list(dict.fromkeys(normalize(query)))[:MAX_QUERY_TOKENS]
+    if not tokens:
+        return []
+
+    if not index_available():
+        return _fallback_search(query, facility, patient_id, limit)
+
+    terms = StudySearchTerm.objects.all()
+    if facility is not None:
+        terms = terms.filter(facility=facility)
+    if patient_id:
+        terms = terms.filter(study__patient__patient_id=patient_id)
+
+    # Cheap bounded probe of every token to find the most selective one
+    probes = []
+    for token in tokens:
+        scores, capped = _token_matches(terms, token, PROBE_CAP)
+        probes.append((capped, len(scores), token, scores))
+    probes.sort(key=lambda p: (p[0], p[1]))
+    capped, _, pivot, totals = probes[0]
+    if capped:
+        # Every token is common (short type-ahead input): rank the newest matches
+        totals, _ = _token_matches(terms, pivot, COMMON_CAP, newest_first=True)
+
+    # Remaining tokens are only looked up for the surviving candidates
+    for _, _, token, _ in probes[1:]:
+        if not totals:
+            break
+        scores = {}
+        candidates = list(totals)
+        for i in range(0, len(candidates), IN_CHUNK):
+            chunk_scores, _ = _token_matches(terms, token, POSTING_CAP, study_ids=candidates[i:i + IN_CHUNK])
+            scores.update(chunk_scores)
+        totals = {sid: total + scores[sid] for sid, total in totals.items() if sid in scores}
+    if not totals:
+        return []
+
+    # Newest study wins ties
+    top = sorted(totals.items(), key=lambda kv: (kv[1], kv[0]), reverse=True)[:limit]
+    studies = Study.objects.select_related('patient', 'modality').in_bulk([sid for sid, _ in top])
+    return [studies[sid] for sid, _ in top if sid in studies]
+
+
+def _fallback_search(query, facility, patient_id, limit):
+    from .models import Study
+
+    studies = Study.objects.all()
+    if facility is not None:
+        studies = studies.filter(facility=facility)
+    if patient_id:
+        studies = studies.filter(patient__patient_id=patient_id)
+    return list(studies.filter(
+        Q(accession_number__icontains=query) |
+        Q(patient__patient_id__icontains=query) |
+        Q(patient__first_name__icontains=query) |
+        Q(patient__last_name__icontains=query) |
+        Q(study_description__icontains=query)
+    ).select_related('patient', 'modality').order_by('-study_date')[:limit])
@@ -0,0 +1,55 @@
+"""
+Keep the study search index in step with ingest (receiver, web upload,
+import_dicom) and with edits made through the admin or APIs, and drop ingest
+resolver entries when the rows they point at are deleted.
+"""
+import logging
+
+from django.db.models.signals import post_delete, post_save
+from django.dispatch import receiver
+
+from accounts.models import Facility
+from .models import Modality, Patient, Series, Study
+from . import resolver, search
+
+logger = logging.getLogger('noctis_pro.worklist')
+
+
+def _touches(update_fields, indexed):
+    return update_fields is None or bool(set(update_fields) & indexed)
+
+
+@receiver(post_save, sender=Study)
+def index_study_on_save(sender, instance, created, update_fields=None, raw=False, **kwargs):
+    if raw or not _touches(update_fields, search.INDEXED_STUDY_FIELDS):
+        return
+    try:
+        search.index_study(instance)
+    except Exception as e:
+        logger.warning(f"Search indexing failed for study {instance.pk}: {e}")
+
+
+@receiver(post_save, sender=Patient)
+def reindex_patient_studies(sender, instance, created, update_fields=None, raw=False, **kwargs):
+    if raw or created or not _touches(update_fields, search.INDEXED_PATIENT_FIELDS):
+        return
+    try:
+        search.rebuild_index(Study.objects.filter(patient=instance))
+    except Exception as e:
+        logger.warning(f"Search reindex failed for patient {instance.pk}: {e}")
+
+
+@receiver(post_delete, sender=Facility)
+@receiver(post_delete, sender=Patient)
+@receiver(post_delete, sender=Modality)
+@receiver(post_delete, sender=Study)
+@receiver(post_delete, sender=Series)
+def invalidate_ingest_resolver(sender, instance, **kwargs):
+    resolver.invalidate()
+
+
+@receiver(post_save, sender=Facility)
+def invalidate_facility_ae(sender, instance, created, raw=False, **kwargs):
+    # AE title or is_active changes alter which facility a C-STORE maps to
+    if not raw:
+        resolver.invalidate()
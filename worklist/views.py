@@ -22,8 +22,11 @@ from .models import (
     Study, Patient, Modality, Series, DicomImage, StudyAttachment, 
     AttachmentComment, AttachmentVersion
 )
+from . import resolver, search
 from accounts.models import User, Facility
 from notifications.models import Notification, NotificationType
+from notifications.dispatcher import notify_new_study
+from dicom_viewer import headers, intensity, prefetch
 from reports.models import Report
 
 # Module logger for robust error reporting
@@ -301,9 +304,9 @@ def upload_study(request):
 					logger.warning(f"Invalid gender value: {gender}, defaulting to 'O'")
 					gender = 'O'
 				
-				# Professional patient creation with comprehensive logging
-				patient, patient_created = Patient.objects.get_or_create(
-					patient_id=patient_id,
+				# Patient and modality resolve to primary keys through the ingest resolver
+				patient_pk, patient_created = resolver.resolve_patient(
+					patient_id,
 					defaults={
 						'first_name': first_name, 
 						'last_name': last_name, 
@@ -313,14 +316,14 @@ def upload_study(request):
 				)
 				
 				if patient_created:
-					logger.info(f"New patient created: {patient.full_name} (ID: {patient_id})")
+					logger.info(f"New patient created: {first_name} {last_name} (ID: {patient_id})")
 				else:
-					logger.debug(f"Existing patient found: {patient.full_name} (ID: {patient_id})")
+					logger.debug(f"Existing patient found: {patient_id}")
 				
 				# Professional modality and study metadata processing
 				modality_code = getattr(rep_ds, 'Modality', 'OT').upper()
-				modality, modality_created = Modality.objects.get_or_create(
-					code=modality_code, 
+				modality_pk, modality_created = resolver.resolve_modality(
+					modality_code, 
 					defaults={'name': modality_code, 'is_active': True}
 				)
 				
@@ -392,9 +395,9 @@ def upload_study(request):
 					study_instance_uid=study_uid,
 					defaults={
 						'accession_number': accession_number,
-						'patient': patient,
+						'patient_id': patient_pk,
 						'facility': facility,
-						'modality': modality,
+						'modality_id': modality_pk,
 						'study_description': study_description,
 						'study_date': sdt,
 						'referring_physician': referring_physician,
@@ -436,10 +439,10 @@ def upload_study(request):
 					body_part = getattr(ds0, 'BodyPartExamined', '').upper()
 					
 					# Professional series creation with comprehensive metadata
-					series, series_created = Series.objects.get_or_create(
-						series_instance_uid=series_uid,
+					series_pk, series_created = resolver.resolve_series(
+						series_uid,
 						defaults={
-							'study': study,
+							'study_id': study.id,
 							'series_number': int(series_number),
 							'series_description': series_desc,
 							'modality': modality_code,
@@ -507,12 +510,13 @@ def upload_study(request):
 							image, image_created = DicomImage.objects.get_or_create(
 								sop_instance_uid=sop_uid,
 								defaults={
-									'series': series,
+									'series_id': series_pk,
 									'instance_number': int(instance_number),
 									'image_position': image_position,
 									'slice_location': slice_location,
 									'file_path': saved_path,
 									'file_size': file_size,
+									'header': headers.extract(headers.stored_path(saved_path)),
 									'processed': False,
 								}
 							)
@@ -532,30 +536,21 @@ def upload_study(request):
 							logger.error(f"Image processing failed for {sop_uid}: {str(e)}")
 							continue
 					
+					# Pixels were not decoded here; intensity stats are built from the stored files after commit,
+					# and the series is warmed up for its hanging protocol right away (it is complete)
+					if images_processed:
+						intensity.schedule_build(series_pk)
+						prefetch.schedule(series_pk, settle=0)
+					
 					series_processing_time = (time.time() - series_start_time) * 1000
 					logger.info(f"Professional series completed: {series_desc} - {images_processed} images in {series_processing_time:.1f}ms")
 					
 				
 				# already tracked above
 				
-				# Enhanced notifications for new study upload
+				# Notifications fan out in the background once the upload commits
 				try:
-					notif_type, _ = NotificationType.objects.get_or_create(
-						code='new_study', defaults={'name': 'New Study Uploaded', 'description': 'A new study has been uploaded', 'is_system': True}
-					)
-					recipients = User.objects.filter(Q(role='radiologist') | Q(role='admin') | Q(facility=facility))
-					for recipient in recipients:
-						Notification.objects.create(
-							notification_type=notif_type,
-							recipient=recipient,
-							sender=request.user,
-							title=f"New {modality_code} study for {patient.full_name}",
-							message=f"Study {accession_number} uploaded from {facility.name} with {total_series_processed} series",
-							priority='normal',
-							study=study,
-							facility=facility,
-							data={'study_id': study.id, 'accession_number': accession_number, 'series_count': total_series_processed}
-						)
+					notify_new_study(study.id, sender_id=request.user.id, series_count=total_series_processed)
 				except Exception:
 					pass
 			
@@ -1089,23 +1084,13 @@ def api_search_studies(request):
     if len(query) < 2:
         return JsonResponse({'studies': []})
     
-    # Base queryset based on user role
+    # Restrict facility users to their own studies
+    facility = None
     if user.is_facility_user() and getattr(user, 'facility', None):
-        studies = Study.objects.filter(facility=user.facility)
-    else:
-        studies = Study.objects.all()
-    
-    # Filter by patient if specified
-    if patient_id:
-        studies = studies.filter(patient__patient_id=patient_id)
+        facility = user.facility
     
-    # Search query
-    studies = studies.filter(
-        Q(accession_number__icontains=query) |
-        Q(patient__first_name__icontains=query) |
-        Q(patient__last_name__icontains=query) |
-        Q(study_description__icontains=query)
-    ).select_related('patient', 'modality').order_by('-study_date')[:20]
+    # Ranked prefix search (falls back to icontains until the index is built)
+    studies = search.search_studies(query, facility=facility, patient_id=patient_id, limit=20)
     
     studies_data = []
     for study in studies: